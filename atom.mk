@@ -18,7 +18,11 @@ LOCAL_SRC_FILES := \
 	src/mp4_box_to_json.c \
 	src/mp4_box_writer.c \
 	src/mp4_demux.c \
+	src/mp4_demux_iterator.c \
+	src/mp4_demux_reader.c \
+	src/mp4_index.c \
 	src/mp4_mux.c \
+	src/mp4_mux_async.c \
 	src/mp4_recovery.c \
 	src/mp4_recovery_reader.c \
 	src/mp4_recovery_writer.c \
@@ -29,11 +33,15 @@ LOCAL_LIBRARIES := \
 	libulog
 
 LOCAL_CONDITIONAL_LIBRARIES := \
+	OPTIONAL:liburing \
 	OPTIONAL:util-linux-ng
 
 ifeq ("$(TARGET_OS)","windows")
   LOCAL_LDLIBS += -lws2_32
 endif
+ifneq ("$(TARGET_OS_FLAVOUR)","android")
+  LOCAL_LDLIBS += -lpthread
+endif
 
 include $(BUILD_LIBRARY)
 
@@ -66,6 +74,40 @@ LOCAL_LIBRARIES := \
 include $(BUILD_EXECUTABLE)
 
 
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := mp4-mux-bench
+LOCAL_DESCRIPTION := MP4 file library muxer write benchmark
+LOCAL_CATEGORY_PATH := multimedia
+LOCAL_SRC_FILES := tools/mp4_mux_bench.c
+LOCAL_LIBRARIES := \
+	libfutils \
+	libmp4 \
+	libulog
+
+include $(BUILD_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := mp4-demux-bench
+LOCAL_DESCRIPTION := MP4 file library demuxer benchmarks
+LOCAL_CATEGORY_PATH := multimedia
+LOCAL_SRC_FILES := tools/mp4_demux_bench.c
+# Table decoding kernels of the library
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/src
+LOCAL_LIBRARIES := \
+	libfutils \
+	libmp4 \
+	libulog
+
+ifneq ("$(TARGET_OS_FLAVOUR)","android")
+  LOCAL_LDLIBS += -lpthread
+endif
+
+include $(BUILD_EXECUTABLE)
+
+
 include $(CLEAR_VARS)
 
 LOCAL_MODULE := larry-covery
@@ -99,6 +141,10 @@ LOCAL_LIBRARIES := \
 	libfutils \
 	libmp4
 
+ifneq ("$(TARGET_OS_FLAVOUR)","android")
+  LOCAL_LDLIBS += -lpthread
+endif
+
 include $(BUILD_EXECUTABLE)
 
 endif
@@ -78,6 +78,9 @@ extern "C" {
 
 #define MP4_MUX_DEFAULT_TABLE_SIZE_MB 2
 
+/* Default demuxer index file suffix (see mp4_demux_open_with_index()) */
+#define MP4_DEMUX_INDEX_SUFFIX ".mp4idx"
+
 enum mp4_track_type {
 	MP4_TRACK_TYPE_UNKNOWN = 0,
 	MP4_TRACK_TYPE_VIDEO,
@@ -126,6 +129,36 @@ enum mp4_seek_method {
 };
 
 
+enum mp4_demux_iterator_order {
+	/* Samples in increasing file offset order */
+	MP4_DEMUX_ITERATOR_ORDER_OFFSET = 0,
+	/* Samples in increasing decoding time order (in microseconds, for
+	 * tracks with different timescales) */
+	MP4_DEMUX_ITERATOR_ORDER_DTS,
+};
+
+
+enum mp4_demux_split_mode {
+	/* Parts of about the same size in bytes */
+	MP4_DEMUX_SPLIT_BY_SIZE = 0,
+	/* Parts of about the same duration */
+	MP4_DEMUX_SPLIT_BY_DURATION,
+};
+
+
+/* Behavior of the asynchronous muxer when its queue is full */
+enum mp4_mux_async_policy {
+	/* Wait for the writer thread */
+	MP4_MUX_ASYNC_POLICY_BLOCK = 0,
+	/* Drop non-sync video samples, and the following samples of the track
+	 * up to the next sync sample, failing with -ENOBUFS for each dropped
+	 * sample; wait for sync samples and the samples of other track types */
+	MP4_MUX_ASYNC_POLICY_DROP_NON_SYNC,
+	/* Fail with -EAGAIN */
+	MP4_MUX_ASYNC_POLICY_ERROR,
+};
+
+
 struct mp4_media_info {
 	uint64_t duration;
 	uint64_t creation_time;
@@ -147,6 +180,7 @@ struct mp4_track_info {
 	uint64_t modification_time;
 	uint32_t sample_count;
 	uint32_t sample_max_size;
+	/* Per-sample tables, expanded on the first request for the track */
 	const uint64_t *sample_offsets;
 	const uint32_t *sample_sizes;
 	enum mp4_video_codec video_codec;
@@ -237,6 +271,40 @@ struct mp4_track_sample {
 };
 
 
+/* Group of pictures: a sync sample and the samples up to the next one */
+struct mp4_track_gop {
+	/* Index of the sync sample */
+	uint32_t sync_sample;
+	/* Indexes of the first and last samples; the samples preceding the
+	 * first sync sample of the track belong to the first GOP */
+	uint32_t first_sample;
+	uint32_t last_sample;
+	/* Decoding time of the first sample and end of the last sample, in
+	 * track timescale units */
+	uint64_t start_dts;
+	uint64_t end_dts;
+	/* Byte range in the file covering all the samples */
+	uint64_t offset;
+	uint64_t size;
+};
+
+
+/* Sample read request of a sample reader */
+struct mp4_demux_sample_read {
+	/* Demuxer and track to read the next sample from */
+	const struct mp4_demux *demux;
+	unsigned int track_id;
+	/* Sample buffer */
+	uint8_t *buffer;
+	size_t buffer_size;
+	/* Sample description, the size is 0 at the end of the track
+	 * (output) */
+	struct mp4_track_sample sample;
+	/* 0 on success, negative errno value in case of error (output) */
+	int status;
+};
+
+
 struct mp4_mux_track_params {
 	/* Track type */
 	enum mp4_track_type type;
@@ -272,9 +340,34 @@ struct mp4_mux_scattered_sample {
 };
 
 
+/* Release function of a sample buffer given to the muxer */
+typedef void (*mp4_mux_sample_release_t)(const uint8_t *buffer,
+					 void *userdata);
+
+
+struct mp4_mux_async_stats {
+	/* Number of queued samples, current and maximum */
+	unsigned int queue_depth;
+	unsigned int max_queue_depth;
+	uint64_t queued_samples;
+	uint64_t written_samples;
+	uint64_t dropped_samples;
+	/* Time between queuing and writing a sample in microseconds, mean
+	 * and maximum */
+	uint64_t mean_latency;
+	uint64_t max_latency;
+	/* Maximum time taken by the writer thread to write a sample in
+	 * microseconds */
+	uint64_t max_write_time;
+};
+
+
 /* Demuxer API */
 
 struct mp4_demux;
+struct mp4_demux_cursor;
+struct mp4_demux_iterator;
+struct mp4_demux_reader;
 
 
 /**
@@ -289,6 +382,44 @@ struct mp4_demux;
 MP4_API int mp4_demux_open(const char *filename, struct mp4_demux **ret_obj);
 
 
+/**
+ * Create an MP4 demuxer on a memory-mapped file.
+ * The file is mapped read-only and the boxes are parsed directly from the
+ * mapping. Samples can then be accessed without copy using
+ * mp4_demux_get_track_sample_mapped().
+ * When no longer needed, the instance must be freed using the
+ * mp4_demux_close() function.
+ * @param filename: file path to use
+ * @param ret_obj: demuxer instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_open_mmap(const char *filename,
+				struct mp4_demux **ret_obj);
+
+
+/**
+ * Create an MP4 demuxer using an index file to skip parsing.
+ * If the index file matches the MP4 file (same size and modification
+ * time, same 'moov' box location and checksum of a few blocks of it), the
+ * demuxer state is loaded from it without parsing the file; the sample
+ * tables are then used in place from the index file mapping. Otherwise
+ * the file is parsed and the index file is (re)written; failing to write
+ * the index is not an error.
+ * The index file is in native byte order and is only meant to be used
+ * on the machine that created it.
+ * When no longer needed, the instance must be freed using the
+ * mp4_demux_close() function.
+ * @param filename: file path to use
+ * @param index_filename: index file path, or NULL to use the file path
+ *                        followed by MP4_DEMUX_INDEX_SUFFIX
+ * @param ret_obj: demuxer instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_open_with_index(const char *filename,
+				      const char *index_filename,
+				      struct mp4_demux **ret_obj);
+
+
 /**
  * Free an MP4 demuxer.
  * This function frees all resources associated with a demuxer instance.
@@ -298,6 +429,22 @@ MP4_API int mp4_demux_open(const char *filename, struct mp4_demux **ret_obj);
 MP4_API int mp4_demux_close(struct mp4_demux *demux);
 
 
+/**
+ * Enable the readahead of track samples.
+ * When the data of a track sample is read, the system is asked to load
+ * the data of the next samples of the track in the background, so that
+ * the following reads are served from memory instead of waiting for the
+ * storage. This is only a hint, which has no effect on platforms that do
+ * not support it.
+ * @param demux: demuxer instance handle
+ * @param sample_count: number of samples to read ahead of the current
+ *                      sample of each track, 0 to disable (default)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_set_readahead(struct mp4_demux *demux,
+				    unsigned int sample_count);
+
+
 /**
  * Get the media level information.
  * @param demux: demuxer instance handle
@@ -328,6 +475,25 @@ MP4_API int mp4_demux_get_track_info(const struct mp4_demux *demux,
 				     struct mp4_track_info *track_info);
 
 
+/**
+ * Get the per-sample offset and size tables of a track.
+ * The tables are the ones returned in the track info: they are expanded
+ * (12 bytes per sample) the first time either function is called for a
+ * track. Both functions can be called concurrently with each other and
+ * with the cursors, iterators and readers of the same demuxer.
+ * @param demux: demuxer instance handle
+ * @param track_idx: track index
+ * @param sample_offsets: pointer to the sample offsets table (output)
+ * @param sample_sizes: pointer to the sample sizes table (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int
+mp4_demux_get_track_sample_tables(const struct mp4_demux *demux,
+				  unsigned int track_idx,
+				  const uint64_t **sample_offsets,
+				  const uint32_t **sample_sizes);
+
+
 /**
  * Get the video decoder config of a specific track.
  * @param demux: demuxer instance handle
@@ -380,6 +546,141 @@ MP4_API int mp4_demux_get_track_sample(const struct mp4_demux *demux,
 				       struct mp4_track_sample *track_sample);
 
 
+/**
+ * Get a track sample without copying its data.
+ * The demuxer must have been created using mp4_demux_open_mmap(). The
+ * returned pointers reference the file mapping and remain valid until
+ * mp4_demux_close() is called; the data sizes are given by the size and
+ * metadata_size fields of track_sample.
+ * @param demux: demuxer instance handle
+ * @param track_id: track ID
+ * @param advance: if true, advance to the next sample of the track
+ * @param sample_data: pointer to the sample data (output)
+ * @param metadata_data: pointer to the metadata data (optional, can be null)
+ * @param track_sample: pointer to the track_sample structure to fill (output)
+ * @return 0 on success, -ENOTSUP if the demuxer is not memory-mapped,
+ *         negative errno value in case of error
+ */
+MP4_API int
+mp4_demux_get_track_sample_mapped(const struct mp4_demux *demux,
+				  unsigned int track_id,
+				  int advance,
+				  const uint8_t **sample_data,
+				  const uint8_t **metadata_data,
+				  struct mp4_track_sample *track_sample);
+
+
+/**
+ * Get a track sample into several buffers.
+ * Same as mp4_demux_get_track_sample() except that the sample data are
+ * read directly into the given buffers, filled one after the other (the
+ * last used buffer can be partially filled); the buffers are read with a
+ * single preadv() call for up to 16 buffers. The position is not advanced
+ * if the sample cannot be read.
+ * @param demux: demuxer instance handle
+ * @param track_id: track ID
+ * @param advance: if true, advance to the next sample of the track
+ * @param buffers: array of sample buffers (can be null if nbuffers is 0)
+ * @param len: array of the sizes of the sample buffers
+ * @param nbuffers: number of sample buffers (0 to not read the data)
+ * @param metadata_buffer: metadata buffer (optional, can be null)
+ * @param metadata_buffer_size: size of the metadata buffer
+ * @param track_sample: pointer to the track_sample structure to fill (output)
+ * @return 0 on success, -ENOBUFS if the sample does not fit in the buffers,
+ *         negative errno value in case of error
+ */
+MP4_API int
+mp4_demux_get_track_sample_scattered(const struct mp4_demux *demux,
+				     unsigned int track_id,
+				     int advance,
+				     uint8_t *const *buffers,
+				     const size_t *len,
+				     int nbuffers,
+				     uint8_t *metadata_buffer,
+				     unsigned int metadata_buffer_size,
+				     struct mp4_track_sample *track_sample);
+
+
+/**
+ * Get the next samples of a track in a single call.
+ * Samples are read from the current position of the track, which is
+ * advanced past the returned samples. Reading stops after max_count
+ * samples, at the first sample with a decoding time at or after end_time
+ * (if not 0), at the end of the track, or when the next sample data does
+ * not fit in the buffers. The sample data (and the associated metadata)
+ * are stored one after the other in the buffers, in the order of the
+ * track_samples array; samples which are contiguous in the file are read
+ * in a single I/O operation. If a buffer is null, the corresponding data
+ * are not read and only the sample descriptions are returned.
+ * @param demux: demuxer instance handle
+ * @param track_id: track ID
+ * @param max_count: maximum number of samples to get (size of the
+ *                   track_samples array)
+ * @param end_time: timestamp in microseconds at which to stop, 0 for none
+ * @param sample_buffer: sample buffer (optional, can be null)
+ * @param sample_buffer_size: sample buffer size
+ * @param metadata_buffer: metadata buffer (optional, can be null)
+ * @param metadata_buffer_size: size of the metadata buffer
+ * @param track_samples: array of track_sample structures to fill (output)
+ * @param sample_count: pointer to the number of samples filled (output),
+ *                      0 at the end of the track
+ * @return 0 on success, -ENOBUFS if the first sample does not fit in the
+ *         buffers, negative errno value in case of error
+ */
+MP4_API int mp4_demux_get_track_samples(const struct mp4_demux *demux,
+					unsigned int track_id,
+					unsigned int max_count,
+					uint64_t end_time,
+					uint8_t *sample_buffer,
+					size_t sample_buffer_size,
+					uint8_t *metadata_buffer,
+					size_t metadata_buffer_size,
+					struct mp4_track_sample *track_samples,
+					unsigned int *sample_count);
+
+
+/**
+ * Read the samples of a track in a time range in a single call.
+ * This is mostly intended for timed metadata tracks, with many small
+ * samples. The read position of the track is not used nor modified. The
+ * sample data are stored one after the other in the buffer, and the
+ * decoding time (in track timescale units), file offset and size of each
+ * sample are stored in separate arrays; samples which are contiguous in
+ * the file are read in a single I/O operation. The samples with a decoding
+ * time in the [start_time, end_time] window (both included) are read;
+ * reading stops earlier after max_count samples, at the end of the track,
+ * or when the next sample data does not fit in the buffer. To read the
+ * following samples, call again with start_time just after the time of the
+ * last sample.
+ * @param demux: demuxer instance handle
+ * @param track_id: track ID
+ * @param start_time: timestamp in microseconds of the first sample to read
+ * @param end_time: timestamp in microseconds of the end of the window
+ *                  (included), 0 for none; must not be lower than
+ *                  start_time
+ * @param max_count: maximum number of samples to read (size of the arrays)
+ * @param buffer: sample buffer (optional, can be null)
+ * @param buffer_size: sample buffer size
+ * @param dts: array of decoding times to fill (optional, can be null)
+ * @param offsets: array of file offsets to fill (optional, can be null)
+ * @param sizes: array of sample sizes to fill (optional, can be null)
+ * @param sample_count: pointer to the number of samples read (output)
+ * @return 0 on success, -ENOBUFS if the first sample does not fit in the
+ *         buffer, negative errno value in case of error
+ */
+MP4_API int mp4_demux_get_track_samples_range(const struct mp4_demux *demux,
+					      unsigned int track_id,
+					      uint64_t start_time,
+					      uint64_t end_time,
+					      unsigned int max_count,
+					      uint8_t *buffer,
+					      size_t buffer_size,
+					      uint64_t *dts,
+					      uint64_t *offsets,
+					      uint32_t *sizes,
+					      unsigned int *sample_count);
+
+
 /**
  * Get the previous sample time of a track.
  * @param demux: demuxer instance handle
@@ -438,6 +739,25 @@ mp4_demux_get_track_next_sample_time_after(const struct mp4_demux *demux,
 					   uint64_t *sample_time);
 
 
+/**
+ * Get the GOPs of a track.
+ * The GOP table is built on the first call and is owned by the demuxer; a
+ * track without sync samples has no GOP. Building the table modifies the
+ * demuxer, but the calls are serialized and the table is only returned once
+ * complete: this function can be called concurrently with the other
+ * functions taking a const demuxer, including the cursors.
+ * @param demux: demuxer instance handle
+ * @param track_id: track ID
+ * @param gops: pointer to the GOP array (output)
+ * @param count: pointer to the number of GOPs (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_get_track_gops(const struct mp4_demux *demux,
+				     unsigned int track_id,
+				     const struct mp4_track_gop **gops,
+				     unsigned int *count);
+
+
 /**
  * Seek to a time offset.
  * @param demux: demuxer instance handle
@@ -472,6 +792,226 @@ MP4_API int mp4_demux_seek_to_track_next_sample(const struct mp4_demux *demux,
 						bool resync);
 
 
+/**
+ * Create a read cursor on a track.
+ * A cursor holds its own read position in the track, independent from
+ * the position used by mp4_demux_get_track_sample() and mp4_demux_seek().
+ * Several cursors can be used concurrently from different threads on the
+ * same demuxer, as long as no other function of the demuxer is called at
+ * the same time. The cursor starts at the first sample of the track and
+ * must be destroyed before the demuxer is closed.
+ * @param demux: demuxer instance handle
+ * @param track_id: track ID
+ * @param ret_obj: cursor handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_cursor_new(const struct mp4_demux *demux,
+				 unsigned int track_id,
+				 struct mp4_demux_cursor **ret_obj);
+
+
+/**
+ * Destroy a read cursor.
+ * @param cursor: cursor handle
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_cursor_destroy(struct mp4_demux_cursor *cursor);
+
+
+/**
+ * Seek a read cursor to a time offset.
+ * @param cursor: cursor handle
+ * @param time_offset: timestamp
+ * @param method: seek method
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_cursor_seek(struct mp4_demux_cursor *cursor,
+				  uint64_t time_offset,
+				  enum mp4_seek_method method);
+
+
+/**
+ * Set the trick-play mode of a read cursor.
+ * With a non-zero stride, the cursor only returns sync samples: after a
+ * sample, it moves to the first sync sample at least 'stride' later, or
+ * with a negative stride to the last sync sample at least '-stride'
+ * earlier (to play backwards). The cursor first moves to the sync sample
+ * at or before its position. The metadata is only read if a metadata
+ * buffer is given, and the samples are not read ahead in this mode.
+ * @param cursor: cursor handle
+ * @param stride: time between samples in track timescale units (0 to
+ * return all the samples)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_cursor_set_sync_stride(struct mp4_demux_cursor *cursor,
+					     int64_t stride);
+
+
+/**
+ * Get the sample at the position of a read cursor.
+ * See mp4_demux_get_track_sample().
+ * @param cursor: cursor handle
+ * @param advance: if true, advance the cursor to the next sample
+ * @param sample_buffer: sample buffer (optional, can be null)
+ * @param sample_buffer_size: sample buffer size
+ * @param metadata_buffer: metadata buffer (optional, can be null)
+ * @param metadata_buffer_size: size of the metadata buffer
+ * @param track_sample: pointer to the track_sample structure to fill (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_cursor_get_sample(struct mp4_demux_cursor *cursor,
+					int advance,
+					uint8_t *sample_buffer,
+					unsigned int sample_buffer_size,
+					uint8_t *metadata_buffer,
+					unsigned int metadata_buffer_size,
+					struct mp4_track_sample *track_sample);
+
+
+/**
+ * Split a track in parts read by separate cursors.
+ * The track is cut between GOPs (see mp4_demux_get_track_gops()) in at most
+ * 'count' consecutive parts of about the same size or duration, and a
+ * cursor is created for each part (see mp4_demux_cursor_new()). A cursor
+ * starts at the first sample of its part and returns an empty sample
+ * after the last one; seeking it is also limited to its part. A track
+ * without sync samples is not split. The first split or
+ * mp4_demux_get_track_gops() call builds the GOP table of the track; like
+ * that function, this function can be called concurrently with the other
+ * functions taking a const demuxer, including other splits and cursors.
+ * @param demux: demuxer instance handle
+ * @param track_id: track ID
+ * @param mode: balance criterion between the parts
+ * @param count: maximum number of parts
+ * @param cursors: array of at least 'count' cursor handles (output)
+ * @param ret_count: pointer to the number of parts (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_split_track(const struct mp4_demux *demux,
+				  unsigned int track_id,
+				  enum mp4_demux_split_mode mode,
+				  unsigned int count,
+				  struct mp4_demux_cursor **cursors,
+				  unsigned int *ret_count);
+
+
+/**
+ * Create an iterator on the samples of several tracks.
+ * The iterator returns the samples of all the selected tracks one after
+ * the other, either in file offset order (for a sequential access to the
+ * file) or in decoding time order. Like cursors, it holds its own read
+ * positions (see mp4_demux_cursor_new()) and must be destroyed before the
+ * demuxer is closed.
+ * @param demux: demuxer instance handle
+ * @param order: order of the samples
+ * @param track_ids: array of the IDs of the tracks to iterate on, null
+ *                   for all the tracks of the file
+ * @param track_count: number of track IDs in the array
+ * @param ret_obj: iterator handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_iterator_new(const struct mp4_demux *demux,
+				   enum mp4_demux_iterator_order order,
+				   const unsigned int *track_ids,
+				   unsigned int track_count,
+				   struct mp4_demux_iterator **ret_obj);
+
+
+/**
+ * Destroy an iterator.
+ * @param iterator: iterator handle
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_iterator_destroy(struct mp4_demux_iterator *iterator);
+
+
+/**
+ * Get the next sample of an iterator.
+ * See mp4_demux_get_track_sample(). When all the samples have been
+ * returned, the track ID is 0 (a sample size of 0 does not mark the end,
+ * empty samples are valid).
+ * @param iterator: iterator handle
+ * @param sample_buffer: sample buffer (optional, can be null)
+ * @param sample_buffer_size: sample buffer size
+ * @param metadata_buffer: metadata buffer (optional, can be null)
+ * @param metadata_buffer_size: size of the metadata buffer
+ * @param track_id: pointer to the ID of the track of the sample (output)
+ * @param track_sample: pointer to the track_sample structure to fill (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_iterator_next(struct mp4_demux_iterator *iterator,
+				    uint8_t *sample_buffer,
+				    unsigned int sample_buffer_size,
+				    uint8_t *metadata_buffer,
+				    unsigned int metadata_buffer_size,
+				    unsigned int *track_id,
+				    struct mp4_track_sample *track_sample);
+
+
+/**
+ * Create a sample reader.
+ * A sample reader reads the next samples of several tracks, possibly
+ * from several demuxers, in batches. When the library is built with
+ * liburing and the kernel supports it, the reads of a batch are submitted
+ * together using io_uring; otherwise they are done one after the other
+ * with pread().
+ * @param queue_depth: maximum number of reads in flight, 0 for a default
+ *                     value
+ * @param ret_obj: sample reader handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_reader_new(unsigned int queue_depth,
+				 struct mp4_demux_reader **ret_obj);
+
+
+/**
+ * Destroy a sample reader.
+ * @param reader: sample reader handle
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_reader_destroy(struct mp4_demux_reader *reader);
+
+
+/**
+ * Register sample buffers with a sample reader.
+ * When io_uring is used, the reads into a registered buffer (a request
+ * buffer within one of the registered buffers) use it as a fixed buffer,
+ * which saves mapping the buffer pages for each read. The buffers must
+ * stay valid until they are unregistered (count set to 0), replaced by a
+ * new registration or the reader is destroyed. Without io_uring, this
+ * function has no effect.
+ * @param reader: sample reader handle
+ * @param buffers: array of buffers (can be null if count is 0)
+ * @param sizes: array of the sizes of the buffers
+ * @param count: number of buffers
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int
+mp4_demux_reader_register_buffers(struct mp4_demux_reader *reader,
+				  uint8_t *const *buffers,
+				  const size_t *sizes,
+				  unsigned int count);
+
+
+/**
+ * Read a batch of samples.
+ * For each request, the next sample of the track is read into the request
+ * buffer and the track is advanced to the following sample, as with
+ * mp4_demux_get_track_sample() (metadata are not read). The result of
+ * each request is given in its status field; if the buffer is too small,
+ * the status is -ENOBUFS and the track is not advanced. The demuxers must
+ * not be used by other functions during the call.
+ * All the reads are completed when the function returns.
+ * @param reader: sample reader handle
+ * @param reads: array of sample read requests
+ * @param count: number of requests
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_demux_reader_read_samples(struct mp4_demux_reader *reader,
+					  struct mp4_demux_sample_read *reads,
+					  unsigned int count);
+
+
 /**
  * Get the chapters of an MP4 file.
  * @param demux: demuxer instance handle
@@ -558,6 +1098,42 @@ struct mp4_mux_config {
 		 * file. */
 		bool allocate_space_for_tables_file;
 	} recovery;
+	/* Chunk grouping policy: consecutive samples of a track are buffered
+	 * and written as a single contiguous chunk until one of the limits is
+	 * reached (0 means no limit). When both limits are 0, each sample is
+	 * written immediately in its own chunk. */
+	struct {
+		/* Maximum chunk duration in microseconds */
+		uint64_t max_duration;
+		/* Maximum chunk size in bytes */
+		size_t max_size;
+	} chunk;
+	/* Write-behind buffer: the sample data is buffered and written when
+	 * the buffer is full, on mp4_mux_sync() and on mp4_mux_close() */
+	struct {
+		/* Buffer size in bytes, rounded up to a multiple of the file
+		 * system block size (0 disables the buffer) */
+		size_t size;
+		/* Maximum time in milliseconds the data stays in the buffer,
+		 * checked when adding samples (0 means no limit) */
+		uint32_t max_delay_ms;
+		/* Write the sample data with direct I/O (O_DIRECT), bypassing
+		 * the page cache; requires a buffer size. Only whole aligned
+		 * blocks are written directly, the unaligned tail is written
+		 * through the page cache on mp4_mux_sync() and
+		 * mp4_mux_close(). Not supported on all platforms and file
+		 * systems (mp4_mux_open() then fails). */
+		bool direct_io;
+	} write_buffer;
+	/* Asynchronous mode: the samples are queued and written by a
+	 * dedicated thread; invalid samples are rejected when queued, and I/O
+	 * errors of the writer thread are returned by the following calls */
+	struct {
+		bool enabled;
+		/* Queue size in samples (0 means the default size) */
+		unsigned int queue_size;
+		enum mp4_mux_async_policy policy;
+	} async;
 };
 
 
@@ -714,6 +1290,9 @@ MP4_API int mp4_mux_set_file_cover(struct mp4_mux *mux,
 
 /**
  * Add a sample to a track.
+ * If a chunk grouping policy is configured, the sample data may be buffered
+ * until the chunk is complete or until the next mp4_mux_sync() or
+ * mp4_mux_close() call.
  * @param mux: muxer instance handle
  * @param track_handle: track handle
  * @param sample: sample to add
@@ -726,6 +1305,7 @@ MP4_API int mp4_mux_track_add_sample(const struct mp4_mux *mux,
 
 /**
  * Add a scattered sample to a track.
+ * In asynchronous mode, the sample data is copied.
  * @param mux: muxer instance handle
  * @param track_handle: track handle
  * @param sample: sample to add
@@ -737,6 +1317,35 @@ MP4_API int mp4_mux_track_add_scattered_sample(
 	const struct mp4_mux_scattered_sample *sample);
 
 
+/**
+ * Add a sample to a track, without copy in asynchronous mode.
+ * The muxer takes ownership of the sample buffer: the release function is
+ * called once the sample is written or dropped, or if the function fails.
+ * @param mux: muxer instance handle
+ * @param track_handle: track handle
+ * @param sample: sample to add
+ * @param release: buffer release function
+ * @param userdata: user data passed to the release function
+ * @return 0 on success, negative errno value in case of error
+ */
+MP4_API int mp4_mux_track_add_sample_owned(const struct mp4_mux *mux,
+					   int track_handle,
+					   const struct mp4_mux_sample *sample,
+					   mp4_mux_sample_release_t release,
+					   void *userdata);
+
+
+/**
+ * Get the statistics of an asynchronous muxer.
+ * @param mux: muxer instance handle
+ * @param stats: statistics (output)
+ * @return 0 on success, -EPERM if the muxer is not asynchronous, negative
+ *         errno value in case of error
+ */
+MP4_API int mp4_mux_get_async_stats(const struct mp4_mux *mux,
+				    struct mp4_mux_async_stats *stats);
+
+
 /**
  * Print the muxer data.
  * @param mux: muxer instance handle
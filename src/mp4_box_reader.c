@@ -31,6 +31,8 @@
 
 #include "mp4_priv.h"
 
+#include "mp4_decode.h"
+
 
 /* Enable to log all table entries */
 #define LOG_ALL 0
@@ -50,6 +52,88 @@
 	} while (0)
 
 
+/* The entries are decoded as flat arrays of 32-bit fields when the entry
+ * structures have no padding */
+static void mp4_decode_stts(struct mp4_time_to_sample_entry *restrict dst,
+			    const uint8_t *restrict src,
+			    size_t count)
+{
+	if (sizeof(*dst) == 2 * sizeof(uint32_t)) {
+		mp4_decode_be32((uint32_t *)dst, src, count * 2);
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		/* 'sample_count' */
+		dst[i].sampleCount = mp4_load_be32(src + i * 8);
+		/* 'sample_delta' */
+		dst[i].sampleDelta = mp4_load_be32(src + i * 8 + 4);
+	}
+}
+
+
+static void mp4_decode_stsc(struct mp4_sample_to_chunk_entry *restrict dst,
+			    const uint8_t *restrict src,
+			    size_t count)
+{
+	if (sizeof(*dst) == 3 * sizeof(uint32_t)) {
+		mp4_decode_be32((uint32_t *)dst, src, count * 3);
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		/* 'first_chunk' */
+		dst[i].firstChunk = mp4_load_be32(src + i * 12);
+		/* 'samples_per_chunk' */
+		dst[i].samplesPerChunk = mp4_load_be32(src + i * 12 + 4);
+		/* 'sample_description_index' */
+		dst[i].sampleDescriptionIndex =
+			mp4_load_be32(src + i * 12 + 8);
+	}
+}
+
+
+/**
+ * Get the next 'size' bytes of the file for bulk decoding of a table.
+ * The data is returned without copy when it is already in memory (loaded
+ * box or file mapping), otherwise it is read at once in a buffer that
+ * is returned through 'tmp' and must be freed by the caller.
+ * The read cursor is moved forward by 'size' bytes.
+ */
+static int mp4_file_read_table(struct mp4_file *mp4,
+			       size_t size,
+			       const uint8_t **data,
+			       uint8_t **tmp)
+{
+	*tmp = NULL;
+	*data = mp4_file_get_data(mp4, mp4->readOffset, size);
+	if (*data != NULL) {
+		mp4->readOffset += size;
+		return 0;
+	}
+
+	*tmp = malloc(size);
+	if (*tmp == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return -ENOMEM;
+	}
+	ssize_t count = mp4_file_read(mp4, *tmp, size);
+	if (count == -1) {
+		int ret = -errno;
+		ULOG_ERRNO("read", -ret);
+		free(*tmp);
+		*tmp = NULL;
+		return ret;
+	} else if ((size_t)count != size) {
+		ULOGE("only %zd bytes read instead of %zu", count, size);
+		free(*tmp);
+		*tmp = NULL;
+		return -EIO;
+	}
+	*data = *tmp;
+
+	return 0;
+}
+
+
 struct mp4_box *mp4_box_new(struct mp4_box *parent)
 {
 	struct mp4_box *box = calloc(1, sizeof(*box));
@@ -143,10 +227,199 @@ void mp4_box_log(const struct mp4_box *box, int level)
 }
 
 
+ssize_t mp4_pread(int fd, void *buf, size_t count, off_t offset)
+{
+#ifdef _WIN32
+	/* No pread() on Windows; the file offset is not preserved */
+	if (lseek(fd, offset, SEEK_SET) == -1)
+		return -1;
+	return read(fd, buf, count);
+#else
+	return pread(fd, buf, count, offset);
+#endif
+}
+
+
+int mp4_file_read_buffer_load(struct mp4_file *mp4, off_t offset, size_t size)
+{
+	size_t total = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(mp4 == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(offset < 0, EINVAL);
+
+	/* The whole file is already in memory */
+	if (mp4->mapped)
+		return 0;
+
+	mp4_file_read_buffer_release(mp4);
+
+	if (size == 0)
+		return 0;
+
+	uint8_t *data = malloc(size);
+	if (data == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return -ENOMEM;
+	}
+
+	while (total < size) {
+		ssize_t count = mp4_pread(mp4->fd,
+					  data + total,
+					  size - total,
+					  offset + (off_t)total);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			int ret = -errno;
+			ULOG_ERRNO("pread", -ret);
+			free(data);
+			return ret;
+		} else if (count == 0) {
+			ULOGE("only %zu bytes read instead of %zu",
+			      total,
+			      size);
+			free(data);
+			return -EIO;
+		}
+		total += count;
+	}
+
+	mp4->readBuffer.data = data;
+	mp4->readBuffer.offset = offset;
+	mp4->readBuffer.size = size;
+
+	return 0;
+}
+
+
+void mp4_file_read_buffer_release(struct mp4_file *mp4)
+{
+	if ((mp4 == NULL) || (mp4->mapped))
+		return;
+
+	free(mp4->readBuffer.data);
+	mp4->readBuffer.data = NULL;
+	mp4->readBuffer.offset = 0;
+	mp4->readBuffer.size = 0;
+}
+
+
+const uint8_t *
+mp4_file_get_data(const struct mp4_file *mp4, off_t offset, size_t size)
+{
+	const uint8_t *data = mp4->readBuffer.data;
+	off_t start = mp4->readBuffer.offset;
+	off_t end = start + (off_t)mp4->readBuffer.size;
+
+	if ((data == NULL) || (offset < start) || (offset + (off_t)size > end))
+		return NULL;
+
+	return data + (offset - start);
+}
+
+
+ssize_t mp4_file_pread(const struct mp4_file *mp4,
+		       void *buf,
+		       size_t count,
+		       off_t offset)
+{
+	const uint8_t *data = mp4_file_get_data(mp4, offset, count);
+
+	if (data != NULL) {
+		/* Fast path: copy from the loaded block or the mapping */
+		memcpy(buf, data, count);
+		return count;
+	}
+
+	return mp4_pread(mp4->fd, buf, count, offset);
+}
+
+
+ssize_t mp4_file_preadv(const struct mp4_file *mp4,
+			const struct iovec *iov,
+			int iovcnt,
+			off_t offset)
+{
+	size_t total = 0;
+	const uint8_t *data;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	data = mp4_file_get_data(mp4, offset, total);
+	if (data != NULL) {
+		/* Fast path: copy from the loaded block or the mapping */
+		for (i = 0; i < iovcnt; i++) {
+			memcpy(iov[i].iov_base, data, iov[i].iov_len);
+			data += iov[i].iov_len;
+		}
+		return total;
+	}
+
+#ifdef _WIN32
+	/* No preadv() on Windows; read the buffers one after the other */
+	total = 0;
+	for (i = 0; i < iovcnt; i++) {
+		ssize_t count = mp4_pread(mp4->fd,
+					  iov[i].iov_base,
+					  iov[i].iov_len,
+					  offset + (off_t)total);
+		if (count < 0)
+			return (total == 0) ? count : (ssize_t)total;
+		total += count;
+		if ((size_t)count != iov[i].iov_len)
+			break;
+	}
+	return total;
+#else
+	return preadv(mp4->fd, iov, iovcnt, offset);
+#endif
+}
+
+
+ssize_t mp4_file_read(struct mp4_file *mp4, void *buf, size_t count)
+{
+	ssize_t ret = mp4_file_pread(mp4, buf, count, mp4->readOffset);
+	if (ret > 0)
+		mp4->readOffset += ret;
+	return ret;
+}
+
+
+off_t mp4_file_seek(struct mp4_file *mp4, off_t offset, int whence)
+{
+	off_t newOffset;
+
+	switch (whence) {
+	case SEEK_SET:
+		newOffset = offset;
+		break;
+	case SEEK_CUR:
+		newOffset = mp4->readOffset + offset;
+		break;
+	case SEEK_END:
+		newOffset = mp4->fileSize + offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (newOffset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	mp4->readOffset = newOffset;
+	return newOffset;
+}
+
+
 /**
  * ISO/IEC 14496-12 - chap. 4.3 - File Type Box
  */
-static off_t mp4_box_ftyp_read(const struct mp4_file *mp4, off_t maxBytes)
+static off_t mp4_box_ftyp_read(struct mp4_file *mp4, off_t maxBytes)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
@@ -154,7 +427,7 @@ static off_t mp4_box_ftyp_read(const struct mp4_file *mp4, off_t maxBytes)
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'major_brand' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t majorBrand = ntohl(val32);
 	ULOGD("- ftyp: major_brand=%c%c%c%c",
 	      (char)((majorBrand >> 24) & 0xFF),
@@ -163,14 +436,14 @@ static off_t mp4_box_ftyp_read(const struct mp4_file *mp4, off_t maxBytes)
 	      (char)(majorBrand & 0xFF));
 
 	/* 'minor_version' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t minorVersion = ntohl(val32);
 	ULOGD("- ftyp: minor_version=%" PRIu32, minorVersion);
 
 	int k = 0;
 	while (boxReadBytes + 4 <= maxBytes) {
 		/* 'compatible_brands[]' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint32_t compatibleBrands = ntohl(val32);
 		ULOGD("- ftyp: compatible_brands[%d]=%c%c%c%c",
 		      k,
@@ -182,7 +455,7 @@ static off_t mp4_box_ftyp_read(const struct mp4_file *mp4, off_t maxBytes)
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -199,7 +472,7 @@ static off_t mp4_box_mvhd_read(struct mp4_file *mp4, off_t maxBytes)
 	CHECK_SIZE(maxBytes, 25 * 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -210,22 +483,22 @@ static off_t mp4_box_mvhd_read(struct mp4_file *mp4, off_t maxBytes)
 		CHECK_SIZE(maxBytes, 28 * 4);
 
 		/* 'creation_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->creationTime = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->creationTime |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		ULOGD("- mvhd: creation_time=%" PRIu64, mp4->creationTime);
 
 		/* 'modification_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->modificationTime = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->modificationTime |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		ULOGD("- mvhd: modification_time=%" PRIu64,
 		      mp4->modificationTime);
 
 		/* 'timescale' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->timescale = ntohl(val32);
 		ULOGD("- mvhd: timescale=%" PRIu32, mp4->timescale);
 		if (mp4->timescale == 0) {
@@ -234,9 +507,9 @@ static off_t mp4_box_mvhd_read(struct mp4_file *mp4, off_t maxBytes)
 		}
 
 		/* 'duration' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->duration = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->duration |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		unsigned int hrs =
 			(unsigned int)((mp4->duration + mp4->timescale / 2) /
@@ -256,18 +529,18 @@ static off_t mp4_box_mvhd_read(struct mp4_file *mp4, off_t maxBytes)
 		      sec);
 	} else {
 		/* 'creation_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->creationTime = ntohl(val32);
 		ULOGD("- mvhd: creation_time=%" PRIu64, mp4->creationTime);
 
 		/* 'modification_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->modificationTime = ntohl(val32);
 		ULOGD("- mvhd: modification_time=%" PRIu64,
 		      mp4->modificationTime);
 
 		/* 'timescale' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->timescale = ntohl(val32);
 		ULOGD("- mvhd: timescale=%" PRIu32, mp4->timescale);
 		if (mp4->timescale == 0) {
@@ -276,7 +549,7 @@ static off_t mp4_box_mvhd_read(struct mp4_file *mp4, off_t maxBytes)
 		}
 
 		/* 'duration' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		mp4->duration = ntohl(val32);
 		unsigned int hrs =
 			(unsigned int)((mp4->duration + mp4->timescale / 2) /
@@ -297,34 +570,34 @@ static off_t mp4_box_mvhd_read(struct mp4_file *mp4, off_t maxBytes)
 	}
 
 	/* 'rate' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	float rate = (float)ntohl(val32) / 65536.;
 	ULOGD("- mvhd: rate=%.4f", rate);
 
 	/* 'volume' & 'reserved' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	float volume = (float)((ntohl(val32) >> 16) & 0xFFFF) / 256.;
 	ULOGD("- mvhd: volume=%.2f", volume);
 
 	/* 'reserved' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	/* 'matrix' */
 	for (int k = 0; k < 9; k++)
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	/* 'pre_defined' */
 	for (int k = 0; k < 6; k++)
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	/* 'next_track_ID' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t next_track_ID = ntohl(val32);
 	ULOGD("- mvhd: next_track_ID=%" PRIu32, next_track_ID);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -333,7 +606,7 @@ static off_t mp4_box_mvhd_read(struct mp4_file *mp4, off_t maxBytes)
 /**
  * ISO/IEC 14496-12 - chap. 8.3.2 - Track Header Box
  */
-static off_t mp4_box_tkhd_read(const struct mp4_file *mp4,
+static off_t mp4_box_tkhd_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
@@ -345,7 +618,7 @@ static off_t mp4_box_tkhd_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 21 * 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -359,31 +632,31 @@ static off_t mp4_box_tkhd_read(const struct mp4_file *mp4,
 		CHECK_SIZE(maxBytes, 24 * 4);
 
 		/* 'creation_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint64_t creationTime = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		creationTime |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		ULOGD("- tkhd: creation_time=%" PRIu64, creationTime);
 
 		/* 'modification_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint64_t modificationTime = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		modificationTime |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		ULOGD("- tkhd: modification_time=%" PRIu64, modificationTime);
 
 		/* 'track_ID' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->id = ntohl(val32);
 		ULOGD("- tkhd: track_ID=%" PRIu32, track->id);
 
 		/* 'reserved' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 		/* 'duration' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint64_t duration = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		duration |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		unsigned int hrs =
 			(unsigned int)((duration + mp4->timescale / 2) /
@@ -403,25 +676,25 @@ static off_t mp4_box_tkhd_read(const struct mp4_file *mp4,
 		      sec);
 	} else {
 		/* 'creation_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint32_t creationTime = ntohl(val32);
 		ULOGD("- tkhd: creation_time=%" PRIu32, creationTime);
 
 		/* 'modification_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint32_t modificationTime = ntohl(val32);
 		ULOGD("- tkhd: modification_time=%" PRIu32, modificationTime);
 
 		/* 'track_ID' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->id = ntohl(val32);
 		ULOGD("- tkhd: track_ID=%" PRIu32, track->id);
 
 		/* 'reserved' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 		/* 'duration' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint32_t duration = ntohl(val32);
 		unsigned int hrs = ((duration + mp4->timescale / 2) /
 				    mp4->timescale / 60 / 60);
@@ -439,37 +712,37 @@ static off_t mp4_box_tkhd_read(const struct mp4_file *mp4,
 	}
 
 	/* 'reserved' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	/* 'layer' & 'alternate_group' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	int16_t layer = (int16_t)(ntohl(val32) >> 16);
 	int16_t alternateGroup = (int16_t)(ntohl(val32) & 0xFFFF);
 	ULOGD("- tkhd: layer=%i", layer);
 	ULOGD("- tkhd: alternate_group=%i", alternateGroup);
 
 	/* 'volume' & 'reserved' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	float volume = (float)((ntohl(val32) >> 16) & 0xFFFF) / 256.;
 	ULOGD("- tkhd: volume=%.2f", volume);
 
 	/* 'matrix' */
 	for (unsigned int k = 0; k < 9; k++)
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	/* 'width' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	float width = (float)ntohl(val32) / 65536.;
 	ULOGD("- tkhd: width=%.2f", width);
 
 	/* 'height' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	float height = (float)ntohl(val32) / 65536.;
 	ULOGD("- tkhd: height=%.2f", height);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -478,7 +751,7 @@ static off_t mp4_box_tkhd_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.3.3 - Track Reference Box
  */
-static off_t mp4_box_tref_read(const struct mp4_file *mp4,
+static off_t mp4_box_tref_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
@@ -490,12 +763,12 @@ static off_t mp4_box_tref_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 3 * 4);
 
 	/* 'reference_type' size */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t referenceTypeSize = ntohl(val32);
 	ULOGD("- tref: reference_type_size=%" PRIu32, referenceTypeSize);
 
 	/* 'reference_type' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	track->referenceType = ntohl(val32);
 	ULOGD("- tref: reference_type=%c%c%c%c",
 	      (char)((track->referenceType >> 24) & 0xFF),
@@ -507,7 +780,7 @@ static off_t mp4_box_tref_read(const struct mp4_file *mp4,
 	track->referenceTrackIdCount = 0;
 	while ((boxReadBytes + 4 <= maxBytes) &&
 	       (track->referenceTrackIdCount < MP4_TRACK_REF_MAX)) {
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->referenceTrackId[track->referenceTrackIdCount] =
 			ntohl(val32);
 		ULOGD("- tref: track_id=%" PRIu32,
@@ -522,7 +795,7 @@ static off_t mp4_box_tref_read(const struct mp4_file *mp4,
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -531,7 +804,7 @@ static off_t mp4_box_tref_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.4.2 - Media Header Box
  */
-static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
+static off_t mp4_box_mdhd_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
@@ -543,7 +816,7 @@ static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 6 * 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -554,23 +827,23 @@ static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
 		CHECK_SIZE(maxBytes, 9 * 4);
 
 		/* 'creation_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->creationTime = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->creationTime |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		ULOGD("- mdhd: creation_time=%" PRIu64, track->creationTime);
 
 		/* 'modification_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->modificationTime = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->modificationTime |=
 			(uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		ULOGD("- mdhd: modification_time=%" PRIu64,
 		      track->modificationTime);
 
 		/* 'timescale' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->timescale = ntohl(val32);
 		ULOGD("- mdhd: timescale=%" PRIu32, track->timescale);
 		if (track->timescale == 0) {
@@ -579,9 +852,9 @@ static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
 		}
 
 		/* 'duration' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->duration = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->duration |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 		unsigned int hrs = (unsigned int)((track->duration +
 						   track->timescale / 2) /
@@ -602,18 +875,18 @@ static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
 		      sec);
 	} else {
 		/* 'creation_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->creationTime = ntohl(val32);
 		ULOGD("- mdhd: creation_time=%" PRIu64, track->creationTime);
 
 		/* 'modification_time' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->modificationTime = ntohl(val32);
 		ULOGD("- mdhd: modification_time=%" PRIu64,
 		      track->modificationTime);
 
 		/* 'timescale' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->timescale = ntohl(val32);
 		ULOGD("- mdhd: timescale=%" PRIu32, track->timescale);
 		if (track->timescale == 0) {
@@ -622,7 +895,7 @@ static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
 		}
 
 		/* 'duration' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		track->duration = (uint64_t)ntohl(val32);
 		unsigned int hrs = (unsigned int)((track->duration +
 						   track->timescale / 2) /
@@ -644,12 +917,12 @@ static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
 	}
 
 	/* 'language' & 'pre_defined' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint16_t language = (uint16_t)(ntohl(val32) >> 16) & 0x7FFF;
 	ULOGD("- mdhd: language=%" PRIu16, language);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -658,7 +931,7 @@ static off_t mp4_box_mdhd_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.4.5.2 - Video Media Header Box
  */
-static off_t mp4_box_vmhd_read(const struct mp4_file *mp4, off_t maxBytes)
+static off_t mp4_box_vmhd_read(struct mp4_file *mp4, off_t maxBytes)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
@@ -667,7 +940,7 @@ static off_t mp4_box_vmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	CHECK_SIZE(maxBytes, 3 * 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -675,17 +948,17 @@ static off_t mp4_box_vmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	ULOGD("- vmhd: flags=%" PRIu32, flags);
 
 	/* 'graphicsmode' */
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	uint16_t graphicsmode = ntohs(val16);
 	ULOGD("- vmhd: graphicsmode=%" PRIu16, graphicsmode);
 
 	/* 'opcolor' */
 	uint16_t opcolor[3];
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	opcolor[0] = ntohs(val16);
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	opcolor[1] = ntohs(val16);
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	opcolor[2] = ntohs(val16);
 	ULOGD("- vmhd: opcolor=(%" PRIu16 ",%" PRIu16 ",%" PRIu16 ")",
 	      opcolor[0],
@@ -693,7 +966,7 @@ static off_t mp4_box_vmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	      opcolor[2]);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -702,7 +975,7 @@ static off_t mp4_box_vmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 /**
  * ISO/IEC 14496-12 - chap. 8.4.5.3 - Sound Media Header Box
  */
-static off_t mp4_box_smhd_read(const struct mp4_file *mp4, off_t maxBytes)
+static off_t mp4_box_smhd_read(struct mp4_file *mp4, off_t maxBytes)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
@@ -710,7 +983,7 @@ static off_t mp4_box_smhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	CHECK_SIZE(maxBytes, 2 * 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -718,13 +991,13 @@ static off_t mp4_box_smhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	ULOGD("- smhd: flags=%" PRIu32, flags);
 
 	/* 'balance' & 'reserved' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	float balance =
 		(float)((int16_t)((ntohl(val32) >> 16) & 0xFFFF)) / 256.;
 	ULOGD("- smhd: balance=%.2f", balance);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -733,7 +1006,7 @@ static off_t mp4_box_smhd_read(const struct mp4_file *mp4, off_t maxBytes)
 /**
  * ISO/IEC 14496-12 - chap. 8.4.5.4 - Hint Media Header Box
  */
-static off_t mp4_box_hmhd_read(const struct mp4_file *mp4, off_t maxBytes)
+static off_t mp4_box_hmhd_read(struct mp4_file *mp4, off_t maxBytes)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
@@ -741,7 +1014,7 @@ static off_t mp4_box_hmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	CHECK_SIZE(maxBytes, 5 * 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -749,27 +1022,27 @@ static off_t mp4_box_hmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	ULOGD("- hmhd: flags=%" PRIu32, flags);
 
 	/* 'maxPDUsize' and 'avgPDUsize' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint16_t maxPDUsize = (uint16_t)((ntohl(val32) >> 16) & 0xFFFF);
 	uint16_t avgPDUsize = (uint16_t)(ntohl(val32) & 0xFFFF);
 	ULOGD("- hmhd: maxPDUsize=%" PRIu16, maxPDUsize);
 	ULOGD("- hmhd: avgPDUsize=%" PRIu16, avgPDUsize);
 
 	/* 'maxbitrate' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t maxbitrate = ntohl(val32);
 	ULOGD("- hmhd: maxbitrate=%" PRIu32, maxbitrate);
 
 	/* 'avgbitrate' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t avgbitrate = ntohl(val32);
 	ULOGD("- hmhd: avgbitrate=%" PRIu32, avgbitrate);
 
 	/* 'reserved' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -778,7 +1051,7 @@ static off_t mp4_box_hmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 /**
  * ISO/IEC 14496-12 - chap. 8.4.5.5 - Null Media Header Box
  */
-static off_t mp4_box_nmhd_read(const struct mp4_file *mp4, off_t maxBytes)
+static off_t mp4_box_nmhd_read(struct mp4_file *mp4, off_t maxBytes)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
@@ -786,7 +1059,7 @@ static off_t mp4_box_nmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	CHECK_SIZE(maxBytes, 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -794,7 +1067,7 @@ static off_t mp4_box_nmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 	ULOGD("- nmhd: flags=%" PRIu32, flags);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -803,7 +1076,7 @@ static off_t mp4_box_nmhd_read(const struct mp4_file *mp4, off_t maxBytes)
 /**
  * ISO/IEC 14496-12 - chap. 8.4.3 - Handler Reference Box
  */
-static off_t mp4_box_hdlr_read(const struct mp4_file *mp4,
+static off_t mp4_box_hdlr_read(struct mp4_file *mp4,
 			       const struct mp4_box *box,
 			       off_t maxBytes,
 			       struct mp4_track *track)
@@ -814,7 +1087,7 @@ static off_t mp4_box_hdlr_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 6 * 4);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -822,10 +1095,10 @@ static off_t mp4_box_hdlr_read(const struct mp4_file *mp4,
 	ULOGD("- hdlr: flags=%" PRIu32, flags);
 
 	/* 'pre_defined' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	/* 'handler_type' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t handlerType = ntohl(val32);
 	ULOGD("- hdlr: handler_type=%c%c%c%c",
 	      (char)((handlerType >> 24) & 0xFF),
@@ -860,12 +1133,12 @@ static off_t mp4_box_hdlr_read(const struct mp4_file *mp4,
 	/* 'reserved' */
 	unsigned int k;
 	for (k = 0; k < 3; k++)
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	char name[100];
 	memset(name, 0, sizeof(name));
 	for (k = 0; (k < sizeof(name) - 1) && (boxReadBytes < maxBytes); k++) {
-		MP4_READ_8(mp4->fd, name[k], boxReadBytes);
+		MP4_FILE_READ_8(mp4, name[k], boxReadBytes);
 		if (name[k] == '\0')
 			break;
 	}
@@ -878,7 +1151,7 @@ static off_t mp4_box_hdlr_read(const struct mp4_file *mp4,
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -887,7 +1160,7 @@ static off_t mp4_box_hdlr_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-15 - chap. 5.3.3.1 - AVC decoder configuration record
  */
-static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
+static off_t mp4_box_avcc_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
@@ -901,7 +1174,7 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, minBytes);
 
 	/* 'version' & 'profile' & 'level' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	val32 = htonl(val32);
 	uint8_t version = (val32 >> 24) & 0xFF;
 	uint8_t profile = (val32 >> 16) & 0xFF;
@@ -913,7 +1186,7 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 	ULOGD("- avcC: level=%d", level);
 
 	/* 'length_size' and 'sps_count' */
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	val16 = htons(val16);
 	uint8_t lengthSize = ((val16 >> 8) & 0x3) + 1;
 	uint8_t spsCount = val16 & 0x1F;
@@ -926,7 +1199,7 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 	int i;
 	for (i = 0; i < spsCount; i++) {
 		/* 'sps_length' */
-		MP4_READ_16(mp4->fd, val16, boxReadBytes);
+		MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 		uint16_t spsLength = htons(val16);
 		ULOGD("- avcC: sps_length=%" PRIu16, spsLength);
 
@@ -941,15 +1214,15 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 				ULOG_ERRNO("malloc", ENOMEM);
 				return -ENOMEM;
 			}
-			ssize_t count =
-				read(mp4->fd, track->vdc.avc.sps, spsLength);
+			ssize_t count = mp4_file_read(
+				mp4, track->vdc.avc.sps, spsLength);
 			if (count == -1) {
 				ULOG_ERRNO("read", errno);
 				return -errno;
 			}
 		} else {
 			/* Ignore any other SPS */
-			off_t ret = lseek(mp4->fd, spsLength, SEEK_CUR);
+			off_t ret = mp4_file_seek(mp4, spsLength, SEEK_CUR);
 			if (ret == -1) {
 				ULOG_ERRNO("lseek", errno);
 				return -errno;
@@ -963,7 +1236,7 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 
 	/* 'pps_count' */
 	uint8_t ppsCount;
-	MP4_READ_8(mp4->fd, ppsCount, boxReadBytes);
+	MP4_FILE_READ_8(mp4, ppsCount, boxReadBytes);
 	ULOGD("- avcC: pps_count=%d", ppsCount);
 	if (ppsCount > INT8_MAX) {
 		ULOGE("ppsCount exceeds the maximum count %" PRIu8, ppsCount);
@@ -975,7 +1248,7 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 
 	for (i = 0; i < ppsCount; i++) {
 		/* 'pps_length' */
-		MP4_READ_16(mp4->fd, val16, boxReadBytes);
+		MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 		uint16_t ppsLength = htons(val16);
 		ULOGD("- avcC: pps_length=%" PRIu16, ppsLength);
 
@@ -990,15 +1263,15 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 				ULOG_ERRNO("malloc", ENOMEM);
 				return -ENOMEM;
 			}
-			ssize_t count =
-				read(mp4->fd, track->vdc.avc.pps, ppsLength);
+			ssize_t count = mp4_file_read(
+				mp4, track->vdc.avc.pps, ppsLength);
 			if (count == -1) {
 				ULOG_ERRNO("read", errno);
 				return -errno;
 			}
 		} else {
 			/* Ignore any other PPS */
-			off_t ret = lseek(mp4->fd, ppsLength, SEEK_CUR);
+			off_t ret = mp4_file_seek(mp4, ppsLength, SEEK_CUR);
 			if (ret == -1) {
 				ULOG_ERRNO("lseek", errno);
 				return -errno;
@@ -1008,7 +1281,7 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -1017,7 +1290,7 @@ static off_t mp4_box_avcc_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-15 - chap. 8.3.3.1.2 - HVCC decoder configuration record
  */
-static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
+static off_t mp4_box_hvcc_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
@@ -1035,7 +1308,7 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 
 	/* 'version' */
 	uint8_t version;
-	MP4_READ_8(mp4->fd, version, boxReadBytes);
+	MP4_FILE_READ_8(mp4, version, boxReadBytes);
 	if (version != 1)
 		ULOGE("hvcC configurationVersion mismatch: %u (expected 1)",
 		      version);
@@ -1045,7 +1318,7 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 
 	/* 'general_profile_space', 'general_tier_flag', 'general_profile_idc'
 	 */
-	MP4_READ_8(mp4->fd, val8, boxReadBytes);
+	MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 	hvcc->general_profile_space = val8 >> 6;
 	hvcc->general_tier_flag = (val8 >> 5) & 0x01;
 	hvcc->general_profile_idc = val8 & 0x1F;
@@ -1054,14 +1327,14 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 	ULOGD("- hvcC: general_profile_idc=%d", hvcc->general_profile_idc);
 
 	/* 'general_profile_compatibility_flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	hvcc->general_profile_compatibility_flags = htonl(val32);
 	ULOGD("- hvcC: general_profile_compatibility_flags= %#" PRIx32,
 	      hvcc->general_profile_compatibility_flags);
 
 	/* 'general_constraints_indicator_flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	val32 = htonl(val32);
 	val16 = htons(val16);
 	hvcc->general_constraints_indicator_flags =
@@ -1070,43 +1343,43 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 	      hvcc->general_constraints_indicator_flags);
 
 	/* 'general_level_idc' */
-	MP4_READ_8(mp4->fd, hvcc->general_level_idc, boxReadBytes);
+	MP4_FILE_READ_8(mp4, hvcc->general_level_idc, boxReadBytes);
 	ULOGD("- hvcC: level_idc=%d", hvcc->general_level_idc);
 
 	/* 'min_spatial_segmentation_idc' */
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	val16 = htons(val16);
 	hvcc->min_spatial_segmentation_idc = val16 & 0x0FFF;
 	ULOGD("- hvcC: min_sseg_idc=%d", hvcc->min_spatial_segmentation_idc);
 
 	/* 'parallelismType' */
-	MP4_READ_8(mp4->fd, val8, boxReadBytes);
+	MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 	hvcc->parallelism_type = val8 & 0x02;
 	ULOGD("- hvcC: parallel_type=%d", hvcc->parallelism_type);
 
 	/* 'chromaFormat' */
-	MP4_READ_8(mp4->fd, val8, boxReadBytes);
+	MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 	hvcc->chroma_format = val8 & 0x02;
 	ULOGD("- hvcC: chroma_format=%d", hvcc->chroma_format);
 
 	/* 'bitDepthLuma' */
-	MP4_READ_8(mp4->fd, val8, boxReadBytes);
+	MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 	hvcc->bit_depth_luma = (val8 & 0x03) + 8;
 	ULOGD("- hvcC: bit_depth_luma=%d", hvcc->bit_depth_luma);
 
 	/* 'bitDepthChroma' */
-	MP4_READ_8(mp4->fd, val8, boxReadBytes);
+	MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 	hvcc->bit_depth_chroma = (val8 & 0x03) + 8;
 	ULOGD("- hvcC: bit_depth_chroma=%d", hvcc->bit_depth_chroma);
 
 	/* 'avgFrameRate' */
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	hvcc->avg_framerate = htons(val16);
 	ULOGD("- hvcC: avg_framerate=%d", hvcc->avg_framerate);
 
 	/* 'constantFrameRate', 'numTemporalLayers', 'temporalIdNested'
 	   'lengthSize'	*/
-	MP4_READ_8(mp4->fd, val8, boxReadBytes);
+	MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 	hvcc->constant_framerate = (val8 >> 6) & 0x03;
 	hvcc->num_temporal_layers = (val8 >> 3) & 0x7;
 	hvcc->temporal_id_nested = (val8 >> 2) & 0x01;
@@ -1117,7 +1390,7 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 	ULOGD("- hvcC: length_size=%d", hvcc->length_size);
 
 	/* 'numOfArrays' */
-	MP4_READ_8(mp4->fd, val8, boxReadBytes);
+	MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 	if (val8 > 16) {
 		ULOGE("hvcC: invalid numOfArrays=%d", val8);
 		return -EINVAL;
@@ -1132,14 +1405,14 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 
 		ULOGD("- hvcC:     ------------------ NALU #%d", i);
 		/* 'array_completeness' and 'NAL_unit_type' */
-		MP4_READ_8(mp4->fd, val8, boxReadBytes);
+		MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 		array_completeness = (val8 >> 7) & 0x01;
 		nalu_type = val8 & 0x3F;
 		ULOGD("- hvcC:     array_completeness=%d", array_completeness);
 		ULOGD("- hvcC:     nal_unit_type=%d", nalu_type);
 
 		/* 'numNalus' */
-		MP4_READ_16(mp4->fd, val16, boxReadBytes);
+		MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 		nb_nalus = htons(val16);
 		if (nb_nalus > 16) {
 			ULOGE("hvcC: invalid numNalus=%d", nb_nalus);
@@ -1152,7 +1425,7 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 			uint16_t nalu_length;
 
 			/* 'nalUnitLength' */
-			MP4_READ_16(mp4->fd, val16, boxReadBytes);
+			MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 			nalu_length = htons(val16);
 			ULOGD("- hvcC:         nalu_length = %d", nalu_length);
 			nalu_pptr = NULL;
@@ -1206,16 +1479,16 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 					ULOG_ERRNO("calloc", ENOMEM);
 					return -ENOMEM;
 				}
-				ssize_t count =
-					read(mp4->fd, *nalu_pptr, nalu_length);
+				ssize_t count = mp4_file_read(
+					mp4, *nalu_pptr, nalu_length);
 				if (count == -1) {
 					ULOG_ERRNO("read", errno);
 					return -errno;
 				}
 			} else {
 				/* Skip the latter nalu of a given type */
-				off_t ret =
-					lseek(mp4->fd, nalu_length, SEEK_CUR);
+				off_t ret = mp4_file_seek(
+					mp4, nalu_length, SEEK_CUR);
 				if (ret == -1) {
 					ULOG_ERRNO("lseek", errno);
 					return -errno;
@@ -1231,7 +1504,7 @@ static off_t mp4_box_hvcc_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-14 - chap. 5.6 - Sample Description Boxes
  */
-static off_t mp4_box_esds_read(const struct mp4_file *mp4,
+static off_t mp4_box_esds_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
@@ -1247,12 +1520,12 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, minBytes);
 
 	/* 'version', always 0 */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	ULOGD("- esds: version=%" PRIu32, val32);
 
 	/* 'ESDescriptor' */
 	uint8_t tag;
-	MP4_READ_8(mp4->fd, tag, boxReadBytes);
+	MP4_FILE_READ_8(mp4, tag, boxReadBytes);
 	if (tag != 3) {
 		ULOGE("invalid ESDescriptor tag: %" PRIu8 ", expected %d",
 		      tag,
@@ -1264,7 +1537,7 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 	off_t size = 0;
 	int cnt = 0;
 	do {
-		MP4_READ_8(mp4->fd, val8, boxReadBytes);
+		MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 		size = (size << 7) + (val8 & 0x7F);
 		cnt++;
 	} while (val8 & 0x80 && cnt < 4);
@@ -1279,31 +1552,31 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, minBytes);
 
 	/* 'ES_ID' */
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	val16 = ntohs(val16);
 	ULOGD("- esds: ESDescriptor ES_ID:%" PRIu16, val16);
 
 	/* 'flags' */
 	uint8_t flags;
-	MP4_READ_8(mp4->fd, flags, boxReadBytes);
+	MP4_FILE_READ_8(mp4, flags, boxReadBytes);
 	ULOGD("- esds: ESDecriptor flags:0x%02x", flags);
 
 	if (flags & 0x80) {
 		/* 'dependsOn_ES_ID' */
-		MP4_READ_16(mp4->fd, val16, boxReadBytes);
+		MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 		val16 = ntohs(val16);
 		ULOGD("- esds: ESDescriptor dependsOn_ES_ID:%" PRIu16, val16);
 	}
 	if (flags & 0x40) {
 		/* URL_Flag : read 'url_len' & 'url' */
-		MP4_READ_8(mp4->fd, val8, boxReadBytes);
+		MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 		ULOGD("- esds: ESDescriptor url_len:%" PRIu8, val8);
-		MP4_READ_SKIP(mp4->fd, val8, boxReadBytes);
+		MP4_FILE_READ_SKIP(mp4, val8, boxReadBytes);
 		ULOGD("- esds: skipped %" PRIu8 " bytes", val8);
 	}
 
 	/* 'DecoderConfigDescriptor' */
-	MP4_READ_8(mp4->fd, tag, boxReadBytes);
+	MP4_FILE_READ_8(mp4, tag, boxReadBytes);
 	if (tag != 4) {
 		ULOGE("invalid DecoderConfigDescriptor tag: %" PRIu8
 		      ", expected %d",
@@ -1315,7 +1588,7 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 	size = 0;
 	cnt = 0;
 	do {
-		MP4_READ_8(mp4->fd, val8, boxReadBytes);
+		MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 		size = (size << 7) + (val8 & 0x7F);
 		cnt++;
 	} while (val8 & 0x80 && cnt < 4);
@@ -1331,7 +1604,7 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 
 	/* 'DecoderConfigDescriptor.objectTypeIndication' */
 	uint8_t objectTypeIndication;
-	MP4_READ_8(mp4->fd, objectTypeIndication, boxReadBytes);
+	MP4_FILE_READ_8(mp4, objectTypeIndication, boxReadBytes);
 	if (objectTypeIndication != 0x40) {
 		ULOGE("invalid objectTypeIndication: %" PRIu8 ", expected 0x%x",
 		      objectTypeIndication,
@@ -1342,7 +1615,7 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 
 	/* 'DecoderConfigDescriptor.streamType' */
 	uint8_t streamType;
-	MP4_READ_8(mp4->fd, streamType, boxReadBytes);
+	MP4_FILE_READ_8(mp4, streamType, boxReadBytes);
 	streamType >>= 2;
 	if (streamType != 0x5) {
 		ULOGE("invalid streamType: %" PRIu8 ", expected 0x%x",
@@ -1353,11 +1626,11 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 	ULOGD("- esds: streamType:0x%x", streamType);
 
 	/* Next 11 bytes unused */
-	MP4_READ_SKIP(mp4->fd, 11, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, 11, boxReadBytes);
 	ULOGD("- esds: skipped 11 bytes");
 
 	/* 'DecoderSpecificInfo' */
-	MP4_READ_8(mp4->fd, tag, boxReadBytes);
+	MP4_FILE_READ_8(mp4, tag, boxReadBytes);
 	if (tag != 5) {
 		ULOGE("invalid DecoderSpecificInfo tag: %" PRIu8
 		      ", expected %d",
@@ -1369,7 +1642,7 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 	size = 0;
 	cnt = 0;
 	do {
-		MP4_READ_8(mp4->fd, val8, boxReadBytes);
+		MP4_FILE_READ_8(mp4, val8, boxReadBytes);
 		size = (size << 7) + (val8 & 0x7F);
 		cnt++;
 	} while (val8 & 0x80 && cnt < 4);
@@ -1390,7 +1663,8 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 			ULOG_ERRNO("malloc", ENOMEM);
 			return -ENOMEM;
 		}
-		ssize_t count = read(mp4->fd, track->audioSpecificConfig, size);
+		ssize_t count =
+			mp4_file_read(mp4, track->audioSpecificConfig, size);
 		if (count == -1) {
 			ret = -errno;
 			ULOG_ERRNO("read", -ret);
@@ -1413,7 +1687,7 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -1422,7 +1696,7 @@ static off_t mp4_box_esds_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.5.2 - Sample Description Box
  */
-static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
+static off_t mp4_box_stsd_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
@@ -1437,7 +1711,7 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -1445,7 +1719,7 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 	ULOGD("- stsd: flags=%" PRIu32, flags);
 
 	/* 'entry_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t entryCount = ntohl(val32);
 	ULOGD("- stsd: entry_count=%" PRIu32, entryCount);
 	if (entryCount > MAX_ENTRY_COUNT) {
@@ -1462,12 +1736,12 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			CHECK_SIZE(maxBytes, 102);
 
 			/* 'size' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t size = ntohl(val32);
 			ULOGD("- stsd: size=%" PRIu32, size);
 
 			/* 'type' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t type = ntohl(val32);
 			ULOGD("- stsd: type=%c%c%c%c",
 			      (char)((type >> 24) & 0xFF),
@@ -1476,10 +1750,10 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			      (char)(type & 0xFF));
 
 			/* 'reserved' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 			/* 'reserved' & 'data_reference_index' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint16_t dataReferenceIndex =
 				(uint16_t)(ntohl(val32) & 0xFFFF);
 			ULOGD("- stsd: data_reference_index=%" PRIu16,
@@ -1487,39 +1761,38 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 
 			for (int k = 0; k < 4; k++) {
 				/* 'pre_defined' & 'reserved' */
-				MP4_READ_32(mp4->fd, val32, boxReadBytes);
+				MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			}
 
 			/* 'width' & 'height' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			track->vdc.width = ((ntohl(val32) >> 16) & 0xFFFF);
 			track->vdc.height = (ntohl(val32) & 0xFFFF);
 			ULOGD("- stsd: width=%" PRIu32, track->vdc.width);
 			ULOGD("- stsd: height=%" PRIu32, track->vdc.height);
 
 			/* 'horizresolution' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			float horizresolution = (float)(ntohl(val32)) / 65536.;
 			ULOGD("- stsd: horizresolution=%.2f", horizresolution);
 
 			/* 'vertresolution' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			float vertresolution = (float)(ntohl(val32)) / 65536.;
 			ULOGD("- stsd: vertresolution=%.2f", vertresolution);
 
 			/* 'reserved' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 			/* 'frame_count' */
-			MP4_READ_16(mp4->fd, val16, boxReadBytes);
+			MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 			uint16_t frameCount = ntohs(val16);
 			ULOGD("- stsd: frame_count=%" PRIu16, frameCount);
 
 			/* 'compressorname' */
 			char compressorname[32];
-			ssize_t count = read(mp4->fd,
-					     &compressorname,
-					     sizeof(compressorname));
+			ssize_t count = mp4_file_read(
+				mp4, &compressorname, sizeof(compressorname));
 			if (count == -1) {
 				ret = -errno;
 				ULOG_ERRNO("read", -ret);
@@ -1533,18 +1806,18 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			ULOGD("- stsd: compressorname=%s", compressorname);
 
 			/* 'depth' & 'pre_defined' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint16_t depth =
 				(uint16_t)((ntohl(val32) >> 16) & 0xFFFF);
 			ULOGD("- stsd: depth=%" PRIu16, depth);
 
 			/* Codec specific size */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t codecSize = ntohl(val32);
 			ULOGD("- stsd: codec_size=%" PRIu32, codecSize);
 
 			/* Codec specific */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t codec = ntohl(val32);
 			ULOGD("- stsd: codec=%c%c%c%c",
 			      (char)((codec >> 24) & 0xFF),
@@ -1589,12 +1862,12 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			CHECK_SIZE(maxBytes, 44);
 
 			/* 'size' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t size = ntohl(val32);
 			ULOGD("- stsd: size=%" PRIu32, size);
 
 			/* 'type' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t type = ntohl(val32);
 			ULOGD("- stsd: type=%c%c%c%c",
 			      (char)((type >> 24) & 0xFF),
@@ -1603,21 +1876,21 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			      (char)(type & 0xFF));
 
 			/* 'reserved' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 			/* 'reserved' & 'data_reference_index' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint16_t dataReferenceIndex =
 				(uint16_t)(ntohl(val32) & 0xFFFF);
 			ULOGD("- stsd: data_reference_index=%" PRIu16,
 			      dataReferenceIndex);
 
 			/* 'reserved' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 			/* 'channelcount' & 'samplesize' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			track->audioChannelCount =
 				((ntohl(val32) >> 16) & 0xFFFF);
 			track->audioSampleSize = (ntohl(val32) & 0xFFFF);
@@ -1627,21 +1900,21 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			      track->audioSampleSize);
 
 			/* 'reserved' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 			/* 'samplerate' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			track->audioSampleRate = ntohl(val32);
 			ULOGD("- stsd: samplerate=%.2f",
 			      (float)track->audioSampleRate / 65536.);
 
 			/* Codec specific size */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t codecSize = ntohl(val32);
 			ULOGD("- stsd: codec_size=%" PRIu32, codecSize);
 
 			/* Codec specific */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t codec = ntohl(val32);
 			ULOGD("- stsd: codec=%c%c%c%c",
 			      (char)((codec >> 24) & 0xFF),
@@ -1672,12 +1945,12 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			CHECK_SIZE(maxBytes, 24);
 
 			/* 'size' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t size = ntohl(val32);
 			ULOGD("- stsd: size=%" PRIu32, size);
 
 			/* 'type' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			uint32_t type = ntohl(val32);
 			ULOGD("- stsd: type=%c%c%c%c",
 			      (char)((type >> 24) & 0xFF),
@@ -1686,11 +1959,11 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			      (char)(type & 0xFF));
 
 			/* 'reserved' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
-			MP4_READ_16(mp4->fd, val16, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
+			MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 
 			/* 'data_reference_index' */
-			MP4_READ_16(mp4->fd, val16, boxReadBytes);
+			MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 			uint16_t dataReferenceIndex = ntohl(val16);
 			ULOGD("- stsd: size=%d", dataReferenceIndex);
 
@@ -1700,7 +1973,7 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			for (k = 0;
 			     (k < sizeof(str) - 1) && (boxReadBytes < maxBytes);
 			     k++) {
-				MP4_READ_8(mp4->fd, str[k], boxReadBytes);
+				MP4_FILE_READ_8(mp4, str[k], boxReadBytes);
 				if (str[k] == '\0')
 					break;
 			}
@@ -1713,7 +1986,7 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 			for (k = 0;
 			     (k < sizeof(str) - 1) && (boxReadBytes < maxBytes);
 			     k++) {
-				MP4_READ_8(mp4->fd, str[k], boxReadBytes);
+				MP4_FILE_READ_8(mp4, str[k], boxReadBytes);
 				if (str[k] == '\0')
 					break;
 			}
@@ -1734,7 +2007,7 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -1743,12 +2016,16 @@ static off_t mp4_box_stsd_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.6.1.2 - Decoding Time to Sample Box
  */
-static off_t mp4_box_stts_read(const struct mp4_file *mp4,
+static off_t mp4_box_stts_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
+	const uint8_t *table;
+	uint8_t *tmp = NULL;
+	size_t tableSize;
+	int ret;
 
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
 
@@ -1760,7 +2037,7 @@ static off_t mp4_box_stts_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -1768,7 +2045,7 @@ static off_t mp4_box_stts_read(const struct mp4_file *mp4,
 	ULOGD("- stts: flags=%" PRIu32, flags);
 
 	/* 'entry_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	track->timeToSampleEntryCount = ntohl(val32);
 	ULOGD("- stts: entry_count=%" PRIu32, track->timeToSampleEntryCount);
 	if (track->timeToSampleEntryCount > MAX_ENTRY_COUNT) {
@@ -1788,23 +2065,27 @@ static off_t mp4_box_stts_read(const struct mp4_file *mp4,
 
 	CHECK_SIZE(maxBytes, 8 + track->timeToSampleEntryCount * 8);
 
-	for (unsigned int i = 0; i < track->timeToSampleEntryCount; i++) {
-		/* 'sample_count' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->timeToSampleEntries[i].sampleCount = ntohl(val32);
+	tableSize = (size_t)track->timeToSampleEntryCount * 8;
+	ret = mp4_file_read_table(mp4, tableSize, &table, &tmp);
+	if (ret < 0)
+		return ret;
+	boxReadBytes += tableSize;
 
-		/* 'sample_delta' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->timeToSampleEntries[i].sampleDelta = ntohl(val32);
+	mp4_decode_stts(track->timeToSampleEntries,
+			table,
+			track->timeToSampleEntryCount);
 #if LOG_ALL
+	for (unsigned int i = 0; i < track->timeToSampleEntryCount; i++) {
 		ULOGD("- stts: sample_count=%" PRIu32 " sample_delta=%" PRIu32,
 		      track->timeToSampleEntries[i].sampleCount,
 		      track->timeToSampleEntries[i].sampleDelta);
-#endif /* LOG_ALL */
 	}
+#endif /* LOG_ALL */
+
+	free(tmp);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -1813,12 +2094,16 @@ static off_t mp4_box_stts_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.6.2 - Sync Sample Box
  */
-static off_t mp4_box_stss_read(const struct mp4_file *mp4,
+static off_t mp4_box_stss_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
+	const uint8_t *table;
+	uint8_t *tmp = NULL;
+	size_t tableSize;
+	int ret;
 
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
 
@@ -1830,7 +2115,7 @@ static off_t mp4_box_stss_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -1838,7 +2123,7 @@ static off_t mp4_box_stss_read(const struct mp4_file *mp4,
 	ULOGD("- stss: flags=%" PRIu32, flags);
 
 	/* 'entry_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	track->syncSampleEntryCount = ntohl(val32);
 	ULOGD("- stss: entry_count=%" PRIu32, track->syncSampleEntryCount);
 	if (track->syncSampleEntryCount > MAX_ENTRY_COUNT) {
@@ -1857,18 +2142,26 @@ static off_t mp4_box_stss_read(const struct mp4_file *mp4,
 
 	CHECK_SIZE(maxBytes, 8 + track->syncSampleEntryCount * 4);
 
-	for (unsigned int i = 0; i < track->syncSampleEntryCount; i++) {
-		/* 'sample_number' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->syncSampleEntries[i] = ntohl(val32);
+	tableSize = (size_t)track->syncSampleEntryCount * 4;
+	ret = mp4_file_read_table(mp4, tableSize, &table, &tmp);
+	if (ret < 0)
+		return ret;
+	boxReadBytes += tableSize;
+
+	/* 'sample_number' */
+	mp4_decode_be32(
+		track->syncSampleEntries, table, track->syncSampleEntryCount);
 #if LOG_ALL
+	for (unsigned int i = 0; i < track->syncSampleEntryCount; i++) {
 		ULOGD("- stss: sample_number=%" PRIu32,
 		      track->syncSampleEntries[i]);
-#endif /* LOG_ALL */
 	}
+#endif /* LOG_ALL */
+
+	free(tmp);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -1877,16 +2170,20 @@ static off_t mp4_box_stss_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.7.3.2 - Sample Size Box
  */
-static off_t mp4_box_stsz_read(const struct mp4_file *mp4,
+static off_t mp4_box_stsz_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
+	const uint8_t *table;
+	uint8_t *tmp = NULL;
+	size_t tableSize;
+	int ret;
 
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
 
-	if (track->sampleSize != NULL) {
+	if ((track->sampleSize != NULL) || (track->sampleConstSize != 0)) {
 		ULOGE("sample size table already defined");
 		return -EEXIST;
 	}
@@ -1894,7 +2191,7 @@ static off_t mp4_box_stsz_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 12);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -1902,12 +2199,12 @@ static off_t mp4_box_stsz_read(const struct mp4_file *mp4,
 	ULOGD("- stsz: flags=%" PRIu32, flags);
 
 	/* 'sample_size' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t sampleSize = ntohl(val32);
 	ULOGD("- stsz: sample_size=%" PRIu32, sampleSize);
 
 	/* 'sample_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	track->sampleCount = ntohl(val32);
 	ULOGD("- stsz: sample_count=%" PRIu32, track->sampleCount);
 	if (track->sampleCount > MAX_ENTRY_COUNT) {
@@ -1916,33 +2213,42 @@ static off_t mp4_box_stsz_read(const struct mp4_file *mp4,
 		return -EPROTO;
 	}
 
-	track->sampleSize = malloc(track->sampleCount * sizeof(uint32_t));
-	if (track->sampleSize == NULL) {
-		ULOG_ERRNO("malloc", ENOMEM);
-		return -ENOMEM;
-	}
-
 	if (sampleSize == 0) {
 		CHECK_SIZE(maxBytes, 12 + track->sampleCount * 4);
 
-		for (unsigned int i = 0; i < track->sampleCount; i++) {
-			/* 'entry_size' */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
-			track->sampleSize[i] = ntohl(val32);
-			if (track->sampleSize[i] > track->sampleMaxSize)
-				track->sampleMaxSize = track->sampleSize[i];
+		track->sampleSize =
+			malloc(track->sampleCount * sizeof(uint32_t));
+		if (track->sampleSize == NULL) {
+			ULOG_ERRNO("malloc", ENOMEM);
+			return -ENOMEM;
+		}
+
+		tableSize = (size_t)track->sampleCount * 4;
+		ret = mp4_file_read_table(mp4, tableSize, &table, &tmp);
+		if (ret < 0)
+			return ret;
+		boxReadBytes += tableSize;
+
+		/* Decode the sizes ('entry_size') and compute the max size
+		 * in one pass */
+		track->sampleMaxSize = mp4_decode_be32_max(
+			track->sampleSize, table, track->sampleCount);
 #if LOG_ALL
+		for (unsigned int i = 0; i < track->sampleCount; i++) {
 			ULOGD("- stsz: entry_size=%" PRIu32,
 			      track->sampleSize[i]);
-#endif /* LOG_ALL */
 		}
+#endif /* LOG_ALL */
 	} else {
-		for (unsigned int i = 0; i < track->sampleCount; i++)
-			track->sampleSize[i] = sampleSize;
+		/* Constant sample size: no per-sample table */
+		track->sampleConstSize = sampleSize;
+		track->sampleMaxSize = sampleSize;
 	}
 
+	free(tmp);
+
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -1951,12 +2257,16 @@ static off_t mp4_box_stsz_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.7.4 - Sample To Chunk Box
  */
-static off_t mp4_box_stsc_read(const struct mp4_file *mp4,
+static off_t mp4_box_stsc_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
+	const uint8_t *table;
+	uint8_t *tmp = NULL;
+	size_t tableSize;
+	int ret;
 
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
 
@@ -1968,7 +2278,7 @@ static off_t mp4_box_stsc_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -1976,7 +2286,7 @@ static off_t mp4_box_stsc_read(const struct mp4_file *mp4,
 	ULOGD("- stsc: flags=%" PRIu32, flags);
 
 	/* 'entry_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	track->sampleToChunkEntryCount = ntohl(val32);
 	if (track->sampleToChunkEntryCount > MAX_ENTRY_COUNT) {
 		ULOGE("track->sampleToChunkEntryCount exceeds maximum entry "
@@ -1996,35 +2306,30 @@ static off_t mp4_box_stsc_read(const struct mp4_file *mp4,
 
 	CHECK_SIZE(maxBytes, 8 + track->sampleToChunkEntryCount * 12);
 
-	for (unsigned int i = 0; i < track->sampleToChunkEntryCount; i++) {
-		/* 'first_chunk' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->sampleToChunkEntries[i].firstChunk = ntohl(val32);
+	tableSize = (size_t)track->sampleToChunkEntryCount * 12;
+	ret = mp4_file_read_table(mp4, tableSize, &table, &tmp);
+	if (ret < 0)
+		return ret;
+	boxReadBytes += tableSize;
+
+	mp4_decode_stsc(track->sampleToChunkEntries,
+			table,
+			track->sampleToChunkEntryCount);
 #if LOG_ALL
+	for (unsigned int i = 0; i < track->sampleToChunkEntryCount; i++) {
 		ULOGD("- stsc: first_chunk=%" PRIu32,
 		      track->sampleToChunkEntries[i].firstChunk);
-#endif /* LOG_ALL */
-
-		/* 'samples_per_chunk' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->sampleToChunkEntries[i].samplesPerChunk = ntohl(val32);
-#if LOG_ALL
 		ULOGD("- stsc: samples_per_chunk=%" PRIu32,
 		      track->sampleToChunkEntries[i].samplesPerChunk);
-#endif /* LOG_ALL */
-
-		/* 'sample_description_index' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->sampleToChunkEntries[i].sampleDescriptionIndex =
-			ntohl(val32);
-#if LOG_ALL
 		ULOGD("- stsc: sample_description_index=%" PRIu32,
 		      track->sampleToChunkEntries[i].sampleDescriptionIndex);
-#endif /* LOG_ALL */
 	}
+#endif /* LOG_ALL */
+
+	free(tmp);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -2033,12 +2338,16 @@ static off_t mp4_box_stsc_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.7.5 - Chunk Offset Box (32-bit)
  */
-static off_t mp4_box_stco_read(const struct mp4_file *mp4,
+static off_t mp4_box_stco_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
+	const uint8_t *table;
+	uint8_t *tmp = NULL;
+	size_t tableSize;
+	int ret;
 
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
 
@@ -2050,7 +2359,7 @@ static off_t mp4_box_stco_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -2058,7 +2367,7 @@ static off_t mp4_box_stco_read(const struct mp4_file *mp4,
 	ULOGD("- stco: flags=%" PRIu32, flags);
 
 	/* 'entry_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	track->chunkCount = ntohl(val32);
 	ULOGD("- stco: entry_count=%" PRIu32, track->chunkCount);
 	if (track->chunkCount > MAX_ENTRY_COUNT) {
@@ -2075,17 +2384,23 @@ static off_t mp4_box_stco_read(const struct mp4_file *mp4,
 
 	CHECK_SIZE(maxBytes, 8 + track->chunkCount * 4);
 
-	for (unsigned int i = 0; i < track->chunkCount; i++) {
-		/* 'chunk_offset' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->chunkOffset[i] = (uint64_t)ntohl(val32);
+	tableSize = (size_t)track->chunkCount * 4;
+	ret = mp4_file_read_table(mp4, tableSize, &table, &tmp);
+	if (ret < 0)
+		return ret;
+	boxReadBytes += tableSize;
+
+	/* 'chunk_offset' */
+	mp4_decode_be32_to_64(track->chunkOffset, table, track->chunkCount);
 #if LOG_ALL
+	for (unsigned int i = 0; i < track->chunkCount; i++)
 		ULOGD("- stco: chunk_offset=%" PRIu64, track->chunkOffset[i]);
 #endif /* LOG_ALL */
-	}
+
+	free(tmp);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -2094,12 +2409,16 @@ static off_t mp4_box_stco_read(const struct mp4_file *mp4,
 /**
  * ISO/IEC 14496-12 - chap. 8.7.5 - Chunk Offset Box (64-bit)
  */
-static off_t mp4_box_co64_read(const struct mp4_file *mp4,
+static off_t mp4_box_co64_read(struct mp4_file *mp4,
 			       off_t maxBytes,
 			       struct mp4_track *track)
 {
 	off_t boxReadBytes = 0;
 	uint32_t val32;
+	const uint8_t *table;
+	uint8_t *tmp = NULL;
+	size_t tableSize;
+	int ret;
 
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
 
@@ -2111,7 +2430,7 @@ static off_t mp4_box_co64_read(const struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -2119,7 +2438,7 @@ static off_t mp4_box_co64_read(const struct mp4_file *mp4,
 	ULOGD("- co64: flags=%" PRIu32, flags);
 
 	/* 'entry_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	track->chunkCount = ntohl(val32);
 	ULOGD("- co64: entry_count=%" PRIu32, track->chunkCount);
 	if (track->chunkCount > MAX_ENTRY_COUNT) {
@@ -2136,19 +2455,23 @@ static off_t mp4_box_co64_read(const struct mp4_file *mp4,
 
 	CHECK_SIZE(maxBytes, 8 + track->chunkCount * 8);
 
-	for (unsigned int i = 0; i < track->chunkCount; i++) {
-		/* 'chunk_offset' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->chunkOffset[i] = (uint64_t)ntohl(val32) << 32;
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
-		track->chunkOffset[i] |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
+	tableSize = (size_t)track->chunkCount * 8;
+	ret = mp4_file_read_table(mp4, tableSize, &table, &tmp);
+	if (ret < 0)
+		return ret;
+	boxReadBytes += tableSize;
+
+	/* 'chunk_offset' */
+	mp4_decode_be64(track->chunkOffset, table, track->chunkCount);
 #if LOG_ALL
+	for (unsigned int i = 0; i < track->chunkCount; i++)
 		ULOGD("- co64: chunk_offset=%" PRIu64, track->chunkOffset[i]);
 #endif /* LOG_ALL */
-	}
+
+	free(tmp);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -2170,12 +2493,12 @@ static off_t mp4_box_xyz_read(struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 4);
 
 	/* 'location_size' */
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	uint16_t locationSize = ntohs(val16);
 	ULOGD("- xyz: location_size=%d", locationSize);
 
 	/* 'language_code' */
-	MP4_READ_16(mp4->fd, val16, boxReadBytes);
+	MP4_FILE_READ_16(mp4, val16, boxReadBytes);
 	uint16_t languageCode = ntohs(val16);
 	ULOGD("- xyz: language_code=%d", languageCode);
 
@@ -2201,7 +2524,8 @@ static off_t mp4_box_xyz_read(struct mp4_file *mp4,
 		ULOG_ERRNO("malloc", ENOMEM);
 		return -ENOMEM;
 	}
-	ssize_t count = read(mp4->fd, mp4->udtaLocationValue, locationSize);
+	ssize_t count =
+		mp4_file_read(mp4, mp4->udtaLocationValue, locationSize);
 	if (count == -1) {
 		ret = -errno;
 		ULOG_ERRNO("read", -ret);
@@ -2217,7 +2541,7 @@ static off_t mp4_box_xyz_read(struct mp4_file *mp4,
 	ULOGD("- xyz: location=%s", mp4->udtaLocationValue);
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -2227,7 +2551,7 @@ static off_t mp4_box_xyz_read(struct mp4_file *mp4,
  * Apple QuickTime File Format - chap. Metadata
  * https://developer.apple.com/library/archive/documentation/QuickTime/QTFF/Metadata/Metadata.html
  */
-static int mp4_ilst_sub_box_count(const struct mp4_file *mp4, off_t maxBytes)
+static int mp4_ilst_sub_box_count(struct mp4_file *mp4, off_t maxBytes)
 {
 	off_t totalReadBytes = 0;
 	off_t boxReadBytes = 0;
@@ -2239,7 +2563,7 @@ static int mp4_ilst_sub_box_count(const struct mp4_file *mp4, off_t maxBytes)
 
 	CHECK_SIZE(maxBytes, 8);
 
-	originalOffset = lseek(mp4->fd, 0, SEEK_CUR);
+	originalOffset = mp4_file_seek(mp4, 0, SEEK_CUR);
 	if (originalOffset == -1) {
 		ULOG_ERRNO("lseek", errno);
 		return -errno;
@@ -2249,11 +2573,11 @@ static int mp4_ilst_sub_box_count(const struct mp4_file *mp4, off_t maxBytes)
 		boxReadBytes = 0;
 
 		/* Box size */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint32_t size = ntohl(val32);
 
 		/* Box type */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 		if (size == 0) {
 			/* Box extends to end of file */
@@ -2264,9 +2588,9 @@ static int mp4_ilst_sub_box_count(const struct mp4_file *mp4, off_t maxBytes)
 			CHECK_SIZE(maxBytes, boxReadBytes + 16);
 
 			/* Large size */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			realBoxSize = (uint64_t)ntohl(val32) << 32;
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			realBoxSize |= (uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 			if (realBoxSize > (mp4->fileSize - mp4->readBytes)) {
 				ULOGE("realBoxSize exceeds maximum size %ld",
@@ -2279,12 +2603,12 @@ static int mp4_ilst_sub_box_count(const struct mp4_file *mp4, off_t maxBytes)
 		count++;
 
 		/* Skip the rest of the box */
-		MP4_READ_SKIP(
-			mp4->fd, realBoxSize - boxReadBytes, boxReadBytes);
+		MP4_FILE_READ_SKIP(
+			mp4, realBoxSize - boxReadBytes, boxReadBytes);
 		totalReadBytes += realBoxSize;
 	}
 
-	off_t ret = lseek(mp4->fd, -totalReadBytes, SEEK_CUR);
+	off_t ret = mp4_file_seek(mp4, -totalReadBytes, SEEK_CUR);
 	if (ret == -1) {
 		ULOG_ERRNO("lseek", errno);
 		return -errno;
@@ -2312,7 +2636,7 @@ static off_t mp4_box_meta_keys_read(struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 8);
 
 	/* 'version' & 'flags' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t flags = ntohl(val32);
 	uint8_t version = (flags >> 24) & 0xFF;
 	flags &= ((1 << 24) - 1);
@@ -2320,7 +2644,7 @@ static off_t mp4_box_meta_keys_read(struct mp4_file *mp4,
 	ULOGD("- keys: flags=%" PRIu32, flags);
 
 	/* 'entry_count' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	metadataCount = ntohl(val32);
 	ULOGD("- keys: entry_count=%" PRIu32, metadataCount);
 	if (metadataCount > MAX_ENTRY_COUNT) {
@@ -2356,7 +2680,7 @@ static off_t mp4_box_meta_keys_read(struct mp4_file *mp4,
 
 	for (uint32_t i = 0; i < metadataCount; i++) {
 		/* 'key_size' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint32_t keySize = ntohl(val32);
 		ULOGD("- keys: key_size=%" PRIu32, keySize);
 
@@ -2369,7 +2693,7 @@ static off_t mp4_box_meta_keys_read(struct mp4_file *mp4,
 		keySize -= 8;
 
 		/* 'key_namespace' */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		uint32_t keyNamespace = ntohl(val32);
 		ULOGD("- keys: key_namespace=%c%c%c%c",
 		      (char)((keyNamespace >> 24) & 0xFF),
@@ -2384,7 +2708,7 @@ static off_t mp4_box_meta_keys_read(struct mp4_file *mp4,
 			ULOG_ERRNO("malloc", ENOMEM);
 			return -ENOMEM;
 		}
-		ssize_t count = read(mp4->fd, metadataKey[i], keySize);
+		ssize_t count = mp4_file_read(mp4, metadataKey[i], keySize);
 		if (count == -1) {
 			ret = -errno;
 			ULOG_ERRNO("read", -ret);
@@ -2401,7 +2725,7 @@ static off_t mp4_box_meta_keys_read(struct mp4_file *mp4,
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -2428,7 +2752,7 @@ static off_t mp4_box_meta_data_read(struct mp4_file *mp4,
 	CHECK_SIZE(maxBytes, 9);
 
 	/* 'version' & 'class' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 	uint32_t clazz = ntohl(val32);
 	uint8_t version = (clazz >> 24) & 0xFF;
 	clazz &= 0xFF;
@@ -2436,7 +2760,7 @@ static off_t mp4_box_meta_data_read(struct mp4_file *mp4,
 	ULOGD("- data: class=%" PRIu32, clazz);
 
 	/* 'reserved' */
-	MP4_READ_32(mp4->fd, val32, boxReadBytes);
+	MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 
 	unsigned int valueLen = maxBytes - boxReadBytes;
 
@@ -2471,8 +2795,8 @@ static off_t mp4_box_meta_data_read(struct mp4_file *mp4,
 				ULOG_ERRNO("malloc", ENOMEM);
 				return -ENOMEM;
 			}
-			ssize_t count = read(
-				mp4->fd, mp4->udtaMetadataValue[idx], valueLen);
+			ssize_t count = mp4_file_read(
+				mp4, mp4->udtaMetadataValue[idx], valueLen);
 			if (count == -1) {
 				ret = -errno;
 				ULOG_ERRNO("read", -ret);
@@ -2507,8 +2831,8 @@ static off_t mp4_box_meta_data_read(struct mp4_file *mp4,
 					ULOG_ERRNO("malloc", ENOMEM);
 					return -ENOMEM;
 				}
-				ssize_t count = read(
-					mp4->fd, metadataValue[idx], valueLen);
+				ssize_t count = mp4_file_read(
+					mp4, metadataValue[idx], valueLen);
 				if (count == -1) {
 					ret = -errno;
 					ULOG_ERRNO("read", -ret);
@@ -2533,7 +2857,7 @@ static off_t mp4_box_meta_data_read(struct mp4_file *mp4,
 		   (track == NULL)) {
 		uint32_t type = box->parent->type;
 		if (type == MP4_METADATA_TAG_TYPE_COVER) {
-			mp4->udtaCoverOffset = lseek(mp4->fd, 0, SEEK_CUR);
+			mp4->udtaCoverOffset = mp4_file_seek(mp4, 0, SEEK_CUR);
 			mp4->udtaCoverSize = valueLen;
 			switch (clazz) {
 			case MP4_METADATA_CLASS_JPEG:
@@ -2557,7 +2881,7 @@ static off_t mp4_box_meta_data_read(struct mp4_file *mp4,
 		} else if ((type > 0) && (type <= mp4->metaMetadataCount) &&
 			   (!strcmp(mp4->metaMetadataKey[type - 1],
 				    MP4_METADATA_KEY_COVER))) {
-			mp4->metaCoverOffset = lseek(mp4->fd, 0, SEEK_CUR);
+			mp4->metaCoverOffset = mp4_file_seek(mp4, 0, SEEK_CUR);
 			mp4->metaCoverSize = valueLen;
 			switch (clazz) {
 			case MP4_METADATA_CLASS_JPEG:
@@ -2582,7 +2906,7 @@ static off_t mp4_box_meta_data_read(struct mp4_file *mp4,
 	}
 
 	/* Skip the rest of the box */
-	MP4_READ_SKIP(mp4->fd, maxBytes - boxReadBytes, boxReadBytes);
+	MP4_FILE_READ_SKIP(mp4, maxBytes - boxReadBytes, boxReadBytes);
 
 	return boxReadBytes;
 }
@@ -2603,24 +2927,8 @@ off_t mp4_box_children_read(struct mp4_file *mp4,
 	ULOG_ERRNO_RETURN_ERR_IF(mp4 == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(parent == NULL, EINVAL);
 
-
-	errno = 0;
-	currOff = lseek(mp4->fd, 0, SEEK_CUR);
-	if (currOff == -1) {
-		ULOG_ERRNO("lseek", errno);
-		return -errno;
-	}
-	eof = lseek(mp4->fd, 0, SEEK_END);
-	if (eof == -1) {
-		ULOG_ERRNO("lseek", errno);
-		return -errno;
-	}
-
-	currOff = lseek(mp4->fd, currOff, SEEK_SET);
-	if (currOff == -1) {
-		ULOG_ERRNO("lseek", errno);
-		return -errno;
-	}
+	currOff = mp4->readOffset;
+	eof = mp4->fileSize;
 
 	while (currOff < eof && !lastBox && (parentReadBytes + 8 < maxBytes)) {
 		off_t boxReadBytes = 0;
@@ -2635,11 +2943,11 @@ off_t mp4_box_children_read(struct mp4_file *mp4,
 		}
 
 		/* Box size */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		box->size = ntohl(val32);
 
 		/* Box type */
-		MP4_READ_32(mp4->fd, val32, boxReadBytes);
+		MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 		box->type = ntohl(val32);
 
 		/* MP4 file format validity: the first box should be 'ftyp' */
@@ -2652,12 +2960,12 @@ off_t mp4_box_children_read(struct mp4_file *mp4,
 		if ((parent->type == MP4_ILST_BOX) &&
 		    (box->type <= mp4->metaMetadataCount))
 			ULOGD("offset 0x%" PRIx64 " metadata box size %" PRIu32,
-			      (int64_t)lseek(mp4->fd, 0, SEEK_CUR) - 8,
+			      (int64_t)currOff,
 			      box->size);
 		else
 			ULOGD("offset 0x%" PRIx64
 			      " box '%c%c%c%c' size %" PRIu32,
-			      (int64_t)lseek(mp4->fd, 0, SEEK_CUR) - 8,
+			      (int64_t)currOff,
 			      (box->type >> 24) & 0xFF,
 			      (box->type >> 16) & 0xFF,
 			      (box->type >> 8) & 0xFF,
@@ -2672,9 +2980,9 @@ off_t mp4_box_children_read(struct mp4_file *mp4,
 			CHECK_SIZE(maxBytes, parentReadBytes + 16);
 
 			/* Large size */
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			box->largesize = (uint64_t)ntohl(val32) << 32;
-			MP4_READ_32(mp4->fd, val32, boxReadBytes);
+			MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 			box->largesize |=
 				(uint64_t)ntohl(val32) & 0xFFFFFFFFULL;
 			realBoxSize = box->largesize;
@@ -2703,14 +3011,44 @@ off_t mp4_box_children_read(struct mp4_file *mp4,
 			goto skip_box;
 		}
 
+		if ((parent->level == 0) && (box->type == MP4_MOVIE_BOX)) {
+			mp4->moovOffset = currOff;
+			mp4->moovSize = realBoxSize;
+		}
+
+		/* Load the parsed top-level boxes (usually 'moov') in memory
+		 * with a single read, the children are then parsed from the
+		 * buffer; the other boxes (media data, padding, unknown
+		 * boxes) are skipped without being read */
+		if ((parent->level == 0) &&
+		    ((box->type == MP4_MOVIE_BOX) ||
+		     (box->type == MP4_FILE_TYPE_BOX) ||
+		     (box->type == MP4_USER_DATA_BOX)) &&
+		    (realBoxSize - boxReadBytes <= MP4_READ_BUFFER_MAX_SIZE)) {
+			ret = mp4_file_read_buffer_load(
+				mp4,
+				mp4->readOffset,
+				(size_t)(realBoxSize - boxReadBytes));
+			if (ret < 0) {
+				/* Not a fatal error, read directly from the
+				 * file instead */
+				ULOGW("failed to load box '%c%c%c%c' in memory",
+				      (box->type >> 24) & 0xFF,
+				      (box->type >> 16) & 0xFF,
+				      (box->type >> 8) & 0xFF,
+				      box->type & 0xFF);
+				ret = 0;
+			}
+		}
+
 		switch (box->type) {
 		case MP4_UUID: {
 			CHECK_SIZE(realBoxSize - boxReadBytes,
 				   sizeof(box->uuid));
 
 			/* Box extended type */
-			ssize_t count =
-				read(mp4->fd, box->uuid, sizeof(box->uuid));
+			ssize_t count = mp4_file_read(
+				mp4, box->uuid, sizeof(box->uuid));
 			if (count == -1) {
 				ULOG_ERRNO("read", errno);
 				return -errno;
@@ -2887,7 +3225,7 @@ off_t mp4_box_children_read(struct mp4_file *mp4,
 				CHECK_SIZE(realBoxSize - boxReadBytes, 4);
 
 				/* 'version' & 'flags' */
-				MP4_READ_32(mp4->fd, val32, boxReadBytes);
+				MP4_FILE_READ_32(mp4, val32, boxReadBytes);
 				uint32_t flags = ntohl(val32);
 				uint8_t version = (flags >> 24) & 0xFF;
 				flags &= ((1 << 24) - 1);
@@ -3037,8 +3375,10 @@ skip_box:
 			ret = -EIO;
 			break;
 		}
-		off_t _ret =
-			lseek(mp4->fd, realBoxSize - boxReadBytes, SEEK_CUR);
+		if (parent->level == 0)
+			mp4_file_read_buffer_release(mp4);
+		off_t _ret = mp4_file_seek(
+			mp4, realBoxSize - boxReadBytes, SEEK_CUR);
 		if (_ret == -1) {
 			ULOGE("failed to seek %" PRIi64
 			      " bytes forward in file",
@@ -3050,11 +3390,7 @@ skip_box:
 		parentReadBytes += realBoxSize;
 		firstBox = 0;
 
-		currOff = lseek(mp4->fd, 0, SEEK_CUR);
-		if (currOff == -1) {
-			ULOG_ERRNO("lseek", errno);
-			return -errno;
-		}
+		currOff = mp4->readOffset;
 	}
 
 	return (ret < 0) ? ret : parentReadBytes;
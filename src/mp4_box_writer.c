@@ -1628,6 +1628,7 @@ static off_t mp4_box_stts_write(struct mp4_mux *mux,
 	off_t bytesWritten = 0;
 	off_t boxSize = 16; /* Box size without table length */
 	uint32_t val32;
+	uint32_t count;
 
 	if (mux == NULL || box == NULL || box->writer.args == NULL)
 		return -EINVAL;
@@ -1656,17 +1657,20 @@ static off_t mp4_box_stts_write(struct mp4_mux *mux,
 	val32 = htonl(track->time_to_sample.count);
 	MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-	for (uint32_t i = 0; i < track->time_to_sample.count; i++) {
-		const struct mp4_time_to_sample_entry *entry;
-		entry = &track->time_to_sample.entries[i];
+	for (uint32_t i = 0; i < track->time_to_sample.count; i += count) {
+		const struct mp4_time_to_sample_entry *entries;
+		entries = mp4_mux_table_block(
+			&track->time_to_sample, i, sizeof(*entries), &count);
 
-		/* 'sample_count' */
-		val32 = htonl(entry->sampleCount);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'sample_count' */
+			val32 = htonl(entries[j].sampleCount);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-		/* 'sample_delta' */
-		val32 = htonl(entry->sampleDelta);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+			/* 'sample_delta' */
+			val32 = htonl(entries[j].sampleDelta);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		}
 	}
 
 	MP4_WRITE_CHECK_SIZE(mux, boxSize, bytesWritten);
@@ -1686,6 +1690,7 @@ static off_t mp4_box_stss_write(struct mp4_mux *mux,
 	off_t bytesWritten = 0;
 	off_t boxSize = 16; /* Box size without table length */
 	uint32_t val32;
+	uint32_t count;
 
 	if (mux == NULL || box == NULL || box->writer.args == NULL)
 		return -EINVAL;
@@ -1714,10 +1719,16 @@ static off_t mp4_box_stss_write(struct mp4_mux *mux,
 	val32 = htonl(track->sync.count);
 	MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-	for (uint32_t i = 0; i < track->sync.count; i++) {
-		/* 'sample_number' */
-		val32 = htonl(track->sync.entries[i]);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+	for (uint32_t i = 0; i < track->sync.count; i += count) {
+		const uint32_t *entries;
+		entries = mp4_mux_table_block(
+			&track->sync, i, sizeof(*entries), &count);
+
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'sample_number' */
+			val32 = htonl(entries[j]);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		}
 	}
 
 	MP4_WRITE_CHECK_SIZE(mux, boxSize, bytesWritten);
@@ -1737,6 +1748,7 @@ static off_t mp4_box_stsz_write(struct mp4_mux *mux,
 	off_t bytesWritten = 0;
 	off_t boxSize = 20; /* Box size without table length */
 	uint32_t val32;
+	uint32_t count;
 
 	if (mux == NULL || box == NULL || box->writer.args == NULL)
 		return -EINVAL;
@@ -1769,10 +1781,16 @@ static off_t mp4_box_stsz_write(struct mp4_mux *mux,
 	val32 = htonl(track->samples.count);
 	MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-	for (uint32_t i = 0; i < track->samples.count; i++) {
-		/* 'entry_size' */
-		val32 = htonl(track->samples.sizes[i]);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+	for (uint32_t i = 0; i < track->samples.count; i += count) {
+		const struct mp4_mux_sample_entry *entries;
+		entries = mp4_mux_table_block(
+			&track->samples, i, sizeof(*entries), &count);
+
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'entry_size' */
+			val32 = htonl(entries[j].size);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		}
 	}
 
 	MP4_WRITE_CHECK_SIZE(mux, boxSize, bytesWritten);
@@ -1792,6 +1810,7 @@ static off_t mp4_box_stsc_write(struct mp4_mux *mux,
 	off_t bytesWritten = 0;
 	off_t boxSize = 16; /* Box size without table length */
 	uint32_t val32;
+	uint32_t count;
 
 	if (mux == NULL || box == NULL || box->writer.args == NULL)
 		return -EINVAL;
@@ -1820,21 +1839,24 @@ static off_t mp4_box_stsc_write(struct mp4_mux *mux,
 	val32 = htonl(track->sample_to_chunk.count);
 	MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-	for (uint32_t i = 0; i < track->sample_to_chunk.count; i++) {
-		const struct mp4_sample_to_chunk_entry *entry;
-		entry = &track->sample_to_chunk.entries[i];
+	for (uint32_t i = 0; i < track->sample_to_chunk.count; i += count) {
+		const struct mp4_sample_to_chunk_entry *entries;
+		entries = mp4_mux_table_block(
+			&track->sample_to_chunk, i, sizeof(*entries), &count);
 
-		/* 'first_chunk' */
-		val32 = htonl(entry->firstChunk);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'first_chunk' */
+			val32 = htonl(entries[j].firstChunk);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-		/* 'samples_per_chunk' */
-		val32 = htonl(entry->samplesPerChunk);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+			/* 'samples_per_chunk' */
+			val32 = htonl(entries[j].samplesPerChunk);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-		/* 'sample_description_id' */
-		val32 = htonl(entry->sampleDescriptionIndex);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+			/* 'sample_description_id' */
+			val32 = htonl(entries[j].sampleDescriptionIndex);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		}
 	}
 
 	MP4_WRITE_CHECK_SIZE(mux, boxSize, bytesWritten);
@@ -1854,6 +1876,7 @@ static off_t mp4_box_stco_write(struct mp4_mux *mux,
 	off_t bytesWritten = 0;
 	off_t boxSize = 16; /* Box size without table length */
 	uint32_t val32;
+	uint32_t count;
 
 	if (mux == NULL || box == NULL || box->writer.args == NULL)
 		return -EINVAL;
@@ -1882,10 +1905,16 @@ static off_t mp4_box_stco_write(struct mp4_mux *mux,
 	val32 = htonl(track->chunks.count);
 	MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-	for (uint32_t i = 0; i < track->chunks.count; i++) {
-		/* 'chunk_offset' (32bits) */
-		val32 = htonl(track->chunks.offsets[i]);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+	for (uint32_t i = 0; i < track->chunks.count; i += count) {
+		const uint64_t *entries;
+		entries = mp4_mux_table_block(
+			&track->chunks, i, sizeof(*entries), &count);
+
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'chunk_offset' (32bits) */
+			val32 = htonl(entries[j]);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		}
 	}
 
 	MP4_WRITE_CHECK_SIZE(mux, boxSize, bytesWritten);
@@ -1905,6 +1934,7 @@ static off_t mp4_box_co64_write(struct mp4_mux *mux,
 	off_t bytesWritten = 0;
 	off_t boxSize = 16; /* Box size without table length */
 	uint32_t val32;
+	uint32_t count;
 
 	if (mux == NULL || box == NULL || box->writer.args == NULL)
 		return -EINVAL;
@@ -1933,13 +1963,18 @@ static off_t mp4_box_co64_write(struct mp4_mux *mux,
 	val32 = htonl(track->chunks.count);
 	MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
 
-	for (uint32_t i = 0; i < track->chunks.count; i++) {
-		uint64_t offset = track->chunks.offsets[i];
-		/* 'chunk_offset' */
-		val32 = htonl(offset >> 32);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
-		val32 = htonl(offset & 0xffffffff);
-		MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+	for (uint32_t i = 0; i < track->chunks.count; i += count) {
+		const uint64_t *entries;
+		entries = mp4_mux_table_block(
+			&track->chunks, i, sizeof(*entries), &count);
+
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'chunk_offset' */
+			val32 = htonl(entries[j] >> 32);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+			val32 = htonl(entries[j] & 0xffffffff);
+			MP4_WRITE_32(mux, val32, bytesWritten, maxBytes);
+		}
 	}
 
 	MP4_WRITE_CHECK_SIZE(mux, boxSize, bytesWritten);
@@ -2590,12 +2625,13 @@ struct mp4_box *mp4_box_new_stco(struct mp4_box *parent,
 		return box;
 	box->type = MP4_CHUNK_OFFSET_BOX;
 	box->writer.func = mp4_box_stco_write;
-	for (size_t i = 0; i < track->chunks.count; i++) {
-		if (track->chunks.offsets[i] > UINT32_MAX) {
-			box->type = MP4_CHUNK_OFFSET_64_BOX;
-			box->writer.func = mp4_box_co64_write;
-			break;
-		}
+	/* The chunk offsets are increasing */
+	if (track->chunks.count > 0 &&
+	    MP4_MUX_TABLE_ENTRY(
+		    &track->chunks, uint64_t, track->chunks.count - 1) >
+		    UINT32_MAX) {
+		box->type = MP4_CHUNK_OFFSET_64_BOX;
+		box->writer.func = mp4_box_co64_write;
 	}
 	box->writer.args = track;
 	box->writer.need_free = 0;
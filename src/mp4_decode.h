@@ -0,0 +1,309 @@
+/**
+ * Copyright (c) 2026 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Decoding of the big-endian sample tables (stts, stss, stsz, stsc, stco,
+ * co64). Each kernel decodes as many entries as possible with the vector
+ * instructions enabled at build time (AVX2, SSE4.1 or NEON; the library
+ * has no runtime CPU detection), and the remaining entries, or all of them
+ * on other targets, with a scalar loop.
+ */
+
+#ifndef _MP4_DECODE_H_
+#define _MP4_DECODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#	include <immintrin.h>
+#elif defined(__ARM_NEON)
+#	include <arm_neon.h>
+#endif
+
+
+/* Name of the vector kernels */
+#if defined(__AVX2__)
+#	define MP4_DECODE_VECTOR_ISA "avx2"
+#elif defined(__SSE4_1__)
+#	define MP4_DECODE_VECTOR_ISA "sse4.1"
+#elif defined(__ARM_NEON)
+#	define MP4_DECODE_VECTOR_ISA "neon"
+#else
+#	define MP4_DECODE_VECTOR_ISA "none"
+#endif
+
+
+static inline uint32_t mp4_load_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+
+static inline uint64_t mp4_load_be64(const uint8_t *p)
+{
+	return ((uint64_t)mp4_load_be32(p) << 32) |
+	       (uint64_t)mp4_load_be32(p + 4);
+}
+
+
+/* Scalar kernels: the source and destination do not alias and the count
+ * is a local, so that the compiler can still vectorize the loops */
+static inline void mp4_decode_be32_scalar(uint32_t *restrict dst,
+					  const uint8_t *restrict src,
+					  size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mp4_load_be32(src + i * 4);
+}
+
+
+static inline uint32_t mp4_decode_be32_max_scalar(uint32_t *restrict dst,
+						  const uint8_t *restrict src,
+						  size_t count)
+{
+	uint32_t max = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t val = mp4_load_be32(src + i * 4);
+		dst[i] = val;
+		max = (val > max) ? val : max;
+	}
+
+	return max;
+}
+
+
+static inline void mp4_decode_be32_to_64_scalar(uint64_t *restrict dst,
+						const uint8_t *restrict src,
+						size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mp4_load_be32(src + i * 4);
+}
+
+
+static inline void mp4_decode_be64_scalar(uint64_t *restrict dst,
+					  const uint8_t *restrict src,
+					  size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mp4_load_be64(src + i * 8);
+}
+
+
+/* Vector kernels: return the number of entries decoded; the max value of
+ * these entries is also computed if 'max' is not NULL */
+static inline size_t mp4_decode_be32_vector(uint32_t *restrict dst,
+					    const uint8_t *restrict src,
+					    size_t count,
+					    uint32_t *max)
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					      11, 10, 9, 8, 15, 14, 13, 12,
+					      3, 2, 1, 0, 7, 6, 5, 4,
+					      11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i vmax = _mm256_setzero_si256();
+	uint32_t lanes[8];
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+		v = _mm256_shuffle_epi8(v, swap);
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+		vmax = _mm256_max_epu32(vmax, v);
+	}
+	if (max != NULL) {
+		_mm256_storeu_si256((__m256i *)lanes, vmax);
+		for (unsigned int k = 0; k < 8; k++)
+			*max = (lanes[k] > *max) ? lanes[k] : *max;
+	}
+#elif defined(__SSE4_1__)
+	const __m128i swap = _mm_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m128i vmax = _mm_setzero_si128();
+	uint32_t lanes[4];
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+		v = _mm_shuffle_epi8(v, swap);
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+		vmax = _mm_max_epu32(vmax, v);
+	}
+	if (max != NULL) {
+		_mm_storeu_si128((__m128i *)lanes, vmax);
+		for (unsigned int k = 0; k < 4; k++)
+			*max = (lanes[k] > *max) ? lanes[k] : *max;
+	}
+#elif defined(__ARM_NEON)
+	uint32x4_t vmax = vdupq_n_u32(0);
+	uint32_t lanes[4];
+
+	for (; i + 4 <= count; i += 4) {
+		uint32x4_t v = vreinterpretq_u32_u8(
+			vrev32q_u8(vld1q_u8(src + i * 4)));
+		vst1q_u32(dst + i, v);
+		vmax = vmaxq_u32(vmax, v);
+	}
+	if (max != NULL) {
+		vst1q_u32(lanes, vmax);
+		for (unsigned int k = 0; k < 4; k++)
+			*max = (lanes[k] > *max) ? lanes[k] : *max;
+	}
+#else
+	(void)dst;
+	(void)src;
+	(void)count;
+	(void)max;
+#endif
+	return i;
+}
+
+
+static inline size_t mp4_decode_be32_to_64_vector(uint64_t *restrict dst,
+						  const uint8_t *restrict src,
+						  size_t count)
+{
+	size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE4_1__)
+	const __m128i swap = _mm_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+		v = _mm_shuffle_epi8(v, swap);
+#	if defined(__AVX2__)
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_cvtepu32_epi64(v));
+#	else
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_cvtepu32_epi64(v));
+		_mm_storeu_si128((__m128i *)(dst + i + 2),
+				 _mm_cvtepu32_epi64(_mm_srli_si128(v, 8)));
+#	endif
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= count; i += 4) {
+		uint32x4_t v = vreinterpretq_u32_u8(
+			vrev32q_u8(vld1q_u8(src + i * 4)));
+		vst1q_u64(dst + i, vmovl_u32(vget_low_u32(v)));
+		vst1q_u64(dst + i + 2, vmovl_u32(vget_high_u32(v)));
+	}
+#else
+	(void)dst;
+	(void)src;
+	(void)count;
+#endif
+	return i;
+}
+
+
+static inline size_t mp4_decode_be64_vector(uint64_t *restrict dst,
+					    const uint8_t *restrict src,
+					    size_t count)
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+					      15, 14, 13, 12, 11, 10, 9, 8,
+					      7, 6, 5, 4, 3, 2, 1, 0,
+					      15, 14, 13, 12, 11, 10, 9, 8);
+
+	for (; i + 4 <= count; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_shuffle_epi8(v, swap));
+	}
+#elif defined(__SSE4_1__)
+	const __m128i swap = _mm_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+	for (; i + 2 <= count; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 8));
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_shuffle_epi8(v, swap));
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 2 <= count; i += 2) {
+		uint8x16_t v = vrev64q_u8(vld1q_u8(src + i * 8));
+		vst1q_u64(dst + i, vreinterpretq_u64_u8(v));
+	}
+#else
+	(void)dst;
+	(void)src;
+	(void)count;
+#endif
+	return i;
+}
+
+
+/* Table decoding: 32-bit entries (stss, stsz, and the stts and stsc entries
+ * as flat arrays of fields), and 32-bit (stco) or 64-bit (co64) offsets */
+static inline void mp4_decode_be32(uint32_t *restrict dst,
+				   const uint8_t *restrict src,
+				   size_t count)
+{
+	size_t i = mp4_decode_be32_vector(dst, src, count, NULL);
+
+	mp4_decode_be32_scalar(dst + i, src + i * 4, count - i);
+}
+
+
+/* Returns the max value */
+static inline uint32_t mp4_decode_be32_max(uint32_t *restrict dst,
+					   const uint8_t *restrict src,
+					   size_t count)
+{
+	uint32_t max = 0, tail;
+	size_t i = mp4_decode_be32_vector(dst, src, count, &max);
+
+	tail = mp4_decode_be32_max_scalar(dst + i, src + i * 4, count - i);
+	return (tail > max) ? tail : max;
+}
+
+
+static inline void mp4_decode_be32_to_64(uint64_t *restrict dst,
+					 const uint8_t *restrict src,
+					 size_t count)
+{
+	size_t i = mp4_decode_be32_to_64_vector(dst, src, count);
+
+	mp4_decode_be32_to_64_scalar(dst + i, src + i * 4, count - i);
+}
+
+
+static inline void mp4_decode_be64(uint64_t *restrict dst,
+				   const uint8_t *restrict src,
+				   size_t count)
+{
+	size_t i = mp4_decode_be64_vector(dst, src, count);
+
+	mp4_decode_be64_scalar(dst + i, src + i * 8, count - i);
+}
+
+
+#endif /* !_MP4_DECODE_H_ */
@@ -30,6 +30,9 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifndef _WIN32
+#	include <sys/mman.h>
+#endif /* !_WIN32 */
 
 
 static int mp4_metadata_build(struct mp4_file *mp4)
@@ -128,14 +131,177 @@ cover:
 }
 
 
-int mp4_demux_open(const char *filename, struct mp4_demux **ret_obj)
+static int mp4_file_map(struct mp4_file *mp4)
+{
+#ifdef _WIN32
+	return -ENOSYS;
+#else
+	void *data;
+
+	if ((uint64_t)mp4->fileSize > SIZE_MAX)
+		return -EFBIG;
+
+	data = mmap(NULL,
+		    (size_t)mp4->fileSize,
+		    PROT_READ,
+		    MAP_SHARED,
+		    mp4->fd,
+		    0);
+	if (data == MAP_FAILED) {
+		int ret = -errno;
+		ULOG_ERRNO("mmap", -ret);
+		return ret;
+	}
+
+	mp4->readBuffer.data = data;
+	mp4->readBuffer.offset = 0;
+	mp4->readBuffer.size = (size_t)mp4->fileSize;
+	mp4->mapped = true;
+
+	return 0;
+#endif
+}
+
+
+static void mp4_file_unmap(struct mp4_file *mp4)
+{
+	if (!mp4->mapped)
+		return;
+
+#ifndef _WIN32
+	munmap(mp4->readBuffer.data, mp4->readBuffer.size);
+#endif
+	mp4->readBuffer.data = NULL;
+	mp4->readBuffer.offset = 0;
+	mp4->readBuffer.size = 0;
+	mp4->mapped = false;
+}
+
+
+/* Ask the system to load a range of the file in the background */
+static void mp4_file_readahead(const struct mp4_file *mp4,
+			       uint64_t offset,
+			       uint64_t size)
+{
+	if (offset >= (uint64_t)mp4->fileSize)
+		return;
+	if (size > (uint64_t)mp4->fileSize - offset)
+		size = (uint64_t)mp4->fileSize - offset;
+
+#ifndef _WIN32
+	if (mp4->mapped) {
+		/* The address must be aligned on a page */
+		uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+		uint64_t start = offset - offset % page;
+		if (madvise(mp4->readBuffer.data + start,
+			    (size_t)(size + offset - start),
+			    MADV_WILLNEED) != 0)
+			ULOG_ERRNO("madvise", errno);
+		return;
+	}
+#endif /* !_WIN32 */
+#ifdef POSIX_FADV_WILLNEED
+	int ret = posix_fadvise(
+		mp4->fd, (off_t)offset, (off_t)size, POSIX_FADV_WILLNEED);
+	if (ret != 0)
+		ULOG_ERRNO("posix_fadvise", ret);
+#endif /* POSIX_FADV_WILLNEED */
+}
+
+
+/**
+ * Free the state built when parsing the file (box tree, tracks, metadata
+ * and chapters)
+ */
+static void mp4_file_clear(struct mp4_file *mp4)
+{
+	unsigned int i;
+
+	mp4_box_destroy(mp4->root);
+	mp4->root = NULL;
+	mp4_tracks_destroy(mp4);
+	list_init(&mp4->tracks);
+	mp4->trackCount = 0;
+	for (i = 0; i < mp4->chaptersCount; i++)
+		free(mp4->chaptersName[i]);
+	mp4->chaptersCount = 0;
+	free(mp4->udtaLocationKey);
+	free(mp4->udtaLocationValue);
+	for (i = 0; i < mp4->udtaMetadataCount; i++) {
+		free(mp4->udtaMetadataKey[i]);
+		free(mp4->udtaMetadataValue[i]);
+	}
+	free(mp4->udtaMetadataKey);
+	free(mp4->udtaMetadataValue);
+	for (i = 0; i < mp4->metaMetadataCount; i++) {
+		free(mp4->metaMetadataKey[i]);
+		free(mp4->metaMetadataValue[i]);
+	}
+	free(mp4->metaMetadataKey);
+	free(mp4->metaMetadataValue);
+	free(mp4->finalMetadataKey);
+	free(mp4->finalMetadataValue);
+	mp4->udtaLocationKey = NULL;
+	mp4->udtaLocationValue = NULL;
+	mp4->udtaMetadataCount = 0;
+	mp4->udtaMetadataKey = NULL;
+	mp4->udtaMetadataValue = NULL;
+	mp4->metaMetadataCount = 0;
+	mp4->metaMetadataKey = NULL;
+	mp4->metaMetadataValue = NULL;
+	mp4->finalMetadataCount = 0;
+	mp4->finalMetadataKey = NULL;
+	mp4->finalMetadataValue = NULL;
+	mp4->udtaCoverSize = 0;
+	mp4->metaCoverSize = 0;
+	mp4->finalCoverSize = 0;
+	/* After the tracks, their sample tables may point into the index */
+	mp4_index_unload(mp4);
+}
+
+
+static int mp4_file_parse(struct mp4_file *mp4)
 {
 	int ret;
-	off_t err;
 	off_t retBytes;
+
+	mp4->root = mp4_box_new(NULL);
+	if (mp4->root == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("mp4_box_new", -ret);
+		return ret;
+	}
+	mp4->root->type = MP4_ROOT_BOX;
+	mp4->root->size = 1;
+	mp4->root->largesize = mp4->fileSize;
+
+	retBytes = mp4_box_children_read(mp4, mp4->root, mp4->fileSize, NULL);
+	if (retBytes < 0)
+		return OFF_T_TO_ERRNO(retBytes, EPROTO);
+	mp4->readBytes += retBytes;
+
+	ret = mp4_tracks_build(mp4);
+	if (ret < 0)
+		return ret;
+
+	mp4_box_log(mp4->root, ULOG_DEBUG);
+
+	return 0;
+}
+
+
+static int mp4_demux_open_internal(const char *filename,
+				   bool map,
+				   const char *index_filename,
+				   struct mp4_demux **ret_obj)
+{
+	int ret;
+	off_t err;
 	struct mp4_demux *demux;
 	struct mp4_file *mp4;
 	int flags = O_RDONLY;
+	bool indexed = false;
+	struct mp4_track *tk;
 
 	ULOG_ERRNO_RETURN_ERR_IF(mp4_validate_str_len(filename, PATH_MAX) == 0,
 				 EINVAL);
@@ -177,32 +343,51 @@ int mp4_demux_open(const char *filename, struct mp4_demux **ret_obj)
 		goto error;
 	}
 
-	mp4->root = mp4_box_new(NULL);
-	if (mp4->root == NULL) {
-		ret = -ENOMEM;
-		ULOG_ERRNO("mp4_box_new", -ret);
-		goto error;
+	if (map) {
+		ret = mp4_file_map(mp4);
+		if (ret < 0)
+			goto error;
 	}
-	mp4->root->type = MP4_ROOT_BOX;
-	mp4->root->size = 1;
-	mp4->root->largesize = mp4->fileSize;
 
-	retBytes = mp4_box_children_read(mp4, mp4->root, mp4->fileSize, NULL);
-	if (retBytes < 0) {
-		ret = OFF_T_TO_ERRNO(retBytes, EPROTO);
-		goto error;
+	if (index_filename != NULL) {
+		ret = mp4_index_load(mp4, index_filename);
+		if (ret == 0) {
+			indexed = true;
+		} else {
+			/* Not a fatal error, parse the file instead */
+			if ((ret != -ENOENT) && (ret != -ESTALE))
+				ULOGW("failed to load index file '%s'",
+				      index_filename);
+			mp4_file_clear(mp4);
+		}
 	}
-	mp4->readBytes += retBytes;
 
-	ret = mp4_tracks_build(mp4);
-	if (ret < 0)
-		goto error;
+	if (!indexed) {
+		ret = mp4_file_parse(mp4);
+		if (ret < 0)
+			goto error;
+	}
 
 	ret = mp4_metadata_build(mp4);
 	if (ret < 0)
 		goto error;
 
-	mp4_box_log(mp4->root, ULOG_DEBUG);
+	/* Built now so that reading samples does not modify the demuxer */
+	list_walk_entry_forward(&mp4->tracks, tk, node)
+	{
+		if (tk->metadata == NULL)
+			continue;
+		ret = mp4_track_build_metadata_association(tk);
+		if (ret < 0)
+			goto error;
+	}
+
+	if ((index_filename != NULL) && !indexed) {
+		/* Not a fatal error */
+		ret = mp4_index_write(mp4, index_filename);
+		if (ret < 0)
+			ULOG_ERRNO("mp4_index_write", -ret);
+	}
 
 	*ret_obj = demux;
 	return 0;
@@ -214,6 +399,59 @@ error:
 }
 
 
+int mp4_demux_open(const char *filename, struct mp4_demux **ret_obj)
+{
+	return mp4_demux_open_internal(filename, false, NULL, ret_obj);
+}
+
+
+int mp4_demux_open_mmap(const char *filename, struct mp4_demux **ret_obj)
+{
+	return mp4_demux_open_internal(filename, true, NULL, ret_obj);
+}
+
+
+int mp4_demux_open_with_index(const char *filename,
+			      const char *index_filename,
+			      struct mp4_demux **ret_obj)
+{
+	int ret;
+	char *_index_filename = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(mp4_validate_str_len(filename, PATH_MAX) == 0,
+				 EINVAL);
+
+	if (index_filename == NULL) {
+		ret = asprintf(&_index_filename,
+			       "%s%s",
+			       filename,
+			       MP4_DEMUX_INDEX_SUFFIX);
+		if (ret < 0) {
+			ret = -ENOMEM;
+			ULOG_ERRNO("asprintf", -ret);
+			return ret;
+		}
+		index_filename = _index_filename;
+	}
+
+	ret = mp4_demux_open_internal(filename, false, index_filename, ret_obj);
+
+	free(_index_filename);
+	return ret;
+}
+
+
+int mp4_demux_set_readahead(struct mp4_demux *demux,
+			    unsigned int sample_count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+
+	demux->mp4.readaheadSampleCount = sample_count;
+
+	return 0;
+}
+
+
 int mp4_demux_close(struct mp4_demux *demux)
 {
 	if (demux == NULL)
@@ -223,27 +461,9 @@ int mp4_demux_close(struct mp4_demux *demux)
 		struct mp4_file *mp4 = &demux->mp4;
 		if (mp4->fd)
 			close(mp4->fd);
-		mp4_box_destroy(mp4->root);
-		mp4_tracks_destroy(mp4);
-		unsigned int i;
-		for (i = 0; i < mp4->chaptersCount; i++)
-			free(mp4->chaptersName[i]);
-		free(mp4->udtaLocationKey);
-		free(mp4->udtaLocationValue);
-		for (i = 0; i < mp4->udtaMetadataCount; i++) {
-			free(mp4->udtaMetadataKey[i]);
-			free(mp4->udtaMetadataValue[i]);
-		}
-		free(mp4->udtaMetadataKey);
-		free(mp4->udtaMetadataValue);
-		for (i = 0; i < mp4->metaMetadataCount; i++) {
-			free(mp4->metaMetadataKey[i]);
-			free(mp4->metaMetadataValue[i]);
-		}
-		free(mp4->metaMetadataKey);
-		free(mp4->metaMetadataValue);
-		free(mp4->finalMetadataKey);
-		free(mp4->finalMetadataValue);
+		mp4_file_read_buffer_release(mp4);
+		mp4_file_unmap(mp4);
+		mp4_file_clear(mp4);
 	}
 
 	free(demux);
@@ -262,7 +482,7 @@ static int get_seek_sample(const struct mp4_track *tk,
 	int nearest;
 	int next;
 	int next_sync;
-	uint64_t start_ts = tk->sampleDecodingTime[start];
+	uint64_t start_ts = mp4_track_get_sample_dts(tk, start);
 
 	switch (method) {
 	case MP4_SEEK_METHOD_PREVIOUS:
@@ -317,51 +537,51 @@ static int get_seek_sample(const struct mp4_track *tk,
 static int get_metadata_sample_from_ref_track(const struct mp4_track *ref_tk,
 					      int ref_sample)
 {
-	int idx;
-	const struct mp4_track *metatk = ref_tk->metadata;
-	uint64_t prev_sample_time = INT64_MAX;
-	uint64_t next_sample_time = INT64_MAX;
-
-	if (!metatk)
+	if ((!ref_tk->metadata) || (!ref_tk->metadataSampleIdx))
 		return -ENOENT;
 
-	uint64_t sample_time = ref_tk->sampleDecodingTime[ref_sample];
-	if ((ref_sample - 1) >= 0)
-		prev_sample_time = ref_tk->sampleDecodingTime[ref_sample - 1];
-	if ((ref_sample + 1) < (int)ref_tk->sampleCount)
-		next_sample_time = ref_tk->sampleDecodingTime[ref_sample + 1];
-
-	idx = mp4_track_find_sample_by_time(
-		metatk,
-		mp4_convert_timescale(
-			sample_time, ref_tk->timescale, metatk->timescale),
-		MP4_TIME_CMP_NEAREST,
-		0,
-		0);
-	if (idx < 0)
+	if (ref_tk->metadataSampleIdx[ref_sample] < 0)
 		return -ENOENT;
 
-	uint64_t meta_sample_time =
-		mp4_convert_timescale(metatk->sampleDecodingTime[idx],
-				      metatk->timescale,
-				      ref_tk->timescale);
+	return ref_tk->metadataSampleIdx[ref_sample];
+}
+
 
-	/* Exact match: return */
-	if (meta_sample_time == sample_time)
-		return idx;
+static int track_seek(const struct mp4_track *tk,
+		      uint64_t time_offset,
+		      enum mp4_seek_method method,
+		      uint32_t *next_sample,
+		      uint64_t *pending_seek_time)
+{
+	int idx;
+	uint64_t ts = mp4_usec_to_sample_time(time_offset, tk->timescale);
+
+	/* Sample at the requested time, or the last one before */
+	int i = mp4_track_find_sample_by_time(tk, ts, MP4_TIME_CMP_EXACT, 0, 0);
+	if (i < 0)
+		i = mp4_track_find_sample_by_time(
+			tk, ts, MP4_TIME_CMP_LT, 0, -1);
+	if (i < 0) {
+		ULOGE("unable to seek in track");
+		return -ENOENT;
+	}
 
-	uint64_t delta_time =
-		llabs((int64_t)meta_sample_time - (int64_t)sample_time);
-	uint64_t prev_delta_time =
-		llabs((int64_t)meta_sample_time - (int64_t)prev_sample_time);
-	uint64_t next_delta_time =
-		llabs((int64_t)meta_sample_time - (int64_t)next_sample_time);
+	idx = get_seek_sample(tk, i, ts, method);
+	if (idx < 0) {
+		ULOGE("unable to seek in track");
+		return -ENOENT;
+	}
 
-	/* Return metadata sample only if closest to the current sample */
-	if ((delta_time < prev_delta_time) && (delta_time < next_delta_time))
-		return idx;
+	*next_sample = idx;
+	*pending_seek_time =
+		(idx == i) ? 0 : mp4_track_get_sample_dts(tk, i);
+	ULOGD("seek to %" PRIu64 " -> sample #%d time %" PRIu64,
+	      time_offset,
+	      idx,
+	      mp4_sample_time_to_usec(mp4_track_get_sample_dts(tk, idx),
+				      tk->timescale));
 
-	return -ENOENT;
+	return 0;
 }
 
 
@@ -371,6 +591,7 @@ int mp4_demux_seek(const struct mp4_demux *demux,
 {
 	struct mp4_track *tk = NULL;
 	const struct mp4_file *mp4;
+	int ret;
 
 	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
 
@@ -378,46 +599,14 @@ int mp4_demux_seek(const struct mp4_demux *demux,
 
 	list_walk_entry_forward(&mp4->tracks, tk, node)
 	{
-		int found = 0;
-		int idx = 0;
-		uint64_t ts =
-			mp4_usec_to_sample_time(time_offset, tk->timescale);
-		uint64_t newPendingSeekTime = 0;
-		int start = (unsigned int)(((uint64_t)tk->sampleCount * ts +
-					    tk->duration - 1) /
-					   tk->duration);
-		if (start < 0)
-			start = 0;
-		if ((unsigned)start >= tk->sampleCount)
-			start = tk->sampleCount - 1;
-		while (((unsigned)start < tk->sampleCount - 1) &&
-		       (tk->sampleDecodingTime[start] < ts))
-			start++;
-		for (int i = start; i >= 0; i--) {
-			if (tk->sampleDecodingTime[i] <= ts) {
-				idx = get_seek_sample(tk, i, ts, method);
-				if (idx < 0)
-					break;
-				newPendingSeekTime =
-					(idx == i) ? 0
-						   : tk->sampleDecodingTime[i];
-				found = 1;
-				break;
-			}
-		}
-		if (found) {
-			tk->nextSample = idx;
-			tk->pendingSeekTime = newPendingSeekTime;
-			ULOGD("seek to %" PRIu64 " -> sample #%d time %" PRIu64,
-			      time_offset,
-			      idx,
-			      mp4_sample_time_to_usec(
-				      tk->sampleDecodingTime[idx],
-				      tk->timescale));
-		} else {
-			ULOGE("unable to seek in track");
-			return -ENOENT;
-		}
+		ret = track_seek(tk,
+				 time_offset,
+				 method,
+				 &tk->nextSample,
+				 &tk->pendingSeekTime);
+		if (ret < 0)
+			return ret;
+		tk->readaheadEnd = 0;
 	}
 
 	return 0;
@@ -464,8 +653,9 @@ int mp4_demux_get_track_info(const struct mp4_demux *demux,
 			     unsigned int track_idx,
 			     struct mp4_track_info *track_info)
 {
+	int ret;
 	const struct mp4_file *mp4;
-	const struct mp4_track *tk = NULL;
+	struct mp4_track *tk = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(track_info == NULL, EINVAL);
@@ -499,8 +689,13 @@ int mp4_demux_get_track_info(const struct mp4_demux *demux,
 			: tk->modificationTime;
 	track_info->sample_count = tk->sampleCount;
 	track_info->sample_max_size = tk->sampleMaxSize;
-	track_info->sample_offsets = tk->sampleOffset;
-	track_info->sample_sizes = tk->sampleSize;
+	ret = mp4_track_expand_sample_tables(tk);
+	if (ret < 0)
+		return ret;
+	track_info->sample_offsets = tk->expandedSampleOffset;
+	track_info->sample_sizes = (tk->sampleSize != NULL)
+					   ? tk->sampleSize
+					   : tk->expandedSampleSize;
 	track_info->has_metadata = (tk->metadata) ? 1 : 0;
 	if (tk->metadata) {
 		track_info->metadata_content_encoding =
@@ -526,6 +721,37 @@ int mp4_demux_get_track_info(const struct mp4_demux *demux,
 }
 
 
+int mp4_demux_get_track_sample_tables(const struct mp4_demux *demux,
+				      unsigned int track_idx,
+				      const uint64_t **sample_offsets,
+				      const uint32_t **sample_sizes)
+{
+	int ret;
+	struct mp4_track *tk = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_offsets == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_sizes == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_idx >= demux->mp4.trackCount, ENOENT);
+
+	tk = mp4_track_find_by_idx(&demux->mp4, track_idx);
+	if (tk == NULL) {
+		ULOGE("track index=%d not found", track_idx);
+		return -ENOENT;
+	}
+
+	ret = mp4_track_expand_sample_tables(tk);
+	if (ret < 0)
+		return ret;
+
+	*sample_offsets = tk->expandedSampleOffset;
+	*sample_sizes = (tk->sampleSize != NULL) ? tk->sampleSize
+						 : tk->expandedSampleSize;
+
+	return 0;
+}
+
+
 int mp4_demux_get_track_video_decoder_config(
 	const struct mp4_demux *demux,
 	unsigned int track_id,
@@ -632,60 +858,317 @@ int mp4_demux_get_track_audio_specific_config(const struct mp4_demux *demux,
 }
 
 
-int mp4_demux_get_track_sample(const struct mp4_demux *demux,
-			       unsigned int track_id,
-			       int advance,
-			       uint8_t *sample_buffer,
-			       unsigned int sample_buffer_size,
-			       uint8_t *metadata_buffer,
-			       unsigned int metadata_buffer_size,
-			       struct mp4_track_sample *track_sample)
+/* Extents separated by at most this gap are requested with a single hint */
+#define MP4_DEMUX_READAHEAD_MAX_GAP (64 * 1024)
+
+
+struct readahead_extent {
+	uint64_t start;
+	uint64_t end;
+};
+
+
+static void readahead_extent_flush(const struct mp4_file *mp4,
+				   struct readahead_extent *extent)
 {
-	const struct mp4_file *mp4;
-	struct mp4_track *tk = NULL;
+	if (extent->end > extent->start)
+		mp4_file_readahead(
+			mp4, extent->start, extent->end - extent->start);
+	extent->start = 0;
+	extent->end = 0;
+}
+
+
+/**
+ * Add a sample to a contiguous extent of the file, or request the extent
+ * and start a new one if the sample is not in or right after it
+ */
+static void readahead_extent_add(const struct mp4_file *mp4,
+				 struct readahead_extent *extent,
+				 uint64_t offset,
+				 uint32_t size)
+{
+	if (size == 0)
+		return;
+	if ((extent->end > extent->start) && (offset >= extent->start) &&
+	    (offset <= extent->end + MP4_DEMUX_READAHEAD_MAX_GAP)) {
+		extent->end = MAX(extent->end, offset + size);
+		return;
+	}
+	readahead_extent_flush(mp4, extent);
+	extent->start = offset;
+	extent->end = offset + size;
+}
+
+
+/**
+ * Ask for the data of the next samples (and of their metadata) to be
+ * loaded in the background, with one request per contiguous extent of the
+ * file; a new range of samples is requested once half of the previous one
+ * has been read
+ */
+static void cursor_readahead(struct mp4_demux_cursor *cursor)
+{
+	const struct mp4_file *mp4 = &cursor->demux->mp4;
+	const struct mp4_track *tk = cursor->track;
+	unsigned int count = mp4->readaheadSampleCount;
+	struct readahead_extent samples = {0, 0};
+	struct readahead_extent metadata = {0, 0};
+	struct mp4_sample_offset_hint hint = {0};
+	uint32_t start, end;
+
+	/* Only sync samples are read in trick-play mode */
+	if ((count == 0) || (cursor->syncStride != 0))
+		return;
+	if ((cursor->nextSample < cursor->readaheadEnd) &&
+	    (cursor->readaheadEnd - cursor->nextSample > count / 2))
+		return;
+
+	start = MAX(cursor->nextSample, cursor->readaheadEnd);
+	end = (count < cursor->endSample - cursor->nextSample)
+		      ? cursor->nextSample + count
+		      : cursor->endSample;
+	if (start >= end)
+		return;
+
+	for (uint32_t i = start; i < end; i++) {
+		readahead_extent_add(
+			mp4,
+			&samples,
+			mp4_track_get_sample_offset_hinted(tk, i, &hint),
+			mp4_track_get_sample_size(tk, i));
+		if ((tk->metadataSampleIdx != NULL) &&
+		    (tk->metadataSampleIdx[i] >= 0)) {
+			int idx = tk->metadataSampleIdx[i];
+			readahead_extent_add(
+				mp4,
+				&metadata,
+				mp4_track_get_sample_offset(tk->metadata, idx),
+				mp4_track_get_sample_size(tk->metadata, idx));
+		}
+	}
+	cursor->readaheadEnd = end;
+
+	/* Interleaved samples and metadata are requested at once */
+	if ((metadata.end > metadata.start) && (samples.end > samples.start) &&
+	    (metadata.start <= samples.end + MP4_DEMUX_READAHEAD_MAX_GAP) &&
+	    (samples.start <= metadata.end + MP4_DEMUX_READAHEAD_MAX_GAP)) {
+		samples.start = MIN(samples.start, metadata.start);
+		samples.end = MAX(samples.end, metadata.end);
+		metadata.end = metadata.start;
+	}
+	readahead_extent_flush(mp4, &samples);
+	readahead_extent_flush(mp4, &metadata);
+}
+
+
+/**
+ * Move the cursor to the sync sample at or before its position in its
+ * range, or to the next one if there is none
+ */
+static void cursor_snap_to_sync(struct mp4_demux_cursor *cursor)
+{
+	const struct mp4_track *tk = cursor->track;
+	uint64_t time;
+	int idx;
+
+	if ((cursor->nextSample >= cursor->endSample) ||
+	    mp4_track_is_sync_sample(tk, cursor->nextSample, NULL))
+		return;
+
+	time = mp4_track_get_sample_dts(tk, cursor->nextSample);
+	idx = mp4_track_find_sample_by_time(
+		tk, time, MP4_TIME_CMP_LT_EQ, 1, cursor->nextSample);
+	if (idx < (int)cursor->startSample) {
+		idx = mp4_track_find_sample_by_time(
+			tk, time, MP4_TIME_CMP_GT_EQ, 1, cursor->nextSample);
+	}
+	cursor->nextSample = ((idx >= 0) && ((uint32_t)idx < cursor->endSample))
+				     ? (uint32_t)idx
+				     : cursor->endSample;
+}
+
+
+/**
+ * Move the cursor after reading the sample at 'time': to the next sample,
+ * or in trick-play mode to the next sync sample at the stride
+ */
+static void cursor_advance(struct mp4_demux_cursor *cursor, uint64_t time)
+{
+	const struct mp4_track *tk = cursor->track;
+	uint64_t stride;
+	int idx = -1;
+
+	if (cursor->syncStride == 0) {
+		cursor->nextSample++;
+		return;
+	}
+
+	if (cursor->syncStride > 0) {
+		idx = mp4_track_find_sample_by_time(tk,
+						    time + cursor->syncStride,
+						    MP4_TIME_CMP_GT_EQ,
+						    1,
+						    cursor->nextSample + 1);
+	} else if (cursor->nextSample > cursor->startSample) {
+		stride = (uint64_t)(-cursor->syncStride);
+		idx = mp4_track_find_sample_by_time(
+			tk,
+			(time > stride) ? time - stride : 0,
+			MP4_TIME_CMP_LT_EQ,
+			1,
+			cursor->nextSample - 1);
+	}
+	cursor->nextSample = ((idx >= (int)cursor->startSample) &&
+			      ((uint32_t)idx < cursor->endSample))
+				     ? (uint32_t)idx
+				     : cursor->endSample;
+}
+
+
+/**
+ * Read a sample and its metadata sample with a single I/O operation when
+ * they are next to each other in the file (the data between them is read
+ * and dropped); returns 1 if they were read, 0 if they must be read
+ * separately, or a negative errno value
+ */
+static int read_sample_with_metadata(const struct mp4_file *mp4,
+				     uint8_t *sample_buffer,
+				     uint32_t sample_size,
+				     uint64_t sample_offset,
+				     uint8_t *metadata_buffer,
+				     uint32_t metadata_size,
+				     uint64_t metadata_offset)
+{
+	uint8_t gap[MP4_COMBINED_READ_MAX_GAP];
+	struct iovec iov[3];
+	uint64_t start, gap_size;
+	size_t total;
+	ssize_t count;
+	int iovcnt = 0;
+
+	if (sample_offset + sample_size <= metadata_offset) {
+		start = sample_offset;
+		gap_size = metadata_offset - (sample_offset + sample_size);
+		iov[0].iov_base = sample_buffer;
+		iov[0].iov_len = sample_size;
+		iov[2].iov_base = metadata_buffer;
+		iov[2].iov_len = metadata_size;
+	} else if (metadata_offset + metadata_size <= sample_offset) {
+		start = metadata_offset;
+		gap_size = sample_offset - (metadata_offset + metadata_size);
+		iov[0].iov_base = metadata_buffer;
+		iov[0].iov_len = metadata_size;
+		iov[2].iov_base = sample_buffer;
+		iov[2].iov_len = sample_size;
+	} else {
+		return 0;
+	}
+	if (gap_size > sizeof(gap))
+		return 0;
+
+	iovcnt = 1;
+	if (gap_size > 0) {
+		iov[iovcnt].iov_base = gap;
+		iov[iovcnt].iov_len = gap_size;
+		iovcnt++;
+	}
+	iov[iovcnt++] = iov[2];
+	total = (size_t)sample_size + metadata_size + gap_size;
+
+	count = mp4_file_preadv(mp4, iov, iovcnt, start);
+	if (count == -1) {
+		int ret = -errno;
+		ULOG_ERRNO("preadv", -ret);
+		return ret;
+	} else if (count != (ssize_t)total) {
+		ULOG_ERRNO("preadv", ENODATA);
+		return -ENODATA;
+	}
+
+	return 1;
+}
+
+
+static int cursor_get_sample(struct mp4_demux_cursor *cursor,
+			     int advance,
+			     uint8_t *sample_buffer,
+			     unsigned int sample_buffer_size,
+			     uint8_t *metadata_buffer,
+			     unsigned int metadata_buffer_size,
+			     const uint8_t **sample_data,
+			     const uint8_t **metadata_data,
+			     struct mp4_track_sample *track_sample)
+{
+	const struct mp4_file *mp4 = &cursor->demux->mp4;
+	const struct mp4_track *tk = cursor->track;
 	int idx;
+	int combined = 0;
 	uint64_t sampleTime;
 	uint32_t sample_size;
 	uint32_t metadata_size;
 	uint64_t sample_offset;
 	uint64_t metadata_offset;
 
-	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(track_sample == NULL, EINVAL);
-
-	mp4 = &demux->mp4;
-
-	tk = mp4_track_find_by_id(mp4, track_id);
-	if (tk == NULL) {
-		ULOGE("track id=%d not found", track_id);
-		return -ENOENT;
-	}
-
 	memset(track_sample, 0, sizeof(*track_sample));
 
-	if (tk->nextSample >= tk->sampleCount)
+	if (cursor->nextSample >= cursor->endSample)
 		return 0;
 
-	sample_size = tk->sampleSize[tk->nextSample];
-	sample_offset = tk->sampleOffset[tk->nextSample];
+	if (sample_data || sample_buffer)
+		cursor_readahead(cursor);
+
+	sample_size = mp4_track_get_sample_size(tk, cursor->nextSample);
+	sample_offset = mp4_track_get_sample_offset_hinted(
+		tk, cursor->nextSample, &cursor->offsetHint);
 	track_sample->size = sample_size;
 	track_sample->offset = sample_offset;
-	if (sample_buffer && (sample_size > 0) &&
-	    (sample_size <= sample_buffer_size)) {
-		off_t _ret = lseek(mp4->fd, sample_offset, SEEK_SET);
-		if (_ret == -1) {
-			ULOG_ERRNO("lseek", errno);
-			return -errno;
+	if (!sample_data && sample_buffer && metadata_buffer && tk->metadata &&
+	    (sample_size > 0) && (sample_size <= sample_buffer_size)) {
+		idx = get_metadata_sample_from_ref_track(tk,
+							 cursor->nextSample);
+		metadata_size = 0;
+		if (idx >= 0) {
+			metadata_size =
+				mp4_track_get_sample_size(tk->metadata, idx);
+		}
+		if ((metadata_size > 0) &&
+		    (metadata_size <= metadata_buffer_size)) {
+			metadata_offset =
+				mp4_track_get_sample_offset(tk->metadata, idx);
+			combined = read_sample_with_metadata(mp4,
+							     sample_buffer,
+							     sample_size,
+							     sample_offset,
+							     metadata_buffer,
+							     metadata_size,
+							     metadata_offset);
+			if (combined < 0) {
+				track_sample->size = 0;
+				return combined;
+			}
 		}
-		ssize_t count = read(mp4->fd, sample_buffer, sample_size);
+	}
+	if (sample_data) {
+		*sample_data =
+			mp4_file_get_data(mp4, sample_offset, sample_size);
+		if (*sample_data == NULL) {
+			track_sample->size = 0;
+			ULOGE("sample out of the file mapping");
+			return -ENODATA;
+		}
+	} else if (sample_buffer && !combined && (sample_size > 0) &&
+		   (sample_size <= sample_buffer_size)) {
+		ssize_t count = mp4_file_pread(
+			mp4, sample_buffer, sample_size, sample_offset);
 		if (count == -1) {
 			track_sample->size = 0;
-			_ret = -errno;
+			int _ret = -errno;
 			ULOG_ERRNO("read", -_ret);
 			return _ret;
 		} else if (count != (ssize_t)sample_size) {
 			track_sample->size = 0;
-			_ret = -ENODATA;
+			int _ret = -ENODATA;
 			ULOG_ERRNO("read", -_ret);
 			return _ret;
 		}
@@ -695,31 +1178,34 @@ int mp4_demux_get_track_sample(const struct mp4_demux *demux,
 		      sample_size);
 		return -ENOBUFS;
 	}
-	sampleTime = tk->sampleDecodingTime[tk->nextSample];
+	sampleTime = mp4_track_get_sample_dts(tk, cursor->nextSample);
 	if (tk->metadata) {
 		const struct mp4_track *metatk = tk->metadata;
-		idx = get_metadata_sample_from_ref_track(tk, tk->nextSample);
+		idx = get_metadata_sample_from_ref_track(tk,
+							 cursor->nextSample);
 		if (idx < 0) {
 			ULOGD("no metadata available at sample time: %" PRIu64,
 			      sampleTime);
 		} else {
-			metadata_size = metatk->sampleSize[idx];
-			metadata_offset = metatk->sampleOffset[idx];
+			metadata_size = mp4_track_get_sample_size(metatk, idx);
+			metadata_offset =
+				mp4_track_get_sample_offset(metatk, idx);
 			track_sample->metadata_size = metadata_size;
-			if (metadata_buffer && (metadata_size > 0) &&
-			    (metadata_size <= metadata_buffer_size)) {
-				off_t _ret = lseek(
-					mp4->fd, metadata_offset, SEEK_SET);
-				if (_ret == -1) {
-					ULOG_ERRNO("lseek", errno);
-					return -errno;
-				}
-				ssize_t count = read(mp4->fd,
-						     metadata_buffer,
-						     metadata_size);
+			if (metadata_data) {
+				*metadata_data = mp4_file_get_data(
+					mp4, metadata_offset, metadata_size);
+				if (*metadata_data == NULL)
+					track_sample->metadata_size = 0;
+			} else if (metadata_buffer && !combined &&
+				   (metadata_size > 0) &&
+				   (metadata_size <= metadata_buffer_size)) {
+				ssize_t count = mp4_file_pread(mp4,
+							       metadata_buffer,
+							       metadata_size,
+							       metadata_offset);
 				if (count == -1) {
 					track_sample->metadata_size = 0;
-					_ret = -errno;
+					int _ret = -errno;
 					if (_ret == 0)
 						_ret = -ENODATA;
 					ULOG_ERRNO("read", -_ret);
@@ -735,43 +1221,633 @@ int mp4_demux_get_track_sample(const struct mp4_demux *demux,
 			}
 		}
 	}
-	track_sample->silent =
-		((tk->pendingSeekTime) && (sampleTime < tk->pendingSeekTime));
-	if (sampleTime >= tk->pendingSeekTime)
-		tk->pendingSeekTime = 0;
+	track_sample->silent = ((cursor->pendingSeekTime) &&
+				(sampleTime < cursor->pendingSeekTime));
+	if (sampleTime >= cursor->pendingSeekTime)
+		cursor->pendingSeekTime = 0;
 	track_sample->dts = sampleTime;
 	track_sample->next_dts =
-		(tk->nextSample < tk->sampleCount - 1)
-			? tk->sampleDecodingTime[tk->nextSample + 1]
+		(cursor->nextSample < tk->sampleCount - 1)
+			? mp4_track_get_sample_dts(tk, cursor->nextSample + 1)
 			: 0;
 	idx = mp4_track_find_sample_by_time(
-		tk, sampleTime, MP4_TIME_CMP_LT, 1, tk->nextSample);
+		tk, sampleTime, MP4_TIME_CMP_LT, 1, cursor->nextSample);
 	if (idx >= 0)
-		track_sample->prev_sync_dts = tk->sampleDecodingTime[idx];
+		track_sample->prev_sync_dts = mp4_track_get_sample_dts(tk, idx);
 	idx = mp4_track_find_sample_by_time(
-		tk, sampleTime, MP4_TIME_CMP_GT, 1, tk->nextSample);
+		tk, sampleTime, MP4_TIME_CMP_GT, 1, cursor->nextSample);
 	if (idx >= 0)
-		track_sample->next_sync_dts = tk->sampleDecodingTime[idx];
-	track_sample->sync = mp4_track_is_sync_sample(tk, tk->nextSample, NULL);
+		track_sample->next_sync_dts = mp4_track_get_sample_dts(tk, idx);
+	track_sample->sync =
+		mp4_track_is_sync_sample(tk, cursor->nextSample, NULL);
 
 	if (advance)
-		tk->nextSample++;
+		cursor_advance(cursor, sampleTime);
 
 	return 0;
 }
 
 
-int mp4_demux_seek_to_track_prev_sample(const struct mp4_demux *demux,
-					unsigned int track_id)
+/* The track holds the position used by the demuxer functions */
+static void track_cursor_load(struct mp4_demux_cursor *cursor,
+			      const struct mp4_demux *demux,
+			      const struct mp4_track *tk)
 {
-	const struct mp4_file *mp4;
-	const struct mp4_track *tk = NULL;
-	int idx;
-	uint64_t ts;
+	cursor->demux = demux;
+	cursor->track = tk;
+	cursor->startSample = 0;
+	cursor->endSample = tk->sampleCount;
+	cursor->syncStride = 0;
+	cursor->nextSample = tk->nextSample;
+	cursor->pendingSeekTime = tk->pendingSeekTime;
+	cursor->readaheadEnd = tk->readaheadEnd;
+	cursor->offsetHint = tk->offsetHint;
+}
 
-	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
 
-	mp4 = &demux->mp4;
+static void track_cursor_store(const struct mp4_demux_cursor *cursor,
+			       struct mp4_track *tk)
+{
+	tk->nextSample = cursor->nextSample;
+	tk->pendingSeekTime = cursor->pendingSeekTime;
+	tk->readaheadEnd = cursor->readaheadEnd;
+	tk->offsetHint = cursor->offsetHint;
+}
+
+
+static int get_track_sample(const struct mp4_demux *demux,
+			    unsigned int track_id,
+			    int advance,
+			    uint8_t *sample_buffer,
+			    unsigned int sample_buffer_size,
+			    uint8_t *metadata_buffer,
+			    unsigned int metadata_buffer_size,
+			    const uint8_t **sample_data,
+			    const uint8_t **metadata_data,
+			    struct mp4_track_sample *track_sample)
+{
+	struct mp4_track *tk = NULL;
+	struct mp4_demux_cursor cursor;
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_sample == NULL, EINVAL);
+
+	tk = mp4_track_find_by_id(&demux->mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	track_cursor_load(&cursor, demux, tk);
+
+	ret = cursor_get_sample(&cursor,
+				advance,
+				sample_buffer,
+				sample_buffer_size,
+				metadata_buffer,
+				metadata_buffer_size,
+				sample_data,
+				metadata_data,
+				track_sample);
+
+	track_cursor_store(&cursor, tk);
+
+	return ret;
+}
+
+
+int mp4_demux_get_track_sample(const struct mp4_demux *demux,
+			       unsigned int track_id,
+			       int advance,
+			       uint8_t *sample_buffer,
+			       unsigned int sample_buffer_size,
+			       uint8_t *metadata_buffer,
+			       unsigned int metadata_buffer_size,
+			       struct mp4_track_sample *track_sample)
+{
+	return get_track_sample(demux,
+				track_id,
+				advance,
+				sample_buffer,
+				sample_buffer_size,
+				metadata_buffer,
+				metadata_buffer_size,
+				NULL,
+				NULL,
+				track_sample);
+}
+
+
+/**
+ * Get the description of the next sample of a track without reading it,
+ * and advance the track if the sample fits in 'max_size' bytes (used by
+ * the sample reader, which reads the data itself)
+ */
+int mp4_demux_track_next_sample(const struct mp4_demux *demux,
+				unsigned int track_id,
+				size_t max_size,
+				struct mp4_track_sample *track_sample)
+{
+	struct mp4_track *tk = NULL;
+	struct mp4_demux_cursor cursor;
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_sample == NULL, EINVAL);
+
+	tk = mp4_track_find_by_id(&demux->mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	track_cursor_load(&cursor, demux, tk);
+
+	ret = cursor_get_sample(
+		&cursor, 0, NULL, 0, NULL, 0, NULL, NULL, track_sample);
+	if ((ret == 0) && (track_sample->size > max_size)) {
+		ULOGE("buffer too small (%zu bytes, %u needed)",
+		      max_size,
+		      track_sample->size);
+		ret = -ENOBUFS;
+	} else if ((ret == 0) && (cursor.nextSample < cursor.endSample)) {
+		/* Same as reading the sample with advance set */
+		cursor_advance(&cursor, track_sample->dts);
+	}
+
+	track_cursor_store(&cursor, tk);
+
+	return ret;
+}
+
+
+int mp4_demux_get_track_sample_mapped(const struct mp4_demux *demux,
+				      unsigned int track_id,
+				      int advance,
+				      const uint8_t **sample_data,
+				      const uint8_t **metadata_data,
+				      struct mp4_track_sample *track_sample)
+{
+	const uint8_t *data = NULL;
+	const uint8_t *metadata = NULL;
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_data == NULL, EINVAL);
+
+	if (!demux->mp4.mapped) {
+		ULOGE("demuxer not opened with mp4_demux_open_mmap()");
+		return -ENOTSUP;
+	}
+
+	ret = get_track_sample(demux,
+			       track_id,
+			       advance,
+			       NULL,
+			       0,
+			       NULL,
+			       0,
+			       &data,
+			       &metadata,
+			       track_sample);
+	if (ret < 0)
+		return ret;
+
+	*sample_data = (track_sample->size > 0) ? data : NULL;
+	if (metadata_data)
+		*metadata_data =
+			(track_sample->metadata_size > 0) ? metadata : NULL;
+
+	return 0;
+}
+
+
+/**
+ * Read 'size' bytes at 'offset' into the buffers one after the other,
+ * MP4_SCATTER_IOV_COUNT buffers at a time
+ */
+static int read_scattered(const struct mp4_file *mp4,
+			  uint64_t offset,
+			  size_t size,
+			  uint8_t *const *buffers,
+			  const size_t *len,
+			  int nbuffers)
+{
+	struct iovec iov[MP4_SCATTER_IOV_COUNT];
+	int i = 0;
+
+	while (size > 0) {
+		size_t total = 0;
+		ssize_t count;
+		int n = 0;
+		while ((n < MP4_SCATTER_IOV_COUNT) && (i < nbuffers) &&
+		       (total < size)) {
+			iov[n].iov_base = buffers[i];
+			iov[n].iov_len = MIN(len[i], size - total);
+			total += iov[n].iov_len;
+			n++;
+			i++;
+		}
+		count = mp4_file_preadv(mp4, iov, n, offset);
+		if (count == -1) {
+			int ret = -errno;
+			ULOG_ERRNO("preadv", -ret);
+			return ret;
+		} else if (count != (ssize_t)total) {
+			ULOG_ERRNO("preadv", ENODATA);
+			return -ENODATA;
+		}
+		offset += total;
+		size -= total;
+	}
+
+	return 0;
+}
+
+
+int mp4_demux_get_track_sample_scattered(const struct mp4_demux *demux,
+					 unsigned int track_id,
+					 int advance,
+					 uint8_t *const *buffers,
+					 const size_t *len,
+					 int nbuffers,
+					 uint8_t *metadata_buffer,
+					 unsigned int metadata_buffer_size,
+					 struct mp4_track_sample *track_sample)
+{
+	struct mp4_track *tk = NULL;
+	struct mp4_demux_cursor cursor, next;
+	size_t capacity = 0;
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(nbuffers < 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		(nbuffers > 0) && ((buffers == NULL) || (len == NULL)), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_sample == NULL, EINVAL);
+
+	tk = mp4_track_find_by_id(&demux->mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	track_cursor_load(&cursor, demux, tk);
+	next = cursor;
+
+	/* Get the sample description and metadata, the position is only
+	 * updated once the sample data is read */
+	ret = cursor_get_sample(&next,
+				advance,
+				NULL,
+				0,
+				metadata_buffer,
+				metadata_buffer_size,
+				NULL,
+				NULL,
+				track_sample);
+	if (ret < 0)
+		return ret;
+
+	if ((nbuffers > 0) && (track_sample->size > 0)) {
+		for (int i = 0; i < nbuffers; i++)
+			capacity += len[i];
+		if (track_sample->size > capacity) {
+			ULOGE("buffers too small (%zu bytes, %" PRIu32
+			      " needed)",
+			      capacity,
+			      track_sample->size);
+			return -ENOBUFS;
+		}
+		cursor_readahead(&cursor);
+		ret = read_scattered(&demux->mp4,
+				     track_sample->offset,
+				     track_sample->size,
+				     buffers,
+				     len,
+				     nbuffers);
+		if (ret < 0) {
+			track_sample->size = 0;
+			return ret;
+		}
+		next.readaheadEnd = cursor.readaheadEnd;
+	}
+
+	track_cursor_store(&next, tk);
+
+	return 0;
+}
+
+
+/* Range of the file read into a buffer with a single I/O operation */
+struct read_run {
+	uint8_t *data;
+	uint64_t offset;
+	size_t size;
+};
+
+
+static int read_run_flush(const struct mp4_file *mp4, struct read_run *run)
+{
+	while (run->size > 0) {
+		ssize_t count =
+			mp4_file_pread(mp4, run->data, run->size, run->offset);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			int ret = -errno;
+			ULOG_ERRNO("read", -ret);
+			return ret;
+		} else if (count == 0) {
+			ULOG_ERRNO("read", ENODATA);
+			return -ENODATA;
+		}
+		run->data += count;
+		run->offset += count;
+		run->size -= count;
+	}
+
+	return 0;
+}
+
+
+static int read_run_add(const struct mp4_file *mp4,
+			struct read_run *run,
+			uint8_t *data,
+			uint64_t offset,
+			size_t size)
+{
+	int ret;
+
+	/* Extend the run if the data follows it both in the file and in
+	 * the buffer */
+	if ((run->size > 0) && (run->data + run->size == data) &&
+	    (run->offset + run->size == offset)) {
+		run->size += size;
+		return 0;
+	}
+
+	ret = read_run_flush(mp4, run);
+	if (ret < 0)
+		return ret;
+
+	run->data = data;
+	run->offset = offset;
+	run->size = size;
+
+	return 0;
+}
+
+
+int mp4_demux_get_track_samples(const struct mp4_demux *demux,
+				unsigned int track_id,
+				unsigned int max_count,
+				uint64_t end_time,
+				uint8_t *sample_buffer,
+				size_t sample_buffer_size,
+				uint8_t *metadata_buffer,
+				size_t metadata_buffer_size,
+				struct mp4_track_sample *track_samples,
+				unsigned int *sample_count)
+{
+	const struct mp4_file *mp4;
+	struct mp4_track *tk = NULL;
+	struct mp4_demux_cursor cursor, next;
+	struct read_run sample_run = {0};
+	struct read_run metadata_run = {0};
+	size_t sample_used = 0;
+	size_t metadata_used = 0;
+	unsigned int count = 0;
+	bool full = false;
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_samples == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_count == NULL, EINVAL);
+
+	*sample_count = 0;
+	mp4 = &demux->mp4;
+
+	tk = mp4_track_find_by_id(mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	track_cursor_load(&cursor, demux, tk);
+
+	while ((count < max_count) && (cursor.nextSample < cursor.endSample)) {
+		struct mp4_track_sample *sample = &track_samples[count];
+		uint64_t dts = mp4_track_get_sample_dts(tk, cursor.nextSample);
+
+		if ((end_time != 0) &&
+		    (mp4_sample_time_to_usec(dts, tk->timescale) >= end_time))
+			break;
+
+		next = cursor;
+		ret = cursor_get_sample(
+			&next, 1, NULL, 0, NULL, 0, NULL, NULL, sample);
+		if (ret < 0)
+			return ret;
+
+		if ((sample_buffer != NULL) &&
+		    (sample->size > sample_buffer_size - sample_used)) {
+			full = true;
+			break;
+		}
+		if ((metadata_buffer != NULL) &&
+		    (sample->metadata_size >
+		     metadata_buffer_size - metadata_used)) {
+			full = true;
+			break;
+		}
+
+		if (sample_buffer != NULL) {
+			ret = read_run_add(mp4,
+					   &sample_run,
+					   sample_buffer + sample_used,
+					   sample->offset,
+					   sample->size);
+			if (ret < 0)
+				return ret;
+			sample_used += sample->size;
+		}
+		if ((metadata_buffer != NULL) && (sample->metadata_size > 0)) {
+			int idx = get_metadata_sample_from_ref_track(
+				tk, cursor.nextSample);
+			ret = read_run_add(
+				mp4,
+				&metadata_run,
+				metadata_buffer + metadata_used,
+				mp4_track_get_sample_offset(tk->metadata, idx),
+				sample->metadata_size);
+			if (ret < 0)
+				return ret;
+			metadata_used += sample->metadata_size;
+		}
+
+		cursor = next;
+		count++;
+	}
+
+	if (full && (count == 0)) {
+		ULOGE("buffer too small for sample #%u", cursor.nextSample);
+		return -ENOBUFS;
+	}
+
+	/* Prefetch the following samples while reading this batch */
+	if (sample_buffer != NULL)
+		cursor_readahead(&cursor);
+
+	ret = read_run_flush(mp4, &sample_run);
+	if (ret < 0)
+		return ret;
+	ret = read_run_flush(mp4, &metadata_run);
+	if (ret < 0)
+		return ret;
+
+	track_cursor_store(&cursor, tk);
+	*sample_count = count;
+
+	return 0;
+}
+
+
+/**
+ * Find the first sample of a track with a decoding time in microseconds
+ * at or after 'time'
+ */
+static uint32_t find_first_sample_at_usec(const struct mp4_track *tk,
+					  uint64_t time)
+{
+	uint64_t ts = mp4_usec_to_sample_time(time, tk->timescale);
+	int i = mp4_track_find_sample_by_time(tk, ts, MP4_TIME_CMP_GT_EQ, 0, 0);
+	uint32_t idx = (i >= 0) ? (uint32_t)i : tk->sampleCount;
+
+	/* Fix the rounding of the time conversion */
+	while ((idx > 0) && (mp4_sample_time_to_usec(
+				     mp4_track_get_sample_dts(tk, idx - 1),
+				     tk->timescale) >= time))
+		idx--;
+	while ((idx < tk->sampleCount) &&
+	       (mp4_sample_time_to_usec(mp4_track_get_sample_dts(tk, idx),
+					tk->timescale) < time))
+		idx++;
+
+	return idx;
+}
+
+
+int mp4_demux_get_track_samples_range(const struct mp4_demux *demux,
+				      unsigned int track_id,
+				      uint64_t start_time,
+				      uint64_t end_time,
+				      unsigned int max_count,
+				      uint8_t *buffer,
+				      size_t buffer_size,
+				      uint64_t *dts,
+				      uint64_t *offsets,
+				      uint32_t *sizes,
+				      unsigned int *sample_count)
+{
+	const struct mp4_file *mp4;
+	const struct mp4_track *tk = NULL;
+	const struct mp4_sample_chunk_run *run;
+	struct read_run data_run = {0};
+	uint32_t i, end, idxInRun = 0, runIdx = 0;
+	uint32_t size = 0;
+	uint64_t offset = 0;
+	size_t used = 0;
+	unsigned int count = 0;
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(max_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(end_time != 0 && end_time < start_time,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_count == NULL, EINVAL);
+
+	*sample_count = 0;
+	mp4 = &demux->mp4;
+
+	tk = mp4_track_find_by_id(mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	/* The samples at end_time are part of the range */
+	i = find_first_sample_at_usec(tk, start_time);
+	end = (end_time != 0 && end_time != UINT64_MAX)
+		      ? find_first_sample_at_usec(tk, end_time + 1)
+		      : tk->sampleCount;
+	if (end < i)
+		end = i;
+	if (end - i > max_count)
+		end = i + max_count;
+	end = MIN(end, tk->sampleCount);
+	if (i < end)
+		runIdx = mp4_track_find_chunk_run(tk, i);
+
+	for (; i < end; i++) {
+		/* Sample offset, following the chunks */
+		while ((runIdx + 1 < tk->chunkRunCount) &&
+		       (tk->chunkRuns[runIdx + 1].firstSample <= i))
+			runIdx++;
+		run = &tk->chunkRuns[runIdx];
+		idxInRun = i - run->firstSample;
+		if ((count == 0) || (idxInRun % run->samplesPerChunk == 0))
+			offset = mp4_track_get_sample_offset(tk, i);
+		else
+			offset += size;
+		size = mp4_track_get_sample_size(tk, i);
+
+		if (buffer != NULL) {
+			if (size > buffer_size - used) {
+				if (count == 0) {
+					ULOGE("buffer too small for sample #%u",
+					      i);
+					return -ENOBUFS;
+				}
+				break;
+			}
+			ret = read_run_add(
+				mp4, &data_run, buffer + used, offset, size);
+			if (ret < 0)
+				return ret;
+			used += size;
+		}
+		if (dts != NULL)
+			dts[count] = mp4_track_get_sample_dts(tk, i);
+		if (offsets != NULL)
+			offsets[count] = offset;
+		if (sizes != NULL)
+			sizes[count] = size;
+		count++;
+	}
+
+	ret = read_run_flush(mp4, &data_run);
+	if (ret < 0)
+		return ret;
+
+	*sample_count = count;
+
+	return 0;
+}
+
+
+int mp4_demux_seek_to_track_prev_sample(const struct mp4_demux *demux,
+					unsigned int track_id)
+{
+	const struct mp4_file *mp4;
+	const struct mp4_track *tk = NULL;
+	int idx;
+	uint64_t ts;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+
+	mp4 = &demux->mp4;
 
 	tk = mp4_track_find_by_id(mp4, track_id);
 	if (tk == NULL) {
@@ -783,7 +1859,7 @@ int mp4_demux_seek_to_track_prev_sample(const struct mp4_demux *demux,
 		return -ENOENT;
 
 	idx = (tk->nextSample >= 2) ? tk->nextSample - 2 : 0;
-	ts = mp4_sample_time_to_usec(tk->sampleDecodingTime[idx],
+	ts = mp4_sample_time_to_usec(mp4_track_get_sample_dts(tk, idx),
 				     tk->timescale);
 
 	return mp4_demux_seek(demux, ts, MP4_SEEK_METHOD_PREVIOUS_SYNC);
@@ -819,7 +1895,7 @@ int mp4_demux_seek_to_track_next_sample(const struct mp4_demux *demux,
 		idx = tk->nextSample + 1;
 	}
 
-	ts = mp4_sample_time_to_usec(tk->sampleDecodingTime[idx],
+	ts = mp4_sample_time_to_usec(mp4_track_get_sample_dts(tk, idx),
 				     tk->timescale);
 
 	if (resync)
@@ -829,6 +1905,183 @@ int mp4_demux_seek_to_track_next_sample(const struct mp4_demux *demux,
 }
 
 
+int mp4_demux_cursor_new(const struct mp4_demux *demux,
+			 unsigned int track_id,
+			 struct mp4_demux_cursor **ret_obj)
+{
+	struct mp4_demux_cursor *cursor;
+	const struct mp4_track *tk;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	tk = mp4_track_find_by_id(&demux->mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	cursor = calloc(1, sizeof(*cursor));
+	if (cursor == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+	cursor->demux = demux;
+	cursor->track = tk;
+	cursor->endSample = tk->sampleCount;
+
+	*ret_obj = cursor;
+	return 0;
+}
+
+
+int mp4_demux_cursor_destroy(struct mp4_demux_cursor *cursor)
+{
+	free(cursor);
+
+	return 0;
+}
+
+
+int mp4_demux_cursor_seek(struct mp4_demux_cursor *cursor,
+			  uint64_t time_offset,
+			  enum mp4_seek_method method)
+{
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cursor == NULL, EINVAL);
+
+	ret = track_seek(cursor->track,
+			 time_offset,
+			 method,
+			 &cursor->nextSample,
+			 &cursor->pendingSeekTime);
+	if (ret < 0)
+		return ret;
+	cursor->nextSample = MAX(cursor->nextSample, cursor->startSample);
+	cursor->nextSample = MIN(cursor->nextSample, cursor->endSample);
+	if (cursor->syncStride != 0)
+		cursor_snap_to_sync(cursor);
+	cursor->readaheadEnd = 0;
+
+	return 0;
+}
+
+
+int mp4_demux_cursor_set_sync_stride(struct mp4_demux_cursor *cursor,
+				     int64_t stride)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(cursor == NULL, EINVAL);
+
+	cursor->syncStride = stride;
+	if (stride != 0)
+		cursor_snap_to_sync(cursor);
+
+	return 0;
+}
+
+
+int mp4_demux_cursor_get_sample(struct mp4_demux_cursor *cursor,
+				int advance,
+				uint8_t *sample_buffer,
+				unsigned int sample_buffer_size,
+				uint8_t *metadata_buffer,
+				unsigned int metadata_buffer_size,
+				struct mp4_track_sample *track_sample)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(cursor == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_sample == NULL, EINVAL);
+
+	return cursor_get_sample(cursor,
+				 advance,
+				 sample_buffer,
+				 sample_buffer_size,
+				 metadata_buffer,
+				 metadata_buffer_size,
+				 NULL,
+				 NULL,
+				 track_sample);
+}
+
+
+static uint64_t gop_weight(const struct mp4_track_gop *gop,
+			   enum mp4_demux_split_mode mode)
+{
+	if (mode == MP4_DEMUX_SPLIT_BY_SIZE)
+		return gop->size;
+	return gop->end_dts - gop->start_dts;
+}
+
+
+int mp4_demux_split_track(const struct mp4_demux *demux,
+			  unsigned int track_id,
+			  enum mp4_demux_split_mode mode,
+			  unsigned int count,
+			  struct mp4_demux_cursor **cursors,
+			  unsigned int *ret_count)
+{
+	int ret;
+	struct mp4_track *tk;
+	uint64_t total = 0, acc = 0;
+	uint32_t g, start = 0, n = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(mode > MP4_DEMUX_SPLIT_BY_DURATION, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cursors == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_count == NULL, EINVAL);
+
+	tk = mp4_track_find_by_id(&demux->mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	ret = mp4_track_build_gops(tk);
+	if (ret < 0)
+		return ret;
+
+	/* Without sync samples the track cannot be split */
+	if (tk->gopCount == 0) {
+		ret = mp4_demux_cursor_new(demux, track_id, &cursors[0]);
+		if (ret < 0)
+			return ret;
+		*ret_count = 1;
+		return 0;
+	}
+
+	for (g = 0; g < tk->gopCount; g++)
+		total += gop_weight(&tk->gops[g], mode);
+
+	/* Cut before the GOP reaching the next fraction of the total */
+	for (g = 0; g <= tk->gopCount; g++) {
+		if ((g == tk->gopCount) ||
+		    ((g > start) && (n + 1 < count) &&
+		     (acc * count >= total * (n + 1)))) {
+			ret = mp4_demux_cursor_new(
+				demux, track_id, &cursors[n]);
+			if (ret < 0)
+				goto error;
+			cursors[n]->startSample = tk->gops[start].first_sample;
+			cursors[n]->endSample = tk->gops[g - 1].last_sample + 1;
+			cursors[n]->nextSample = cursors[n]->startSample;
+			n++;
+			start = g;
+		}
+		if (g < tk->gopCount)
+			acc += gop_weight(&tk->gops[g], mode);
+	}
+
+	*ret_count = n;
+	return 0;
+
+error:
+	while (n > 0)
+		mp4_demux_cursor_destroy(cursors[--n]);
+	return ret;
+}
+
+
 int mp4_demux_get_track_prev_sample_time(const struct mp4_demux *demux,
 					 unsigned int track_id,
 					 uint64_t *sample_time)
@@ -852,7 +2105,7 @@ int mp4_demux_get_track_prev_sample_time(const struct mp4_demux *demux,
 
 	if (tk->nextSample >= 2) {
 		prev_ts = mp4_sample_time_to_usec(
-			tk->sampleDecodingTime[tk->nextSample - 2],
+			mp4_track_get_sample_dts(tk, tk->nextSample - 2),
 			tk->timescale);
 	} else {
 		ret = -ENOENT;
@@ -887,7 +2140,8 @@ int mp4_demux_get_track_next_sample_time(const struct mp4_demux *demux,
 
 	if (tk->nextSample < tk->sampleCount) {
 		next_ts = mp4_sample_time_to_usec(
-			tk->sampleDecodingTime[tk->nextSample], tk->timescale);
+			mp4_track_get_sample_dts(tk, tk->nextSample),
+			tk->timescale);
 	} else {
 		ret = -ENOENT;
 	}
@@ -928,8 +2182,8 @@ static int mp4_demux_get_track_sample_time(const struct mp4_demux *demux,
 	idx = mp4_track_find_sample_by_time(tk, ts, cmp, sync, -1);
 
 	if (idx >= 0) {
-		sample_ts = mp4_sample_time_to_usec(tk->sampleDecodingTime[idx],
-						    tk->timescale);
+		sample_ts = mp4_sample_time_to_usec(
+			mp4_track_get_sample_dts(tk, idx), tk->timescale);
 		ret = 0;
 	} else {
 		ULOGE("no sample found for the requested time");
@@ -963,6 +2217,35 @@ int mp4_demux_get_track_next_sample_time_after(const struct mp4_demux *demux,
 }
 
 
+int mp4_demux_get_track_gops(const struct mp4_demux *demux,
+			     unsigned int track_id,
+			     const struct mp4_track_gop **gops,
+			     unsigned int *count)
+{
+	int ret;
+	struct mp4_track *tk;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(gops == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+
+	tk = mp4_track_find_by_id(&demux->mp4, track_id);
+	if (tk == NULL) {
+		ULOGE("track id=%d not found", track_id);
+		return -ENOENT;
+	}
+
+	ret = mp4_track_build_gops(tk);
+	if (ret < 0)
+		return ret;
+
+	*gops = tk->gops;
+	*count = tk->gopCount;
+
+	return 0;
+}
+
+
 int mp4_demux_get_chapters(struct mp4_demux *demux,
 			   unsigned int *chapters_count,
 			   uint64_t **chapters_time,
@@ -1049,14 +2332,10 @@ int mp4_demux_get_metadata_cover(const struct mp4_demux *demux,
 			*cover_type = mp4->finalCoverType;
 		if (cover_buffer &&
 		    (mp4->finalCoverSize <= cover_buffer_size)) {
-			off_t _ret =
-				lseek(mp4->fd, mp4->finalCoverOffset, SEEK_SET);
-			if (_ret == -1) {
-				ULOG_ERRNO("lseek", errno);
-				return -errno;
-			}
-			ssize_t count = read(
-				mp4->fd, cover_buffer, mp4->finalCoverSize);
+			ssize_t count = mp4_file_pread(mp4,
+						       cover_buffer,
+						       mp4->finalCoverSize,
+						       mp4->finalCoverOffset);
 			if (count == -1) {
 				ret = -errno;
 				ULOG_ERRNO("read", -ret);
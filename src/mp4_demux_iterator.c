@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2026 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Iterator on the samples of several tracks: each track is read with its
+ * own cursor, and a min-heap ordered by the file offset or the decoding
+ * time of the next sample of each track gives the track to read next.
+ */
+
+#include "mp4_priv.h"
+
+
+struct mp4_demux_iterator_entry {
+	uint64_t key;
+	/* Index of the cursor, also used to order equal keys */
+	unsigned int idx;
+};
+
+
+struct mp4_demux_iterator {
+	enum mp4_demux_iterator_order order;
+	unsigned int cursorCount;
+	struct mp4_demux_cursor **cursors;
+	/* Min-heap of the tracks with samples left */
+	unsigned int heapSize;
+	struct mp4_demux_iterator_entry *heap;
+};
+
+
+/* Get the ordering key of the next sample of a cursor, if any */
+static bool iterator_get_key(const struct mp4_demux_iterator *iterator,
+			     unsigned int idx,
+			     uint64_t *key)
+{
+	const struct mp4_demux_cursor *cursor = iterator->cursors[idx];
+	const struct mp4_track *tk = cursor->track;
+	struct mp4_sample_offset_hint hint = cursor->offsetHint;
+
+	if (cursor->nextSample >= tk->sampleCount)
+		return false;
+
+	switch (iterator->order) {
+	case MP4_DEMUX_ITERATOR_ORDER_OFFSET:
+		*key = mp4_track_get_sample_offset_hinted(
+			tk, cursor->nextSample, &hint);
+		break;
+	case MP4_DEMUX_ITERATOR_ORDER_DTS:
+	default:
+		*key = mp4_sample_time_to_usec(
+			mp4_track_get_sample_dts(tk, cursor->nextSample),
+			tk->timescale);
+		break;
+	}
+
+	return true;
+}
+
+
+static bool entry_is_lower(const struct mp4_demux_iterator_entry *a,
+			   const struct mp4_demux_iterator_entry *b)
+{
+	return (a->key < b->key) || ((a->key == b->key) && (a->idx < b->idx));
+}
+
+
+static void heap_sift_up(struct mp4_demux_iterator *iterator, unsigned int i)
+{
+	struct mp4_demux_iterator_entry entry = iterator->heap[i];
+
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!entry_is_lower(&entry, &iterator->heap[parent]))
+			break;
+		iterator->heap[i] = iterator->heap[parent];
+		i = parent;
+	}
+	iterator->heap[i] = entry;
+}
+
+
+static void heap_sift_down(struct mp4_demux_iterator *iterator,
+			   unsigned int i)
+{
+	struct mp4_demux_iterator_entry entry = iterator->heap[i];
+
+	while (2 * i + 1 < iterator->heapSize) {
+		unsigned int child = 2 * i + 1;
+		if ((child + 1 < iterator->heapSize) &&
+		    entry_is_lower(&iterator->heap[child + 1],
+				   &iterator->heap[child]))
+			child++;
+		if (!entry_is_lower(&iterator->heap[child], &entry))
+			break;
+		iterator->heap[i] = iterator->heap[child];
+		i = child;
+	}
+	iterator->heap[i] = entry;
+}
+
+
+int mp4_demux_iterator_new(const struct mp4_demux *demux,
+			   enum mp4_demux_iterator_order order,
+			   const unsigned int *track_ids,
+			   unsigned int track_count,
+			   struct mp4_demux_iterator **ret_obj)
+{
+	int ret;
+	struct mp4_demux_iterator *iterator;
+	unsigned int i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(order > MP4_DEMUX_ITERATOR_ORDER_DTS, EINVAL);
+
+	if (track_ids == NULL)
+		track_count = demux->mp4.trackCount;
+
+	iterator = calloc(1, sizeof(*iterator));
+	if (iterator == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+	iterator->order = order;
+	if (track_count == 0)
+		goto out;
+
+	iterator->cursors = calloc(track_count, sizeof(*iterator->cursors));
+	iterator->heap = calloc(track_count, sizeof(*iterator->heap));
+	if ((iterator->cursors == NULL) || (iterator->heap == NULL)) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		goto error;
+	}
+
+	for (i = 0; i < track_count; i++) {
+		unsigned int track_id = (track_ids != NULL)
+						? track_ids[i]
+						: demux->mp4.trackArray[i]->id;
+		ret = mp4_demux_cursor_new(
+			demux, track_id, &iterator->cursors[i]);
+		if (ret < 0)
+			goto error;
+		iterator->cursorCount = i + 1;
+	}
+
+	for (i = 0; i < iterator->cursorCount; i++) {
+		struct mp4_demux_iterator_entry *entry =
+			&iterator->heap[iterator->heapSize];
+		if (!iterator_get_key(iterator, i, &entry->key))
+			continue;
+		entry->idx = i;
+		heap_sift_up(iterator, iterator->heapSize++);
+	}
+
+out:
+	*ret_obj = iterator;
+	return 0;
+
+error:
+	mp4_demux_iterator_destroy(iterator);
+	return ret;
+}
+
+
+int mp4_demux_iterator_destroy(struct mp4_demux_iterator *iterator)
+{
+	if (iterator == NULL)
+		return 0;
+
+	for (unsigned int i = 0; i < iterator->cursorCount; i++)
+		mp4_demux_cursor_destroy(iterator->cursors[i]);
+	free(iterator->cursors);
+	free(iterator->heap);
+	free(iterator);
+
+	return 0;
+}
+
+
+int mp4_demux_iterator_next(struct mp4_demux_iterator *iterator,
+			    uint8_t *sample_buffer,
+			    unsigned int sample_buffer_size,
+			    uint8_t *metadata_buffer,
+			    unsigned int metadata_buffer_size,
+			    unsigned int *track_id,
+			    struct mp4_track_sample *track_sample)
+{
+	int ret;
+	struct mp4_demux_iterator_entry *top;
+	struct mp4_demux_cursor *cursor;
+
+	ULOG_ERRNO_RETURN_ERR_IF(iterator == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_id == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_sample == NULL, EINVAL);
+
+	*track_id = 0;
+	if (iterator->heapSize == 0) {
+		memset(track_sample, 0, sizeof(*track_sample));
+		return 0;
+	}
+
+	top = &iterator->heap[0];
+	cursor = iterator->cursors[top->idx];
+	ret = mp4_demux_cursor_get_sample(cursor,
+					  1,
+					  sample_buffer,
+					  sample_buffer_size,
+					  metadata_buffer,
+					  metadata_buffer_size,
+					  track_sample);
+	if (ret < 0)
+		return ret;
+	*track_id = cursor->track->id;
+
+	/* Next sample of the track, or remove the track */
+	if (!iterator_get_key(iterator, top->idx, &top->key))
+		*top = iterator->heap[--iterator->heapSize];
+	if (iterator->heapSize > 0)
+		heap_sift_down(iterator, 0);
+
+	return 0;
+}
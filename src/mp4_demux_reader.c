@@ -0,0 +1,389 @@
+/**
+ * Copyright (c) 2026 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Sample reader: reads the next samples of several tracks, possibly from
+ * several demuxers, in batches. The sample descriptions are resolved from
+ * the tables first, then the reads are submitted together with io_uring
+ * when available (BUILD_LIBURING and kernel support), or done with
+ * pread() otherwise. Samples already in memory (mapped files) are copied.
+ * A batch always completes all its reads before returning, so that no
+ * buffer is still targeted by an I/O; if io_uring fails, the reader falls
+ * back to pread().
+ */
+
+#include "mp4_priv.h"
+
+#if BUILD_LIBURING
+#	include <liburing.h>
+#endif /* BUILD_LIBURING */
+
+
+#define MP4_DEMUX_READER_DEFAULT_QUEUE_DEPTH 64
+
+
+struct mp4_demux_reader {
+	unsigned int queueDepth;
+#if BUILD_LIBURING
+	struct io_uring ring;
+	bool ringInitialized;
+	/* Reads prepared in the submission queue, not submitted yet */
+	unsigned int queued;
+	/* Reads submitted, not completed yet */
+	unsigned int inFlight;
+	/* Buffers registered with the ring */
+	struct iovec *buffers;
+	unsigned int bufferCount;
+#endif /* BUILD_LIBURING */
+};
+
+
+/* Set the status of a read from the byte count or negative errno */
+static void read_done(struct mp4_demux_sample_read *read, ssize_t count)
+{
+	if (count < 0) {
+		read->status = (int)count;
+		ULOG_ERRNO("read", -read->status);
+	} else if ((size_t)count != read->sample.size) {
+		read->status = -ENODATA;
+		ULOG_ERRNO("read", -read->status);
+	} else {
+		read->status = 0;
+	}
+}
+
+
+#if BUILD_LIBURING
+
+static void reader_ring_exit(struct mp4_demux_reader *reader)
+{
+	if (!reader->ringInitialized)
+		return;
+
+	io_uring_queue_exit(&reader->ring);
+	reader->ringInitialized = false;
+	reader->queued = 0;
+	reader->inFlight = 0;
+	reader->bufferCount = 0;
+	free(reader->buffers);
+	reader->buffers = NULL;
+}
+
+
+/* Wait for the completion of the reads in flight */
+static int reader_reap(struct mp4_demux_reader *reader)
+{
+	while (reader->inFlight > 0) {
+		struct io_uring_cqe *cqe;
+		int ret = io_uring_wait_cqe(&reader->ring, &cqe);
+		if ((ret == -EINTR) || (ret == -EAGAIN))
+			continue;
+		if (ret < 0) {
+			ULOG_ERRNO("io_uring_wait_cqe", -ret);
+			return ret;
+		}
+		read_done(io_uring_cqe_get_data(cqe), cqe->res);
+		io_uring_cqe_seen(&reader->ring, cqe);
+		reader->inFlight--;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Submit the queued reads and wait for the completion of all the reads.
+ * On error, the ring is no longer used (the reads it did not complete
+ * keep the -EINPROGRESS status and are done with pread())
+ */
+static int reader_flush(struct mp4_demux_reader *reader)
+{
+	int ret = 0;
+
+	while (reader->queued > 0) {
+		ret = io_uring_submit(&reader->ring);
+		if (ret > 0) {
+			ret = ((unsigned int)ret > reader->queued)
+				      ? (int)reader->queued
+				      : ret;
+			reader->queued -= (unsigned int)ret;
+			reader->inFlight += (unsigned int)ret;
+			ret = 0;
+			continue;
+		} else if (ret == -EINTR) {
+			continue;
+		} else if (((ret == -EAGAIN) || (ret == -EBUSY)) &&
+			   (reader->inFlight > 0)) {
+			/* Out of resources: complete the reads in flight
+			 * first */
+			ret = reader_reap(reader);
+			if (ret < 0)
+				break;
+			continue;
+		}
+		if (ret == 0)
+			ret = -EIO;
+		ULOG_ERRNO("io_uring_submit", -ret);
+		break;
+	}
+
+	if (ret == 0)
+		ret = reader_reap(reader);
+	else if (reader_reap(reader) < 0)
+		ULOGE("reads still in flight, cancelled by the ring exit");
+	if (ret < 0) {
+		/* The reads queued but not submitted are discarded with
+		 * the ring */
+		ULOGW("io_uring failed, falling back to pread()");
+		reader_ring_exit(reader);
+	}
+
+	return ret;
+}
+
+
+/* Index of the registered buffer containing the read buffer, or -1 */
+static int reader_find_buffer(const struct mp4_demux_reader *reader,
+			      const struct mp4_demux_sample_read *read)
+{
+	for (unsigned int i = 0; i < reader->bufferCount; i++) {
+		const struct iovec *iov = &reader->buffers[i];
+		uintptr_t start = (uintptr_t)iov->iov_base;
+		uintptr_t addr = (uintptr_t)read->buffer;
+		if ((addr >= start) && (addr - start <= iov->iov_len) &&
+		    (read->sample.size <= iov->iov_len - (addr - start)))
+			return (int)i;
+	}
+
+	return -1;
+}
+
+
+/* Queue a read in the submission queue; 1 if queued, 0 if the ring is
+ * not available (the read is left to pread()) */
+static int reader_queue(struct mp4_demux_reader *reader,
+			struct mp4_demux_sample_read *read)
+{
+	int idx;
+	struct io_uring_sqe *sqe;
+
+	if (!reader->ringInitialized)
+		return 0;
+
+	sqe = io_uring_get_sqe(&reader->ring);
+	if (sqe == NULL) {
+		/* Submission queue full: complete the reads first */
+		if (reader_flush(reader) < 0)
+			return 0;
+		sqe = io_uring_get_sqe(&reader->ring);
+		if (sqe == NULL)
+			return 0;
+	}
+
+	idx = reader_find_buffer(reader, read);
+	if (idx >= 0) {
+		io_uring_prep_read_fixed(sqe,
+					 read->demux->mp4.fd,
+					 read->buffer,
+					 read->sample.size,
+					 read->sample.offset,
+					 idx);
+	} else {
+		io_uring_prep_read(sqe,
+				   read->demux->mp4.fd,
+				   read->buffer,
+				   read->sample.size,
+				   read->sample.offset);
+	}
+	io_uring_sqe_set_data(sqe, read);
+	reader->queued++;
+
+	return 1;
+}
+
+#endif /* BUILD_LIBURING */
+
+
+int mp4_demux_reader_new(unsigned int queue_depth,
+			 struct mp4_demux_reader **ret_obj)
+{
+	struct mp4_demux_reader *reader;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	reader = calloc(1, sizeof(*reader));
+	if (reader == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+	reader->queueDepth = (queue_depth > 0)
+				     ? queue_depth
+				     : MP4_DEMUX_READER_DEFAULT_QUEUE_DEPTH;
+
+#if BUILD_LIBURING
+	int ret = io_uring_queue_init(reader->queueDepth, &reader->ring, 0);
+	if (ret < 0) {
+		/* Not a fatal error, use pread() instead */
+		ULOG_ERRNO("io_uring_queue_init", -ret);
+	} else {
+		reader->ringInitialized = true;
+	}
+#endif /* BUILD_LIBURING */
+
+	*ret_obj = reader;
+	return 0;
+}
+
+
+int mp4_demux_reader_destroy(struct mp4_demux_reader *reader)
+{
+	if (reader == NULL)
+		return 0;
+
+#if BUILD_LIBURING
+	reader_ring_exit(reader);
+#endif /* BUILD_LIBURING */
+
+	free(reader);
+
+	return 0;
+}
+
+
+int mp4_demux_reader_register_buffers(struct mp4_demux_reader *reader,
+				      uint8_t *const *buffers,
+				      const size_t *sizes,
+				      unsigned int count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(reader == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((count > 0) && (buffers == NULL), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((count > 0) && (sizes == NULL), EINVAL);
+
+#if BUILD_LIBURING
+	int ret;
+	struct iovec *iov = NULL;
+
+	if (!reader->ringInitialized)
+		return 0;
+
+	if (reader->bufferCount > 0) {
+		ret = io_uring_unregister_buffers(&reader->ring);
+		if (ret < 0) {
+			ULOG_ERRNO("io_uring_unregister_buffers", -ret);
+			return ret;
+		}
+		free(reader->buffers);
+		reader->buffers = NULL;
+		reader->bufferCount = 0;
+	}
+	if (count == 0)
+		return 0;
+
+	iov = calloc(count, sizeof(*iov));
+	if (iov == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len = sizes[i];
+	}
+	ret = io_uring_register_buffers(&reader->ring, iov, count);
+	if (ret < 0) {
+		ULOG_ERRNO("io_uring_register_buffers", -ret);
+		free(iov);
+		return ret;
+	}
+	reader->buffers = iov;
+	reader->bufferCount = count;
+#endif /* BUILD_LIBURING */
+
+	return 0;
+}
+
+
+int mp4_demux_reader_read_samples(struct mp4_demux_reader *reader,
+				  struct mp4_demux_sample_read *reads,
+				  unsigned int count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(reader == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((reads == NULL) && (count > 0), EINVAL);
+
+	for (unsigned int i = 0; i < count; i++) {
+		struct mp4_demux_sample_read *read = &reads[i];
+		const struct mp4_file *mp4;
+		const uint8_t *data;
+
+		if (read->demux == NULL) {
+			memset(&read->sample, 0, sizeof(read->sample));
+			read->status = -EINVAL;
+			continue;
+		}
+		read->status = mp4_demux_track_next_sample(
+			read->demux,
+			read->track_id,
+			(read->buffer != NULL) ? read->buffer_size : 0,
+			&read->sample);
+		if ((read->status < 0) || (read->sample.size == 0))
+			continue;
+
+		/* The sample is already in memory */
+		mp4 = &read->demux->mp4;
+		data = mp4_file_get_data(
+			mp4, read->sample.offset, read->sample.size);
+		if (data != NULL) {
+			memcpy(read->buffer, data, read->sample.size);
+			continue;
+		}
+
+		read->status = -EINPROGRESS;
+#if BUILD_LIBURING
+		if (reader_queue(reader, read))
+			continue;
+#endif /* BUILD_LIBURING */
+	}
+
+#if BUILD_LIBURING
+	if (reader->ringInitialized)
+		(void)reader_flush(reader);
+#endif /* BUILD_LIBURING */
+
+	/* Reads not done with io_uring */
+	for (unsigned int i = 0; i < count; i++) {
+		struct mp4_demux_sample_read *read = &reads[i];
+		ssize_t _count;
+
+		if (read->status != -EINPROGRESS)
+			continue;
+		_count = mp4_file_pread(&read->demux->mp4,
+					read->buffer,
+					read->sample.size,
+					read->sample.offset);
+		read_done(read, (_count == -1) ? -errno : _count);
+	}
+
+	return 0;
+}
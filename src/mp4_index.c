@@ -0,0 +1,1023 @@
+/**
+ * Copyright (c) 2026 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Demuxer index file: the state built when parsing an MP4 file (tables,
+ * decoder configurations, metadata, chapters and cover location) is
+ * serialized so that the file can be re-opened without parsing it.
+ *
+ * The index is stored in native byte order and is only meant to be used
+ * on the machine that created it. It is validated against the MP4 file
+ * size and modification time, the location of the 'moov' box and a
+ * checksum of a few fixed blocks of it (not the whole box, which would
+ * cost as much as parsing it). The sample tables are aligned in the
+ * index file so that they are used in place from the mapping.
+ */
+
+#include "mp4_priv.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef _WIN32
+#	include <sys/mman.h>
+#endif /* !_WIN32 */
+
+#define MP4_INDEX_MAGIC 0x5844494d /* "MIDX" */
+#define MP4_INDEX_VERSION 2
+#define MP4_INDEX_ABI                                                          \
+	((uint32_t)(sizeof(off_t) << 16) | (uint32_t)(sizeof(size_t) << 8) |   \
+	 (uint32_t)sizeof(enum mp4_track_type))
+#define MP4_INDEX_HASH_BLOCK_SIZE 4096
+#define MP4_INDEX_HASH_BLOCK_COUNT 8
+#define MP4_INDEX_TABLE_ALIGN 8
+#define MP4_INDEX_FNV_OFFSET 0xcbf29ce484222325ULL
+#define MP4_INDEX_FNV_PRIME 0x100000001b3ULL
+
+
+struct mp4_index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t abi;
+	uint64_t fileSize;
+	int64_t fileTime;
+	int64_t fileTimeNsec;
+	uint64_t moovOffset;
+	uint64_t moovSize;
+	uint64_t moovHash;
+};
+
+
+struct mp4_index_writer {
+	int fd;
+	uint64_t offset;
+};
+
+
+struct mp4_index_reader {
+	uint8_t *data;
+	size_t size;
+	size_t offset;
+};
+
+
+#define INDEX_WRITE_VAL(_w, _val)                                              \
+	do {                                                                   \
+		ret = mp4_index_write_data(_w, &(_val), sizeof(_val));         \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+	} while (0)
+
+
+#define INDEX_WRITE_PTR(_w, _ptr, _size)                                       \
+	do {                                                                   \
+		ret = mp4_index_write_ptr(_w, _ptr, _size);                    \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+	} while (0)
+
+
+#define INDEX_WRITE_TABLE(_w, _ptr, _size)                                     \
+	do {                                                                   \
+		ret = mp4_index_write_table(_w, _ptr, _size);                  \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+	} while (0)
+
+
+#define INDEX_WRITE_STR(_w, _str)                                              \
+	do {                                                                   \
+		ret = mp4_index_write_ptr(                                     \
+			_w, _str, (_str != NULL) ? strlen(_str) : 0);          \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+	} while (0)
+
+
+#define INDEX_READ_VAL(_r, _val)                                               \
+	do {                                                                   \
+		ret = mp4_index_read_data(_r, &(_val), sizeof(_val));          \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+	} while (0)
+
+
+#define INDEX_READ_PTR(_r, _ptr, _size)                                        \
+	do {                                                                   \
+		void *_p = NULL;                                               \
+		uint64_t _s = 0;                                               \
+		ret = mp4_index_read_ptr(_r, &_p, &_s, false);                 \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+		_ptr = _p;                                                     \
+		_size = _s;                                                    \
+	} while (0)
+
+
+#define INDEX_READ_TABLE(_r, _ptr, _size)                                      \
+	do {                                                                   \
+		void *_p = NULL;                                               \
+		uint64_t _s = 0;                                               \
+		ret = mp4_index_read_table(_r, &_p, &_s);                      \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+		_ptr = _p;                                                     \
+		_size = _s;                                                    \
+	} while (0)
+
+
+#define INDEX_READ_STR(_r, _str)                                               \
+	do {                                                                   \
+		void *_p = NULL;                                               \
+		uint64_t _s = 0;                                               \
+		ret = mp4_index_read_ptr(_r, &_p, &_s, true);                  \
+		if (ret < 0)                                                   \
+			goto out;                                              \
+		_str = _p;                                                     \
+	} while (0)
+
+
+static int
+mp4_index_write_data(struct mp4_index_writer *w, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size > 0) {
+		ssize_t count = write(w->fd, p, size);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			int ret = -errno;
+			ULOG_ERRNO("write", -ret);
+			return ret;
+		} else if (count == 0) {
+			ULOG_ERRNO("write", ENOSPC);
+			return -ENOSPC;
+		}
+		p += count;
+		size -= (size_t)count;
+		w->offset += (uint64_t)count;
+	}
+
+	return 0;
+}
+
+
+static int
+mp4_index_write_ptr(struct mp4_index_writer *w, const void *ptr, uint64_t size)
+{
+	int ret;
+	uint32_t present = (ptr != NULL);
+
+	ret = mp4_index_write_data(w, &present, sizeof(present));
+	if ((ret < 0) || !present)
+		return ret;
+	ret = mp4_index_write_data(w, &size, sizeof(size));
+	if (ret < 0)
+		return ret;
+	return mp4_index_write_data(w, ptr, (size_t)size);
+}
+
+
+/* Same as mp4_index_write_ptr(), with the data aligned in the file so
+ * that it can be used in place when loading the index */
+static int mp4_index_write_table(struct mp4_index_writer *w,
+				 const void *ptr,
+				 uint64_t size)
+{
+	int ret;
+	uint32_t present = (ptr != NULL);
+	static const uint8_t padding[MP4_INDEX_TABLE_ALIGN];
+
+	ret = mp4_index_write_data(w, &present, sizeof(present));
+	if ((ret < 0) || !present)
+		return ret;
+	ret = mp4_index_write_data(w, &size, sizeof(size));
+	if (ret < 0)
+		return ret;
+	ret = mp4_index_write_data(
+		w,
+		padding,
+		(size_t)(-w->offset & (MP4_INDEX_TABLE_ALIGN - 1)));
+	if (ret < 0)
+		return ret;
+	return mp4_index_write_data(w, ptr, (size_t)size);
+}
+
+
+static int
+mp4_index_read_data(struct mp4_index_reader *r, void *data, size_t size)
+{
+	if (r->size - r->offset < size) {
+		ULOGE("truncated index file");
+		return -EPROTO;
+	}
+	memcpy(data, r->data + r->offset, size);
+	r->offset += size;
+
+	return 0;
+}
+
+
+static int mp4_index_read_ptr(struct mp4_index_reader *r,
+			      void **ptr,
+			      uint64_t *size,
+			      bool str)
+{
+	int ret;
+	uint32_t present;
+
+	*ptr = NULL;
+	*size = 0;
+
+	ret = mp4_index_read_data(r, &present, sizeof(present));
+	if ((ret < 0) || !present)
+		return ret;
+	ret = mp4_index_read_data(r, size, sizeof(*size));
+	if (ret < 0)
+		return ret;
+	if (r->size - r->offset < *size) {
+		ULOGE("truncated index file");
+		return -EPROTO;
+	}
+
+	/* Never return NULL for a present empty table */
+	*ptr = malloc((size_t)*size + (str ? 1 : 0) + ((*size == 0) ? 1 : 0));
+	if (*ptr == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return -ENOMEM;
+	}
+	memcpy(*ptr, r->data + r->offset, (size_t)*size);
+	if (str)
+		((char *)*ptr)[*size] = '\0';
+	r->offset += (size_t)*size;
+
+	return 0;
+}
+
+
+/* Table written by mp4_index_write_table(), returned in place */
+static int mp4_index_read_table(struct mp4_index_reader *r,
+				void **ptr,
+				uint64_t *size)
+{
+	int ret;
+	uint32_t present;
+	size_t padding;
+
+	*ptr = NULL;
+	*size = 0;
+
+	ret = mp4_index_read_data(r, &present, sizeof(present));
+	if ((ret < 0) || !present)
+		return ret;
+	ret = mp4_index_read_data(r, size, sizeof(*size));
+	if (ret < 0)
+		return ret;
+	padding = -r->offset & (MP4_INDEX_TABLE_ALIGN - 1);
+	if ((r->size - r->offset < padding) ||
+	    (r->size - r->offset - padding < *size)) {
+		ULOGE("truncated index file");
+		return -EPROTO;
+	}
+	r->offset += padding;
+	*ptr = r->data + r->offset;
+	r->offset += (size_t)*size;
+
+	return 0;
+}
+
+
+/**
+ * Checksum of the 'moov' box: the box header and the start of the first
+ * track, and fixed blocks spread up to the end of the box
+ */
+static int mp4_index_moov_hash(const struct mp4_file *mp4, uint64_t *hash)
+{
+	uint8_t block[MP4_INDEX_HASH_BLOCK_SIZE];
+	uint64_t h = MP4_INDEX_FNV_OFFSET;
+	uint64_t size = MP4_INDEX_HASH_BLOCK_SIZE;
+	uint64_t step = 0;
+	unsigned int count = 1;
+
+	if (mp4->moovSize <= size * MP4_INDEX_HASH_BLOCK_COUNT) {
+		/* Small box: hash all of it */
+		count = (mp4->moovSize + size - 1) / size;
+		step = size;
+	} else {
+		count = MP4_INDEX_HASH_BLOCK_COUNT;
+		step = (mp4->moovSize - size) / (count - 1);
+	}
+
+	/* 64-bit FNV-1a */
+	for (unsigned int i = 0; i < count; i++) {
+		uint64_t offset = i * step;
+		size_t len = (size_t)MIN(size, mp4->moovSize - offset);
+		ssize_t ret = mp4_file_pread(
+			mp4, block, len, mp4->moovOffset + (off_t)offset);
+		if (ret < 0) {
+			int err = -errno;
+			ULOG_ERRNO("pread", -err);
+			return err;
+		} else if ((size_t)ret != len) {
+			ULOG_ERRNO("pread", ENODATA);
+			return -ENODATA;
+		}
+		for (size_t j = 0; j < len; j++) {
+			h ^= block[j];
+			h *= MP4_INDEX_FNV_PRIME;
+		}
+	}
+	*hash = h;
+
+	return 0;
+}
+
+
+static void mp4_index_file_time(const struct stat *st, int64_t *nsec)
+{
+#if defined(__APPLE__)
+	*nsec = st->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	*nsec = 0;
+#else
+	*nsec = st->st_mtim.tv_nsec;
+#endif
+}
+
+
+static int mp4_index_header_fill(const struct mp4_file *mp4,
+				 struct mp4_index_header *header)
+{
+	int ret;
+	struct stat st;
+
+	if (mp4->moovSize == 0) {
+		ULOGE("no 'moov' box");
+		return -ENOENT;
+	}
+
+	ret = fstat(mp4->fd, &st);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("fstat", -ret);
+		return ret;
+	}
+
+	memset(header, 0, sizeof(*header));
+	header->magic = MP4_INDEX_MAGIC;
+	header->version = MP4_INDEX_VERSION;
+	header->abi = MP4_INDEX_ABI;
+	header->fileSize = mp4->fileSize;
+	header->fileTime = st.st_mtime;
+	mp4_index_file_time(&st, &header->fileTimeNsec);
+	header->moovOffset = mp4->moovOffset;
+	header->moovSize = mp4->moovSize;
+
+	return mp4_index_moov_hash(mp4, &header->moovHash);
+}
+
+
+static int mp4_index_write_track(struct mp4_index_writer *w,
+				 const struct mp4_track *tk)
+{
+	int ret = 0;
+	uint32_t metadataId = (tk->metadata != NULL) ? tk->metadata->id : 0;
+	uint32_t chaptersId = (tk->chapters != NULL) ? tk->chapters->id : 0;
+	const struct mp4_video_decoder_config *vdc = &tk->vdc;
+
+	INDEX_WRITE_VAL(w, tk->id);
+	INDEX_WRITE_VAL(w, tk->type);
+	INDEX_WRITE_VAL(w, tk->timescale);
+	INDEX_WRITE_VAL(w, tk->duration);
+	INDEX_WRITE_VAL(w, tk->creationTime);
+	INDEX_WRITE_VAL(w, tk->modificationTime);
+
+	/* Sample tables */
+	INDEX_WRITE_VAL(w, tk->sampleCount);
+	INDEX_WRITE_VAL(w, tk->sampleConstSize);
+	INDEX_WRITE_VAL(w, tk->sampleMaxSize);
+	INDEX_WRITE_TABLE(w,
+			  tk->sampleSize,
+			(uint64_t)tk->sampleCount * sizeof(*tk->sampleSize));
+	INDEX_WRITE_VAL(w, tk->chunkCount);
+	INDEX_WRITE_TABLE(w,
+			  tk->chunkOffset,
+			(uint64_t)tk->chunkCount * sizeof(*tk->chunkOffset));
+	INDEX_WRITE_VAL(w, tk->timeToSampleEntryCount);
+	INDEX_WRITE_TABLE(w,
+			  tk->timeToSampleEntries,
+			(uint64_t)tk->timeToSampleEntryCount *
+				sizeof(*tk->timeToSampleEntries));
+	INDEX_WRITE_VAL(w, tk->sampleToChunkEntryCount);
+	INDEX_WRITE_TABLE(w,
+			  tk->sampleToChunkEntries,
+			(uint64_t)tk->sampleToChunkEntryCount *
+				sizeof(*tk->sampleToChunkEntries));
+	INDEX_WRITE_VAL(w, tk->syncSampleEntryCount);
+	INDEX_WRITE_TABLE(w,
+			  tk->syncSampleEntries,
+			(uint64_t)tk->syncSampleEntryCount *
+				sizeof(*tk->syncSampleEntries));
+
+	/* Track references */
+	INDEX_WRITE_VAL(w, tk->referenceType);
+	INDEX_WRITE_VAL(w, tk->referenceTrackId);
+	INDEX_WRITE_VAL(w, tk->referenceTrackIdCount);
+	INDEX_WRITE_VAL(w, metadataId);
+	INDEX_WRITE_VAL(w, chaptersId);
+
+	/* Decoder configuration */
+	INDEX_WRITE_VAL(w, vdc->codec);
+	INDEX_WRITE_VAL(w, vdc->width);
+	INDEX_WRITE_VAL(w, vdc->height);
+	switch (vdc->codec) {
+	case MP4_VIDEO_CODEC_AVC:
+		INDEX_WRITE_PTR(w, vdc->avc.sps, vdc->avc.sps_size);
+		INDEX_WRITE_PTR(w, vdc->avc.pps, vdc->avc.pps_size);
+		break;
+	case MP4_VIDEO_CODEC_HEVC:
+		INDEX_WRITE_VAL(w, vdc->hevc.hvcc_info);
+		INDEX_WRITE_PTR(w, vdc->hevc.vps, vdc->hevc.vps_size);
+		INDEX_WRITE_PTR(w, vdc->hevc.sps, vdc->hevc.sps_size);
+		INDEX_WRITE_PTR(w, vdc->hevc.pps, vdc->hevc.pps_size);
+		break;
+	default:
+		break;
+	}
+	INDEX_WRITE_VAL(w, tk->audioCodec);
+	INDEX_WRITE_VAL(w, tk->audioChannelCount);
+	INDEX_WRITE_VAL(w, tk->audioSampleSize);
+	INDEX_WRITE_VAL(w, tk->audioSampleRate);
+	INDEX_WRITE_PTR(
+		w, tk->audioSpecificConfig, tk->audioSpecificConfigSize);
+
+	/* Metadata */
+	INDEX_WRITE_STR(w, tk->contentEncoding);
+	INDEX_WRITE_STR(w, tk->mimeFormat);
+	INDEX_WRITE_VAL(w, tk->staticMetadataCount);
+	for (unsigned int i = 0; i < tk->staticMetadataCount; i++) {
+		INDEX_WRITE_STR(w, tk->staticMetadataKey[i]);
+		INDEX_WRITE_STR(w, tk->staticMetadataValue[i]);
+	}
+	INDEX_WRITE_STR(w, tk->name);
+	INDEX_WRITE_VAL(w, tk->enabled);
+	INDEX_WRITE_VAL(w, tk->in_movie);
+	INDEX_WRITE_VAL(w, tk->in_preview);
+
+out:
+	return ret;
+}
+
+
+static int mp4_index_write_file(struct mp4_index_writer *w,
+				const struct mp4_file *mp4)
+{
+	int ret = 0;
+	const struct mp4_track *tk = NULL;
+
+	INDEX_WRITE_VAL(w, mp4->timescale);
+	INDEX_WRITE_VAL(w, mp4->duration);
+	INDEX_WRITE_VAL(w, mp4->creationTime);
+	INDEX_WRITE_VAL(w, mp4->modificationTime);
+
+	INDEX_WRITE_VAL(w, mp4->trackCount);
+	list_walk_entry_forward(&mp4->tracks, tk, node)
+	{
+		ret = mp4_index_write_track(w, tk);
+		if (ret < 0)
+			goto out;
+	}
+
+	INDEX_WRITE_VAL(w, mp4->chaptersCount);
+	for (unsigned int i = 0; i < mp4->chaptersCount; i++) {
+		INDEX_WRITE_VAL(w, mp4->chaptersTime[i]);
+		INDEX_WRITE_STR(w, mp4->chaptersName[i]);
+	}
+
+	/* Metadata and cover location, before selection of the final
+	 * values (see mp4_metadata_build) */
+	INDEX_WRITE_VAL(w, mp4->udtaMetadataCount);
+	for (unsigned int i = 0; i < mp4->udtaMetadataCount; i++) {
+		INDEX_WRITE_STR(w, mp4->udtaMetadataKey[i]);
+		INDEX_WRITE_STR(w, mp4->udtaMetadataValue[i]);
+	}
+	INDEX_WRITE_VAL(w, mp4->metaMetadataCount);
+	for (unsigned int i = 0; i < mp4->metaMetadataCount; i++) {
+		INDEX_WRITE_STR(w, mp4->metaMetadataKey[i]);
+		INDEX_WRITE_STR(w, mp4->metaMetadataValue[i]);
+	}
+	INDEX_WRITE_STR(w, mp4->udtaLocationKey);
+	INDEX_WRITE_STR(w, mp4->udtaLocationValue);
+	INDEX_WRITE_VAL(w, mp4->udtaCoverOffset);
+	INDEX_WRITE_VAL(w, mp4->udtaCoverSize);
+	INDEX_WRITE_VAL(w, mp4->udtaCoverType);
+	INDEX_WRITE_VAL(w, mp4->metaCoverOffset);
+	INDEX_WRITE_VAL(w, mp4->metaCoverSize);
+	INDEX_WRITE_VAL(w, mp4->metaCoverType);
+
+out:
+	return ret;
+}
+
+
+int mp4_index_write(const struct mp4_file *mp4, const char *filename)
+{
+	int ret;
+	int fd = -1;
+	struct mp4_index_writer writer = {0};
+	char *tmpFilename = NULL;
+	struct mp4_index_header header;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+	ULOG_ERRNO_RETURN_ERR_IF(mp4 == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(filename == NULL, EINVAL);
+
+	ret = mp4_index_header_fill(mp4, &header);
+	if (ret < 0)
+		return ret;
+
+	/* Write to a temporary file first, so that a partially written
+	 * index is never used */
+	ret = asprintf(&tmpFilename, "%s.%d.tmp", filename, (int)getpid());
+	if (ret < 0) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("asprintf", -ret);
+		return ret;
+	}
+
+#ifdef O_BINARY
+	flags |= O_BINARY;
+#endif
+	fd = open(tmpFilename, flags, 0644);
+	if (fd == -1) {
+		ret = -errno;
+		ULOG_ERRNO("open:'%s'", -ret, tmpFilename);
+		goto out;
+	}
+
+	writer.fd = fd;
+	INDEX_WRITE_VAL(&writer, header);
+	ret = mp4_index_write_file(&writer, mp4);
+	if (ret < 0)
+		goto out;
+
+	ret = close(fd);
+	fd = -1;
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("close", -ret);
+		goto out;
+	}
+
+	ret = rename(tmpFilename, filename);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("rename:'%s'", -ret, filename);
+		goto out;
+	}
+
+out:
+	if (fd >= 0)
+		close(fd);
+	if (ret < 0)
+		unlink(tmpFilename);
+	free(tmpFilename);
+	return ret;
+}
+
+
+static int mp4_index_check_header(struct mp4_file *mp4,
+				  struct mp4_index_reader *r)
+{
+	int ret;
+	struct stat st;
+	struct mp4_index_header header;
+	uint64_t moovHash;
+	int64_t fileTimeNsec;
+
+	ret = mp4_index_read_data(r, &header, sizeof(header));
+	if (ret < 0)
+		return ret;
+
+	if ((header.magic != MP4_INDEX_MAGIC) ||
+	    (header.version != MP4_INDEX_VERSION) ||
+	    (header.abi != MP4_INDEX_ABI)) {
+		ULOGI("unsupported index file format");
+		return -ESTALE;
+	}
+
+	ret = fstat(mp4->fd, &st);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("fstat", -ret);
+		return ret;
+	}
+	mp4_index_file_time(&st, &fileTimeNsec);
+	if ((header.fileSize != (uint64_t)mp4->fileSize) ||
+	    (header.fileTime != (int64_t)st.st_mtime) ||
+	    (header.fileTimeNsec != fileTimeNsec) ||
+	    (header.moovSize == 0) ||
+	    (header.moovOffset > (uint64_t)mp4->fileSize) ||
+	    (header.moovSize > (uint64_t)mp4->fileSize - header.moovOffset)) {
+		ULOGI("index file does not match the MP4 file");
+		return -ESTALE;
+	}
+
+	mp4->moovOffset = header.moovOffset;
+	mp4->moovSize = header.moovSize;
+	ret = mp4_index_moov_hash(mp4, &moovHash);
+	if (ret < 0)
+		return ret;
+	if (moovHash != header.moovHash) {
+		ULOGI("index file does not match the MP4 'moov' box");
+		return -ESTALE;
+	}
+
+	return 0;
+}
+
+
+static int mp4_index_read_track(struct mp4_index_reader *r,
+				struct mp4_track *tk,
+				uint32_t *metadataId,
+				uint32_t *chaptersId)
+{
+	int ret = 0;
+	uint64_t size;
+	struct mp4_video_decoder_config *vdc = &tk->vdc;
+
+	INDEX_READ_VAL(r, tk->id);
+	INDEX_READ_VAL(r, tk->type);
+	INDEX_READ_VAL(r, tk->timescale);
+	INDEX_READ_VAL(r, tk->duration);
+	INDEX_READ_VAL(r, tk->creationTime);
+	INDEX_READ_VAL(r, tk->modificationTime);
+
+	/* Sample tables, used in place */
+	tk->tablesInIndex = true;
+	INDEX_READ_VAL(r, tk->sampleCount);
+	INDEX_READ_VAL(r, tk->sampleConstSize);
+	INDEX_READ_VAL(r, tk->sampleMaxSize);
+	INDEX_READ_TABLE(r, tk->sampleSize, size);
+	if ((tk->sampleSize != NULL) &&
+	    (size != (uint64_t)tk->sampleCount * sizeof(*tk->sampleSize)))
+		goto invalid;
+	INDEX_READ_VAL(r, tk->chunkCount);
+	INDEX_READ_TABLE(r, tk->chunkOffset, size);
+	if (size != (uint64_t)tk->chunkCount * sizeof(*tk->chunkOffset))
+		goto invalid;
+	INDEX_READ_VAL(r, tk->timeToSampleEntryCount);
+	INDEX_READ_TABLE(r, tk->timeToSampleEntries, size);
+	if (size != (uint64_t)tk->timeToSampleEntryCount *
+			    sizeof(*tk->timeToSampleEntries))
+		goto invalid;
+	INDEX_READ_VAL(r, tk->sampleToChunkEntryCount);
+	INDEX_READ_TABLE(r, tk->sampleToChunkEntries, size);
+	if (size != (uint64_t)tk->sampleToChunkEntryCount *
+			    sizeof(*tk->sampleToChunkEntries))
+		goto invalid;
+	INDEX_READ_VAL(r, tk->syncSampleEntryCount);
+	INDEX_READ_TABLE(r, tk->syncSampleEntries, size);
+	if (size != (uint64_t)tk->syncSampleEntryCount *
+			    sizeof(*tk->syncSampleEntries))
+		goto invalid;
+
+	/* Track references */
+	INDEX_READ_VAL(r, tk->referenceType);
+	INDEX_READ_VAL(r, tk->referenceTrackId);
+	INDEX_READ_VAL(r, tk->referenceTrackIdCount);
+	if (tk->referenceTrackIdCount > MP4_TRACK_REF_MAX)
+		goto invalid;
+	INDEX_READ_VAL(r, *metadataId);
+	INDEX_READ_VAL(r, *chaptersId);
+
+	/* Decoder configuration */
+	INDEX_READ_VAL(r, vdc->codec);
+	INDEX_READ_VAL(r, vdc->width);
+	INDEX_READ_VAL(r, vdc->height);
+	switch (vdc->codec) {
+	case MP4_VIDEO_CODEC_AVC:
+		INDEX_READ_PTR(r, vdc->avc.sps, vdc->avc.sps_size);
+		INDEX_READ_PTR(r, vdc->avc.pps, vdc->avc.pps_size);
+		break;
+	case MP4_VIDEO_CODEC_HEVC:
+		INDEX_READ_VAL(r, vdc->hevc.hvcc_info);
+		INDEX_READ_PTR(r, vdc->hevc.vps, vdc->hevc.vps_size);
+		INDEX_READ_PTR(r, vdc->hevc.sps, vdc->hevc.sps_size);
+		INDEX_READ_PTR(r, vdc->hevc.pps, vdc->hevc.pps_size);
+		break;
+	default:
+		break;
+	}
+	INDEX_READ_VAL(r, tk->audioCodec);
+	INDEX_READ_VAL(r, tk->audioChannelCount);
+	INDEX_READ_VAL(r, tk->audioSampleSize);
+	INDEX_READ_VAL(r, tk->audioSampleRate);
+	INDEX_READ_PTR(r, tk->audioSpecificConfig, tk->audioSpecificConfigSize);
+
+	/* Metadata */
+	INDEX_READ_STR(r, tk->contentEncoding);
+	INDEX_READ_STR(r, tk->mimeFormat);
+	INDEX_READ_VAL(r, tk->staticMetadataCount);
+	if (tk->staticMetadataCount > 0) {
+		/* Bound the allocation by the remaining index data */
+		if (tk->staticMetadataCount > r->size - r->offset)
+			goto invalid;
+		tk->staticMetadataKey =
+			calloc(tk->staticMetadataCount, sizeof(char *));
+		tk->staticMetadataValue =
+			calloc(tk->staticMetadataCount, sizeof(char *));
+		if ((tk->staticMetadataKey == NULL) ||
+		    (tk->staticMetadataValue == NULL)) {
+			tk->staticMetadataCount = 0;
+			ret = -ENOMEM;
+			ULOG_ERRNO("calloc", -ret);
+			goto out;
+		}
+	}
+	for (unsigned int i = 0; i < tk->staticMetadataCount; i++) {
+		INDEX_READ_STR(r, tk->staticMetadataKey[i]);
+		INDEX_READ_STR(r, tk->staticMetadataValue[i]);
+	}
+	INDEX_READ_STR(r, tk->name);
+	INDEX_READ_VAL(r, tk->enabled);
+	INDEX_READ_VAL(r, tk->in_movie);
+	INDEX_READ_VAL(r, tk->in_preview);
+
+	/* Sample tables consistency is checked when building the runs */
+	return mp4_track_build_lookup_tables(tk);
+
+invalid:
+	ret = -EPROTO;
+	ULOGE("invalid index file track");
+out:
+	return ret;
+}
+
+
+static int mp4_index_read_metadata(struct mp4_index_reader *r,
+				   unsigned int *count,
+				   char ***keys,
+				   char ***values)
+{
+	int ret = 0;
+
+	INDEX_READ_VAL(r, *count);
+	if (*count == 0)
+		return 0;
+
+	if (*count > r->size - r->offset) {
+		*count = 0;
+		ULOGE("invalid index file metadata count");
+		return -EPROTO;
+	}
+	*keys = calloc(*count, sizeof(char *));
+	*values = calloc(*count, sizeof(char *));
+	if ((*keys == NULL) || (*values == NULL)) {
+		*count = 0;
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+	for (unsigned int i = 0; i < *count; i++) {
+		INDEX_READ_STR(r, (*keys)[i]);
+		INDEX_READ_STR(r, (*values)[i]);
+	}
+
+out:
+	return ret;
+}
+
+
+static int mp4_index_read_file(struct mp4_index_reader *r,
+			       struct mp4_file *mp4)
+{
+	int ret = 0;
+	unsigned int trackCount;
+	unsigned int chaptersCount;
+	unsigned int i = 0;
+	uint32_t *linkedTrackIds = NULL;
+	struct mp4_track *tk = NULL;
+
+	INDEX_READ_VAL(r, mp4->timescale);
+	INDEX_READ_VAL(r, mp4->duration);
+	INDEX_READ_VAL(r, mp4->creationTime);
+	INDEX_READ_VAL(r, mp4->modificationTime);
+
+	INDEX_READ_VAL(r, trackCount);
+	if (trackCount > r->size - r->offset)
+		goto invalid;
+
+	/* Metadata and chapters track IDs of each track, linked once all
+	 * tracks are known */
+	linkedTrackIds = calloc(2 * (size_t)trackCount + 1, sizeof(uint32_t));
+	if (linkedTrackIds == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		goto out;
+	}
+	for (i = 0; i < trackCount; i++) {
+		tk = mp4_track_add(mp4);
+		if (tk == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ret = mp4_index_read_track(r,
+					   tk,
+					   &linkedTrackIds[2 * i],
+					   &linkedTrackIds[2 * i + 1]);
+		if (ret < 0)
+			goto out;
+	}
+
+	i = 0;
+	list_walk_entry_forward(&mp4->tracks, tk, node)
+	{
+		uint32_t metadataId = linkedTrackIds[2 * i];
+		uint32_t chaptersId = linkedTrackIds[2 * i + 1];
+
+		if (metadataId != 0) {
+			tk->metadata = mp4_track_find_by_id(mp4, metadataId);
+			if (tk->metadata == NULL)
+				goto invalid;
+		}
+		if (chaptersId != 0) {
+			tk->chapters = mp4_track_find_by_id(mp4, chaptersId);
+			if (tk->chapters == NULL)
+				goto invalid;
+		}
+		i++;
+	}
+
+	INDEX_READ_VAL(r, chaptersCount);
+	if (chaptersCount > MP4_CHAPTERS_MAX)
+		goto invalid;
+	for (unsigned int i = 0; i < chaptersCount; i++) {
+		INDEX_READ_VAL(r, mp4->chaptersTime[i]);
+		INDEX_READ_STR(r, mp4->chaptersName[i]);
+		mp4->chaptersCount++;
+	}
+
+	ret = mp4_index_read_metadata(r,
+				      &mp4->udtaMetadataCount,
+				      &mp4->udtaMetadataKey,
+				      &mp4->udtaMetadataValue);
+	if (ret < 0)
+		goto out;
+	ret = mp4_index_read_metadata(r,
+				      &mp4->metaMetadataCount,
+				      &mp4->metaMetadataKey,
+				      &mp4->metaMetadataValue);
+	if (ret < 0)
+		goto out;
+	INDEX_READ_STR(r, mp4->udtaLocationKey);
+	INDEX_READ_STR(r, mp4->udtaLocationValue);
+	INDEX_READ_VAL(r, mp4->udtaCoverOffset);
+	INDEX_READ_VAL(r, mp4->udtaCoverSize);
+	INDEX_READ_VAL(r, mp4->udtaCoverType);
+	INDEX_READ_VAL(r, mp4->metaCoverOffset);
+	INDEX_READ_VAL(r, mp4->metaCoverSize);
+	INDEX_READ_VAL(r, mp4->metaCoverType);
+
+	if (r->offset != r->size)
+		goto invalid;
+
+	goto out;
+
+invalid:
+	ret = -EPROTO;
+	ULOGE("invalid index file");
+out:
+	free(linkedTrackIds);
+	return ret;
+}
+
+
+/* On error, the index stays loaded until mp4_index_unload() as the
+ * tracks already read may point into it */
+int mp4_index_load(struct mp4_file *mp4, const char *filename)
+{
+	int ret;
+	int fd;
+	struct stat st;
+	void *data = NULL;
+	struct mp4_index_reader reader = {0};
+	int flags = O_RDONLY;
+
+	ULOG_ERRNO_RETURN_ERR_IF(mp4 == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(filename == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(mp4->indexData != NULL, EBUSY);
+
+#ifdef O_BINARY
+	flags |= O_BINARY;
+#endif
+	fd = open(filename, flags);
+	if (fd == -1) {
+		ret = -errno;
+		if (ret != -ENOENT)
+			ULOG_ERRNO("open:'%s'", -ret, filename);
+		return ret;
+	}
+
+	ret = fstat(fd, &st);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("fstat", -ret);
+		goto out;
+	}
+	if ((uint64_t)st.st_size < sizeof(struct mp4_index_header) ||
+	    (uint64_t)st.st_size > SIZE_MAX) {
+		ULOGI("invalid index file size");
+		ret = -ESTALE;
+		goto out;
+	}
+	reader.size = (size_t)st.st_size;
+
+	/* Load the whole index at once; it is kept for the lifetime of the
+	 * tracks as their sample tables are used in place */
+#ifdef _WIN32
+	data = malloc(reader.size);
+	if (data == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("malloc", -ret);
+		goto out;
+	}
+	mp4->indexData = data;
+	mp4->indexSize = reader.size;
+	ssize_t count = mp4_pread(fd, data, reader.size, 0);
+	if ((count < 0) || ((size_t)count != reader.size)) {
+		ret = (count < 0) ? -errno : -ENODATA;
+		ULOG_ERRNO("pread", -ret);
+		goto out;
+	}
+#else
+	/* Private writable mapping: the few writes made when building the
+	 * lookup tables must not reach the file */
+	data = mmap(NULL,
+		    reader.size,
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE,
+		    fd,
+		    0);
+	if (data == MAP_FAILED) {
+		ret = -errno;
+		ULOG_ERRNO("mmap", -ret);
+		goto out;
+	}
+	mp4->indexData = data;
+	mp4->indexSize = reader.size;
+#endif
+	reader.data = data;
+
+	ret = mp4_index_check_header(mp4, &reader);
+	if (ret < 0)
+		goto out;
+
+	ret = mp4_index_read_file(&reader, mp4);
+	if (ret < 0)
+		goto out;
+
+	ULOGI("demuxer state loaded from index file '%s'", filename);
+
+out:
+	close(fd);
+	return ret;
+}
+
+
+void mp4_index_unload(struct mp4_file *mp4)
+{
+	if (mp4->indexData == NULL)
+		return;
+
+#ifdef _WIN32
+	free(mp4->indexData);
+#else
+	munmap(mp4->indexData, mp4->indexSize);
+#endif
+	mp4->indexData = NULL;
+	mp4->indexSize = 0;
+}
@@ -40,15 +40,11 @@
 #else
 #	include <windows.h>
 #endif
-#define MP4_MUX_TABLES_GROW_SIZE 128
+/* Initial number of block pointers of the muxer tables */
+#define MP4_MUX_TABLE_BLOCKS_INIT 16
 
 #ifdef _WIN32
 
-struct iovec {
-	void *iov_base;
-	size_t iov_len;
-};
-
 static ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 {
 	ssize_t total = 0, ret;
@@ -69,138 +65,434 @@ static ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 struct mp4_mux_track *mp4_mux_track_find_by_handle(const struct mp4_mux *mux,
 						   uint32_t track_handle)
 {
-	struct mp4_mux_track *_track = NULL;
-
-	if (track_handle > mux->track_count)
+	if (track_handle == 0 || track_handle > mux->track_count)
 		return NULL;
 
-	list_walk_entry_forward(&mux->tracks, _track, node)
-	{
-		if (_track->handle == track_handle)
-			return _track;
+	return mux->track_array[track_handle - 1];
+}
+
+
+int mp4_mux_table_reserve(struct mp4_mux_table *table,
+			  uint32_t new_entries,
+			  size_t entry_size)
+{
+	void **blocks;
+	uint32_t block_count = table->capacity >> MP4_MUX_TABLE_BLOCK_SHIFT;
+	uint32_t needed = (table->count + new_entries +
+			   MP4_MUX_TABLE_BLOCK_ENTRIES - 1) >>
+			  MP4_MUX_TABLE_BLOCK_SHIFT;
+	uint32_t nextcap = table->block_capacity;
+
+	if (needed <= block_count)
+		return 0;
+
+	/* Only the block pointers are moved */
+	if (needed > nextcap) {
+		if (nextcap == 0)
+			nextcap = MP4_MUX_TABLE_BLOCKS_INIT;
+		while (nextcap < needed)
+			nextcap *= 2;
+		blocks = realloc(table->blocks, nextcap * sizeof(*blocks));
+		if (blocks == NULL)
+			return -ENOMEM;
+		table->blocks = blocks;
+		table->block_capacity = nextcap;
 	}
-	return NULL;
+
+	while (block_count < needed) {
+		table->blocks[block_count] =
+			malloc(MP4_MUX_TABLE_BLOCK_ENTRIES * entry_size);
+		if (table->blocks[block_count] == NULL)
+			return -ENOMEM;
+		block_count++;
+		table->capacity += MP4_MUX_TABLE_BLOCK_ENTRIES;
+	}
+
+	return 0;
+}
+
+
+/* Entries of a table from index to the end of its block or of the table;
+ * the number of entries is returned through count */
+const void *mp4_mux_table_block(const struct mp4_mux_table *table,
+				uint32_t index,
+				size_t entry_size,
+				uint32_t *count)
+{
+	uint32_t block = index >> MP4_MUX_TABLE_BLOCK_SHIFT;
+	uint32_t first = index & (MP4_MUX_TABLE_BLOCK_ENTRIES - 1);
+
+	*count = MIN(MP4_MUX_TABLE_BLOCK_ENTRIES - first, table->count - index);
+	return (const uint8_t *)table->blocks[block] + first * entry_size;
+}
+
+
+void mp4_mux_table_clear(struct mp4_mux_table *table)
+{
+	uint32_t block_count = table->capacity >> MP4_MUX_TABLE_BLOCK_SHIFT;
+
+	for (uint32_t i = 0; i < block_count; i++)
+		free(table->blocks[i]);
+	free(table->blocks);
+	memset(table, 0, sizeof(*table));
 }
 
 
 int mp4_mux_grow_samples(struct mp4_mux_track *track, int new_samples)
 {
-	uint32_t *tmp;
-	uint64_t *tmp64;
+	return mp4_mux_table_reserve(&track->samples,
+				     new_samples,
+				     sizeof(struct mp4_mux_sample_entry));
+}
 
-	uint32_t nextcap = track->samples.capacity;
 
-	while (nextcap < track->samples.count + new_samples)
-		nextcap += MP4_MUX_TABLES_GROW_SIZE;
+int mp4_mux_grow_chunks(struct mp4_mux_track *track, int new_chunks)
+{
+	return mp4_mux_table_reserve(
+		&track->chunks, new_chunks, sizeof(uint64_t));
+}
 
-	if (nextcap == track->samples.capacity)
-		return 0;
 
-	tmp = realloc(track->samples.sizes, nextcap * sizeof(*tmp));
-	if (tmp == NULL)
-		return -ENOMEM;
-	track->samples.sizes = tmp;
+int mp4_mux_grow_tts(struct mp4_mux_track *track, int new_tts)
+{
+	return mp4_mux_table_reserve(&track->time_to_sample,
+				     new_tts,
+				     sizeof(struct mp4_time_to_sample_entry));
+}
 
-	tmp64 = realloc(track->samples.decoding_times,
-			nextcap * sizeof(*tmp64));
-	if (tmp64 == NULL)
-		return -ENOMEM;
-	track->samples.decoding_times = tmp64;
 
-	tmp64 = realloc(track->samples.offsets, nextcap * sizeof(*tmp64));
-	if (tmp64 == NULL)
-		return -ENOMEM;
-	track->samples.offsets = tmp64;
+int mp4_mux_grow_stc(struct mp4_mux_track *track, int new_stc)
+{
+	return mp4_mux_table_reserve(&track->sample_to_chunk,
+				     new_stc,
+				     sizeof(struct mp4_sample_to_chunk_entry));
+}
 
-	track->samples.capacity = nextcap;
-	return 0;
+
+int mp4_mux_grow_sync(struct mp4_mux_track *track, int new_sync)
+{
+	return mp4_mux_table_reserve(
+		&track->sync, new_sync, sizeof(uint32_t));
 }
 
 
-int mp4_mux_grow_chunks(struct mp4_mux_track *track, int new_chunks)
+static ssize_t
+mp4_mux_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset)
 {
-	uint64_t *tmp64;
+#ifdef _WIN32
+	if (lseek(fd, offset, SEEK_SET) == -1)
+		return -1;
+	return writev(fd, iov, iovcnt);
+#else
+	return pwritev(fd, iov, iovcnt, offset);
+#endif
+}
 
-	uint32_t nextcap = track->chunks.capacity;
 
-	while (nextcap < track->chunks.count + new_chunks)
-		nextcap += MP4_MUX_TABLES_GROW_SIZE;
+static int mp4_mux_check_written(const char *func, ssize_t written, size_t size)
+{
+	int ret;
 
-	if (nextcap == track->chunks.capacity)
+	if (written != -1 && (size_t)written == size)
 		return 0;
 
-	tmp64 = realloc(track->chunks.offsets, nextcap * sizeof(*tmp64));
-	if (tmp64 == NULL)
-		return -ENOMEM;
-	track->chunks.offsets = tmp64;
-
-	track->chunks.capacity = nextcap;
-	return 0;
+	ret = -errno;
+	if (written == -1) {
+		ULOG_ERRNO("%s", -ret, func);
+	} else {
+		ret = -ENOSPC;
+		ULOGE("%s: only %zu bytes written instead of %zu",
+		      func,
+		      (size_t)written,
+		      size);
+	}
+	return ret;
 }
 
 
-int mp4_mux_grow_tts(struct mp4_mux_track *track, int new_tts)
+/* Write the aligned blocks of the buffer with direct I/O and the unaligned
+ * tail through the page cache; the tail is moved to the start of the buffer
+ * and written again with its block once complete */
+static int mp4_mux_write_buffer_flush_direct(const struct mp4_mux *mux)
 {
-	struct mp4_time_to_sample_entry *tmp;
+	int ret;
+	ssize_t written;
+	struct mp4_mux_write_buffer *wb = mux->write_buffer;
+	size_t tail = wb->size % wb->block_size;
+	struct iovec iov;
+
+	iov.iov_base = wb->buf;
+	iov.iov_len = wb->size - tail;
+	if (iov.iov_len > 0) {
+		written = mp4_mux_pwritev(wb->fd, &iov, 1, wb->offset);
+		ret = mp4_mux_check_written("pwritev", written, iov.iov_len);
+		if (ret < 0)
+			return ret;
+		memmove(wb->buf, wb->buf + iov.iov_len, tail);
+		wb->offset += iov.iov_len;
+		wb->size = tail;
+		wb->written = 0;
+	}
 
-	uint32_t nextcap = track->time_to_sample.capacity;
+	if (tail <= wb->written)
+		return 0;
+
+	iov.iov_base = wb->buf + wb->written;
+	iov.iov_len = tail - wb->written;
+	written = mp4_mux_pwritev(
+		mux->fd, &iov, 1, wb->offset + (off_t)wb->written);
+	ret = mp4_mux_check_written("pwritev", written, iov.iov_len);
+	if (ret < 0)
+		return ret;
+	wb->written = tail;
+	return 0;
+}
 
-	while (nextcap < track->time_to_sample.count + new_tts)
-		nextcap += MP4_MUX_TABLES_GROW_SIZE;
 
-	if (nextcap == track->time_to_sample.capacity)
+static int mp4_mux_write_buffer_flush(const struct mp4_mux *mux)
+{
+	int ret;
+	ssize_t written;
+	struct mp4_mux_write_buffer *wb = mux->write_buffer;
+	struct iovec iov;
+
+	if (wb == NULL || wb->size == wb->written)
 		return 0;
 
-	tmp = realloc(track->time_to_sample.entries, nextcap * sizeof(*tmp));
-	if (tmp == NULL)
-		return -ENOMEM;
-	track->time_to_sample.entries = tmp;
+	if (wb->direct)
+		return mp4_mux_write_buffer_flush_direct(mux);
 
-	track->time_to_sample.capacity = nextcap;
+	iov.iov_base = wb->buf;
+	iov.iov_len = wb->size;
+	written = mp4_mux_pwritev(mux->fd, &iov, 1, wb->offset);
+	ret = mp4_mux_check_written("pwritev", written, wb->size);
+	if (ret < 0)
+		return ret;
+
+	wb->offset += wb->size;
+	wb->size = 0;
 	return 0;
 }
 
 
-int mp4_mux_grow_stc(struct mp4_mux_track *track, int new_stc)
+/* Write data at the end of the file, through the write buffer if enabled;
+ * the file offset of the data is returned through ret_offset */
+static int mp4_mux_write_data(const struct mp4_mux *mux,
+			      const struct iovec *iov,
+			      int iovcnt,
+			      size_t size,
+			      off_t *ret_offset)
 {
-	struct mp4_sample_to_chunk_entry *tmp;
+	int ret;
+	ssize_t written;
+	off_t offset;
+	size_t start;
+	size_t limit;
+	size_t len;
+	uint64_t now;
+	struct timespec ts;
+	struct mp4_mux_write_buffer *wb = mux->write_buffer;
+
+	if (wb == NULL) {
+		offset = lseek(mux->fd, 0, SEEK_CUR);
+		if (offset == -1) {
+			ret = -errno;
+			ULOG_ERRNO("lseek", -ret);
+			return ret;
+		}
+		written = writev(mux->fd, iov, iovcnt);
+		ret = mp4_mux_check_written("writev", written, size);
+		if (ret < 0) {
+			if (lseek(mux->fd, offset, SEEK_SET) == -1)
+				ULOG_ERRNO("lseek", errno);
+			return ret;
+		}
+		*ret_offset = offset;
+		return 0;
+	}
+
+	/* Write the buffered data if it is older than the maximum delay */
+	if (wb->size > wb->written && wb->max_delay != 0) {
+		time_get_monotonic(&ts);
+		time_timespec_to_us(&ts, &now);
+		if (now - wb->first_time >= wb->max_delay) {
+			ret = mp4_mux_write_buffer_flush(mux);
+			if (ret < 0)
+				return ret;
+		}
+	}
 
-	uint32_t nextcap = track->sample_to_chunk.capacity;
+	/* Data larger than the buffer is written directly, unless it must be
+	 * aligned for direct I/O */
+	if (size >= wb->capacity && !wb->direct) {
+		ret = mp4_mux_write_buffer_flush(mux);
+		if (ret < 0)
+			return ret;
+		written = mp4_mux_pwritev(mux->fd, iov, iovcnt, wb->offset);
+		ret = mp4_mux_check_written("pwritev", written, size);
+		if (ret < 0)
+			return ret;
+		*ret_offset = wb->offset;
+		wb->offset += size;
+		return 0;
+	}
 
-	while (nextcap < track->sample_to_chunk.count + new_stc)
-		nextcap += MP4_MUX_TABLES_GROW_SIZE;
+	if (wb->size == wb->written) {
+		time_get_monotonic(&ts);
+		time_timespec_to_us(&ts, &wb->first_time);
+	}
 
-	if (nextcap == track->sample_to_chunk.capacity)
+	/* The buffer is written when full; it is filled up to a block boundary
+	 * so that all writes but the first one are aligned (with direct I/O,
+	 * the first one is aligned too). */
+	start = wb->size;
+	*ret_offset = wb->offset + wb->size;
+	for (int i = 0; i < iovcnt; i++) {
+		const uint8_t *data = iov[i].iov_base;
+		size_t remaining = iov[i].iov_len;
+		while (remaining > 0) {
+			limit = wb->capacity - wb->offset % wb->block_size;
+			len = MIN(remaining, limit - wb->size);
+			memcpy(wb->buf + wb->size, data, len);
+			wb->size += len;
+			data += len;
+			remaining -= len;
+			if (wb->size < limit)
+				continue;
+			ret = mp4_mux_write_buffer_flush(mux);
+			if (ret < 0) {
+				/* Drop the part of the data already copied */
+				wb->size = start;
+				return ret;
+			}
+			start = 0;
+			time_get_monotonic(&ts);
+			time_timespec_to_us(&ts, &wb->first_time);
+		}
+	}
+
+	return 0;
+}
+
+
+static int mp4_mux_track_flush_chunk(const struct mp4_mux *mux,
+				     struct mp4_mux_track *track)
+{
+	int ret;
+	off_t offset;
+	uint32_t first_sample;
+	uint32_t count = track->pending_chunk.sample_count;
+	struct mp4_mux_sample_entry *sample;
+	struct mp4_sample_to_chunk_entry *entry;
+	struct iovec iov;
+
+	if (count == 0)
 		return 0;
 
-	tmp = realloc(track->sample_to_chunk.entries, nextcap * sizeof(*tmp));
-	if (tmp == NULL)
-		return -ENOMEM;
-	track->sample_to_chunk.entries = tmp;
+	ret = mp4_mux_grow_chunks(track, 1);
+	if (ret != 0) {
+		ULOG_ERRNO("mp4_mux_grow_chunks", -ret);
+		return ret;
+	}
+	ret = mp4_mux_grow_stc(track, 1);
+	if (ret != 0) {
+		ULOG_ERRNO("mp4_mux_grow_stc", -ret);
+		return ret;
+	}
+
+	iov.iov_base = track->pending_chunk.buf;
+	iov.iov_len = track->pending_chunk.size;
+	ret = mp4_mux_write_data(
+		mux, &iov, 1, track->pending_chunk.size, &offset);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_write_data", -ret);
+		return ret;
+	}
 
-	track->sample_to_chunk.capacity = nextcap;
+	MP4_MUX_TABLE_ENTRY(&track->chunks, uint64_t, track->chunks.count) =
+		offset;
+	track->chunks.count++;
+	first_sample = track->samples.count - count;
+	for (uint32_t i = first_sample; i < track->samples.count; i++) {
+		sample = &MP4_MUX_TABLE_ENTRY(
+			&track->samples, struct mp4_mux_sample_entry, i);
+		sample->offset = offset;
+		offset += sample->size;
+	}
+
+	/* Start a new 'sample_to_chunk' run if the number of samples per chunk
+	 * changes; the initial entry is not used by any chunk before the first
+	 * one is written and can be updated in place */
+	entry = &MP4_MUX_TABLE_ENTRY(&track->sample_to_chunk,
+				     struct mp4_sample_to_chunk_entry,
+				     track->sample_to_chunk.count - 1);
+	if (entry->samplesPerChunk != count) {
+		if (entry->firstChunk == track->chunks.count) {
+			entry->samplesPerChunk = count;
+		} else {
+			entry = &MP4_MUX_TABLE_ENTRY(
+				&track->sample_to_chunk,
+				struct mp4_sample_to_chunk_entry,
+				track->sample_to_chunk.count);
+			entry->firstChunk = track->chunks.count;
+			entry->samplesPerChunk = count;
+			entry->sampleDescriptionIndex = 1;
+			track->sample_to_chunk.count++;
+		}
+	}
+
+	track->pending_chunk.sample_count = 0;
+	track->pending_chunk.size = 0;
 	return 0;
 }
 
 
-int mp4_mux_grow_sync(struct mp4_mux_track *track, int new_sync)
+/* Remove the buffered samples that could not be written from the tables */
+static void mp4_mux_track_drop_pending_chunk(struct mp4_mux_track *track)
 {
-	uint32_t *tmp;
+	uint32_t count;
+
+	count = track->samples.count - track->pending_chunk.sample_count;
+	while (track->sync.count > 0 &&
+	       MP4_MUX_TABLE_ENTRY(&track->sync,
+				   uint32_t,
+				   track->sync.count - 1) > count)
+		track->sync.count--;
+	track->samples.count = count;
+	track->last_dts = 0;
+	if (count > 0) {
+		track->last_dts =
+			MP4_MUX_TABLE_ENTRY(&track->samples,
+					    struct mp4_mux_sample_entry,
+					    count - 1)
+				.decoding_time;
+	}
+	track->pending_chunk.sample_count = 0;
+	track->pending_chunk.size = 0;
+}
 
-	uint32_t nextcap = track->sync.capacity;
 
-	while (nextcap < track->sync.count + new_sync)
-		nextcap += MP4_MUX_TABLES_GROW_SIZE;
+/* Write the pending chunks and the content of the write buffer */
+static int mp4_mux_flush_data(struct mp4_mux *mux)
+{
+	int ret;
+	struct mp4_mux_track *track;
 
-	if (nextcap == track->sync.capacity)
-		return 0;
+	list_walk_entry_forward(&mux->tracks, track, node)
+	{
+		ret = mp4_mux_track_flush_chunk(mux, track);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_mux_track_flush_chunk", -ret);
+			return ret;
+		}
+	}
 
-	tmp = realloc(track->sync.entries, nextcap * sizeof(*tmp));
-	if (tmp == NULL)
-		return -ENOMEM;
-	track->sync.entries = tmp;
+	ret = mp4_mux_write_buffer_flush(mux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_write_buffer_flush", -ret);
+		return ret;
+	}
 
-	track->sync.capacity = nextcap;
 	return 0;
 }
 
@@ -214,6 +506,9 @@ int mp4_mux_track_compute_tts(const struct mp4_mux *mux,
 	uint64_t next_dts;
 	uint32_t diff;
 	uint32_t prev_diff;
+	uint32_t count;
+	const struct mp4_mux_sample_entry *samples;
+	struct mp4_time_to_sample_entry *entry = NULL;
 
 	if (track == NULL)
 		return 0;
@@ -228,41 +523,46 @@ int mp4_mux_track_compute_tts(const struct mp4_mux *mux,
 		return 0;
 
 	prev_diff = UINT32_MAX;
-	prev_dts = track->samples.decoding_times[0];
-	for (uint32_t i = 1; i < nsamples; i++) {
-		next_dts = track->samples.decoding_times[i];
-		diff = next_dts - prev_dts;
-		/* Convert to timescale */
-		track->duration_moov += mp4_convert_timescale(
-			diff, track->timescale, mux->timescale);
-		track->duration += diff;
-		if (diff != prev_diff) {
-			ret = mp4_mux_grow_tts(track, 1);
-			if (ret != 0)
-				return ret;
-			track->time_to_sample
-				.entries[track->time_to_sample.count]
-				.sampleCount = 1;
-			track->time_to_sample
-				.entries[track->time_to_sample.count]
-				.sampleDelta = diff;
-			track->time_to_sample.count++;
-		} else if (track->time_to_sample.count > 0) {
-			track->time_to_sample
-				.entries[track->time_to_sample.count - 1]
-				.sampleCount++;
-		}
-		prev_diff = diff;
-		prev_dts = next_dts;
+	prev_dts = MP4_MUX_TABLE_ENTRY(
+			   &track->samples, struct mp4_mux_sample_entry, 0)
+			   .decoding_time;
+	for (uint32_t i = 1; i < nsamples; i += count) {
+		samples = mp4_mux_table_block(
+			&track->samples, i, sizeof(*samples), &count);
+		for (uint32_t j = 0; j < count; j++) {
+			next_dts = samples[j].decoding_time;
+			diff = next_dts - prev_dts;
+			/* Convert to timescale */
+			track->duration_moov += mp4_convert_timescale(
+				diff, track->timescale, mux->timescale);
+			track->duration += diff;
+			if (diff != prev_diff) {
+				ret = mp4_mux_grow_tts(track, 1);
+				if (ret != 0)
+					return ret;
+				entry = &MP4_MUX_TABLE_ENTRY(
+					&track->time_to_sample,
+					struct mp4_time_to_sample_entry,
+					track->time_to_sample.count);
+				entry->sampleCount = 1;
+				entry->sampleDelta = diff;
+				track->time_to_sample.count++;
+			} else if (track->time_to_sample.count > 0) {
+				entry->sampleCount++;
+			}
+			prev_diff = diff;
+			prev_dts = next_dts;
+		}
 	}
 	/* Add a final zero-length entry */
 	ret = mp4_mux_grow_tts(track, 1);
 	if (ret != 0)
 		return ret;
-	track->time_to_sample.entries[track->time_to_sample.count].sampleCount =
-		1;
-	track->time_to_sample.entries[track->time_to_sample.count].sampleDelta =
-		0;
+	entry = &MP4_MUX_TABLE_ENTRY(&track->time_to_sample,
+				     struct mp4_time_to_sample_entry,
+				     track->time_to_sample.count);
+	entry->sampleCount = 1;
+	entry->sampleDelta = 0;
 	track->time_to_sample.count++;
 
 	return 0;
@@ -279,17 +579,16 @@ static void mp4_mux_track_destroy(struct mp4_mux_track *track)
 
 	list_del(&track->node);
 	/* Samples */
-	free(track->samples.sizes);
-	free(track->samples.decoding_times);
-	free(track->samples.offsets);
+	mp4_mux_table_clear(&track->samples);
 	/* Chunks */
-	free(track->chunks.offsets);
+	mp4_mux_table_clear(&track->chunks);
+	free(track->pending_chunk.buf);
 	/* 'time_to_sample' */
-	free(track->time_to_sample.entries);
+	mp4_mux_table_clear(&track->time_to_sample);
 	/* 'sample_to_chunk' */
-	free(track->sample_to_chunk.entries);
+	mp4_mux_table_clear(&track->sample_to_chunk);
 	/* 'sync' */
-	free(track->sync.entries);
+	mp4_mux_table_clear(&track->sync);
 	/* cover of the track*/
 	free(track->track_metadata.cover);
 
@@ -331,6 +630,9 @@ static void mp4_mux_free(struct mp4_mux *mux)
 	if (mux == NULL)
 		return;
 
+	/* The writer thread uses the file and the tracks */
+	(void)mp4_mux_async_destroy(mux->async);
+
 	if (mux->fd != -1)
 		close(mux->fd);
 
@@ -341,6 +643,15 @@ static void mp4_mux_free(struct mp4_mux *mux)
 		mp4_mux_track_destroy(track);
 	}
 
+	free(mux->track_array);
+
+	if (mux->write_buffer != NULL) {
+		if (mux->write_buffer->direct)
+			close(mux->write_buffer->fd);
+		free(mux->write_buffer->buf);
+		free(mux->write_buffer);
+	}
+
 	list_walk_entry_forward_safe(&mux->metadatas, meta, mtmp, node)
 	{
 		free(meta->key);
@@ -513,6 +824,123 @@ static int allocate_file_space(int fd, off_t size)
 }
 
 
+/* Open the file for writing with direct I/O */
+static int mp4_mux_open_direct(const char *filename, int *ret_fd)
+{
+	int ret;
+	int fd;
+
+#if defined(O_DIRECT)
+	fd = open(filename, O_WRONLY | O_DIRECT);
+	if (fd == -1) {
+		ret = -errno;
+		ULOG_ERRNO("open:'%s'", -ret, filename);
+		return ret;
+	}
+#elif defined(F_NOCACHE)
+	fd = open(filename, O_WRONLY);
+	if (fd == -1) {
+		ret = -errno;
+		ULOG_ERRNO("open:'%s'", -ret, filename);
+		return ret;
+	}
+	if (fcntl(fd, F_NOCACHE, 1) == -1) {
+		ret = -errno;
+		ULOG_ERRNO("fcntl:F_NOCACHE", -ret);
+		close(fd);
+		return ret;
+	}
+#else
+	(void)fd;
+	ret = -ENOTSUP;
+	ULOGE("direct I/O is not supported on this platform");
+	return ret;
+#endif
+
+	*ret_fd = fd;
+	return 0;
+}
+
+
+static int mp4_mux_write_buffer_create(struct mp4_mux *mux,
+				       const struct mp4_mux_config *config)
+{
+	int ret;
+	size_t block_size = MP4_MUX_DEFAULT_BLOCK_SIZE;
+	struct mp4_mux_write_buffer *wb;
+#ifndef _WIN32
+	struct stat st;
+
+	if (fstat(mux->fd, &st) == 0 && st.st_blksize > 0)
+		block_size = st.st_blksize;
+#endif
+
+	wb = calloc(1, sizeof(*wb));
+	if (wb == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		return ret;
+	}
+
+	wb->block_size = block_size;
+	wb->capacity = (config->write_buffer.size + block_size - 1) /
+		       block_size * block_size;
+	wb->max_delay = (uint64_t)config->write_buffer.max_delay_ms * 1000;
+	wb->direct = config->write_buffer.direct_io;
+	wb->fd = -1;
+#ifndef _WIN32
+	if (wb->direct) {
+		ret = -posix_memalign(
+			(void **)&wb->buf, block_size, wb->capacity);
+		if (ret < 0) {
+			ULOG_ERRNO("posix_memalign", -ret);
+			goto error;
+		}
+	}
+#endif
+	if (wb->buf == NULL) {
+		wb->buf = malloc(wb->capacity);
+		if (wb->buf == NULL) {
+			ret = -ENOMEM;
+			ULOG_ERRNO("malloc", -ret);
+			goto error;
+		}
+	}
+
+	/* The data starts at the current position, after the mdat header */
+	wb->offset = lseek(mux->fd, 0, SEEK_CUR);
+	if (wb->offset == -1) {
+		ret = -errno;
+		ULOG_ERRNO("lseek", -ret);
+		goto error;
+	}
+
+	if (wb->direct) {
+		/* Start the data on the next block so that the blocks written
+		 * with direct I/O never contain the mdat header, which is
+		 * rewritten through the page cache; the gap is part of the
+		 * mdat box and is not referenced by any sample */
+		wb->offset = (wb->offset + block_size - 1) / block_size *
+			     block_size;
+		ret = mp4_mux_open_direct(mux->filename, &wb->fd);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_mux_open_direct:'%s'",
+				   -ret,
+				   mux->filename);
+			goto error;
+		}
+	}
+
+	mux->write_buffer = wb;
+	return 0;
+
+error:
+	free(wb->buf);
+	free(wb);
+	return ret;
+}
+
+
 MP4_API int mp4_mux_open(const struct mp4_mux_config *config,
 			 struct mp4_mux **ret_obj)
 {
@@ -534,6 +962,9 @@ MP4_API int mp4_mux_open(const struct mp4_mux_config *config,
 	ULOG_ERRNO_RETURN_ERR_IF(
 		mp4_validate_str_len(config->filename, PATH_MAX) == 0, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(config->tables_size_mbytes == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->write_buffer.direct_io &&
+					 config->write_buffer.size == 0,
+				 EINVAL);
 
 	if (config->recovery.tables_file != NULL)
 		recovery_enabled = true;
@@ -565,6 +996,8 @@ MP4_API int mp4_mux_open(const struct mp4_mux_config *config,
 	mux->modification_time =
 		config->modification_time + MP4_MAC_TO_UNIX_EPOCH_OFFSET;
 	mux->timescale = config->timescale;
+	mux->chunk.max_duration = config->chunk.max_duration;
+	mux->chunk.max_size = config->chunk.max_size;
 
 	mux->data_offset = config->tables_size_mbytes * 1024 * 1024;
 
@@ -613,6 +1046,25 @@ MP4_API int mp4_mux_open(const struct mp4_mux_config *config,
 		goto error;
 	}
 
+	if (config->write_buffer.size != 0) {
+		ret = mp4_mux_write_buffer_create(mux, config);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_mux_write_buffer_create", -ret);
+			goto error;
+		}
+	}
+
+	if (config->async.enabled) {
+		ret = mp4_mux_async_new(mux,
+					config->async.queue_size,
+					config->async.policy,
+					&mux->async);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_mux_async_new", -ret);
+			goto error;
+		}
+	}
+
 	*ret_obj = mux;
 	if (recovery_enabled) {
 		/* tables file to record tables */
@@ -1281,11 +1733,26 @@ MP4_API int mp4_mux_sync(struct mp4_mux *mux, bool write_tables)
 
 	ULOG_ERRNO_RETURN_ERR_IF(mux == NULL, EINVAL);
 
+	/* Write the samples queued so far first */
+	ret = mp4_mux_async_drain(mux->async);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_async_drain", -ret);
+		return ret;
+	}
+
+	mp4_mux_async_lock(mux->async);
+
+	ret = mp4_mux_flush_data(mux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_flush_data", -ret);
+		goto out;
+	}
+
 	if (mux->recovery.tables_file != NULL) {
 		ret = mp4_mux_incremental_sync(mux);
 		if (ret < 0) {
 			ULOG_ERRNO("mp4_mux_incremental_sync", -ret);
-			return ret;
+			goto out;
 		}
 	}
 
@@ -1293,24 +1760,50 @@ MP4_API int mp4_mux_sync(struct mp4_mux *mux, bool write_tables)
 		ret = mp4_mux_sync_internal(mux, false);
 		if (ret < 0) {
 			ULOG_ERRNO("mp4_mux_sync_internal", -ret);
-			return ret;
+			goto out;
 		}
 	}
 
-	return 0;
+out:
+	mp4_mux_async_unlock(mux->async);
+	return ret;
 }
 
 
 MP4_API int mp4_mux_close(struct mp4_mux *mux)
 {
 	int ret = 0;
+	int err;
+	struct mp4_mux_track *track;
+
 	if (mux == NULL)
 		return 0;
 
-	ret = mp4_mux_sync_internal(mux, true);
-	if (ret < 0) {
+	/* Write the queued samples and stop the writer thread; the first
+	 * error of the following steps is returned */
+	ret = mp4_mux_async_destroy(mux->async);
+	mux->async = NULL;
+	if (ret < 0)
+		ULOG_ERRNO("mp4_mux_async_destroy", -ret);
+
+	err = mp4_mux_flush_data(mux);
+	if (err < 0) {
+		ULOG_ERRNO("mp4_mux_flush_data", -err);
+		if (ret == 0)
+			ret = err;
+		/* Do not reference unwritten data in the tables */
+		list_walk_entry_forward(&mux->tracks, track, node)
+		{
+			mp4_mux_track_drop_pending_chunk(track);
+		}
+	}
+
+	err = mp4_mux_sync_internal(mux, true);
+	if (err < 0) {
 		mux->recovery.failed_in_close = true;
-		ULOG_ERRNO("mp4_mux_sync_internal", -ret);
+		ULOG_ERRNO("mp4_mux_sync_internal", -err);
+		if (ret == 0)
+			ret = err;
 	}
 
 	mp4_mux_free(mux);
@@ -1323,6 +1816,8 @@ MP4_API int mp4_mux_add_track(struct mp4_mux *mux,
 {
 	int ret;
 	struct mp4_mux_track *track;
+	struct mp4_mux_track **array;
+	struct mp4_sample_to_chunk_entry *stc;
 
 	ULOG_ERRNO_RETURN_ERR_IF(mux == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(params == NULL, EINVAL);
@@ -1334,6 +1829,16 @@ MP4_API int mp4_mux_add_track(struct mp4_mux *mux,
 			params->type != MP4_TRACK_TYPE_CHAPTERS,
 		EINVAL);
 
+	/* The writer thread looks up the tracks */
+	mp4_mux_async_lock(mux->async);
+	array = realloc(mux->track_array,
+			(mux->track_count + 1) * sizeof(*mux->track_array));
+	if (array != NULL)
+		mux->track_array = array;
+	mp4_mux_async_unlock(mux->async);
+	if (!array)
+		return -ENOMEM;
+
 	track = calloc(1, sizeof(*track));
 	if (!track)
 		return -ENOMEM;
@@ -1351,9 +1856,11 @@ MP4_API int mp4_mux_add_track(struct mp4_mux *mux,
 	ret = mp4_mux_grow_stc(track, 1);
 	if (ret != 0)
 		goto error;
-	track->sample_to_chunk.entries[0].firstChunk = 1;
-	track->sample_to_chunk.entries[0].samplesPerChunk = 1;
-	track->sample_to_chunk.entries[0].sampleDescriptionIndex = 1;
+	stc = &MP4_MUX_TABLE_ENTRY(
+		&track->sample_to_chunk, struct mp4_sample_to_chunk_entry, 0);
+	stc->firstChunk = 1;
+	stc->samplesPerChunk = 1;
+	stc->sampleDescriptionIndex = 1;
 	track->sample_to_chunk.count = 1;
 
 	track->timescale = params->timescale;
@@ -1362,9 +1869,18 @@ MP4_API int mp4_mux_add_track(struct mp4_mux *mux,
 	track->modification_time =
 		params->modification_time + MP4_MAC_TO_UNIX_EPOCH_OFFSET;
 
+	/* The samples are checked when queued */
+	ret = mp4_mux_async_add_track(
+		mux->async, mux->track_count + 1, track->type);
+	if (ret != 0)
+		goto error;
+
+	mp4_mux_async_lock(mux->async);
 	list_add_before(&mux->tracks, &track->node);
+	mux->track_array[mux->track_count] = track;
 	mux->track_count++;
 	track->handle = mux->track_count;
+	mp4_mux_async_unlock(mux->async);
 
 	list_init(&track->metadatas);
 
@@ -1726,26 +2242,104 @@ MP4_API int mp4_mux_track_add_sample(const struct mp4_mux *mux,
 }
 
 
-MP4_API int mp4_mux_track_add_scattered_sample(
-	const struct mp4_mux *mux,
-	int track_handle,
-	const struct mp4_mux_scattered_sample *sample)
+static int
+mp4_mux_track_buffer_sample(const struct mp4_mux *mux,
+			    struct mp4_mux_track *track,
+			    const struct mp4_mux_scattered_sample *sample,
+			    size_t size)
+{
+	int ret;
+	uint8_t *buf;
+	size_t capacity;
+	uint64_t max_duration;
+	struct mp4_mux_sample_entry *entry;
+	bool sync = sample->sync && track->type == MP4_TRACK_TYPE_VIDEO;
+
+	/* Write the current chunk if the sample does not fit in */
+	if (track->pending_chunk.sample_count > 0) {
+		max_duration = mp4_usec_to_sample_time(mux->chunk.max_duration,
+						       track->timescale);
+		if ((mux->chunk.max_duration != 0 &&
+		     (uint64_t)sample->dts - track->pending_chunk.first_dts >=
+			     max_duration) ||
+		    (mux->chunk.max_size != 0 &&
+		     track->pending_chunk.size + size > mux->chunk.max_size)) {
+			ret = mp4_mux_track_flush_chunk(mux, track);
+			if (ret < 0) {
+				ULOG_ERRNO("mp4_mux_track_flush_chunk", -ret);
+				return ret;
+			}
+		}
+	}
+
+	/* Grow arrays if needed */
+	ret = mp4_mux_grow_samples(track, 1);
+	if (ret != 0) {
+		ULOG_ERRNO("mp4_mux_grow_samples", -ret);
+		return ret;
+	}
+	if (sync) {
+		ret = mp4_mux_grow_sync(track, 1);
+		if (ret != 0) {
+			ULOG_ERRNO("mp4_mux_grow_sync", -ret);
+			return ret;
+		}
+	}
+	if (track->pending_chunk.size + size > track->pending_chunk.capacity) {
+		capacity = MAX(track->pending_chunk.size + size,
+			       2 * track->pending_chunk.capacity);
+		buf = realloc(track->pending_chunk.buf, capacity);
+		if (buf == NULL) {
+			ret = -ENOMEM;
+			ULOG_ERRNO("realloc", -ret);
+			return ret;
+		}
+		track->pending_chunk.buf = buf;
+		track->pending_chunk.capacity = capacity;
+	}
+
+	buf = track->pending_chunk.buf + track->pending_chunk.size;
+	for (int i = 0; i < sample->nbuffers; i++) {
+		memcpy(buf, sample->buffers[i], sample->len[i]);
+		buf += sample->len[i];
+	}
+
+	if (track->pending_chunk.sample_count == 0)
+		track->pending_chunk.first_dts = sample->dts;
+	track->pending_chunk.sample_count++;
+	track->pending_chunk.size += size;
+
+	/* The offset is known once the chunk is written */
+	entry = &MP4_MUX_TABLE_ENTRY(&track->samples,
+				     struct mp4_mux_sample_entry,
+				     track->samples.count);
+	entry->size = size;
+	entry->decoding_time = sample->dts;
+	entry->offset = 0;
+	track->samples.count++;
+	if (sync) {
+		MP4_MUX_TABLE_ENTRY(&track->sync, uint32_t, track->sync.count) =
+			track->samples.count;
+		track->sync.count++;
+	}
+	track->last_dts = sample->dts;
+
+	return 0;
+}
+
+
+int mp4_mux_track_write_sample(const struct mp4_mux *mux,
+			       int track_handle,
+			       const struct mp4_mux_scattered_sample *sample)
 {
 	int ret = 0;
 	struct mp4_mux_track *track;
+	struct mp4_mux_sample_entry *entry;
 	struct iovec stack_iov[MP4_DEFAULT_BUFFER_COUNT];
 	struct iovec *iov = stack_iov;
-	ssize_t written;
 	ssize_t total_size = 0;
 	off_t offset = 0;
 
-	ULOG_ERRNO_RETURN_ERR_IF(mux == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(track_handle == 0, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(sample == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(sample->nbuffers < 1, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(sample->buffers == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(sample->len == NULL, EINVAL);
-
 	if (sample->nbuffers > MP4_DEFAULT_BUFFER_COUNT) {
 		iov = calloc(sample->nbuffers, sizeof(*iov));
 		if (!iov) {
@@ -1786,6 +2380,14 @@ MP4_API int mp4_mux_track_add_scattered_sample(
 	      track_handle,
 	      track->type);
 
+	if (mux->chunk.max_duration != 0 || mux->chunk.max_size != 0) {
+		ret = mp4_mux_track_buffer_sample(
+			mux, track, sample, total_size);
+		if (ret < 0)
+			ULOG_ERRNO("mp4_mux_track_buffer_sample", -ret);
+		goto out;
+	}
+
 	/* Grow arrays if needed */
 	ret = mp4_mux_grow_samples(track, 1);
 	if (ret != 0) {
@@ -1798,46 +2400,32 @@ MP4_API int mp4_mux_track_add_scattered_sample(
 		goto out;
 	}
 
-	offset = lseek(mux->fd, 0, SEEK_CUR);
-	if (offset == -1) {
-		ret = -errno;
-		ULOG_ERRNO("lseek", -ret);
-		goto out;
-	}
-
-	track->samples.sizes[track->samples.count] = total_size;
-	track->samples.decoding_times[track->samples.count] = sample->dts;
-	track->samples.offsets[track->samples.count] = offset;
-
-	track->chunks.offsets[track->chunks.count] = offset;
-
 	if (sample->sync && track->type == MP4_TRACK_TYPE_VIDEO) {
 		ret = mp4_mux_grow_sync(track, 1);
 		if (ret != 0) {
 			ULOG_ERRNO("mp4_mux_grow_sync", -ret);
 			goto out;
 		}
-		track->sync.entries[track->sync.count] =
+		MP4_MUX_TABLE_ENTRY(&track->sync, uint32_t, track->sync.count) =
 			track->samples.count + 1;
 	}
 
-	written = writev(mux->fd, iov, sample->nbuffers);
-	if (written == -1 || written < total_size) {
-		ret = -errno;
-		if (written == -1) {
-			ULOG_ERRNO("writev", -ret);
-		} else {
-			ret = -ENOSPC;
-			ULOGE("writev: only %zu bytes written instead of %zu",
-			      (size_t)written,
-			      (size_t)total_size);
-		}
-		offset = lseek(mux->fd, offset, SEEK_SET);
-		if (offset == -1)
-			ULOG_ERRNO("lseek", errno);
+	ret = mp4_mux_write_data(
+		mux, iov, sample->nbuffers, total_size, &offset);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_write_data", -ret);
 		goto out;
 	}
 
+	entry = &MP4_MUX_TABLE_ENTRY(&track->samples,
+				     struct mp4_mux_sample_entry,
+				     track->samples.count);
+	entry->size = total_size;
+	entry->decoding_time = sample->dts;
+	entry->offset = offset;
+
+	MP4_MUX_TABLE_ENTRY(&track->chunks, uint64_t, track->chunks.count) =
+		offset;
 
 	track->samples.count++;
 	track->chunks.count++;
@@ -1852,12 +2440,84 @@ out:
 }
 
 
+MP4_API int mp4_mux_track_add_scattered_sample(
+	const struct mp4_mux *mux,
+	int track_handle,
+	const struct mp4_mux_scattered_sample *sample)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(mux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_handle == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample->nbuffers < 1, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample->buffers == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample->len == NULL, EINVAL);
+
+	if (mux->async != NULL)
+		return mp4_mux_async_queue(
+			mux->async, track_handle, sample, NULL, NULL);
+
+	return mp4_mux_track_write_sample(mux, track_handle, sample);
+}
+
+
+MP4_API int mp4_mux_track_add_sample_owned(const struct mp4_mux *mux,
+					   int track_handle,
+					   const struct mp4_mux_sample *sample,
+					   mp4_mux_sample_release_t release,
+					   void *userdata)
+{
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(release == NULL, EINVAL);
+	if (mux == NULL || track_handle == 0 || sample == NULL ||
+	    sample->buffer == NULL || sample->len == 0) {
+		ret = -EINVAL;
+		ULOG_ERRNO("invalid arguments", -ret);
+		if (sample != NULL)
+			release(sample->buffer, userdata);
+		return ret;
+	}
+
+	const struct mp4_mux_scattered_sample sample_ = {
+		.buffers = &sample->buffer,
+		.len = &sample->len,
+		.nbuffers = 1,
+		.dts = sample->dts,
+		.sync = sample->sync,
+	};
+
+	if (mux->async != NULL)
+		return mp4_mux_async_queue(
+			mux->async, track_handle, &sample_, release, userdata);
+
+	ret = mp4_mux_track_write_sample(mux, track_handle, &sample_);
+	release(sample->buffer, userdata);
+	return ret;
+}
+
+
+MP4_API int mp4_mux_get_async_stats(const struct mp4_mux *mux,
+				    struct mp4_mux_async_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(mux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	if (mux->async == NULL)
+		return -EPERM;
+
+	mp4_mux_async_get_stats(mux->async, stats);
+	return 0;
+}
+
+
 MP4_API void mp4_mux_dump(struct mp4_mux *mux)
 {
 	struct mp4_mux_track *track;
 
 	ULOG_ERRNO_RETURN_IF(mux == NULL, EINVAL);
 
+	mp4_mux_async_lock(mux->async);
+
 	ULOGI("object MUX dump:");
 	if (!mux) {
 		ULOGI("NULL");
@@ -1893,11 +2553,16 @@ MP4_API void mp4_mux_dump(struct mp4_mux *mux)
 		      track->samples.count,
 		      track->samples.capacity);
 		for (uint32_t i = 0; i < track->samples.count; i++) {
+			const struct mp4_mux_sample_entry *sample =
+				&MP4_MUX_TABLE_ENTRY(
+					&track->samples,
+					struct mp4_mux_sample_entry,
+					i);
 			ULOGI("      - size:%10" PRIu32 ", offset:%10" PRIu64
 			      ", dts:%10" PRIu64,
-			      track->samples.sizes[i],
-			      track->samples.offsets[i],
-			      track->samples.decoding_times[i]);
+			      sample->size,
+			      sample->offset,
+			      sample->decoding_time);
 		}
 		ULOGI("    }");
 		ULOGI("    - chunks[%d/%d]: {",
@@ -1905,28 +2570,37 @@ MP4_API void mp4_mux_dump(struct mp4_mux *mux)
 		      track->chunks.capacity);
 		for (uint32_t i = 0; i < track->chunks.count; i++) {
 			ULOGI("      - offset:%" PRIu64,
-			      track->chunks.offsets[i]);
+			      MP4_MUX_TABLE_ENTRY(&track->chunks, uint64_t, i));
 		}
 		ULOGI("    }");
 		ULOGI("    - time_to_sample[%d/%d]: {",
 		      track->time_to_sample.count,
 		      track->time_to_sample.capacity);
 		for (uint32_t i = 0; i < track->time_to_sample.count; i++) {
+			const struct mp4_time_to_sample_entry *tts =
+				&MP4_MUX_TABLE_ENTRY(
+					&track->time_to_sample,
+					struct mp4_time_to_sample_entry,
+					i);
 			ULOGI("      - count:%" PRIu32 ", delta:%" PRIu32,
-			      track->time_to_sample.entries[i].sampleCount,
-			      track->time_to_sample.entries[i].sampleDelta);
+			      tts->sampleCount,
+			      tts->sampleDelta);
 		}
 		ULOGI("    }");
 		ULOGI("    - sample_to_chunk[%d/%d]: {",
 		      track->sample_to_chunk.count,
 		      track->sample_to_chunk.capacity);
 		for (uint32_t i = 0; i < track->sample_to_chunk.count; i++) {
+			const struct mp4_sample_to_chunk_entry *stc =
+				&MP4_MUX_TABLE_ENTRY(
+					&track->sample_to_chunk,
+					struct mp4_sample_to_chunk_entry,
+					i);
 			ULOGI("      - firstChunk:%" PRIu32 ", count:%" PRIu32
 			      ", desc:%" PRIu32,
-			      track->sample_to_chunk.entries[i].firstChunk,
-			      track->sample_to_chunk.entries[i].samplesPerChunk,
-			      track->sample_to_chunk.entries[i]
-				      .sampleDescriptionIndex);
+			      stc->firstChunk,
+			      stc->samplesPerChunk,
+			      stc->sampleDescriptionIndex);
 		}
 		ULOGI("    }");
 		ULOGI("    - sync[%d/%d]: {",
@@ -1934,7 +2608,7 @@ MP4_API void mp4_mux_dump(struct mp4_mux *mux)
 		      track->sync.capacity);
 		for (uint32_t i = 0; i < track->sync.count; i++) {
 			ULOGI("      - sample:%" PRIu32,
-			      track->sync.entries[i]);
+			      MP4_MUX_TABLE_ENTRY(&track->sync, uint32_t, i));
 		}
 		ULOGI("    }");
 		ULOGI("  }");
@@ -1952,4 +2626,6 @@ MP4_API void mp4_mux_dump(struct mp4_mux *mux)
 		      meta->storage);
 	}
 	ULOGI("}");
+
+	mp4_mux_async_unlock(mux->async);
 }
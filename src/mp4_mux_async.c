@@ -0,0 +1,475 @@
+/**
+ * Copyright (c) 2026 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Asynchronous muxer: the samples are queued in a bounded ring and written
+ * by a dedicated thread. Each queue entry keeps its buffer from one sample
+ * to the next, so copied samples do not allocate once the buffers have
+ * grown to the largest sample size. The queue lock is only held to reserve
+ * and release entries, never during copies or writes; the writer thread
+ * holds the I/O lock while writing a sample, which the muxer functions
+ * changing the tables or the file also take.
+ */
+
+#include "mp4_priv.h"
+
+#include <pthread.h>
+
+
+#define MP4_MUX_ASYNC_DEFAULT_QUEUE_SIZE 64
+
+
+struct mp4_mux_async_entry {
+	int track_handle;
+	int sync;
+	int64_t dts;
+	/* Sample data: copy in buf or buffer owned until released */
+	const uint8_t *data;
+	size_t len;
+	mp4_mux_sample_release_t release;
+	void *userdata;
+	uint8_t *buf;
+	size_t buf_size;
+	/* Set once the data is filled in; a skipped entry is not written */
+	bool ready;
+	bool skip;
+	uint64_t queue_time;
+};
+
+
+/* Track state checked when queueing, indexed by handle - 1 */
+struct mp4_mux_async_track {
+	enum mp4_track_type type;
+	/* DTS of the last queued sample */
+	int64_t last_dts;
+	/* Samples are dropped up to the next sync sample */
+	bool dropping;
+};
+
+
+struct mp4_mux_async {
+	const struct mp4_mux *mux;
+	enum mp4_mux_async_policy policy;
+	pthread_t thread;
+	pthread_mutex_t io_mutex;
+
+	/* Protected by mutex */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_ready;
+	pthread_cond_t cond_done;
+	struct mp4_mux_async_entry *entries;
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+	bool stop;
+	/* First I/O error of the writer thread */
+	int error;
+	struct mp4_mux_async_track *tracks;
+	unsigned int track_count;
+	struct mp4_mux_async_stats stats;
+	uint64_t total_latency;
+};
+
+
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+	uint64_t us = 0;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+/* Errors that do not leave the file in an unknown state only fail the
+ * sample, as in synchronous mode */
+static bool is_sample_error(int error)
+{
+	return error == -EINVAL || error == -ENOENT || error == -ENOMEM;
+}
+
+
+static void *writer_thread(void *userdata)
+{
+	int ret;
+	struct mp4_mux_async *async = userdata;
+	struct mp4_mux_async_entry *entry;
+	struct mp4_mux_scattered_sample sample;
+	uint64_t start;
+	uint64_t end;
+
+	pthread_mutex_lock(&async->mutex);
+	while (true) {
+		while ((async->count == 0 && !async->stop) ||
+		       (async->count > 0 &&
+			!async->entries[async->head].ready))
+			pthread_cond_wait(&async->cond_ready, &async->mutex);
+		if (async->count == 0)
+			break;
+
+		entry = &async->entries[async->head];
+		ret = entry->skip ? -ECANCELED : async->error;
+		pthread_mutex_unlock(&async->mutex);
+
+		/* After an error, the samples are released without write */
+		start = get_time_us();
+		if (ret == 0) {
+			sample.buffers = &entry->data;
+			sample.len = &entry->len;
+			sample.nbuffers = 1;
+			sample.sync = entry->sync;
+			sample.dts = entry->dts;
+			pthread_mutex_lock(&async->io_mutex);
+			ret = mp4_mux_track_write_sample(
+				async->mux, entry->track_handle, &sample);
+			pthread_mutex_unlock(&async->io_mutex);
+			if (ret < 0)
+				ULOG_ERRNO("mp4_mux_track_write_sample", -ret);
+		}
+		end = get_time_us();
+		if (entry->release != NULL)
+			entry->release(entry->data, entry->userdata);
+		entry->release = NULL;
+
+		pthread_mutex_lock(&async->mutex);
+		if (ret == 0) {
+			async->stats.written_samples++;
+			async->total_latency += end - entry->queue_time;
+			async->stats.max_latency =
+				MAX(async->stats.max_latency,
+				    end - entry->queue_time);
+			async->stats.max_write_time =
+				MAX(async->stats.max_write_time, end - start);
+		} else {
+			async->stats.dropped_samples++;
+			if (async->error == 0 && ret != -ECANCELED &&
+			    !is_sample_error(ret))
+				async->error = ret;
+		}
+		entry->ready = false;
+		async->head = (async->head + 1) % async->size;
+		async->count--;
+		pthread_cond_broadcast(&async->cond_done);
+	}
+	pthread_mutex_unlock(&async->mutex);
+
+	return NULL;
+}
+
+
+int mp4_mux_async_new(const struct mp4_mux *mux,
+		      unsigned int queue_size,
+		      enum mp4_mux_async_policy policy,
+		      struct mp4_mux_async **ret_obj)
+{
+	int ret;
+	struct mp4_mux_async *async;
+
+	ULOG_ERRNO_RETURN_ERR_IF(mux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		policy != MP4_MUX_ASYNC_POLICY_BLOCK &&
+			policy != MP4_MUX_ASYNC_POLICY_DROP_NON_SYNC &&
+			policy != MP4_MUX_ASYNC_POLICY_ERROR,
+		EINVAL);
+
+	async = calloc(1, sizeof(*async));
+	if (async == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		return ret;
+	}
+	async->mux = mux;
+	async->policy = policy;
+	async->size = queue_size != 0 ? queue_size
+				       : MP4_MUX_ASYNC_DEFAULT_QUEUE_SIZE;
+	async->entries = calloc(async->size, sizeof(*async->entries));
+	if (async->entries == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		free(async);
+		return ret;
+	}
+
+	pthread_mutex_init(&async->io_mutex, NULL);
+	pthread_mutex_init(&async->mutex, NULL);
+	pthread_cond_init(&async->cond_ready, NULL);
+	pthread_cond_init(&async->cond_done, NULL);
+
+	ret = pthread_create(&async->thread, NULL, &writer_thread, async);
+	if (ret != 0) {
+		ret = -ret;
+		ULOG_ERRNO("pthread_create", -ret);
+		pthread_cond_destroy(&async->cond_done);
+		pthread_cond_destroy(&async->cond_ready);
+		pthread_mutex_destroy(&async->mutex);
+		pthread_mutex_destroy(&async->io_mutex);
+		free(async->entries);
+		free(async);
+		return ret;
+	}
+
+	*ret_obj = async;
+	return 0;
+}
+
+
+int mp4_mux_async_destroy(struct mp4_mux_async *async)
+{
+	int ret;
+
+	if (async == NULL)
+		return 0;
+
+	ret = mp4_mux_async_drain(async);
+
+	pthread_mutex_lock(&async->mutex);
+	async->stop = true;
+	pthread_cond_signal(&async->cond_ready);
+	pthread_mutex_unlock(&async->mutex);
+	pthread_join(async->thread, NULL);
+
+	pthread_cond_destroy(&async->cond_done);
+	pthread_cond_destroy(&async->cond_ready);
+	pthread_mutex_destroy(&async->mutex);
+	pthread_mutex_destroy(&async->io_mutex);
+	for (unsigned int i = 0; i < async->size; i++)
+		free(async->entries[i].buf);
+	free(async->entries);
+	free(async->tracks);
+	free(async);
+
+	return ret;
+}
+
+
+int mp4_mux_async_add_track(struct mp4_mux_async *async,
+			    int track_handle,
+			    enum mp4_track_type type)
+{
+	int ret = 0;
+	struct mp4_mux_async_track *tracks;
+
+	if (async == NULL)
+		return 0;
+
+	pthread_mutex_lock(&async->mutex);
+	if ((unsigned int)track_handle != async->track_count + 1) {
+		ret = -EINVAL;
+		ULOG_ERRNO("unexpected track handle %d", -ret, track_handle);
+		goto out;
+	}
+	tracks = realloc(async->tracks, track_handle * sizeof(*tracks));
+	if (tracks == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("realloc", -ret);
+		goto out;
+	}
+	async->tracks = tracks;
+	memset(&tracks[track_handle - 1], 0, sizeof(*tracks));
+	tracks[track_handle - 1].type = type;
+	async->track_count++;
+
+out:
+	pthread_mutex_unlock(&async->mutex);
+	return ret;
+}
+
+
+int mp4_mux_async_queue(struct mp4_mux_async *async,
+			int track_handle,
+			const struct mp4_mux_scattered_sample *sample,
+			mp4_mux_sample_release_t release,
+			void *userdata)
+{
+	int ret = 0;
+	size_t len = 0;
+	uint8_t *buf;
+	struct mp4_mux_async_entry *entry;
+	struct mp4_mux_async_track *track;
+	bool droppable;
+
+	ULOG_ERRNO_RETURN_ERR_IF(async == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track_handle <= 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(release != NULL && sample->nbuffers != 1,
+				 EINVAL);
+
+	for (int i = 0; i < sample->nbuffers; i++)
+		len += sample->len[i];
+
+	pthread_mutex_lock(&async->mutex);
+
+	/* Invalid samples are rejected here, so that only the I/O errors of
+	 * the writer thread fail the following samples; the tracks array can
+	 * be reallocated while waiting, so the track pointer is not kept */
+	if ((unsigned int)track_handle > async->track_count) {
+		ret = -ENOENT;
+		ULOG_ERRNO("track %d not found", -ret, track_handle);
+		goto out;
+	}
+	track = &async->tracks[track_handle - 1];
+	if (track->last_dts != 0 && sample->dts <= track->last_dts) {
+		ret = -EINVAL;
+		ULOGE("timestamp rollback from %" PRIi64 " to %" PRIi64,
+		      track->last_dts,
+		      sample->dts);
+		goto out;
+	}
+
+	/* Only the non-sync video samples can be dropped; samples following
+	 * a dropped sample depend on it */
+	droppable = track->type == MP4_TRACK_TYPE_VIDEO && !sample->sync;
+	if (track->type == MP4_TRACK_TYPE_VIDEO && sample->sync) {
+		track->dropping = false;
+	} else if (droppable && track->dropping) {
+		ret = -ENOBUFS;
+		async->stats.dropped_samples++;
+		goto out;
+	}
+
+	while (async->error == 0 && async->count == async->size) {
+		if (async->policy == MP4_MUX_ASYNC_POLICY_ERROR) {
+			ret = -EAGAIN;
+			goto out;
+		} else if (droppable &&
+			   async->policy ==
+				   MP4_MUX_ASYNC_POLICY_DROP_NON_SYNC) {
+			ULOGW("queue full, dropping samples of track %d up to "
+			      "the next sync sample",
+			      track_handle);
+			async->tracks[track_handle - 1].dropping = true;
+			ret = -ENOBUFS;
+			async->stats.dropped_samples++;
+			goto out;
+		}
+		pthread_cond_wait(&async->cond_done, &async->mutex);
+	}
+	if (async->error != 0) {
+		ret = async->error;
+		goto out;
+	}
+
+	/* Reserve the entry, the data is filled in without the lock */
+	entry = &async->entries[(async->head + async->count) % async->size];
+	async->count++;
+	async->stats.queued_samples++;
+	async->stats.max_queue_depth =
+		MAX(async->stats.max_queue_depth, async->count);
+	pthread_mutex_unlock(&async->mutex);
+
+	entry->track_handle = track_handle;
+	entry->sync = sample->sync;
+	entry->dts = sample->dts;
+	entry->len = len;
+	entry->release = release;
+	entry->userdata = userdata;
+	entry->skip = false;
+	if (release != NULL) {
+		entry->data = sample->buffers[0];
+	} else {
+		if (len > entry->buf_size) {
+			buf = realloc(entry->buf, len);
+			if (buf == NULL) {
+				ret = -ENOMEM;
+				ULOG_ERRNO("realloc", -ret);
+				entry->skip = true;
+			} else {
+				entry->buf = buf;
+				entry->buf_size = len;
+			}
+		}
+		if (!entry->skip) {
+			buf = entry->buf;
+			for (int i = 0; i < sample->nbuffers; i++) {
+				memcpy(buf, sample->buffers[i], sample->len[i]);
+				buf += sample->len[i];
+			}
+		}
+		entry->data = entry->buf;
+	}
+	entry->queue_time = get_time_us();
+
+	pthread_mutex_lock(&async->mutex);
+	/* A skipped sample does not move the track timestamps forward */
+	if (!entry->skip)
+		async->tracks[track_handle - 1].last_dts = sample->dts;
+	entry->ready = true;
+	pthread_cond_signal(&async->cond_ready);
+	pthread_mutex_unlock(&async->mutex);
+	return ret;
+
+out:
+	pthread_mutex_unlock(&async->mutex);
+	if (release != NULL)
+		release(sample->buffers[0], userdata);
+	return ret;
+}
+
+
+int mp4_mux_async_drain(struct mp4_mux_async *async)
+{
+	int ret;
+
+	if (async == NULL)
+		return 0;
+
+	pthread_mutex_lock(&async->mutex);
+	while (async->count > 0)
+		pthread_cond_wait(&async->cond_done, &async->mutex);
+	ret = async->error;
+	pthread_mutex_unlock(&async->mutex);
+
+	return ret;
+}
+
+
+void mp4_mux_async_lock(struct mp4_mux_async *async)
+{
+	if (async != NULL)
+		pthread_mutex_lock(&async->io_mutex);
+}
+
+
+void mp4_mux_async_unlock(struct mp4_mux_async *async)
+{
+	if (async != NULL)
+		pthread_mutex_unlock(&async->io_mutex);
+}
+
+
+void mp4_mux_async_get_stats(struct mp4_mux_async *async,
+			     struct mp4_mux_async_stats *stats)
+{
+	pthread_mutex_lock(&async->mutex);
+	*stats = async->stats;
+	stats->queue_depth = async->count;
+	if (async->stats.written_samples > 0)
+		stats->mean_latency =
+			async->total_latency / async->stats.written_samples;
+	pthread_mutex_unlock(&async->mutex);
+}
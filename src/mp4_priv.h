@@ -37,6 +37,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -48,6 +49,7 @@
 #	include <winsock2.h>
 #else /* !_WIN32 */
 #	include <arpa/inet.h>
+#	include <sys/uio.h>
 #endif /* !_WIN32 */
 
 #define ULOG_TAG libmp4
@@ -61,8 +63,34 @@
 /* Note: MAX_ALLOC_SIZE must be large enough to hold thumbnail */
 #define MAX_ALLOC_SIZE (10 * 1000 * 1000)
 
+/* Maximum size of a top-level box loaded in memory for parsing */
+#define MP4_READ_BUFFER_MAX_SIZE (256 * 1024 * 1024)
+
 #define UNUSED(x) (void)(x)
 
+/* Maximum gap between a sample and its metadata sample read together
+ * (the gap data is read and dropped) */
+#define MP4_COMBINED_READ_MAX_GAP 4096
+
+/* Maximum number of buffers given to a single preadv() by the scattered
+ * sample read */
+#define MP4_SCATTER_IOV_COUNT 16
+
+/* Block size used for the muxer write buffer if the file system one is
+ * not known */
+#define MP4_MUX_DEFAULT_BLOCK_SIZE 4096
+
+/* Number of entries per block of the muxer tables */
+#define MP4_MUX_TABLE_BLOCK_SHIFT 9
+#define MP4_MUX_TABLE_BLOCK_ENTRIES (1 << MP4_MUX_TABLE_BLOCK_SHIFT)
+
+#ifdef _WIN32
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#endif /* _WIN32 */
+
 
 /* clang-format off */
 #define MP4_ISOM                            0x69736f6d /* "isom" */
@@ -276,6 +304,33 @@ struct mp4_sample_to_chunk_entry {
 };
 
 
+/* Run of consecutive samples with the same duration
+ * (built from the time-to-sample entries) */
+struct mp4_sample_time_run {
+	uint32_t firstSample;
+	uint32_t sampleCount;
+	uint32_t sampleDelta;
+	uint64_t firstTime;
+};
+
+
+/* Run of consecutive chunks with the same number of samples
+ * (built from the sample-to-chunk entries) */
+struct mp4_sample_chunk_run {
+	uint32_t firstSample;
+	uint32_t firstChunk;
+	uint32_t samplesPerChunk;
+};
+
+
+/* Offset of the next sample when reading in order, so that the offset of a
+ * sample inside a chunk does not have to be summed from the chunk start */
+struct mp4_sample_offset_hint {
+	uint32_t sampleIdx;
+	uint64_t offset;
+};
+
+
 /* track structure used by demuxer */
 struct mp4_track {
 	uint32_t id;
@@ -286,19 +341,35 @@ struct mp4_track {
 	uint64_t modificationTime;
 	uint32_t nextSample;
 	uint64_t pendingSeekTime;
+	uint32_t readaheadEnd;
+	struct mp4_sample_offset_hint offsetHint;
 	uint32_t sampleCount;
+	/* NULL if all samples have the same size (sampleConstSize) */
 	uint32_t *sampleSize;
+	uint32_t sampleConstSize;
 	uint32_t sampleMaxSize;
-	uint64_t *sampleDecodingTime;
-	uint64_t *sampleOffset;
 	uint32_t chunkCount;
 	uint64_t *chunkOffset;
 	uint32_t timeToSampleEntryCount;
 	struct mp4_time_to_sample_entry *timeToSampleEntries;
 	uint32_t sampleToChunkEntryCount;
 	struct mp4_sample_to_chunk_entry *sampleToChunkEntries;
+	/* The sample tables above and the sync sample entries point into
+	 * the index file data and must not be freed */
+	bool tablesInIndex;
+	uint32_t timeRunCount;
+	struct mp4_sample_time_run *timeRuns;
+	uint32_t chunkRunCount;
+	struct mp4_sample_chunk_run *chunkRuns;
+	/* Per-sample tables, expanded on the first track info request and
+	 * only published once complete, under tablesMutex */
+	uint64_t *expandedSampleOffset;
+	uint32_t *expandedSampleSize;
+	pthread_mutex_t tablesMutex;
 	uint32_t syncSampleEntryCount;
 	uint32_t *syncSampleEntries;
+	/* One bit per sample, set for sync samples */
+	uint32_t *syncSampleBitmap;
 	uint32_t referenceType;
 	uint32_t referenceTrackId[MP4_TRACK_REF_MAX];
 	unsigned int referenceTrackIdCount;
@@ -319,6 +390,13 @@ struct mp4_track {
 	char **staticMetadataValue;
 
 	struct mp4_track *metadata;
+	/* Associated metadata sample for each sample (-1 if none), built
+	 * when opening the demuxer */
+	int32_t *metadataSampleIdx;
+	/* GOP table, built on request and only published once complete,
+	 * under tablesMutex */
+	struct mp4_track_gop *gops;
+	uint32_t gopCount;
 	struct mp4_track *chapters;
 
 	char *name;
@@ -334,9 +412,29 @@ struct mp4_file {
 	int fd;
 	off_t fileSize;
 	off_t readBytes;
+	/* Box parser cursor and block loaded in memory (the whole file
+	 * when mapped) */
+	off_t readOffset;
+	struct {
+		uint8_t *data;
+		off_t offset;
+		size_t size;
+	} readBuffer;
+	bool mapped;
+	/* Number of samples to read ahead of the read position (0 if
+	 * disabled) */
+	unsigned int readaheadSampleCount;
+	/* Location of the 'moov' box, used to validate the index file */
+	off_t moovOffset;
+	uint64_t moovSize;
+	/* Index file loaded in memory (NULL if not indexed) */
+	void *indexData;
+	size_t indexSize;
 	struct mp4_box *root;
 	struct list_node tracks;
 	unsigned int trackCount;
+	/* Tracks in list order, for direct access by index */
+	struct mp4_track **trackArray;
 	uint32_t timescale;
 	uint64_t duration;
 	uint64_t creationTime;
@@ -376,6 +474,26 @@ struct mp4_demux {
 };
 
 
+/* Read position in a track, independent from the position stored in the
+ * track itself (used by the mp4_demux_get_track_sample() functions) */
+struct mp4_demux_cursor {
+	const struct mp4_demux *demux;
+	const struct mp4_track *track;
+	/* Range of samples the cursor can read (the whole track unless
+	 * created by mp4_demux_split_track()) */
+	uint32_t startSample;
+	uint32_t endSample;
+	uint32_t nextSample;
+	uint64_t pendingSeekTime;
+	/* End of the samples range already read ahead */
+	uint32_t readaheadEnd;
+	struct mp4_sample_offset_hint offsetHint;
+	/* Time between the sync samples returned in trick-play mode,
+	 * negative to play backwards (0 if disabled) */
+	int64_t syncStride;
+};
+
+
 struct mp4_mux_metadata_info {
 	struct list_node *metadatas;
 	uint8_t *cover;
@@ -384,6 +502,31 @@ struct mp4_mux_metadata_info {
 };
 
 
+/* Table of the muxer: the entries are stored in fixed-size blocks, so
+ * appending never moves nor copies the existing entries; only the array of
+ * block pointers is reallocated */
+struct mp4_mux_table {
+	uint32_t count;
+	/* Multiple of MP4_MUX_TABLE_BLOCK_ENTRIES */
+	uint32_t capacity;
+	void **blocks;
+	uint32_t block_capacity;
+};
+
+
+/* Entry of a muxer table; the index must be lower than the table capacity */
+#define MP4_MUX_TABLE_ENTRY(_table, _type, _index)                             \
+	(((_type *)(_table)->blocks[(_index) >> MP4_MUX_TABLE_BLOCK_SHIFT])    \
+		 [(_index) & (MP4_MUX_TABLE_BLOCK_ENTRIES - 1)])
+
+
+struct mp4_mux_sample_entry {
+	uint64_t decoding_time;
+	uint64_t offset;
+	uint32_t size;
+};
+
+
 /* track structure used by muxer */
 struct mp4_mux_track {
 	/* Opaque handle used to identify the track. */
@@ -403,33 +546,16 @@ struct mp4_mux_track {
 	uint64_t duration_moov;
 	uint64_t creation_time;
 	uint64_t modification_time;
-	struct {
-		uint32_t count;
-		uint32_t capacity;
-		uint32_t *sizes;
-		uint64_t *decoding_times;
-		uint64_t *offsets;
-	} samples;
-	struct {
-		uint32_t count;
-		uint32_t capacity;
-		uint64_t *offsets;
-	} chunks;
-	struct {
-		uint32_t count;
-		uint32_t capacity;
-		struct mp4_time_to_sample_entry *entries;
-	} time_to_sample;
-	struct {
-		uint32_t count;
-		uint32_t capacity;
-		struct mp4_sample_to_chunk_entry *entries;
-	} sample_to_chunk;
-	struct {
-		uint32_t count;
-		uint32_t capacity;
-		uint32_t *entries;
-	} sync;
+	/* struct mp4_mux_sample_entry */
+	struct mp4_mux_table samples;
+	/* uint64_t chunk offsets */
+	struct mp4_mux_table chunks;
+	/* struct mp4_time_to_sample_entry */
+	struct mp4_mux_table time_to_sample;
+	/* struct mp4_sample_to_chunk_entry */
+	struct mp4_mux_table sample_to_chunk;
+	/* uint32_t sample numbers */
+	struct mp4_mux_table sync;
 	struct {
 		uint32_t samples;
 		uint32_t chunks;
@@ -437,6 +563,15 @@ struct mp4_mux_track {
 		uint32_t sample_to_chunk;
 		uint32_t sync;
 	} stbl_index_write_count;
+	/* Samples of the current chunk, buffered until the chunk is complete;
+	 * they are the last sample_count entries of the samples table */
+	struct {
+		uint32_t sample_count;
+		uint64_t first_dts;
+		uint8_t *buf;
+		size_t size;
+		size_t capacity;
+	} pending_chunk;
 	bool track_info_written;
 	uint32_t meta_write_count;
 
@@ -471,6 +606,32 @@ struct mp4_mux_metadata {
 	struct list_node node;
 };
 
+struct mp4_mux_async;
+
+/* Write-behind buffer for the sample data */
+struct mp4_mux_write_buffer {
+	uint8_t *buf;
+	size_t size;
+	/* Multiple of the block size */
+	size_t capacity;
+	size_t block_size;
+	/* File offset of the buffered data; the data is logically written at
+	 * offset + size, the file position is not used */
+	off_t offset;
+	/* Direct I/O: the buffer and the offset are aligned on the block size
+	 * and full blocks are written through fd, opened with O_DIRECT; the
+	 * unaligned tail is written through the muxer file descriptor and
+	 * kept in the buffer until its block is complete. written is the size
+	 * of the tail already written this way. */
+	bool direct;
+	int fd;
+	size_t written;
+	/* Maximum delay before the buffered data is written and time of the
+	 * oldest buffered data (monotonic), in microseconds */
+	uint64_t max_delay;
+	uint64_t first_time;
+};
+
 struct mp4_mux {
 	int fd;
 	char *filename;
@@ -493,10 +654,21 @@ struct mp4_mux {
 	/* Tracks */
 	struct list_node tracks;
 	uint32_t track_count;
+	/* Tracks indexed by handle - 1 */
+	struct mp4_mux_track **track_array;
 	/* Metadata */
 	struct list_node metadatas;
 	struct mp4_mux_metadata_info file_metadata;
 	bool max_tables_size_reached;
+	/* Chunk grouping policy (see mp4_mux_config) */
+	struct {
+		uint64_t max_duration;
+		size_t max_size;
+	} chunk;
+	/* NULL if disabled */
+	struct mp4_mux_write_buffer *write_buffer;
+	/* Writer thread and sample queue, NULL if not asynchronous */
+	struct mp4_mux_async *async;
 	struct {
 		uint8_t *buf;
 		off_t offset;
@@ -595,6 +767,77 @@ static const uint32_t MP4_RECOVERY_FORMAT_VERSION_MIN_SUPPORTED =
 	} while (0)
 
 
+#define MP4_FILE_READ_32(_mp4, _val32, _readBytes)                             \
+	do {                                                                   \
+		_val32 = 0;                                                    \
+		ssize_t _count =                                               \
+			mp4_file_read(_mp4, &_val32, sizeof(uint32_t));        \
+		if (_count == -1) {                                            \
+			ULOG_ERRNO("read", errno);                             \
+			return -errno;                                         \
+		} else if ((size_t)_count != sizeof(uint32_t)) {               \
+			ULOG_ERRNO("only %zd bytes read instead of %zu",       \
+				   EIO,                                        \
+				   _count,                                     \
+				   sizeof(uint32_t));                          \
+			return -EIO;                                           \
+		}                                                              \
+		_readBytes += sizeof(uint32_t);                                \
+	} while (0)
+
+
+#define MP4_FILE_READ_16(_mp4, _val16, _readBytes)                             \
+	do {                                                                   \
+		_val16 = 0;                                                    \
+		ssize_t _count =                                               \
+			mp4_file_read(_mp4, &_val16, sizeof(uint16_t));        \
+		if (_count == -1) {                                            \
+			ULOG_ERRNO("read", errno);                             \
+			return -errno;                                         \
+		} else if ((size_t)_count != sizeof(uint16_t)) {               \
+			ULOG_ERRNO("only %zd bytes read instead of %zu",       \
+				   EIO,                                        \
+				   _count,                                     \
+				   sizeof(uint16_t));                          \
+			return -EIO;                                           \
+		}                                                              \
+		_readBytes += sizeof(uint16_t);                                \
+	} while (0)
+
+
+#define MP4_FILE_READ_8(_mp4, _val8, _readBytes)                               \
+	do {                                                                   \
+		_val8 = 0;                                                     \
+		ssize_t _count =                                               \
+			mp4_file_read(_mp4, &_val8, sizeof(uint8_t));          \
+		if (_count == -1) {                                            \
+			ULOG_ERRNO("read", errno);                             \
+			return -errno;                                         \
+		} else if ((size_t)_count != sizeof(uint8_t)) {                \
+			ULOG_ERRNO("only %zd bytes read instead of %zu",       \
+				   EIO,                                        \
+				   _count,                                     \
+				   sizeof(uint8_t));                           \
+			return -EIO;                                           \
+		}                                                              \
+		_readBytes += sizeof(uint8_t);                                 \
+	} while (0)
+
+
+#define MP4_FILE_READ_SKIP(_mp4, _nBytes, _readBytes)                          \
+	do {                                                                   \
+		__typeof__(_readBytes) _i_nBytes = _nBytes;                    \
+		if (_i_nBytes > 0) {                                           \
+			off_t _ret = mp4_file_seek(_mp4, _i_nBytes, SEEK_CUR); \
+			if (_ret == -1) {                                      \
+				ULOG_ERRNO("lseek", errno);                    \
+				return -errno;                                 \
+			}                                                      \
+			_readBytes += _i_nBytes;                               \
+		}                                                              \
+	} while (0)
+
+
 #define MP4_WRITE_32(_mux, _val32, _writeBytes, _maxBytes)                     \
 	do {                                                                   \
 		if (_writeBytes + sizeof(uint32_t) > _maxBytes)                \
@@ -798,6 +1041,37 @@ off_t mp4_box_children_read(struct mp4_file *mp4,
 			    struct mp4_track *track);
 
 
+ssize_t mp4_pread(int fd, void *buf, size_t count, off_t offset);
+
+
+int mp4_file_read_buffer_load(struct mp4_file *mp4, off_t offset, size_t size);
+
+
+void mp4_file_read_buffer_release(struct mp4_file *mp4);
+
+
+const uint8_t *
+mp4_file_get_data(const struct mp4_file *mp4, off_t offset, size_t size);
+
+
+ssize_t mp4_file_pread(const struct mp4_file *mp4,
+		       void *buf,
+		       size_t count,
+		       off_t offset);
+
+
+ssize_t mp4_file_preadv(const struct mp4_file *mp4,
+			const struct iovec *iov,
+			int iovcnt,
+			off_t offset);
+
+
+ssize_t mp4_file_read(struct mp4_file *mp4, void *buf, size_t count);
+
+
+off_t mp4_file_seek(struct mp4_file *mp4, off_t offset, int whence);
+
+
 off_t mp4_box_ftyp_write(struct mp4_mux *mux);
 
 
@@ -812,6 +1086,40 @@ int mp4_track_is_sync_sample(const struct mp4_track *track,
 			     int *prevSyncSampleIdx);
 
 
+uint32_t mp4_track_get_sample_size(const struct mp4_track *track,
+				   unsigned int sampleIdx);
+
+
+unsigned int mp4_track_find_chunk_run(const struct mp4_track *track,
+				      unsigned int sampleIdx);
+
+
+uint64_t mp4_track_get_sample_offset(const struct mp4_track *track,
+				     unsigned int sampleIdx);
+
+
+uint64_t
+mp4_track_get_sample_offset_hinted(const struct mp4_track *track,
+				   unsigned int sampleIdx,
+				   struct mp4_sample_offset_hint *hint);
+
+
+uint64_t mp4_track_get_sample_dts(const struct mp4_track *track,
+				  unsigned int sampleIdx);
+
+
+int mp4_track_expand_sample_tables(struct mp4_track *track);
+
+
+int mp4_track_build_lookup_tables(struct mp4_track *track);
+
+
+int mp4_track_build_metadata_association(struct mp4_track *track);
+
+
+int mp4_track_build_gops(struct mp4_track *track);
+
+
 int mp4_track_find_sample_by_time(const struct mp4_track *track,
 				  uint64_t time,
 				  enum mp4_time_cmp cmp,
@@ -837,7 +1145,7 @@ struct mp4_track *mp4_track_find_by_id(const struct mp4_file *mp4,
 				       unsigned int track_id);
 
 
-void mp4_tracks_destroy(const struct mp4_file *mp4);
+void mp4_tracks_destroy(struct mp4_file *mp4);
 
 
 int mp4_tracks_build(struct mp4_file *mp4);
@@ -846,6 +1154,21 @@ int mp4_tracks_build(struct mp4_file *mp4);
 void mp4_video_decoder_config_destroy(struct mp4_video_decoder_config *vdc);
 
 
+int mp4_demux_track_next_sample(const struct mp4_demux *demux,
+				unsigned int track_id,
+				size_t max_size,
+				struct mp4_track_sample *track_sample);
+
+
+int mp4_index_write(const struct mp4_file *mp4, const char *filename);
+
+
+int mp4_index_load(struct mp4_file *mp4, const char *filename);
+
+
+void mp4_index_unload(struct mp4_file *mp4);
+
+
 struct mp4_mux_track *mp4_mux_track_find_by_handle(const struct mp4_mux *mux,
 						   uint32_t track_handle);
 
@@ -857,6 +1180,20 @@ int mp4_mux_track_compute_tts(const struct mp4_mux *mux,
 			      struct mp4_mux_track *track);
 
 
+int mp4_mux_table_reserve(struct mp4_mux_table *table,
+			  uint32_t new_entries,
+			  size_t entry_size);
+
+
+const void *mp4_mux_table_block(const struct mp4_mux_table *table,
+				uint32_t index,
+				size_t entry_size,
+				uint32_t *count);
+
+
+void mp4_mux_table_clear(struct mp4_mux_table *table);
+
+
 int mp4_mux_grow_samples(struct mp4_mux_track *track, int new_samples);
 
 
@@ -875,6 +1212,45 @@ int mp4_mux_grow_sync(struct mp4_mux_track *track, int new_sync);
 int mp4_mux_incremental_sync(struct mp4_mux *mux);
 
 
+int mp4_mux_track_write_sample(const struct mp4_mux *mux,
+			       int track_handle,
+			       const struct mp4_mux_scattered_sample *sample);
+
+
+int mp4_mux_async_new(const struct mp4_mux *mux,
+		      unsigned int queue_size,
+		      enum mp4_mux_async_policy policy,
+		      struct mp4_mux_async **ret_obj);
+
+
+int mp4_mux_async_destroy(struct mp4_mux_async *async);
+
+
+int mp4_mux_async_add_track(struct mp4_mux_async *async,
+			    int track_handle,
+			    enum mp4_track_type type);
+
+
+int mp4_mux_async_queue(struct mp4_mux_async *async,
+			int track_handle,
+			const struct mp4_mux_scattered_sample *sample,
+			mp4_mux_sample_release_t release,
+			void *userdata);
+
+
+int mp4_mux_async_drain(struct mp4_mux_async *async);
+
+
+void mp4_mux_async_lock(struct mp4_mux_async *async);
+
+
+void mp4_mux_async_unlock(struct mp4_mux_async *async);
+
+
+void mp4_mux_async_get_stats(struct mp4_mux_async *async,
+			     struct mp4_mux_async_stats *stats);
+
+
 int mp4_mux_fill_from_file(const struct mp4_recovery_tables_header *header,
 			   const char *tables_file,
 			   struct mp4_mux *mux,
@@ -37,7 +37,6 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
-#define MP4_MUX_TABLES_GROW_SIZE 128
 #define MS_TO_S 1000
 #define SECONDS_IN_MONTH 267840
 #define FTYP_SIZE 32
@@ -165,6 +165,7 @@ static int mp4_mux_recovery_read_stsc(int file_fd,
 	ssize_t err = 0;
 	struct mp4_mux_track *track;
 	struct mp4_sample_to_chunk_entry entry;
+	struct mp4_sample_to_chunk_entry *last;
 
 	track = mp4_mux_track_find_by_handle(mux, item->track_handle);
 	if (track == NULL) {
@@ -178,17 +179,28 @@ static int mp4_mux_recovery_read_stsc(int file_fd,
 		RECOVERY_READ_VAL(entry.samplesPerChunk);
 		RECOVERY_READ_VAL(entry.sampleDescriptionIndex);
 
-		if (track->sample_to_chunk.count + 1 >
-		    track->sample_to_chunk.capacity) {
-			ret = mp4_mux_grow_stc(track, 1);
-			if (ret < 0) {
-				ULOG_ERRNO("mp4_mux_grow_stc", -ret);
-				goto out;
+		/* The entry starting at the same chunk (i.e. the initial one
+		 * set by mp4_mux_add_track) is replaced */
+		if (track->sample_to_chunk.count > 0) {
+			last = &MP4_MUX_TABLE_ENTRY(
+				&track->sample_to_chunk,
+				struct mp4_sample_to_chunk_entry,
+				track->sample_to_chunk.count - 1);
+			if (last->firstChunk == entry.firstChunk) {
+				*last = entry;
+				continue;
 			}
-			track->sample_to_chunk.count++;
 		}
-		track->sample_to_chunk
-			.entries[track->sample_to_chunk.count - 1] = entry;
+
+		ret = mp4_mux_grow_stc(track, 1);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_mux_grow_stc", -ret);
+			goto out;
+		}
+		MP4_MUX_TABLE_ENTRY(&track->sample_to_chunk,
+				    struct mp4_sample_to_chunk_entry,
+				    track->sample_to_chunk.count) = entry;
+		track->sample_to_chunk.count++;
 	}
 
 out:
@@ -206,6 +218,7 @@ static int mp4_mux_recovery_read_stsz(int file_fd,
 	uint32_t sample_size;
 	uint64_t sample_offset;
 	uint64_t sample_decoding_time;
+	struct mp4_mux_sample_entry *entry;
 
 	track = mp4_mux_track_find_by_handle(mux, item->track_handle);
 	if (track == NULL) {
@@ -227,10 +240,12 @@ static int mp4_mux_recovery_read_stsz(int file_fd,
 			}
 		}
 
-		track->samples.sizes[track->samples.count] = sample_size;
-		track->samples.offsets[track->samples.count] = sample_offset;
-		track->samples.decoding_times[track->samples.count] =
-			sample_decoding_time;
+		entry = &MP4_MUX_TABLE_ENTRY(&track->samples,
+					     struct mp4_mux_sample_entry,
+					     track->samples.count);
+		entry->size = sample_size;
+		entry->offset = sample_offset;
+		entry->decoding_time = sample_decoding_time;
 		track->samples.count++;
 	}
 
@@ -445,7 +460,8 @@ static int mp4_mux_recovery_read_stss(int file_fd,
 			}
 		}
 
-		track->sync.entries[track->sync.count] = sync;
+		MP4_MUX_TABLE_ENTRY(&track->sync, uint32_t, track->sync.count) =
+			sync;
 		track->sync.count++;
 	}
 out:
@@ -481,8 +497,9 @@ static int mp4_mux_recovery_read_stts(int file_fd,
 				goto out;
 			}
 		}
-		track->time_to_sample.entries[track->time_to_sample.count] =
-			entry;
+		MP4_MUX_TABLE_ENTRY(&track->time_to_sample,
+				    struct mp4_time_to_sample_entry,
+				    track->time_to_sample.count) = entry;
 		track->time_to_sample.count++;
 	}
 
@@ -545,7 +562,8 @@ static int mp4_mux_recovery_read_stco(int file_fd,
 			}
 		}
 
-		track->chunks.offsets[track->chunks.count] = offset;
+		MP4_MUX_TABLE_ENTRY(
+			&track->chunks, uint64_t, track->chunks.count) = offset;
 
 		track->chunks.count++;
 	}
@@ -819,6 +837,60 @@ static inline int seek_to_start_of_data(int tables_fd)
 }
 
 
+/* Keep only the complete chunks (and their samples) whose data is in the
+ * file; returns the end offset of the last chunk kept */
+static off_t mp4_mux_recovery_truncate_track(struct mp4_mux_track *track,
+					     off_t end_of_file)
+{
+	uint32_t chunk;
+	uint32_t sample = 0;
+	uint32_t stc = 0;
+	uint32_t count;
+	off_t end;
+	off_t max_offset = 0;
+	const struct mp4_sample_to_chunk_entry *entry;
+
+	for (chunk = 0; chunk < track->chunks.count; chunk++) {
+		while (stc + 1 < track->sample_to_chunk.count &&
+		       MP4_MUX_TABLE_ENTRY(&track->sample_to_chunk,
+					   struct mp4_sample_to_chunk_entry,
+					   stc + 1)
+				       .firstChunk <= chunk + 1)
+			stc++;
+		entry = &MP4_MUX_TABLE_ENTRY(&track->sample_to_chunk,
+					     struct mp4_sample_to_chunk_entry,
+					     stc);
+		count = entry->samplesPerChunk;
+		if (count > track->samples.count - sample)
+			break;
+		end = MP4_MUX_TABLE_ENTRY(&track->chunks, uint64_t, chunk);
+		for (uint32_t i = 0; i < count; i++) {
+			end += MP4_MUX_TABLE_ENTRY(&track->samples,
+						   struct mp4_mux_sample_entry,
+						   sample + i)
+				       .size;
+		}
+		if (end > end_of_file)
+			break;
+		max_offset = MAX(max_offset, end);
+		sample += count;
+	}
+
+	track->samples.count = sample;
+	track->chunks.count = chunk;
+	while (track->sample_to_chunk.count > 1) {
+		entry = &MP4_MUX_TABLE_ENTRY(&track->sample_to_chunk,
+					     struct mp4_sample_to_chunk_entry,
+					     track->sample_to_chunk.count - 1);
+		if (entry->firstChunk <= chunk)
+			break;
+		track->sample_to_chunk.count--;
+	}
+
+	return max_offset;
+}
+
+
 int mp4_mux_fill_from_file(const struct mp4_recovery_tables_header *header,
 			   const char *tables_file,
 			   struct mp4_mux *mux,
@@ -830,12 +902,10 @@ int mp4_mux_fill_from_file(const struct mp4_recovery_tables_header *header,
 	ssize_t curr_off = 0;
 	struct recovery_box_info item;
 	struct mp4_mux_track *track;
-	uint32_t resized_samples = 0;
 	off_t end_of_file;
 	off_t max_offset = 0;
 	off_t tmp_offset;
 	bool minor_fail = false;
-	uint32_t min_count = 0;
 
 	file_fd = open(tables_file, O_RDONLY);
 	if (file_fd == -1) {
@@ -897,18 +967,9 @@ int mp4_mux_fill_from_file(const struct mp4_recovery_tables_header *header,
 	/* remove samples referencing unexisting data */
 	list_walk_entry_forward(&mux->tracks, track, node)
 	{
-		min_count = MIN(track->chunks.count, track->samples.count);
-		resized_samples = 0;
-		for (size_t i = 0; i < min_count; i++) {
-			tmp_offset = track->chunks.offsets[i] +
-				     track->samples.sizes[i];
-			if (tmp_offset > end_of_file)
-				break;
-			max_offset = MAX(max_offset, tmp_offset);
-			resized_samples++;
-		}
-		track->samples.count = resized_samples;
-		track->chunks.count = resized_samples;
+		tmp_offset = mp4_mux_recovery_truncate_track(track,
+							     end_of_file);
+		max_offset = MAX(max_offset, tmp_offset);
 	}
 
 	/* remove unreferenced data */
@@ -315,7 +315,11 @@ static int mp4_mux_recovery_write_stco(const struct mp4_mux *mux,
 {
 	int ret = 0;
 	ssize_t err = 0;
-	bool co64 = track->chunks.offsets[track->chunks.count - 1] > UINT32_MAX;
+	uint32_t count;
+	const uint64_t *entries;
+	bool co64 = MP4_MUX_TABLE_ENTRY(
+			    &track->chunks, uint64_t, track->chunks.count - 1) >
+		    UINT32_MAX;
 
 	err = mp4_mux_recovery_write_box_info(
 		mux,
@@ -330,12 +334,16 @@ static int mp4_mux_recovery_write_stco(const struct mp4_mux *mux,
 
 	for (uint32_t i = track->stbl_index_write_count.chunks;
 	     i < track->chunks.count;
-	     i++) {
-		/* 64 bits written whether it's co or co64 */
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
-				   track->chunks.offsets[i]);
-
-		track->stbl_index_write_count.chunks++;
+	     i += count) {
+		entries = mp4_mux_table_block(
+			&track->chunks, i, sizeof(*entries), &count);
+		for (uint32_t j = 0; j < count; j++) {
+			/* 64 bits written whether it's co or co64 */
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
+					   entries[j]);
+
+			track->stbl_index_write_count.chunks++;
+		}
 	}
 
 out:
@@ -348,6 +356,8 @@ static int mp4_mux_recovery_write_stsz(const struct mp4_mux *mux,
 {
 	int ret = 0;
 	ssize_t err = 0;
+	uint32_t count;
+	const struct mp4_mux_sample_entry *entries;
 
 	err = mp4_mux_recovery_write_box_info(
 		mux,
@@ -362,20 +372,24 @@ static int mp4_mux_recovery_write_stsz(const struct mp4_mux *mux,
 
 	for (uint32_t i = track->stbl_index_write_count.samples;
 	     i < track->samples.count;
-	     i++) {
-		/* 'entry size' */
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
-				   track->samples.sizes[i]);
-
-		/* 'entry offset' */
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
-				   track->samples.offsets[i]);
-
-		/* 'entry decoding time' */
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
-				   track->samples.decoding_times[i]);
-
-		track->stbl_index_write_count.samples++;
+	     i += count) {
+		entries = mp4_mux_table_block(
+			&track->samples, i, sizeof(*entries), &count);
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'entry size' */
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
+					   entries[j].size);
+
+			/* 'entry offset' */
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
+					   entries[j].offset);
+
+			/* 'entry decoding time' */
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables,
+					   entries[j].decoding_time);
+
+			track->stbl_index_write_count.samples++;
+		}
 	}
 
 out:
@@ -389,6 +403,8 @@ static int mp4_mux_recovery_write_stsc(const struct mp4_mux *mux,
 	uint32_t val32;
 	int ret = 0;
 	ssize_t err = 0;
+	uint32_t count;
+	const struct mp4_sample_to_chunk_entry *entries;
 
 	err = mp4_mux_recovery_write_box_info(
 		mux,
@@ -404,23 +420,24 @@ static int mp4_mux_recovery_write_stsc(const struct mp4_mux *mux,
 
 	for (uint32_t i = track->stbl_index_write_count.sample_to_chunk;
 	     i < track->sample_to_chunk.count;
-	     i++) {
-		const struct mp4_sample_to_chunk_entry *entry;
-		entry = &track->sample_to_chunk.entries[i];
-
-		/* 'first_chunk' */
-		val32 = entry->firstChunk;
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
-
-		/* 'samples_per_chunk' */
-		val32 = entry->samplesPerChunk;
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
-
-		/* 'sample_description_id' */
-		val32 = entry->sampleDescriptionIndex;
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
-
-		track->stbl_index_write_count.sample_to_chunk++;
+	     i += count) {
+		entries = mp4_mux_table_block(
+			&track->sample_to_chunk, i, sizeof(*entries), &count);
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'first_chunk' */
+			val32 = entries[j].firstChunk;
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
+
+			/* 'samples_per_chunk' */
+			val32 = entries[j].samplesPerChunk;
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
+
+			/* 'sample_description_id' */
+			val32 = entries[j].sampleDescriptionIndex;
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
+
+			track->stbl_index_write_count.sample_to_chunk++;
+		}
 	}
 
 out:
@@ -434,6 +451,8 @@ static int mp4_mux_recovery_write_stss(const struct mp4_mux *mux,
 	uint32_t val32;
 	int ret = 0;
 	ssize_t err = 0;
+	uint32_t count;
+	const uint32_t *entries;
 
 	err = mp4_mux_recovery_write_box_info(
 		mux,
@@ -448,12 +467,16 @@ static int mp4_mux_recovery_write_stss(const struct mp4_mux *mux,
 
 	for (uint32_t i = track->stbl_index_write_count.sync;
 	     i < track->sync.count;
-	     i++) {
-		/* 'sample_number' */
-		val32 = track->sync.entries[i];
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
-
-		track->stbl_index_write_count.sync++;
+	     i += count) {
+		entries = mp4_mux_table_block(
+			&track->sync, i, sizeof(*entries), &count);
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'sample_number' */
+			val32 = entries[j];
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
+
+			track->stbl_index_write_count.sync++;
+		}
 	}
 
 out:
@@ -467,7 +490,8 @@ static int mp4_mux_recovery_write_stts(const struct mp4_mux *mux,
 	uint32_t val32;
 	int ret = 0;
 	ssize_t err = 0;
-	struct mp4_time_to_sample_entry entry;
+	uint32_t count;
+	const struct mp4_time_to_sample_entry *entries;
 
 	err = mp4_mux_recovery_write_box_info(
 		mux,
@@ -483,18 +507,20 @@ static int mp4_mux_recovery_write_stts(const struct mp4_mux *mux,
 
 	for (uint32_t i = track->stbl_index_write_count.time_to_sample;
 	     i < track->time_to_sample.count;
-	     i++) {
-		entry = track->time_to_sample.entries[i];
-
-		/* 'sample_count' */
-		val32 = entry.sampleCount;
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
-
-		/* 'sample_delta' */
-		val32 = entry.sampleDelta;
-		RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
-
-		track->stbl_index_write_count.time_to_sample++;
+	     i += count) {
+		entries = mp4_mux_table_block(
+			&track->time_to_sample, i, sizeof(*entries), &count);
+		for (uint32_t j = 0; j < count; j++) {
+			/* 'sample_count' */
+			val32 = entries[j].sampleCount;
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
+
+			/* 'sample_delta' */
+			val32 = entries[j].sampleDelta;
+			RECOVERY_WRITE_VAL(mux->recovery.fd_tables, val32);
+
+			track->stbl_index_write_count.time_to_sample++;
+		}
 	}
 
 out:
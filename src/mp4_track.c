@@ -28,42 +28,297 @@
 #include "mp4_priv.h"
 
 
+/**
+ * Find the last sync sample entry for a sample index lower than or equal
+ * to sampleIdx; returns -1 if there is none
+ */
+static int mp4_track_find_sync_entry(const struct mp4_track *track,
+				     unsigned int sampleIdx)
+{
+	int low = 0;
+	int high = (int)track->syncSampleEntryCount - 1;
+
+	while (low <= high) {
+		int mid = low + (high - low) / 2;
+		if (track->syncSampleEntries[mid] - 1 <= sampleIdx)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return high;
+}
+
+
 int mp4_track_is_sync_sample(const struct mp4_track *track,
 			     unsigned int sampleIdx,
 			     int *prevSyncSampleIdx)
 {
-	unsigned int i;
+	int i;
 
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
 
 	if (!track->syncSampleEntries)
 		return 1;
 
-	for (i = 0; i < track->syncSampleEntryCount; i++) {
-		if (track->syncSampleEntries[i] - 1 == sampleIdx)
+	if (sampleIdx < track->sampleCount) {
+		uint32_t word = track->syncSampleBitmap[sampleIdx / 32];
+		if (word & (1U << (sampleIdx % 32)))
 			return 1;
-		else if (track->syncSampleEntries[i] - 1 > sampleIdx) {
-			if (prevSyncSampleIdx && (i > 0)) {
-				*prevSyncSampleIdx =
-					track->syncSampleEntries[i - 1] - 1;
-			}
-			return 0;
-		}
 	}
 
-	if (prevSyncSampleIdx && (i > 0))
-		*prevSyncSampleIdx = track->syncSampleEntries[i - 1] - 1;
+	if (prevSyncSampleIdx) {
+		i = mp4_track_find_sync_entry(track, sampleIdx);
+		if (i >= 0)
+			*prevSyncSampleIdx = track->syncSampleEntries[i] - 1;
+	}
 	return 0;
 }
 
 
-static inline int
-is_sample_searchable(const struct mp4_track *track, int i, int sync)
+static unsigned int mp4_track_find_time_run(const struct mp4_track *track,
+					    unsigned int sampleIdx)
 {
-	if (!sync)
-		return 1;
+	unsigned int low = 0;
+	unsigned int high = track->timeRunCount - 1;
+
+	/* Last run starting at or before the sample */
+	while (low < high) {
+		unsigned int mid = low + (high - low + 1) / 2;
+		if (track->timeRuns[mid].firstSample <= sampleIdx)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return low;
+}
+
+
+unsigned int mp4_track_find_chunk_run(const struct mp4_track *track,
+				      unsigned int sampleIdx)
+{
+	unsigned int low = 0;
+	unsigned int high = track->chunkRunCount - 1;
+
+	/* Last run starting at or before the sample */
+	while (low < high) {
+		unsigned int mid = low + (high - low + 1) / 2;
+		if (track->chunkRuns[mid].firstSample <= sampleIdx)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return low;
+}
+
+
+uint32_t mp4_track_get_sample_size(const struct mp4_track *track,
+				   unsigned int sampleIdx)
+{
+	if (track->sampleSize == NULL)
+		return track->sampleConstSize;
+
+	return track->sampleSize[sampleIdx];
+}
+
+
+uint64_t
+mp4_track_get_sample_offset_hinted(const struct mp4_track *track,
+				   unsigned int sampleIdx,
+				   struct mp4_sample_offset_hint *hint)
+{
+	const struct mp4_sample_chunk_run *run;
+	unsigned int idxInRun, idxInChunk, chunkIdx;
+	uint64_t offset;
+
+	run = &track->chunkRuns[(track->chunkRunCount > 1)
+					? mp4_track_find_chunk_run(track,
+								   sampleIdx)
+					: 0];
+	idxInRun = sampleIdx - run->firstSample;
+	chunkIdx = run->firstChunk + idxInRun / run->samplesPerChunk;
+	idxInChunk = idxInRun % run->samplesPerChunk;
+	offset = track->chunkOffset[chunkIdx];
+
+	if (track->sampleSize == NULL)
+		return offset + (uint64_t)idxInChunk * track->sampleConstSize;
+
+	/* Only sum the sizes from the chunk start on random access */
+	if ((idxInChunk > 0) && (hint != NULL) &&
+	    (hint->sampleIdx == sampleIdx)) {
+		offset = hint->offset;
+	} else {
+		for (unsigned int i = sampleIdx - idxInChunk; i < sampleIdx;
+		     i++)
+			offset += track->sampleSize[i];
+	}
+	if (hint != NULL) {
+		hint->sampleIdx = sampleIdx + 1;
+		hint->offset = offset + track->sampleSize[sampleIdx];
+	}
+
+	return offset;
+}
+
+
+uint64_t mp4_track_get_sample_offset(const struct mp4_track *track,
+				     unsigned int sampleIdx)
+{
+	return mp4_track_get_sample_offset_hinted(track, sampleIdx, NULL);
+}
+
+
+uint64_t mp4_track_get_sample_dts(const struct mp4_track *track,
+				  unsigned int sampleIdx)
+{
+	const struct mp4_sample_time_run *run;
+
+	/* Constant frame rate tracks have a single run */
+	run = &track->timeRuns[(track->timeRunCount > 1)
+				       ? mp4_track_find_time_run(track,
+								 sampleIdx)
+				       : 0];
+
+	return run->firstTime +
+	       (uint64_t)(sampleIdx - run->firstSample) * run->sampleDelta;
+}
+
+
+int mp4_track_expand_sample_tables(struct mp4_track *track)
+{
+	int ret = 0;
+	struct mp4_sample_offset_hint hint = {0};
+	uint64_t *offsets = NULL;
+	uint32_t *sizes = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
+
+	pthread_mutex_lock(&track->tablesMutex);
+
+	if (track->expandedSampleOffset == NULL) {
+		offsets = malloc(track->sampleCount * sizeof(uint64_t));
+		if (offsets == NULL) {
+			ret = -ENOMEM;
+			ULOG_ERRNO("malloc", -ret);
+			goto out;
+		}
+		for (unsigned int i = 0; i < track->sampleCount; i++) {
+			offsets[i] = mp4_track_get_sample_offset_hinted(
+				track, i, &hint);
+		}
+	}
+
+	if ((track->sampleSize == NULL) &&
+	    (track->expandedSampleSize == NULL)) {
+		sizes = malloc(track->sampleCount * sizeof(uint32_t));
+		if (sizes == NULL) {
+			ret = -ENOMEM;
+			ULOG_ERRNO("malloc", -ret);
+			goto out;
+		}
+		for (unsigned int i = 0; i < track->sampleCount; i++)
+			sizes[i] = track->sampleConstSize;
+	}
+
+	/* Published once complete */
+	if (offsets != NULL) {
+		track->expandedSampleOffset = offsets;
+		offsets = NULL;
+	}
+	if (sizes != NULL)
+		track->expandedSampleSize = sizes;
+
+out:
+	pthread_mutex_unlock(&track->tablesMutex);
+	free(offsets);
+	return ret;
+}
+
+
+/**
+ * Find the first sample with a decoding time greater than or equal to
+ * 'time' using the time runs; returns sampleCount if there is none
+ */
+static unsigned int mp4_track_time_lower_bound(const struct mp4_track *track,
+					       uint64_t time)
+{
+	const struct mp4_sample_time_run *run;
+	unsigned int low = 0;
+	unsigned int high = track->timeRunCount;
+	uint64_t k;
+
+	/* First run starting at or after the time */
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+		if (track->timeRuns[mid].firstTime < time)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == 0)
+		return 0;
+
+	/* The sample is in the previous run or is the first of this run */
+	run = &track->timeRuns[low - 1];
+	if (run->sampleDelta == 0)
+		return run->firstSample + run->sampleCount;
+	k = (time - run->firstTime - 1) / run->sampleDelta + 1;
+	if (k >= run->sampleCount)
+		return run->firstSample + run->sampleCount;
+
+	return run->firstSample + (unsigned int)k;
+}
+
+
+/**
+ * Find the first sample with a decoding time strictly greater than
+ * 'time'; returns sampleCount if there is none
+ */
+static unsigned int mp4_track_time_upper_bound(const struct mp4_track *track,
+					       uint64_t time)
+{
+	if (time == UINT64_MAX)
+		return track->sampleCount;
+
+	return mp4_track_time_lower_bound(track, time + 1);
+}
+
+
+/* Last (sync if required) sample at or before index i, or -1 */
+static int
+mp4_track_find_prev_searchable(const struct mp4_track *track, int i, int sync)
+{
+	int k;
+
+	if (i < 0)
+		return -1;
+	if (!sync || !track->syncSampleEntries)
+		return i;
+
+	k = mp4_track_find_sync_entry(track, i);
+	return (k >= 0) ? (int)track->syncSampleEntries[k] - 1 : -1;
+}
+
+
+/* First (sync if required) sample at or after index i, or -1 */
+static int
+mp4_track_find_next_searchable(const struct mp4_track *track, int i, int sync)
+{
+	int k;
+
+	if (i >= (int)track->sampleCount)
+		return -1;
+	if (!sync || !track->syncSampleEntries)
+		return i;
 
-	return mp4_track_is_sync_sample(track, i, NULL);
+	k = mp4_track_find_sync_entry(track, i);
+	if ((k < 0) || (track->syncSampleEntries[k] - 1 < (uint32_t)i))
+		k++;
+	return (k < (int)track->syncSampleEntryCount)
+		       ? (int)track->syncSampleEntries[k] - 1
+		       : -1;
 }
 
 
@@ -73,19 +328,17 @@ mp4_track_find_sample_by_time_exact(const struct mp4_track *track,
 				    int sync,
 				    int start)
 {
+	int i;
+
 	if (start < 0)
 		start = 0;
 	if (start >= (int)track->sampleCount)
 		start = (int)track->sampleCount - 1;
 
-	for (int i = start; i < (int)track->sampleCount; i++) {
-		if (track->sampleDecodingTime[i] == time) {
-			if (is_sample_searchable(track, i, sync))
-				return i;
-		} else if (track->sampleDecodingTime[i] > time) {
-			break;
-		}
-	}
+	i = (int)mp4_track_time_lower_bound(track, time);
+	i = mp4_track_find_next_searchable(track, MAX(i, start), sync);
+	if ((i >= 0) && (mp4_track_get_sample_dts(track, i) == time))
+		return i;
 
 	return -ENOENT;
 }
@@ -97,36 +350,42 @@ mp4_track_find_sample_by_time_nearest(const struct mp4_track *track,
 				      int sync,
 				      int start)
 {
-	int is_sync;
-	int min_idx = -1;
-	uint64_t delta_ts;
-	uint64_t prev_delta_ts = UINT64_MAX;
-	uint64_t min_delta_ts = UINT64_MAX;
+	int i, before, after;
+	uint64_t before_dts, before_delta_ts, after_delta_ts;
 
 	if (start < 0)
 		start = 0;
 	if (start >= (int)track->sampleCount)
 		start = (int)track->sampleCount - 1;
 
-	for (int i = start; i < (int)track->sampleCount; i++, is_sync = 0) {
-		if (sync)
-			is_sync = mp4_track_is_sync_sample(track, i, NULL);
-		if (sync && !is_sync)
-			continue;
-		delta_ts = llabs((int64_t)time -
-				 (int64_t)track->sampleDecodingTime[i]);
-		if (delta_ts < min_delta_ts) {
-			min_delta_ts = delta_ts;
-			min_idx = i;
-		}
-		if (prev_delta_ts < delta_ts)
+	/* Candidates: the last sample before the time and the first one at
+	 * or after it (both from the start sample) */
+	i = MAX((int)mp4_track_time_lower_bound(track, time), start);
+	before = mp4_track_find_prev_searchable(track, i - 1, sync);
+	if (before < start)
+		before = -1;
+	after = mp4_track_find_next_searchable(track, i, sync);
+
+	if (before < 0)
+		return (after >= 0) ? after : -ENOENT;
+
+	/* Return the first of the samples with the same time */
+	before_dts = mp4_track_get_sample_dts(track, before);
+	while (before > start) {
+		i = mp4_track_find_prev_searchable(track, before - 1, sync);
+		if ((i < start) ||
+		    (mp4_track_get_sample_dts(track, i) != before_dts))
 			break;
-		prev_delta_ts = delta_ts;
+		before = i;
 	}
-	if (min_idx >= 0)
-		return min_idx;
+	if (after < 0)
+		return before;
 
-	return -ENOENT;
+	before_delta_ts = llabs((int64_t)time - (int64_t)before_dts);
+	after_delta_ts = llabs((int64_t)time -
+			       (int64_t)mp4_track_get_sample_dts(track, after));
+
+	return (before_delta_ts <= after_delta_ts) ? before : after;
 }
 
 
@@ -137,21 +396,21 @@ mp4_track_find_sample_by_time_lt(const struct mp4_track *track,
 				 int sync,
 				 int start)
 {
+	int i;
+
 	if (start < 0)
 		start = (int)track->sampleCount - 1;
 	if (start >= (int)track->sampleCount)
 		start = (int)track->sampleCount - 1;
 
-	for (int i = start; i >= 0; i--) {
-		bool check_cmp = ((cmp == MP4_TIME_CMP_LT) &&
-				  (track->sampleDecodingTime[i] < time)) ||
-				 ((cmp == MP4_TIME_CMP_LT_EQ) &&
-				  (track->sampleDecodingTime[i] <= time));
-		if (check_cmp && is_sample_searchable(track, i, sync))
-			return i;
-	}
+	/* Last sample matching the comparison */
+	if (cmp == MP4_TIME_CMP_LT)
+		i = (int)mp4_track_time_lower_bound(track, time) - 1;
+	else
+		i = (int)mp4_track_time_upper_bound(track, time) - 1;
+	i = mp4_track_find_prev_searchable(track, MIN(i, start), sync);
 
-	return -ENOENT;
+	return (i >= 0) ? i : -ENOENT;
 }
 
 
@@ -162,21 +421,21 @@ mp4_track_find_sample_by_time_gt(const struct mp4_track *track,
 				 int sync,
 				 int start)
 {
+	int i;
+
 	if (start < 0)
 		start = 0;
 	if (start >= (int)track->sampleCount)
 		start = (int)track->sampleCount - 1;
 
-	for (int i = start; i < (int)track->sampleCount; i++) {
-		bool check_cmp = ((cmp == MP4_TIME_CMP_GT) &&
-				  (track->sampleDecodingTime[i] > time)) ||
-				 ((cmp == MP4_TIME_CMP_GT_EQ) &&
-				  (track->sampleDecodingTime[i] >= time));
-		if (check_cmp && is_sample_searchable(track, i, sync))
-			return i;
-	}
+	/* First sample matching the comparison */
+	if (cmp == MP4_TIME_CMP_GT)
+		i = (int)mp4_track_time_upper_bound(track, time);
+	else
+		i = (int)mp4_track_time_lower_bound(track, time);
+	i = mp4_track_find_next_searchable(track, MAX(i, start), sync);
 
-	return -ENOENT;
+	return (i >= 0) ? i : -ENOENT;
 }
 
 
@@ -211,6 +470,92 @@ int mp4_track_find_sample_by_time(const struct mp4_track *track,
 }
 
 
+int mp4_track_build_metadata_association(struct mp4_track *track)
+{
+	const struct mp4_track *metatk;
+	int32_t *table;
+	uint32_t i, j = 0, k;
+
+	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(track->metadata == NULL, EINVAL);
+
+	if ((track->metadataSampleIdx != NULL) || (track->sampleCount == 0))
+		return 0;
+
+	metatk = track->metadata;
+	table = malloc(track->sampleCount * sizeof(*table));
+	if (table == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return -ENOMEM;
+	}
+
+	/* Both tracks are sorted by decoding time: the nearest metadata
+	 * sample never moves backwards, so a single merge pass finds it
+	 * for every sample ('k' is the first sample after the samples
+	 * sharing the decoding time of sample 'j') */
+	k = (metatk->sampleCount > 0)
+		    ? mp4_track_time_upper_bound(
+			      metatk, mp4_track_get_sample_dts(metatk, 0))
+		    : 0;
+	for (i = 0; i < track->sampleCount; i++) {
+		uint64_t prev_sample_time = INT64_MAX;
+		uint64_t next_sample_time = INT64_MAX;
+		uint64_t sample_time = mp4_track_get_sample_dts(track, i);
+		uint64_t meta_time = mp4_convert_timescale(
+			sample_time, track->timescale, metatk->timescale);
+
+		table[i] = -1;
+		if (metatk->sampleCount == 0)
+			continue;
+
+		while ((k < metatk->sampleCount) &&
+		       (llabs((int64_t)mp4_track_get_sample_dts(metatk, k) -
+			      (int64_t)meta_time) <
+			llabs((int64_t)mp4_track_get_sample_dts(metatk, j) -
+			      (int64_t)meta_time))) {
+			j = k;
+			k = mp4_track_time_upper_bound(
+				metatk, mp4_track_get_sample_dts(metatk, j));
+		}
+
+		if (i > 0)
+			prev_sample_time =
+				mp4_track_get_sample_dts(track, i - 1);
+		if (i + 1 < track->sampleCount)
+			next_sample_time =
+				mp4_track_get_sample_dts(track, i + 1);
+
+		uint64_t meta_sample_time = mp4_convert_timescale(
+			mp4_track_get_sample_dts(metatk, j),
+			metatk->timescale,
+			track->timescale);
+
+		/* Exact match */
+		if (meta_sample_time == sample_time) {
+			table[i] = j;
+			continue;
+		}
+
+		uint64_t delta_time =
+			llabs((int64_t)meta_sample_time - (int64_t)sample_time);
+		uint64_t prev_delta_time = llabs((int64_t)meta_sample_time -
+						 (int64_t)prev_sample_time);
+		uint64_t next_delta_time = llabs((int64_t)meta_sample_time -
+						 (int64_t)next_sample_time);
+
+		/* Associate the metadata sample only if closest to the
+		 * current sample */
+		if ((delta_time < prev_delta_time) &&
+		    (delta_time < next_delta_time))
+			table[i] = j;
+	}
+
+	track->metadataSampleIdx = table;
+
+	return 0;
+}
+
+
 static struct mp4_track *mp4_track_new(void)
 {
 	struct mp4_track *track = calloc(1, sizeof(*track));
@@ -219,6 +564,7 @@ static struct mp4_track *mp4_track_new(void)
 		return NULL;
 	}
 	list_node_unref(&track->node);
+	pthread_mutex_init(&track->tablesMutex, NULL);
 
 	return track;
 }
@@ -230,13 +576,20 @@ static int mp4_track_destroy(struct mp4_track *track)
 		return 0;
 
 	mp4_video_decoder_config_destroy(&track->vdc);
-	free(track->timeToSampleEntries);
-	free(track->sampleDecodingTime);
-	free(track->sampleSize);
-	free(track->chunkOffset);
-	free(track->sampleToChunkEntries);
-	free(track->sampleOffset);
-	free(track->syncSampleEntries);
+	if (!track->tablesInIndex) {
+		free(track->timeToSampleEntries);
+		free(track->sampleSize);
+		free(track->chunkOffset);
+		free(track->sampleToChunkEntries);
+		free(track->syncSampleEntries);
+	}
+	free(track->timeRuns);
+	free(track->chunkRuns);
+	free(track->expandedSampleOffset);
+	free(track->expandedSampleSize);
+	free(track->syncSampleBitmap);
+	free(track->metadataSampleIdx);
+	free(track->gops);
 	free(track->audioSpecificConfig);
 	free(track->contentEncoding);
 	free(track->mimeFormat);
@@ -247,16 +600,115 @@ static int mp4_track_destroy(struct mp4_track *track)
 	free(track->staticMetadataKey);
 	free(track->staticMetadataValue);
 	free(track->name);
+	pthread_mutex_destroy(&track->tablesMutex);
 	free(track);
 
 	return 0;
 }
 
 
+static void mp4_track_gop_end(const struct mp4_track *track,
+			      struct mp4_track_gop *gop,
+			      unsigned int endSample,
+			      uint64_t start,
+			      uint64_t end)
+{
+	gop->last_sample = endSample - 1;
+	/* The time runs also give the end of the last sample */
+	gop->end_dts = mp4_track_get_sample_dts(track, endSample);
+	gop->offset = start;
+	gop->size = end - start;
+}
+
+
+static void mp4_track_fill_gops(const struct mp4_track *track,
+				struct mp4_track_gop *gops)
+{
+	struct mp4_track_gop *gop = NULL;
+	struct mp4_sample_offset_hint hint = {0};
+	unsigned int i;
+	uint64_t offset, start = UINT64_MAX, end = 0;
+	uint32_t size;
+
+	for (i = 0; i < track->sampleCount; i++) {
+		offset = mp4_track_get_sample_offset_hinted(track, i, &hint);
+		size = mp4_track_get_sample_size(track, i);
+
+		if (mp4_track_is_sync_sample(track, i, NULL)) {
+			if (gop == NULL) {
+				/* Keep the leading samples in the first GOP */
+				gop = gops;
+				gop->first_sample = 0;
+			} else {
+				mp4_track_gop_end(track, gop, i, start, end);
+				gop++;
+				gop->first_sample = i;
+				start = UINT64_MAX;
+				end = 0;
+			}
+			gop->sync_sample = i;
+			gop->start_dts = mp4_track_get_sample_dts(
+				track, gop->first_sample);
+		}
+		if (offset < start)
+			start = offset;
+		if (offset + size > end)
+			end = offset + size;
+	}
+	mp4_track_gop_end(track, gop, track->sampleCount, start, end);
+}
+
+
+int mp4_track_build_gops(struct mp4_track *track)
+{
+	int ret = 0;
+	struct mp4_track_gop *gops;
+	unsigned int i, count = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
+
+	pthread_mutex_lock(&track->tablesMutex);
+
+	if (track->gops != NULL)
+		goto out;
+
+	for (i = 0; i < track->sampleCount; i++)
+		count += mp4_track_is_sync_sample(track, i, NULL);
+	if (count == 0)
+		goto out;
+
+	gops = calloc(count, sizeof(*gops));
+	if (gops == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		goto out;
+	}
+	mp4_track_fill_gops(track, gops);
+
+	/* Published once complete */
+	track->gops = gops;
+	track->gopCount = count;
+
+out:
+	pthread_mutex_unlock(&track->tablesMutex);
+	return ret;
+}
+
+
 struct mp4_track *mp4_track_add(struct mp4_file *mp4)
 {
+	struct mp4_track **array;
+
 	ULOG_ERRNO_RETURN_VAL_IF(mp4 == NULL, EINVAL, NULL);
 
+	array = realloc(mp4->trackArray,
+			(mp4->trackCount + 1) * sizeof(*mp4->trackArray));
+	if (array == NULL) {
+		ULOG_ERRNO("realloc", ENOMEM);
+		return NULL;
+	}
+	mp4->trackArray = array;
+
 	struct mp4_track *track = mp4_track_new();
 	if (track == NULL) {
 		ULOG_ERRNO("mp4_track_new", ENOMEM);
@@ -266,6 +718,7 @@ struct mp4_track *mp4_track_add(struct mp4_file *mp4)
 
 	/* Add to the list */
 	list_add_after(list_last(&mp4->tracks), &track->node);
+	mp4->trackArray[mp4->trackCount] = track;
 	mp4->trackCount++;
 
 	return track;
@@ -275,6 +728,7 @@ struct mp4_track *mp4_track_add(struct mp4_file *mp4)
 int mp4_track_remove(struct mp4_file *mp4, struct mp4_track *track)
 {
 	const struct mp4_track *_track = NULL;
+	unsigned int i;
 
 	ULOG_ERRNO_RETURN_ERR_IF(mp4 == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(track == NULL, EINVAL);
@@ -287,6 +741,11 @@ int mp4_track_remove(struct mp4_file *mp4, struct mp4_track *track)
 
 	/* Remove from the list */
 	list_del(&track->node);
+	for (i = 0; mp4->trackArray[i] != track; i++)
+		;
+	memmove(&mp4->trackArray[i],
+		&mp4->trackArray[i + 1],
+		(mp4->trackCount - i - 1) * sizeof(*mp4->trackArray));
 	mp4->trackCount--;
 
 	return mp4_track_destroy(track);
@@ -320,52 +779,37 @@ struct mp4_track *mp4_track_find(const struct mp4_file *mp4,
 struct mp4_track *mp4_track_find_by_idx(const struct mp4_file *mp4,
 					unsigned int track_idx)
 {
-	struct mp4_track *_track = NULL;
-	int found = 0;
-	unsigned int k = 0;
-
 	ULOG_ERRNO_RETURN_VAL_IF(mp4 == NULL, EINVAL, NULL);
 
-	list_walk_entry_forward(&mp4->tracks, _track, node)
-	{
-		if (k == track_idx) {
-			found = 1;
-			break;
-		}
-		k++;
-	}
-
-	if (!found)
+	if (track_idx >= mp4->trackCount)
 		return NULL;
 
-	return _track;
+	return mp4->trackArray[track_idx];
 }
 
 
 struct mp4_track *mp4_track_find_by_id(const struct mp4_file *mp4,
 				       unsigned int track_id)
 {
-	struct mp4_track *_track = NULL;
-	int found = 0;
+	unsigned int i;
 
 	ULOG_ERRNO_RETURN_VAL_IF(mp4 == NULL, EINVAL, NULL);
 
-	list_walk_entry_forward(&mp4->tracks, _track, node)
-	{
-		if (_track->id == track_id) {
-			found = 1;
-			break;
-		}
-	}
+	/* Track IDs are usually numbered from 1 in file order */
+	if (track_id > 0 && track_id <= mp4->trackCount &&
+	    mp4->trackArray[track_id - 1]->id == track_id)
+		return mp4->trackArray[track_id - 1];
 
-	if (!found)
-		return NULL;
+	for (i = 0; i < mp4->trackCount; i++) {
+		if (mp4->trackArray[i]->id == track_id)
+			return mp4->trackArray[i];
+	}
 
-	return _track;
+	return NULL;
 }
 
 
-void mp4_tracks_destroy(const struct mp4_file *mp4)
+void mp4_tracks_destroy(struct mp4_file *mp4)
 {
 	struct mp4_track *track = NULL;
 	struct mp4_track *tmp = NULL;
@@ -376,6 +820,212 @@ void mp4_tracks_destroy(const struct mp4_file *mp4)
 	{
 		mp4_track_destroy(track);
 	}
+	free(mp4->trackArray);
+	mp4->trackArray = NULL;
+}
+
+
+static int mp4_track_build_chunk_runs(struct mp4_track *tk)
+{
+	uint32_t lastFirstChunk = 1;
+	uint32_t lastSamplesPerChunk = 0;
+	uint32_t chunkCount;
+	uint64_t sampleCount = 0;
+
+	tk->chunkRuns = malloc((tk->sampleToChunkEntryCount + 1) *
+			       sizeof(*tk->chunkRuns));
+	if (tk->chunkRuns == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return -ENOMEM;
+	}
+	tk->chunkRunCount = 0;
+
+	for (unsigned int i = 0; i <= tk->sampleToChunkEntryCount; i++) {
+		/* The last run extends to the last chunk */
+		uint32_t firstChunk =
+			(i < tk->sampleToChunkEntryCount)
+				? tk->sampleToChunkEntries[i].firstChunk
+				: tk->chunkCount + 1;
+		if (firstChunk < lastFirstChunk) {
+			ULOGE("invalid sample-to-chunk first chunk: %" PRIu32,
+			      firstChunk);
+			return -EPROTO;
+		}
+		chunkCount = firstChunk - lastFirstChunk;
+
+		if ((chunkCount > 0) && (lastSamplesPerChunk > 0)) {
+			struct mp4_sample_chunk_run *run =
+				&tk->chunkRuns[tk->chunkRunCount++];
+			run->firstSample = sampleCount;
+			run->firstChunk = lastFirstChunk - 1;
+			run->samplesPerChunk = lastSamplesPerChunk;
+			sampleCount +=
+				(uint64_t)chunkCount * lastSamplesPerChunk;
+			if (sampleCount > tk->sampleCount)
+				break;
+		}
+
+		if (i < tk->sampleToChunkEntryCount) {
+			lastFirstChunk = firstChunk;
+			lastSamplesPerChunk =
+				tk->sampleToChunkEntries[i].samplesPerChunk;
+		}
+	}
+
+	if (sampleCount != tk->sampleCount) {
+		ULOGE("sample count mismatch: %" PRIu64 ", expected %d",
+		      sampleCount,
+		      tk->sampleCount);
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+
+static int mp4_track_build_time_runs(struct mp4_track *tk)
+{
+	uint64_t sampleCount = 0;
+	uint64_t ts = 0;
+
+	tk->timeRuns = malloc((tk->timeToSampleEntryCount + 1) *
+			      sizeof(*tk->timeRuns));
+	if (tk->timeRuns == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return -ENOMEM;
+	}
+	tk->timeRunCount = 0;
+
+	for (unsigned int i = 0; i < tk->timeToSampleEntryCount; i++) {
+		const struct mp4_time_to_sample_entry *entry =
+			&tk->timeToSampleEntries[i];
+		struct mp4_sample_time_run *run;
+		uint64_t runDuration;
+
+		if (entry->sampleCount == 0)
+			continue;
+
+		run = &tk->timeRuns[tk->timeRunCount++];
+		run->firstSample = sampleCount;
+		run->sampleCount = entry->sampleCount;
+		run->sampleDelta = entry->sampleDelta;
+		run->firstTime = ts;
+
+		sampleCount += entry->sampleCount;
+		if (sampleCount > tk->sampleCount)
+			break;
+
+		runDuration = (uint64_t)entry->sampleCount * entry->sampleDelta;
+		if (runDuration > UINT64_MAX - ts) {
+			ULOGE("timestamp overflow at sample %" PRIu64,
+			      sampleCount);
+			return -EOVERFLOW;
+		}
+		ts += runDuration;
+	}
+
+	if (sampleCount != tk->sampleCount) {
+		ULOGE("sample count mismatch: %" PRIu64 ", expected %d",
+		      sampleCount,
+		      tk->sampleCount);
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+
+static int mp4_track_compare_sync_entries(const void *a, const void *b)
+{
+	uint32_t sa = *(const uint32_t *)a;
+	uint32_t sb = *(const uint32_t *)b;
+
+	return (sa > sb) - (sa < sb);
+}
+
+
+static int mp4_track_build_sync_index(struct mp4_track *tk)
+{
+	uint32_t count = 0;
+	bool sorted = true;
+
+	if (tk->syncSampleEntries == NULL)
+		return 0;
+
+	/* The sync sample entries are binary searched: drop the invalid
+	 * entries and make sure they are in increasing order */
+	for (unsigned int i = 0; i < tk->syncSampleEntryCount; i++) {
+		uint32_t entry = tk->syncSampleEntries[i];
+		if ((entry == 0) || (entry > tk->sampleCount))
+			continue;
+		if ((count > 0) && (entry <= tk->syncSampleEntries[count - 1]))
+			sorted = false;
+		/* Only write the table if an entry was dropped, it may be
+		 * mapped from the index file */
+		if (count != i)
+			tk->syncSampleEntries[count] = entry;
+		count++;
+	}
+	if (!sorted) {
+		uint32_t unique = 0;
+		ULOGW("sync sample entries are not in increasing order");
+		qsort(tk->syncSampleEntries,
+		      count,
+		      sizeof(*tk->syncSampleEntries),
+		      &mp4_track_compare_sync_entries);
+		for (unsigned int i = 0; i < count; i++) {
+			if ((unique > 0) && (tk->syncSampleEntries[i] ==
+					     tk->syncSampleEntries[unique - 1]))
+				continue;
+			tk->syncSampleEntries[unique++] =
+				tk->syncSampleEntries[i];
+		}
+		count = unique;
+	}
+	if (count != tk->syncSampleEntryCount) {
+		ULOGW("%" PRIu32 " invalid sync sample entries ignored",
+		      tk->syncSampleEntryCount - count);
+		tk->syncSampleEntryCount = count;
+	}
+
+	tk->syncSampleBitmap =
+		calloc((tk->sampleCount + 31) / 32, sizeof(uint32_t));
+	if (tk->syncSampleBitmap == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+	for (unsigned int i = 0; i < tk->syncSampleEntryCount; i++) {
+		uint32_t idx = tk->syncSampleEntries[i] - 1;
+		tk->syncSampleBitmap[idx / 32] |= 1U << (idx % 32);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Build the tables used to look up samples on demand: the run tables
+ * for the sample offsets and decoding times (instead of expanding them
+ * for each sample) and the sync samples index
+ */
+int mp4_track_build_lookup_tables(struct mp4_track *tk)
+{
+	int ret;
+
+	ret = mp4_track_build_chunk_runs(tk);
+	if (ret < 0)
+		return ret;
+
+	if (tk->sampleCount == 0) {
+		ULOGE("invalid sample count");
+		return -EPROTO;
+	}
+
+	ret = mp4_track_build_time_runs(tk);
+	if (ret < 0)
+		return ret;
+
+	return mp4_track_build_sync_index(tk);
 }
 
 
@@ -398,121 +1048,10 @@ int mp4_tracks_build(struct mp4_file *mp4)
 	list_walk_entry_forward(&mp4->tracks, tk, node)
 	{
 		unsigned int i;
-		unsigned int j;
-		unsigned int k;
-		unsigned int n;
-		uint32_t lastFirstChunk = 1;
-		uint32_t lastSamplesPerChunk = 0;
-		uint32_t chunkCount;
-		uint32_t sampleCount = 0;
-		uint32_t chunkIdx;
-		uint64_t offsetInChunk;
-		for (i = 0; i < tk->sampleToChunkEntryCount; i++) {
-			chunkCount = tk->sampleToChunkEntries[i].firstChunk -
-				     lastFirstChunk;
-			sampleCount += chunkCount * lastSamplesPerChunk;
-			lastFirstChunk = tk->sampleToChunkEntries[i].firstChunk;
-			lastSamplesPerChunk =
-				tk->sampleToChunkEntries[i].samplesPerChunk;
-		}
-		chunkCount = tk->chunkCount - lastFirstChunk + 1;
-		sampleCount += chunkCount * lastSamplesPerChunk;
-
-		if (sampleCount != tk->sampleCount) {
-			ULOGE("sample count mismatch: %d, expected %d",
-			      sampleCount,
-			      tk->sampleCount);
-			return -EPROTO;
-		}
 
-		if (sampleCount == 0) {
-			ULOGE("invalid sample count");
-			return -EPROTO;
-		}
-		tk->sampleOffset = malloc(sampleCount * sizeof(uint64_t));
-		if (tk->sampleOffset == NULL) {
-			ULOG_ERRNO("malloc", ENOMEM);
-			return -ENOMEM;
-		}
-
-		lastFirstChunk = 1;
-		lastSamplesPerChunk = 0;
-		for (i = 0, n = 0, chunkIdx = 0;
-		     i < tk->sampleToChunkEntryCount;
-		     i++) {
-			chunkCount = tk->sampleToChunkEntries[i].firstChunk -
-				     lastFirstChunk;
-			for (j = 0; j < chunkCount; j++, chunkIdx++) {
-				for (k = 0, offsetInChunk = 0;
-				     k < lastSamplesPerChunk;
-				     k++, n++) {
-					tk->sampleOffset[n] =
-						tk->chunkOffset[chunkIdx] +
-						offsetInChunk;
-					offsetInChunk += tk->sampleSize[n];
-				}
-			}
-			lastFirstChunk = tk->sampleToChunkEntries[i].firstChunk;
-			lastSamplesPerChunk =
-				tk->sampleToChunkEntries[i].samplesPerChunk;
-		}
-		chunkCount = tk->chunkCount - lastFirstChunk + 1;
-		for (j = 0; j < chunkCount; j++, chunkIdx++) {
-			for (k = 0, offsetInChunk = 0; k < lastSamplesPerChunk;
-			     k++, n++) {
-				tk->sampleOffset[n] =
-					tk->chunkOffset[chunkIdx] +
-					offsetInChunk;
-				offsetInChunk += tk->sampleSize[n];
-			}
-		}
-
-		for (i = 0, sampleCount = 0; i < tk->timeToSampleEntryCount;
-		     i++)
-			sampleCount += tk->timeToSampleEntries[i].sampleCount;
-
-		if (sampleCount != tk->sampleCount) {
-			ULOGE("sample count mismatch: %d, expected %d",
-			      sampleCount,
-			      tk->sampleCount);
-			return -EPROTO;
-		}
-
-		tk->sampleDecodingTime =
-			malloc(tk->sampleCount * sizeof(uint64_t));
-		if (tk->sampleDecodingTime == NULL) {
-			ULOG_ERRNO("malloc", ENOMEM);
-			return -ENOMEM;
-		}
-
-		uint64_t ts = 0;
-		k = 0;
-		for (i = 0; i < tk->timeToSampleEntryCount; i++) {
-			const struct mp4_time_to_sample_entry *entry =
-				&tk->timeToSampleEntries[i];
-
-			for (j = 0; j < entry->sampleCount; j++, k++) {
-				if (k >= sampleCount) {
-					ULOGE("time-to-sample entries exceed "
-					      "sample count");
-					free(tk->sampleDecodingTime);
-					tk->sampleDecodingTime = NULL;
-					return -EPROTO;
-				}
-
-				tk->sampleDecodingTime[k] = ts;
-
-				if (entry->sampleDelta > UINT64_MAX - ts) {
-					ULOGE("timestamp overflow at sample %u",
-					      k);
-					free(tk->sampleDecodingTime);
-					tk->sampleDecodingTime = NULL;
-					return -EOVERFLOW;
-				}
-
-				ts += entry->sampleDelta;
-			}
-		}
+		ret = mp4_track_build_lookup_tables(tk);
+		if (ret < 0)
+			return ret;
 
 		switch (tk->type) {
 		case MP4_TRACK_TYPE_VIDEO:
@@ -574,14 +1113,16 @@ int mp4_tracks_build(struct mp4_file *mp4)
 			unsigned int sampleSize;
 			unsigned int readBytes = 0;
 			uint16_t sz;
-			sampleSize = chapTk->sampleSize[i];
-			off_t _ret = lseek(
-				mp4->fd, chapTk->sampleOffset[i], SEEK_SET);
+			sampleSize = mp4_track_get_sample_size(chapTk, i);
+			off_t _ret = mp4_file_seek(
+				mp4,
+				mp4_track_get_sample_offset(chapTk, i),
+				SEEK_SET);
 			if (_ret == -1) {
 				ULOG_ERRNO("lseek", errno);
 				return -errno;
 			}
-			MP4_READ_16(mp4->fd, sz, readBytes);
+			MP4_FILE_READ_16(mp4, sz, readBytes);
 			sz = ntohs(sz);
 			if (sz <= sampleSize - readBytes) {
 				if (mp4->chaptersCount >= MP4_CHAPTERS_MAX) {
@@ -593,7 +1134,8 @@ int mp4_tracks_build(struct mp4_file *mp4)
 					return -ENOMEM;
 				mp4->chaptersName[mp4->chaptersCount] =
 					chapName;
-				ssize_t count = read(mp4->fd, chapName, sz);
+				ssize_t count =
+					mp4_file_read(mp4, chapName, sz);
 				if (count == -1) {
 					ret = -errno;
 					ULOG_ERRNO("read", -ret);
@@ -605,7 +1147,7 @@ int mp4_tracks_build(struct mp4_file *mp4)
 				}
 				chapName[sz] = '\0';
 				uint64_t chapTime = mp4_sample_time_to_usec(
-					chapTk->sampleDecodingTime[i],
+					mp4_track_get_sample_dts(chapTk, i),
 					chapTk->timescale);
 				ULOGD("chapter #%d time=%" PRIu64 " '%s'",
 				      mp4->chaptersCount + 1,
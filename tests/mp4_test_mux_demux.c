@@ -26,6 +26,8 @@
  */
 
 #include "mp4_test.h"
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -282,41 +284,127 @@ test_demux_track(const struct mp4_demux *demux, unsigned int i, unsigned int t)
 }
 
 
-static void test_demux(void)
+static void test_demux_content(struct mp4_demux *demux, unsigned int i)
 {
 	int res = 0;
-	struct mp4_demux *demux;
 	int track_count = 0;
 	unsigned int meta_count = 0;
 	char **keys = NULL;
 	char **values = NULL;
 
+	res = mp4_demux_get_metadata_strings(
+		demux, &meta_count, &keys, &values);
+	CU_ASSERT_EQUAL(res, 0);
+
+	CU_ASSERT(meta_count > 0);
+	CU_ASSERT_EQUAL(meta_count, test_mux_demux_map[i].metadata_count);
+	for (size_t m = 0; m < meta_count; m++) {
+		CU_ASSERT_STRING_EQUAL(keys[m],
+				       test_mux_demux_map[i].metadatas[m].key);
+		CU_ASSERT_STRING_EQUAL(
+			values[m], test_mux_demux_map[i].metadatas[m].value);
+	}
+
+	track_count = mp4_demux_get_track_count(demux);
+	CU_ASSERT(track_count > 0);
+	CU_ASSERT_EQUAL(track_count, test_mux_demux_map[i].track_count);
+	for (size_t t = 0; t < (size_t)track_count; t++)
+		test_demux_track(demux, i, t);
+}
+
+
+static void test_demux(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+
 	for (size_t i = 0; i < SIZEOF_ARRAY(test_mux_demux_map); i++) {
 		res = mp4_demux_open(test_mux_demux_map[i].config.filename,
 				     &demux);
 		CU_ASSERT_EQUAL(res, 0);
 
-		res = mp4_demux_get_metadata_strings(
-			demux, &meta_count, &keys, &values);
+		test_demux_content(demux, i);
+
+		res = mp4_demux_close(demux);
 		CU_ASSERT_EQUAL(res, 0);
 
-		CU_ASSERT(meta_count > 0);
-		CU_ASSERT_EQUAL(meta_count,
-				test_mux_demux_map[i].metadata_count);
-		for (size_t m = 0; m < meta_count; m++) {
-			CU_ASSERT_STRING_EQUAL(
-				keys[m],
-				test_mux_demux_map[i].metadatas[m].key);
-			CU_ASSERT_STRING_EQUAL(
-				values[m],
-				test_mux_demux_map[i].metadatas[m].value);
-		}
+		remove(test_mux_demux_map[i].config.filename);
+	}
+}
+
+
+static void test_demux_mmap(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	const uint8_t *sample_data;
+
+	for (size_t i = 0; i < SIZEOF_ARRAY(test_mux_demux_map); i++) {
+		/* Zero-copy access requires a memory-mapped demuxer */
+		res = mp4_demux_open(test_mux_demux_map[i].config.filename,
+				     &demux);
+		CU_ASSERT_EQUAL(res, 0);
+		mp4_demux_get_track_info(demux, 0, &track_info);
+		res = mp4_demux_get_track_sample_mapped(demux,
+							track_info.id,
+							0,
+							&sample_data,
+							NULL,
+							&track_sample);
+		CU_ASSERT_EQUAL(res, -ENOTSUP);
+		res = mp4_demux_close(demux);
+		CU_ASSERT_EQUAL(res, 0);
+
+		res = mp4_demux_open_mmap(test_mux_demux_map[i].config.filename,
+					  &demux);
+		CU_ASSERT_EQUAL(res, 0);
 
-		track_count = mp4_demux_get_track_count(demux);
-		CU_ASSERT(track_count > 0);
-		CU_ASSERT_EQUAL(track_count, test_mux_demux_map[i].track_count);
-		for (size_t t = 0; t < (size_t)track_count; t++)
-			test_demux_track(demux, i, t);
+		for (size_t t = 0; t < test_mux_demux_map[i].track_count; t++) {
+			const struct expected_track *track =
+				&test_mux_demux_map[i].tracks[t];
+
+			mp4_demux_get_track_info(demux, t, &track_info);
+			CU_ASSERT_EQUAL(track_info.sample_count,
+					track->sample_count);
+
+			for (size_t s = 0; s < track->sample_count; s++) {
+				const struct mp4_mux_sample *expected_sample =
+					&track->samples[s];
+
+				res = mp4_demux_get_track_sample_mapped(
+					demux,
+					track_info.id,
+					1,
+					&sample_data,
+					NULL,
+					&track_sample);
+				CU_ASSERT_EQUAL(res, 0);
+				CU_ASSERT_PTR_NOT_NULL_FATAL(sample_data);
+				CU_ASSERT_EQUAL(expected_sample->len,
+						track_sample.size);
+				CU_ASSERT_EQUAL(expected_sample->sync,
+						track_sample.sync);
+				CU_ASSERT_EQUAL(expected_sample->dts,
+						track_sample.dts);
+				CU_ASSERT_EQUAL(memcmp(expected_sample->buffer,
+						       sample_data,
+						       expected_sample->len),
+						0);
+			}
+
+			/* End of track */
+			res = mp4_demux_get_track_sample_mapped(demux,
+								track_info.id,
+								1,
+								&sample_data,
+								NULL,
+								&track_sample);
+			CU_ASSERT_EQUAL(res, 0);
+			CU_ASSERT_EQUAL(track_sample.size, 0);
+			CU_ASSERT_PTR_NULL(sample_data);
+		}
 
 		res = mp4_demux_close(demux);
 		CU_ASSERT_EQUAL(res, 0);
@@ -326,6 +414,82 @@ static void test_demux(void)
 }
 
 
+static void test_demux_index(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	char index_filename[PATH_MAX];
+	struct stat st;
+	struct stat st_file;
+	struct timespec times[2];
+
+	for (size_t i = 0; i < SIZEOF_ARRAY(test_mux_demux_map); i++) {
+		const char *filename = test_mux_demux_map[i].config.filename;
+
+		snprintf(index_filename,
+			 sizeof(index_filename),
+			 "%s%s",
+			 filename,
+			 MP4_DEMUX_INDEX_SUFFIX);
+		remove(index_filename);
+
+		/* First open: the file is parsed and the index written */
+		res = mp4_demux_open_with_index(filename, NULL, &demux);
+		CU_ASSERT_EQUAL(res, 0);
+		test_demux_content(demux, i);
+		res = mp4_demux_close(demux);
+		CU_ASSERT_EQUAL(res, 0);
+		res = stat(index_filename, &st);
+		CU_ASSERT_EQUAL(res, 0);
+
+		/* Second open: the state is loaded from the index */
+		res = mp4_demux_open_with_index(
+			filename, index_filename, &demux);
+		CU_ASSERT_EQUAL(res, 0);
+		test_demux_content(demux, i);
+		res = mp4_demux_close(demux);
+		CU_ASSERT_EQUAL(res, 0);
+		res = stat(index_filename, &st_file);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(st_file.st_ino, st.st_ino);
+
+		/* A modification time change below the second makes the
+		 * index stale: the file is parsed and the index rewritten */
+		res = stat(filename, &st_file);
+		CU_ASSERT_EQUAL(res, 0);
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT;
+		times[1] = st_file.st_mtim;
+		times[1].tv_nsec = (times[1].tv_nsec == 0) ? 1 : 0;
+		res = utimensat(AT_FDCWD, filename, times, 0);
+		CU_ASSERT_EQUAL(res, 0);
+		res = mp4_demux_open_with_index(
+			filename, index_filename, &demux);
+		CU_ASSERT_EQUAL(res, 0);
+		test_demux_content(demux, i);
+		res = mp4_demux_close(demux);
+		CU_ASSERT_EQUAL(res, 0);
+		res = stat(index_filename, &st_file);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_NOT_EQUAL(st_file.st_ino, st.st_ino);
+		st = st_file;
+
+		/* A corrupted index must be ignored */
+		res = truncate(index_filename, st.st_size / 2);
+		CU_ASSERT_EQUAL(res, 0);
+		res = mp4_demux_open_with_index(
+			filename, index_filename, &demux);
+		CU_ASSERT_EQUAL(res, 0);
+		test_demux_content(demux, i);
+		res = mp4_demux_close(demux);
+		CU_ASSERT_EQUAL(res, 0);
+
+		remove(index_filename);
+		remove(filename);
+	}
+}
+
+
 static void test_recovery(void)
 {
 	char *error_msg;
@@ -350,6 +514,20 @@ static void test_mp4_mux_demux_test(void)
 }
 
 
+static void test_mp4_mux_demux_mmap_test(void)
+{
+	(void)fill_muxer_list(true, false);
+	test_demux_mmap();
+}
+
+
+static void test_mp4_mux_demux_index_test(void)
+{
+	(void)fill_muxer_list(true, false);
+	test_demux_index();
+}
+
+
 static void test_mp4_mux_internal_sync_demux_test(void)
 {
 	struct mp4_mux **muxers = fill_muxer_list(false, true);
@@ -378,6 +556,1971 @@ static void test_mp4_mux_recovery_test(void)
 }
 
 
+/* Video at 90000 Hz, metadata at 1000 Hz: the metadata sample at 34 ms
+ * is closer to the second frame than to the third one, which gets none */
+static const uint64_t video_dts[] = {0, 3000, 6000, 9000, 12000};
+static const uint64_t meta_dts[] = {0, 34, 100, 134};
+static const uint32_t expected_meta_size[] = {1, 2, 0, 3, 4};
+
+
+static void mux_metadata_track_file(void)
+{
+	int res = 0;
+	int video_handle, meta_handle;
+	struct mp4_mux *mux;
+	uint8_t meta_data[4] = {0, 1, 2, 3};
+	struct expected_track video = tracks[0];
+	struct mp4_mux_track_params meta_params = {
+		.type = MP4_TRACK_TYPE_METADATA,
+		.name = "metadata",
+		.timescale = 1000,
+	};
+
+	video.samples = NULL;
+	video.sample_count = 0;
+
+	res = mp4_mux_open(&test_mux_demux_map[0].config, &mux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	add_expected_track(mux, &video);
+	video_handle = 1;
+	meta_handle = mp4_mux_add_track(mux, &meta_params);
+	CU_ASSERT_EQUAL(meta_handle, 2);
+	res = mp4_mux_track_set_metadata_mime_type(
+		mux, meta_handle, "", "application/octet-stream");
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_add_ref_to_track(mux, meta_handle, video_handle);
+	CU_ASSERT_EQUAL(res, 0);
+
+	for (size_t s = 0; s < SIZEOF_ARRAY(video_dts); s++) {
+		struct mp4_mux_sample sample = empty_sample;
+		sample.dts = video_dts[s];
+		res = mp4_mux_track_add_sample(mux, video_handle, &sample);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	for (size_t s = 0; s < SIZEOF_ARRAY(meta_dts); s++) {
+		struct mp4_mux_sample sample = {
+			.buffer = meta_data,
+			.len = s + 1,
+			.sync = 1,
+			.dts = meta_dts[s],
+		};
+		res = mp4_mux_track_add_sample(mux, meta_handle, &sample);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+static void test_mp4_mux_demux_metadata_track(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	uint8_t sample_buffer[16];
+	uint8_t metadata_buffer[16];
+
+	mux_metadata_track_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_info.type, MP4_TRACK_TYPE_VIDEO);
+	CU_ASSERT_EQUAL(track_info.has_metadata, 1);
+
+	for (size_t s = 0; s < SIZEOF_ARRAY(video_dts); s++) {
+		res = mp4_demux_get_track_sample(demux,
+						 track_info.id,
+						 1,
+						 sample_buffer,
+						 sizeof(sample_buffer),
+						 metadata_buffer,
+						 sizeof(metadata_buffer),
+						 &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_sample.dts, video_dts[s]);
+		CU_ASSERT_EQUAL(track_sample.metadata_size,
+				expected_meta_size[s]);
+		/* Both are usually read at once, check the data */
+		CU_ASSERT_EQUAL(track_sample.size, sizeof(empty_cookie));
+		CU_ASSERT_EQUAL(memcmp(sample_buffer,
+				       &empty_cookie,
+				       sizeof(empty_cookie)),
+				0);
+		for (uint32_t i = 0; i < track_sample.metadata_size; i++)
+			CU_ASSERT_EQUAL(metadata_buffer[i], i);
+	}
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_cursor(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_demux_cursor *cursors[2];
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	uint8_t sample_buffer[16];
+	uint8_t metadata_buffer[16];
+
+	mux_metadata_track_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = mp4_demux_cursor_new(demux, 0xffff, &cursors[0]);
+	CU_ASSERT_EQUAL(res, -ENOENT);
+	for (size_t c = 0; c < SIZEOF_ARRAY(cursors); c++) {
+		res = mp4_demux_cursor_new(demux, track_info.id, &cursors[c]);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+	}
+
+	/* Interleaved reads: each cursor keeps its own position */
+	for (size_t s = 0; s < SIZEOF_ARRAY(video_dts); s++) {
+		for (size_t c = 0; c < SIZEOF_ARRAY(cursors); c++) {
+			res = mp4_demux_cursor_get_sample(
+				cursors[c],
+				1,
+				sample_buffer,
+				sizeof(sample_buffer),
+				metadata_buffer,
+				sizeof(metadata_buffer),
+				&track_sample);
+			CU_ASSERT_EQUAL(res, 0);
+			CU_ASSERT_EQUAL(track_sample.dts, video_dts[s]);
+			CU_ASSERT_EQUAL(track_sample.metadata_size,
+					expected_meta_size[s]);
+		}
+	}
+
+	/* End of track */
+	res = mp4_demux_cursor_get_sample(
+		cursors[0], 1, NULL, 0, NULL, 0, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.size, 0);
+
+	/* Seeking a cursor moves neither the other cursor nor the track */
+	res = mp4_demux_cursor_seek(
+		cursors[1],
+		mp4_sample_time_to_usec(video_dts[3], track_info.timescale),
+		MP4_SEEK_METHOD_PREVIOUS);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_demux_cursor_get_sample(
+		cursors[1], 0, NULL, 0, NULL, 0, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.dts, video_dts[3]);
+	res = mp4_demux_cursor_get_sample(
+		cursors[0], 0, NULL, 0, NULL, 0, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.size, 0);
+	res = mp4_demux_get_track_sample(
+		demux, track_info.id, 0, NULL, 0, NULL, 0, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.dts, video_dts[0]);
+
+	for (size_t c = 0; c < SIZEOF_ARRAY(cursors); c++) {
+		res = mp4_demux_cursor_destroy(cursors[c]);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_track_samples(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_samples[SIZEOF_ARRAY(video_dts)];
+	unsigned int sample_count = 0;
+	uint8_t sample_buffer[SIZEOF_ARRAY(video_dts) * sizeof(empty_cookie)];
+	uint8_t metadata_buffer[16];
+	size_t metadata_offset = 0;
+
+	mux_metadata_track_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	/* Buffer too small for the first sample */
+	res = mp4_demux_get_track_samples(demux,
+					  track_info.id,
+					  SIZEOF_ARRAY(track_samples),
+					  0,
+					  sample_buffer,
+					  sizeof(empty_cookie) - 1,
+					  NULL,
+					  0,
+					  track_samples,
+					  &sample_count);
+	CU_ASSERT_EQUAL(res, -ENOBUFS);
+	CU_ASSERT_EQUAL(sample_count, 0);
+
+	/* Stop before the fourth sample */
+	res = mp4_demux_get_track_samples(
+		demux,
+		track_info.id,
+		SIZEOF_ARRAY(track_samples),
+		mp4_sample_time_to_usec(video_dts[3], track_info.timescale),
+		sample_buffer,
+		sizeof(sample_buffer),
+		metadata_buffer,
+		sizeof(metadata_buffer),
+		track_samples,
+		&sample_count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL_FATAL(sample_count, 3);
+	for (size_t s = 0; s < sample_count; s++) {
+		CU_ASSERT_EQUAL(track_samples[s].dts, video_dts[s]);
+		CU_ASSERT_EQUAL(track_samples[s].size, sizeof(empty_cookie));
+		CU_ASSERT_EQUAL(memcmp(sample_buffer + s * sizeof(empty_cookie),
+				       &empty_cookie,
+				       sizeof(empty_cookie)),
+				0);
+		CU_ASSERT_EQUAL(track_samples[s].metadata_size,
+				expected_meta_size[s]);
+		/* Metadata samples are prefixes of {0, 1, 2, 3} */
+		for (size_t m = 0; m < track_samples[s].metadata_size; m++)
+			CU_ASSERT_EQUAL(metadata_buffer[metadata_offset++], m);
+	}
+
+	/* Remaining samples */
+	res = mp4_demux_get_track_samples(demux,
+					  track_info.id,
+					  SIZEOF_ARRAY(track_samples),
+					  0,
+					  NULL,
+					  0,
+					  NULL,
+					  0,
+					  track_samples,
+					  &sample_count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL_FATAL(sample_count, 2);
+	CU_ASSERT_EQUAL(track_samples[0].dts, video_dts[3]);
+	CU_ASSERT_EQUAL(track_samples[1].dts, video_dts[4]);
+
+	/* End of track */
+	res = mp4_demux_get_track_samples(demux,
+					  track_info.id,
+					  SIZEOF_ARRAY(track_samples),
+					  0,
+					  NULL,
+					  0,
+					  NULL,
+					  0,
+					  track_samples,
+					  &sample_count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(sample_count, 0);
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_readahead(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	uint8_t sample_buffer[16];
+	uint8_t metadata_buffer[16];
+
+	mux_metadata_track_file();
+
+	for (int map = 0; map < 2; map++) {
+		if (map)
+			res = mp4_demux_open_mmap(
+				test_mux_demux_map[0].config.filename, &demux);
+		else
+			res = mp4_demux_open(
+				test_mux_demux_map[0].config.filename, &demux);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+
+		res = mp4_demux_set_readahead(demux, 2);
+		CU_ASSERT_EQUAL(res, 0);
+
+		res = mp4_demux_get_track_info(demux, 0, &track_info);
+		CU_ASSERT_EQUAL(res, 0);
+
+		/* Read twice to read ahead again after seeking back */
+		for (int pass = 0; pass < 2; pass++) {
+			for (size_t s = 0; s < SIZEOF_ARRAY(video_dts); s++) {
+				res = mp4_demux_get_track_sample(
+					demux,
+					track_info.id,
+					1,
+					sample_buffer,
+					sizeof(sample_buffer),
+					metadata_buffer,
+					sizeof(metadata_buffer),
+					&track_sample);
+				CU_ASSERT_EQUAL(res, 0);
+				CU_ASSERT_EQUAL(track_sample.dts, video_dts[s]);
+				CU_ASSERT_EQUAL(memcmp(sample_buffer,
+						       &empty_cookie,
+						       sizeof(empty_cookie)),
+						0);
+				CU_ASSERT_EQUAL(track_sample.metadata_size,
+						expected_meta_size[s]);
+			}
+			res = mp4_demux_seek(
+				demux, 0, MP4_SEEK_METHOD_PREVIOUS_SYNC);
+			CU_ASSERT_EQUAL(res, 0);
+		}
+
+		res = mp4_demux_close(demux);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_reader(void)
+{
+	int res = 0;
+	struct mp4_demux *demuxes[2];
+	struct mp4_demux_reader *reader;
+	struct mp4_track_info track_info;
+	uint8_t buffers[2 * SIZEOF_ARRAY(video_dts) + 2][16];
+	struct mp4_demux_sample_read reads[SIZEOF_ARRAY(buffers)];
+	uint8_t *registered[1];
+	size_t registered_size[1];
+
+	mux_metadata_track_file();
+
+	/* Read the same file with two demuxers, one of them mapped */
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename,
+			     &demuxes[0]);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = mp4_demux_open_mmap(test_mux_demux_map[0].config.filename,
+				  &demuxes[1]);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demuxes[0], 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = mp4_demux_reader_new(2, &reader);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	/* All the samples of both demuxers, then the end of the tracks */
+	for (size_t r = 0; r < SIZEOF_ARRAY(reads); r++) {
+		reads[r].demux = demuxes[r % 2];
+		reads[r].track_id = track_info.id;
+		reads[r].buffer = buffers[r];
+		reads[r].buffer_size = sizeof(buffers[r]);
+	}
+	res = mp4_demux_reader_read_samples(reader, reads, SIZEOF_ARRAY(reads));
+	CU_ASSERT_EQUAL(res, 0);
+	for (size_t r = 0; r < SIZEOF_ARRAY(reads); r++) {
+		size_t s = r / 2;
+		CU_ASSERT_EQUAL(reads[r].status, 0);
+		if (s >= SIZEOF_ARRAY(video_dts)) {
+			CU_ASSERT_EQUAL(reads[r].sample.size, 0);
+			continue;
+		}
+		CU_ASSERT_EQUAL(reads[r].sample.dts, video_dts[s]);
+		CU_ASSERT_EQUAL(reads[r].sample.size, sizeof(empty_cookie));
+		CU_ASSERT_EQUAL(
+			memcmp(buffers[r], &empty_cookie, sizeof(empty_cookie)),
+			0);
+	}
+
+	/* Buffer too small: the track is not advanced */
+	res = mp4_demux_seek(demuxes[0], 0, MP4_SEEK_METHOD_PREVIOUS);
+	CU_ASSERT_EQUAL(res, 0);
+	reads[0].buffer_size = sizeof(empty_cookie) - 1;
+	res = mp4_demux_reader_read_samples(reader, reads, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(reads[0].status, -ENOBUFS);
+	reads[0].buffer_size = sizeof(buffers[0]);
+	res = mp4_demux_reader_read_samples(reader, reads, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(reads[0].status, 0);
+	CU_ASSERT_EQUAL(reads[0].sample.dts, video_dts[0]);
+
+	/* Same reads into registered buffers */
+	for (size_t d = 0; d < SIZEOF_ARRAY(demuxes); d++) {
+		res = mp4_demux_seek(demuxes[d], 0, MP4_SEEK_METHOD_PREVIOUS);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	registered[0] = &buffers[0][0];
+	registered_size[0] = sizeof(buffers);
+	res = mp4_demux_reader_register_buffers(
+		reader, registered, registered_size, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	memset(buffers, 0, sizeof(buffers));
+	res = mp4_demux_reader_read_samples(reader, reads, SIZEOF_ARRAY(reads));
+	CU_ASSERT_EQUAL(res, 0);
+	for (size_t r = 0; r < SIZEOF_ARRAY(video_dts) * 2; r++) {
+		CU_ASSERT_EQUAL(reads[r].status, 0);
+		CU_ASSERT_EQUAL(reads[r].sample.dts, video_dts[r / 2]);
+		CU_ASSERT_EQUAL(
+			memcmp(buffers[r], &empty_cookie, sizeof(empty_cookie)),
+			0);
+	}
+	res = mp4_demux_reader_register_buffers(reader, NULL, NULL, 0);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = mp4_demux_reader_destroy(reader);
+	CU_ASSERT_EQUAL(res, 0);
+
+	for (size_t d = 0; d < SIZEOF_ARRAY(demuxes); d++) {
+		res = mp4_demux_close(demuxes[d]);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_iterator(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_demux_iterator *iterator;
+	struct mp4_track_info video_info, meta_info;
+	struct mp4_track_sample track_sample;
+	unsigned int track_id;
+	unsigned int invalid_id = 0xffff;
+	uint64_t prev_offset = 0;
+	/* Samples in decoding time order, the video track first for equal
+	 * times: {track index, sample index} */
+	const unsigned int expected_order[][2] = {
+		{0, 0},
+		{1, 0},
+		{0, 1},
+		{1, 1},
+		{0, 2},
+		{0, 3},
+		{1, 2},
+		{0, 4},
+		{1, 3},
+	};
+
+	mux_metadata_track_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &video_info);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_demux_get_track_info(demux, 1, &meta_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = mp4_demux_iterator_new(demux,
+				     MP4_DEMUX_ITERATOR_ORDER_DTS,
+				     &invalid_id,
+				     1,
+				     &iterator);
+	CU_ASSERT_EQUAL(res, -ENOENT);
+
+	/* All tracks, in decoding time order */
+	res = mp4_demux_iterator_new(
+		demux, MP4_DEMUX_ITERATOR_ORDER_DTS, NULL, 0, &iterator);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	for (size_t i = 0; i < SIZEOF_ARRAY(expected_order); i++) {
+		unsigned int t = expected_order[i][0];
+		unsigned int s = expected_order[i][1];
+		res = mp4_demux_iterator_next(
+			iterator, NULL, 0, NULL, 0, &track_id, &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_id, t ? meta_info.id : video_info.id);
+		CU_ASSERT_EQUAL(track_sample.dts,
+				t ? meta_dts[s] : video_dts[s]);
+	}
+	res = mp4_demux_iterator_next(
+		iterator, NULL, 0, NULL, 0, &track_id, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.size, 0);
+	CU_ASSERT_EQUAL(track_id, 0);
+	mp4_demux_iterator_destroy(iterator);
+
+	/* All tracks, in file offset order */
+	res = mp4_demux_iterator_new(
+		demux, MP4_DEMUX_ITERATOR_ORDER_OFFSET, NULL, 0, &iterator);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	for (size_t i = 0; i < SIZEOF_ARRAY(expected_order); i++) {
+		res = mp4_demux_iterator_next(
+			iterator, NULL, 0, NULL, 0, &track_id, &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_NOT_EQUAL(track_sample.size, 0);
+		CU_ASSERT(track_sample.offset >= prev_offset);
+		prev_offset = track_sample.offset;
+	}
+	res = mp4_demux_iterator_next(
+		iterator, NULL, 0, NULL, 0, &track_id, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.size, 0);
+	mp4_demux_iterator_destroy(iterator);
+
+	/* Selected track only */
+	res = mp4_demux_iterator_new(demux,
+				     MP4_DEMUX_ITERATOR_ORDER_DTS,
+				     &meta_info.id,
+				     1,
+				     &iterator);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	for (size_t s = 0; s < SIZEOF_ARRAY(meta_dts); s++) {
+		res = mp4_demux_iterator_next(
+			iterator, NULL, 0, NULL, 0, &track_id, &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_id, meta_info.id);
+		CU_ASSERT_EQUAL(track_sample.dts, meta_dts[s]);
+	}
+	mp4_demux_iterator_destroy(iterator);
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_many_tracks(void)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	uint8_t data[16] = {0};
+	struct mp4_mux_sample sample = {
+		.buffer = data,
+		.sync = 1,
+	};
+	struct mp4_mux_track_params params = {
+		.type = MP4_TRACK_TYPE_METADATA,
+		.name = "metadata",
+		.timescale = 1000,
+	};
+	const unsigned int track_count = 16;
+
+	res = mp4_mux_open(&test_mux_demux_map[0].config, &mux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	/* Track i has i + 1 samples of i + 1 bytes */
+	for (unsigned int i = 0; i < track_count; i++) {
+		int handle = mp4_mux_add_track(mux, &params);
+		CU_ASSERT_EQUAL(handle, (int)i + 1);
+		res = mp4_mux_track_set_metadata_mime_type(
+			mux, handle, "", "application/octet-stream");
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	for (unsigned int s = 0; s < track_count; s++) {
+		for (unsigned int i = s; i < track_count; i++) {
+			sample.len = i + 1;
+			sample.dts = s * 10;
+			res = mp4_mux_track_add_sample(mux, i + 1, &sample);
+			CU_ASSERT_EQUAL(res, 0);
+		}
+	}
+	res = mp4_mux_track_add_sample(mux, 0, &sample);
+	CU_ASSERT_NOT_EQUAL(res, 0);
+	res = mp4_mux_track_add_sample(mux, track_count + 1, &sample);
+	CU_ASSERT_NOT_EQUAL(res, 0);
+
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	CU_ASSERT_EQUAL(mp4_demux_get_track_count(demux), (int)track_count);
+	res = mp4_demux_get_track_info(demux, track_count, &track_info);
+	CU_ASSERT_EQUAL(res, -ENOENT);
+
+	/* Look the tracks up from the last one, by index then by ID */
+	for (unsigned int i = track_count; i > 0; i--) {
+		res = mp4_demux_get_track_info(demux, i - 1, &track_info);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_info.sample_count, i);
+		res = mp4_demux_get_track_sample(demux,
+						 track_info.id,
+						 1,
+						 NULL,
+						 0,
+						 NULL,
+						 0,
+						 &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_sample.size, i);
+	}
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+/* Video samples sync flags; the first sample is not a sync sample */
+static const int gop_sync[] = {0, 1, 0, 0, 1, 0, 1};
+
+
+/**
+ * Write a file with a video track with samples of 1 to 7 bytes, every
+ * 3000 units of time, in 3 GOPs (see gop_sync)
+ */
+static void mux_gop_file(void)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	uint8_t data[8] = {0};
+	struct expected_track video = tracks[0];
+
+	video.samples = NULL;
+	video.sample_count = 0;
+
+	res = mp4_mux_open(&test_mux_demux_map[0].config, &mux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	add_expected_track(mux, &video);
+	for (size_t s = 0; s < SIZEOF_ARRAY(gop_sync); s++) {
+		struct mp4_mux_sample sample = {
+			.buffer = data,
+			.len = s + 1,
+			.sync = gop_sync[s],
+			.dts = s * 3000,
+		};
+		res = mp4_mux_track_add_sample(mux, 1, &sample);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+static void test_mp4_mux_demux_gops(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	const struct mp4_track_gop *gops;
+	unsigned int gop_count;
+	uint64_t offsets[SIZEOF_ARRAY(gop_sync)];
+	/* The muxer gives a zero duration to the last sample */
+	const struct mp4_track_gop expected[] = {
+		{.sync_sample = 1,
+		 .first_sample = 0,
+		 .last_sample = 3,
+		 .end_dts = 12000},
+		{.sync_sample = 4,
+		 .first_sample = 4,
+		 .last_sample = 5,
+		 .end_dts = 18000},
+		{.sync_sample = 6,
+		 .first_sample = 6,
+		 .last_sample = 6,
+		 .end_dts = 18000},
+	};
+
+	mux_gop_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+	for (size_t s = 0; s < SIZEOF_ARRAY(gop_sync); s++) {
+		res = mp4_demux_get_track_sample(demux,
+						 track_info.id,
+						 1,
+						 NULL,
+						 0,
+						 NULL,
+						 0,
+						 &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		offsets[s] = track_sample.offset;
+	}
+
+	res = mp4_demux_get_track_gops(
+		demux, track_info.id + 1, &gops, &gop_count);
+	CU_ASSERT_EQUAL(res, -ENOENT);
+	res = mp4_demux_get_track_gops(demux, track_info.id, &gops, &gop_count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL_FATAL(gop_count, SIZEOF_ARRAY(expected));
+	for (size_t g = 0; g < gop_count; g++) {
+		uint32_t first = expected[g].first_sample;
+		uint32_t last = expected[g].last_sample;
+		CU_ASSERT_EQUAL(gops[g].sync_sample, expected[g].sync_sample);
+		CU_ASSERT_EQUAL(gops[g].first_sample, first);
+		CU_ASSERT_EQUAL(gops[g].last_sample, last);
+		CU_ASSERT_EQUAL(gops[g].start_dts, first * 3000);
+		CU_ASSERT_EQUAL(gops[g].end_dts, expected[g].end_dts);
+		CU_ASSERT_EQUAL(gops[g].offset, offsets[first]);
+		CU_ASSERT_EQUAL(gops[g].size,
+				offsets[last] + last + 1 - offsets[first]);
+	}
+
+	/* The table is built once */
+	res = mp4_demux_get_track_gops(demux, track_info.id, &gops, &gop_count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(gop_count, SIZEOF_ARRAY(expected));
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_split(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_demux_cursor *cursors[8];
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	unsigned int count;
+	/* GOP sizes are 10, 11 and 7 bytes, durations are 12000, 6000 and 0 */
+	const struct {
+		enum mp4_demux_split_mode mode;
+		unsigned int count;
+		unsigned int part_count;
+		uint32_t part_end[3];
+	} splits[] = {
+		{MP4_DEMUX_SPLIT_BY_SIZE, 1, 1, {7}},
+		{MP4_DEMUX_SPLIT_BY_SIZE, 2, 2, {6, 7}},
+		{MP4_DEMUX_SPLIT_BY_DURATION, 2, 2, {4, 7}},
+		{MP4_DEMUX_SPLIT_BY_SIZE, 8, 3, {4, 6, 7}},
+	};
+
+	mux_gop_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = mp4_demux_split_track(demux,
+				    track_info.id,
+				    MP4_DEMUX_SPLIT_BY_SIZE,
+				    0,
+				    cursors,
+				    &count);
+	CU_ASSERT_EQUAL(res, -EINVAL);
+
+	for (size_t i = 0; i < SIZEOF_ARRAY(splits); i++) {
+		uint32_t s = 0;
+		res = mp4_demux_split_track(demux,
+					    track_info.id,
+					    splits[i].mode,
+					    splits[i].count,
+					    cursors,
+					    &count);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL_FATAL(count, splits[i].part_count);
+		for (unsigned int p = 0; p < count; p++) {
+			/* Each part returns its samples, then an empty one */
+			for (; s < splits[i].part_end[p]; s++) {
+				res = mp4_demux_cursor_get_sample(
+					cursors[p],
+					1,
+					NULL,
+					0,
+					NULL,
+					0,
+					&track_sample);
+				CU_ASSERT_EQUAL(res, 0);
+				CU_ASSERT_EQUAL(track_sample.size, s + 1);
+				CU_ASSERT_EQUAL(track_sample.dts, s * 3000);
+			}
+			res = mp4_demux_cursor_get_sample(
+				cursors[p], 1, NULL, 0, NULL, 0, &track_sample);
+			CU_ASSERT_EQUAL(res, 0);
+			CU_ASSERT_EQUAL(track_sample.size, 0);
+		}
+		CU_ASSERT_EQUAL(s, SIZEOF_ARRAY(gop_sync));
+
+		/* Seeking is limited to the part */
+		res = mp4_demux_cursor_seek(
+			cursors[count - 1], 0, MP4_SEEK_METHOD_PREVIOUS);
+		CU_ASSERT_EQUAL(res, 0);
+		res = mp4_demux_cursor_get_sample(
+			cursors[count - 1], 0, NULL, 0, NULL, 0, &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_sample.size,
+				(count > 1) ? splits[i].part_end[count - 2] + 1
+					    : 1);
+
+		for (unsigned int p = 0; p < count; p++)
+			mp4_demux_cursor_destroy(cursors[p]);
+	}
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+#define SPLIT_THREAD_COUNT 4
+#define SPLIT_SAMPLE_COUNT 600
+#define SPLIT_GOP_LENGTH 10
+#define SPLIT_MAX_SIZE 64
+
+
+struct split_thread {
+	pthread_t thread;
+	const struct mp4_demux *demux;
+	uint32_t track_id;
+	struct mp4_demux_cursor *cursor;
+	int res;
+	unsigned int count;
+};
+
+
+/* Samples read by the threads, indexed by sample number */
+static uint8_t split_data[SPLIT_SAMPLE_COUNT][SPLIT_MAX_SIZE];
+static uint32_t split_size[SPLIT_SAMPLE_COUNT];
+static unsigned int split_read_count[SPLIT_SAMPLE_COUNT];
+
+
+/* The threads write to distinct samples, and do not call CUnit */
+static void *split_read_thread(void *userdata)
+{
+	struct split_thread *thread = userdata;
+	struct mp4_track_sample track_sample;
+	uint8_t buffer[SPLIT_MAX_SIZE];
+	uint64_t s;
+
+	while (true) {
+		thread->res = mp4_demux_cursor_get_sample(thread->cursor,
+							  1,
+							  buffer,
+							  sizeof(buffer),
+							  NULL,
+							  0,
+							  &track_sample);
+		if (thread->res < 0 || track_sample.size == 0)
+			break;
+		s = track_sample.dts / 3000;
+		if (s >= SPLIT_SAMPLE_COUNT) {
+			thread->res = -ERANGE;
+			break;
+		}
+		memcpy(split_data[s], buffer, track_sample.size);
+		split_size[s] = track_sample.size;
+		split_read_count[s]++;
+		thread->count++;
+	}
+
+	return NULL;
+}
+
+
+/* Concurrent splits of a track, the first one building the GOP table */
+static void *split_track_thread(void *userdata)
+{
+	struct split_thread *thread = userdata;
+	struct mp4_demux_cursor *cursors[SPLIT_THREAD_COUNT];
+
+	thread->res = mp4_demux_split_track(thread->demux,
+					    thread->track_id,
+					    MP4_DEMUX_SPLIT_BY_SIZE,
+					    SPLIT_THREAD_COUNT,
+					    cursors,
+					    &thread->count);
+	if (thread->res < 0)
+		return NULL;
+	for (unsigned int t = 0; t < thread->count; t++)
+		mp4_demux_cursor_destroy(cursors[t]);
+
+	return NULL;
+}
+
+
+static void test_mp4_mux_demux_split_threads(void)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	struct split_thread threads[SPLIT_THREAD_COUNT];
+	struct mp4_demux_cursor *cursors[SPLIT_THREAD_COUNT];
+	struct expected_track video = tracks[0];
+	uint8_t data[SPLIT_MAX_SIZE];
+	uint8_t buffer[SPLIT_MAX_SIZE];
+	unsigned int count, total;
+
+	/* Samples of varying sizes, each with its own content */
+	video.samples = NULL;
+	video.sample_count = 0;
+	res = mp4_mux_open(&test_mux_demux_map[0].config, &mux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	add_expected_track(mux, &video);
+	for (unsigned int s = 0; s < SPLIT_SAMPLE_COUNT; s++) {
+		struct mp4_mux_sample sample = {
+			.buffer = data,
+			.len = 1 + s % SPLIT_MAX_SIZE,
+			.sync = (s % SPLIT_GOP_LENGTH) == 0,
+			.dts = s * 3000,
+		};
+		for (size_t i = 0; i < sample.len; i++)
+			data[i] = s + i;
+		res = mp4_mux_track_add_sample(mux, 1, &sample);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	for (int map = 0; map < 2; map++) {
+		if (map)
+			res = mp4_demux_open_mmap(
+				test_mux_demux_map[0].config.filename, &demux);
+		else
+			res = mp4_demux_open(
+				test_mux_demux_map[0].config.filename, &demux);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+		res = mp4_demux_get_track_info(demux, 0, &track_info);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+		res = mp4_demux_set_readahead(demux, 16);
+		CU_ASSERT_EQUAL(res, 0);
+
+		for (unsigned int t = 0; t < SPLIT_THREAD_COUNT; t++) {
+			threads[t].demux = demux;
+			threads[t].track_id = track_info.id;
+			threads[t].res = 0;
+			threads[t].count = 0;
+			res = pthread_create(&threads[t].thread,
+					     NULL,
+					     &split_track_thread,
+					     &threads[t]);
+			CU_ASSERT_EQUAL_FATAL(res, 0);
+		}
+		for (unsigned int t = 0; t < SPLIT_THREAD_COUNT; t++) {
+			pthread_join(threads[t].thread, NULL);
+			CU_ASSERT_EQUAL(threads[t].res, 0);
+			CU_ASSERT_EQUAL(threads[t].count, SPLIT_THREAD_COUNT);
+		}
+
+		/* Read all the parts concurrently */
+		memset(split_read_count, 0, sizeof(split_read_count));
+		res = mp4_demux_split_track(demux,
+					    track_info.id,
+					    MP4_DEMUX_SPLIT_BY_SIZE,
+					    SPLIT_THREAD_COUNT,
+					    cursors,
+					    &count);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+		CU_ASSERT_EQUAL(count, SPLIT_THREAD_COUNT);
+		for (unsigned int t = 0; t < count; t++) {
+			threads[t].cursor = cursors[t];
+			threads[t].res = 0;
+			threads[t].count = 0;
+			res = pthread_create(&threads[t].thread,
+					     NULL,
+					     &split_read_thread,
+					     &threads[t]);
+			CU_ASSERT_EQUAL_FATAL(res, 0);
+		}
+		total = 0;
+		for (unsigned int t = 0; t < count; t++) {
+			pthread_join(threads[t].thread, NULL);
+			CU_ASSERT_EQUAL(threads[t].res, 0);
+			CU_ASSERT_NOT_EQUAL(threads[t].count, 0);
+			total += threads[t].count;
+			mp4_demux_cursor_destroy(cursors[t]);
+		}
+		CU_ASSERT_EQUAL(total, SPLIT_SAMPLE_COUNT);
+
+		/* Compare with a sequential read */
+		for (unsigned int s = 0; s < SPLIT_SAMPLE_COUNT; s++) {
+			res = mp4_demux_get_track_sample(demux,
+							 track_info.id,
+							 1,
+							 buffer,
+							 sizeof(buffer),
+							 NULL,
+							 0,
+							 &track_sample);
+			CU_ASSERT_EQUAL(res, 0);
+			CU_ASSERT_EQUAL(track_sample.dts, s * 3000);
+			CU_ASSERT_EQUAL(split_read_count[s], 1);
+			CU_ASSERT_EQUAL(split_size[s], track_sample.size);
+			CU_ASSERT_EQUAL(memcmp(split_data[s],
+					       buffer,
+					       track_sample.size),
+					0);
+		}
+
+		res = mp4_demux_close(demux);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_trick_play(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_demux_cursor *cursor;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	uint8_t sample_buffer[8];
+	/* Sync samples are 1, 4 and 6; time is 3000 units per sample, and
+	 * seek times are in microseconds */
+	const struct {
+		int64_t stride;
+		uint64_t seek_time;
+		uint32_t samples[4];
+		size_t count;
+	} plays[] = {
+		{3000, 0, {1, 4, 6}, 3},
+		{9000, 0, {1, 4}, 2},
+		{-3000, 200000, {6, 4, 1}, 3},
+		{-9000, 170000, {4, 1}, 2},
+	};
+
+	mux_gop_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = mp4_demux_cursor_new(demux, track_info.id, &cursor);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	for (size_t i = 0; i < SIZEOF_ARRAY(plays); i++) {
+		res = mp4_demux_cursor_set_sync_stride(cursor, 0);
+		CU_ASSERT_EQUAL(res, 0);
+		res = mp4_demux_cursor_seek(
+			cursor, plays[i].seek_time, MP4_SEEK_METHOD_PREVIOUS);
+		CU_ASSERT_EQUAL(res, 0);
+		res = mp4_demux_cursor_set_sync_stride(cursor, plays[i].stride);
+		CU_ASSERT_EQUAL(res, 0);
+		for (size_t k = 0; k < plays[i].count; k++) {
+			uint32_t s = plays[i].samples[k];
+			res = mp4_demux_cursor_get_sample(cursor,
+							  1,
+							  sample_buffer,
+							  sizeof(sample_buffer),
+							  NULL,
+							  0,
+							  &track_sample);
+			CU_ASSERT_EQUAL(res, 0);
+			CU_ASSERT_EQUAL(track_sample.size, s + 1);
+			CU_ASSERT_EQUAL(track_sample.dts, s * 3000);
+			CU_ASSERT_EQUAL(track_sample.sync, 1);
+		}
+		res = mp4_demux_cursor_get_sample(
+			cursor, 1, NULL, 0, NULL, 0, &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_sample.size, 0);
+	}
+
+	/* Back to normal reading */
+	res = mp4_demux_cursor_set_sync_stride(cursor, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_demux_cursor_seek(cursor, 140000, MP4_SEEK_METHOD_PREVIOUS);
+	CU_ASSERT_EQUAL(res, 0);
+	for (uint32_t s = 4; s < SIZEOF_ARRAY(gop_sync); s++) {
+		res = mp4_demux_cursor_get_sample(
+			cursor, 1, NULL, 0, NULL, 0, &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_sample.dts, s * 3000);
+	}
+
+	mp4_demux_cursor_destroy(cursor);
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_samples_range(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info meta_info;
+	struct mp4_track_sample track_sample;
+	uint8_t buffer[16];
+	uint64_t dts[4];
+	uint64_t offsets[4];
+	uint32_t sizes[4];
+	unsigned int count;
+	/* Metadata sample s has s + 1 bytes, from 0 to s */
+	const uint8_t expected_data[] = {0, 1, 0, 1, 2};
+
+	mux_metadata_track_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 1, &meta_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	/* Whole track, descriptions only */
+	res = mp4_demux_get_track_samples_range(demux,
+						meta_info.id,
+						0,
+						0,
+						SIZEOF_ARRAY(dts),
+						NULL,
+						0,
+						dts,
+						offsets,
+						sizes,
+						&count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL_FATAL(count, SIZEOF_ARRAY(meta_dts));
+	for (size_t s = 0; s < count; s++) {
+		CU_ASSERT_EQUAL(dts[s], meta_dts[s]);
+		CU_ASSERT_EQUAL(sizes[s], s + 1);
+		if (s > 0)
+			CU_ASSERT(offsets[s] > offsets[s - 1]);
+	}
+
+	/* [34ms, 100ms] window */
+	res = mp4_demux_get_track_samples_range(demux,
+						meta_info.id,
+						34000,
+						100000,
+						SIZEOF_ARRAY(dts),
+						buffer,
+						sizeof(buffer),
+						dts,
+						NULL,
+						sizes,
+						&count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL_FATAL(count, 2);
+	CU_ASSERT_EQUAL(dts[0], 34);
+	CU_ASSERT_EQUAL(dts[1], 100);
+	CU_ASSERT_EQUAL(memcmp(buffer, expected_data, sizeof(expected_data)),
+			0);
+
+	/* Both ends are included */
+	res = mp4_demux_get_track_samples_range(demux,
+						meta_info.id,
+						100000,
+						134000,
+						SIZEOF_ARRAY(dts),
+						NULL,
+						0,
+						dts,
+						NULL,
+						NULL,
+						&count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL_FATAL(count, 2);
+	CU_ASSERT_EQUAL(dts[0], 100);
+	CU_ASSERT_EQUAL(dts[1], 134);
+
+	/* End before start */
+	res = mp4_demux_get_track_samples_range(demux,
+						meta_info.id,
+						800000,
+						200000,
+						SIZEOF_ARRAY(dts),
+						NULL,
+						0,
+						dts,
+						NULL,
+						NULL,
+						&count);
+	CU_ASSERT_EQUAL(res, -EINVAL);
+
+	/* Stop when the buffer is full, then resume */
+	res = mp4_demux_get_track_samples_range(demux,
+						meta_info.id,
+						34000,
+						0,
+						SIZEOF_ARRAY(dts),
+						buffer,
+						3,
+						dts,
+						NULL,
+						NULL,
+						&count);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(count, 1);
+	res = mp4_demux_get_track_samples_range(demux,
+						meta_info.id,
+						34001,
+						0,
+						SIZEOF_ARRAY(dts),
+						buffer,
+						2,
+						dts,
+						NULL,
+						NULL,
+						&count);
+	CU_ASSERT_EQUAL(res, -ENOBUFS);
+	CU_ASSERT_EQUAL(count, 0);
+
+	/* The track read position is not modified */
+	res = mp4_demux_get_track_sample(
+		demux, meta_info.id, 1, NULL, 0, NULL, 0, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.dts, meta_dts[0]);
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static void test_mp4_mux_demux_scattered(void)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	uint8_t part1[3], part2[2], part3[10];
+	uint8_t *buffers[] = {part1, part2, part3};
+	size_t len[] = {sizeof(part1), sizeof(part2), sizeof(part3)};
+	uint8_t metadata_buffer[16];
+	const uint8_t *cookie = (const uint8_t *)&empty_cookie;
+
+	mux_metadata_track_file();
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL(res, 0);
+
+	/* The buffers are too small: the position is not advanced */
+	res = mp4_demux_get_track_sample_scattered(demux,
+						   track_info.id,
+						   1,
+						   buffers,
+						   len,
+						   2,
+						   NULL,
+						   0,
+						   &track_sample);
+	CU_ASSERT_EQUAL(res, -ENOBUFS);
+
+	/* Description only */
+	res = mp4_demux_get_track_sample_scattered(
+		demux, track_info.id, 0, NULL, NULL, 0, NULL, 0, &track_sample);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(track_sample.dts, video_dts[0]);
+
+	for (size_t s = 0; s < SIZEOF_ARRAY(video_dts); s++) {
+		memset(part3, 0xff, sizeof(part3));
+		res = mp4_demux_get_track_sample_scattered(
+			demux,
+			track_info.id,
+			1,
+			buffers,
+			len,
+			SIZEOF_ARRAY(buffers),
+			metadata_buffer,
+			sizeof(metadata_buffer),
+			&track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_sample.dts, video_dts[s]);
+		CU_ASSERT_EQUAL(track_sample.size, sizeof(empty_cookie));
+		CU_ASSERT_EQUAL(memcmp(part1, cookie, 3), 0);
+		CU_ASSERT_EQUAL(memcmp(part2, cookie + 3, 2), 0);
+		CU_ASSERT_EQUAL(memcmp(part3, cookie + 5, 3), 0);
+		CU_ASSERT_EQUAL(part3[3], 0xff);
+		CU_ASSERT_EQUAL(track_sample.metadata_size,
+				expected_meta_size[s]);
+		for (uint32_t i = 0; i < track_sample.metadata_size; i++)
+			CU_ASSERT_EQUAL(metadata_buffer[i], i);
+	}
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+/**
+ * Fixture of the muxer options tests: a file is muxed with the tested
+ * options and checked against the generated samples, then muxed again and
+ * recovered from the tables written by the last mp4_mux_sync()
+ */
+struct recovery_fixture {
+	/* Test file configuration with the tested options */
+	struct mp4_mux_config config;
+	/* Tracks, one handle per entry in order */
+	const enum mp4_track_type *track_types;
+	unsigned int track_count;
+	uint32_t sample_count;
+	/* The muxer is synced without tables before these samples */
+	const uint32_t *sync_samples;
+	unsigned int sync_count;
+	/* When recovering, stop muxing right after the last sync */
+	bool stop_at_last_sync;
+	size_t max_sample_size;
+	/* Fill the sample s of the track t (index from 0) */
+	void (*get_sample)(unsigned int t,
+			   uint32_t s,
+			   uint8_t *data,
+			   struct mp4_mux_sample *sample);
+	/* Optional checks of a sample read from the file */
+	void (*check_sample)(struct mp4_demux *demux,
+			     unsigned int t,
+			     uint32_t s,
+			     const struct mp4_track_sample *track_sample);
+};
+
+
+/* Samples of all the tracks are interleaved */
+static struct mp4_mux *mux_fixture_file(const struct recovery_fixture *f,
+					bool stop_at_last_sync)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	struct expected_track video = tracks[0];
+	struct mp4_mux_track_params meta_params = {
+		.type = MP4_TRACK_TYPE_METADATA,
+		.name = "metadata",
+		.timescale = 1000,
+	};
+	unsigned int sync = 0;
+	uint8_t *data;
+
+	data = malloc(f->max_sample_size);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	video.samples = NULL;
+	video.sample_count = 0;
+
+	res = mp4_mux_open(&f->config, &mux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	for (unsigned int t = 0; t < f->track_count; t++) {
+		if (f->track_types[t] == MP4_TRACK_TYPE_VIDEO) {
+			add_expected_track(mux, &video);
+			continue;
+		}
+		res = mp4_mux_add_track(mux, &meta_params);
+		CU_ASSERT_EQUAL(res, t + 1);
+		res = mp4_mux_track_set_metadata_mime_type(
+			mux, t + 1, "", "application/octet-stream");
+		CU_ASSERT_EQUAL(res, 0);
+	}
+
+	for (uint32_t s = 0; s < f->sample_count; s++) {
+		if (sync < f->sync_count && s == f->sync_samples[sync]) {
+			res = mp4_mux_sync(mux, false);
+			CU_ASSERT_EQUAL(res, 0);
+			if (++sync == f->sync_count && stop_at_last_sync)
+				break;
+		}
+		for (unsigned int t = 0; t < f->track_count; t++) {
+			struct mp4_mux_sample sample;
+			f->get_sample(t, s, data, &sample);
+			res = mp4_mux_track_add_sample(mux, t + 1, &sample);
+			CU_ASSERT_EQUAL(res, 0);
+		}
+	}
+
+	free(data);
+	return mux;
+}
+
+
+static void check_fixture_file(const struct recovery_fixture *f,
+			       uint32_t sample_count)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	struct mp4_mux_sample sample;
+	uint8_t *buffer = malloc(f->max_sample_size);
+	uint8_t *expected = malloc(f->max_sample_size);
+	uint32_t mismatch;
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(buffer);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+
+	res = mp4_demux_open(f->config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	for (unsigned int t = 0; t < f->track_count; t++) {
+		res = mp4_demux_get_track_info(demux, t, &track_info);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+		CU_ASSERT_EQUAL_FATAL(track_info.sample_count, sample_count);
+
+		/* Count the mismatches to limit the failed asserts */
+		mismatch = 0;
+		for (uint32_t s = 0; s < sample_count; s++) {
+			res = mp4_demux_get_track_sample(demux,
+							 track_info.id,
+							 1,
+							 buffer,
+							 f->max_sample_size,
+							 NULL,
+							 0,
+							 &track_sample);
+			CU_ASSERT_EQUAL(res, 0);
+			f->get_sample(t, s, expected, &sample);
+			if (track_sample.size != sample.len ||
+			    track_sample.dts != sample.dts ||
+			    track_sample.sync != sample.sync ||
+			    memcmp(buffer, expected, sample.len) != 0)
+				mismatch++;
+			if (f->check_sample != NULL)
+				f->check_sample(demux, t, s, &track_sample);
+		}
+		CU_ASSERT_EQUAL(mismatch, 0);
+	}
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+	free(buffer);
+	free(expected);
+}
+
+
+static void test_recovery_fixture(const struct recovery_fixture *f)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	char *error_msg = NULL;
+
+	mux = mux_fixture_file(f, false);
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+	check_fixture_file(f, f->sample_count);
+	res = mp4_recovery_finalize(
+		f->config.recovery.tables_file, false, NULL);
+	CU_ASSERT_EQUAL(res, 0);
+	remove(f->config.filename);
+
+	/* Only the samples written before the last sync are recovered */
+	mux = mux_fixture_file(f, f->stop_at_last_sync);
+	res = mp4_recovery_recover_file_from_paths(
+		f->config.recovery.tables_file,
+		f->config.filename,
+		&error_msg,
+		NULL);
+	CU_ASSERT_EQUAL(res, 0);
+	free(error_msg);
+	check_fixture_file(f, f->sync_samples[f->sync_count - 1]);
+	res = mp4_recovery_finalize(
+		f->config.recovery.tables_file, false, NULL);
+	CU_ASSERT_EQUAL(res, 0);
+	remove(f->config.filename);
+	mp4_mux_close(mux);
+	remove(f->config.recovery.tables_file);
+}
+
+
+/* Chunks of 100 ms: 3 video samples (every 33.3 ms at 90000 Hz) or 4
+ * metadata samples (every 33 ms at 1000 Hz), split on mp4_mux_sync() */
+static const bool video_chunk_start[] = {
+	1, 0, 0, 1, 0, 0, 1, 0, 1, 0, 0, 1};
+static const bool meta_chunk_start[] = {1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0};
+
+
+/* Samples of 1 to 12 bytes */
+static void chunk_sample(unsigned int t,
+			 uint32_t s,
+			 uint8_t *data,
+			 struct mp4_mux_sample *sample)
+{
+	sample->buffer = data;
+	sample->len = s + 1;
+	sample->sync = t == 0 ? (s % 3) == 0 : 1;
+	sample->dts = t == 0 ? s * 3000 : s * 33;
+	memset(data, t == 0 ? s : 0x80 | s, sample->len);
+}
+
+
+static void check_chunk_sample(struct mp4_demux *demux,
+			       unsigned int t,
+			       uint32_t s,
+			       const struct mp4_track_sample *track_sample)
+{
+	int res = 0;
+	struct mp4_track_info track_info;
+	const uint64_t *offsets = NULL;
+	const uint32_t *sizes = NULL;
+
+	res = mp4_demux_get_track_sample_tables(demux, t, &offsets, &sizes);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(offsets);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sizes);
+	/* Same tables as in the track info */
+	if (s == 0) {
+		res = mp4_demux_get_track_info(demux, t, &track_info);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+		CU_ASSERT_PTR_EQUAL(track_info.sample_offsets, offsets);
+		CU_ASSERT_PTR_EQUAL(track_info.sample_sizes, sizes);
+	}
+
+	CU_ASSERT_EQUAL(track_sample->size, sizes[s]);
+	CU_ASSERT_EQUAL(track_sample->offset, offsets[s]);
+	/* Samples of a chunk are contiguous in the file */
+	if (!(t == 0 ? video_chunk_start : meta_chunk_start)[s])
+		CU_ASSERT_EQUAL(offsets[s], offsets[s - 1] + sizes[s - 1]);
+}
+
+
+/* Interleaved video and metadata samples grouped in chunks, synced after
+ * 8 samples of each track */
+static void test_mp4_mux_demux_chunks(void)
+{
+	const enum mp4_track_type types[] = {
+		MP4_TRACK_TYPE_VIDEO,
+		MP4_TRACK_TYPE_METADATA,
+	};
+	const uint32_t syncs[] = {8};
+	struct recovery_fixture f = {
+		.config = test_mux_demux_map[0].config,
+		.track_types = types,
+		.track_count = SIZEOF_ARRAY(types),
+		.sample_count = SIZEOF_ARRAY(video_chunk_start),
+		.sync_samples = syncs,
+		.sync_count = SIZEOF_ARRAY(syncs),
+		.max_sample_size = SIZEOF_ARRAY(video_chunk_start),
+		.get_sample = &chunk_sample,
+		.check_sample = &check_chunk_sample,
+	};
+
+	f.config.chunk.max_duration = 100000;
+	test_recovery_fixture(&f);
+}
+
+
+/* Alternating sample durations, so that there is a 'time_to_sample' entry
+ * per sample */
+static void tables_sample(unsigned int t,
+			  uint32_t s,
+			  uint8_t *data,
+			  struct mp4_mux_sample *sample)
+{
+	sample->buffer = data;
+	sample->len = (s % 7) + 1;
+	sample->sync = (s % 3) == 0;
+	sample->dts = s * 3000 + (s % 2) * 1000;
+	memset(data, s, sample->len);
+}
+
+
+/* More than one block of each table (512 entries) in chunks of up to 8
+ * bytes; the second sync writes the recovery tables from the middle of a
+ * block */
+static void test_mp4_mux_demux_tables(void)
+{
+	const enum mp4_track_type types[] = {MP4_TRACK_TYPE_VIDEO};
+	const uint32_t syncs[] = {700, 1027};
+	struct recovery_fixture f = {
+		.config = test_mux_demux_map[0].config,
+		.track_types = types,
+		.track_count = SIZEOF_ARRAY(types),
+		.sample_count = 1543,
+		.sync_samples = syncs,
+		.sync_count = SIZEOF_ARRAY(syncs),
+		.max_sample_size = 7,
+		.get_sample = &tables_sample,
+	};
+
+	f.config.chunk.max_size = 8;
+	test_recovery_fixture(&f);
+}
+
+
+/* Up to 1.5 kB, every fifth sample is larger than the write buffer */
+static void write_buffer_sample(unsigned int t,
+				uint32_t s,
+				uint8_t *data,
+				struct mp4_mux_sample *sample)
+{
+	uint32_t n = s + t + 1;
+
+	sample->buffer = data;
+	sample->len = (n % 5) == 2 ? 5000 + n * 10 : n * 37 + 1;
+	sample->sync = 1;
+	sample->dts = s * 3000;
+	memset(data, s + (t + 1) * 0x40, sample->len);
+}
+
+
+/* Two tracks of interleaved samples through the write buffer; the muxing
+ * stops right after the sync, so that the data buffered at the sync must
+ * be written before the tables */
+static void check_write_buffer(bool direct_io)
+{
+	const enum mp4_track_type types[] = {
+		MP4_TRACK_TYPE_VIDEO,
+		MP4_TRACK_TYPE_VIDEO,
+	};
+	const uint32_t syncs[] = {20};
+	struct recovery_fixture f = {
+		.config = test_mux_demux_map[0].config,
+		.track_types = types,
+		.track_count = SIZEOF_ARRAY(types),
+		.sample_count = 40,
+		.sync_samples = syncs,
+		.sync_count = SIZEOF_ARRAY(syncs),
+		.stop_at_last_sync = true,
+		.max_sample_size = 9000,
+		.get_sample = &write_buffer_sample,
+	};
+
+	/* Rounded up to the file system block size */
+	f.config.write_buffer.size = 1;
+	f.config.write_buffer.direct_io = direct_io;
+	test_recovery_fixture(&f);
+}
+
+
+static void test_mp4_mux_demux_write_buffer(void)
+{
+	check_write_buffer(false);
+}
+
+
+/* The samples larger than the buffer are split in aligned blocks and the
+ * unaligned tail written at the sync is completed by the following samples */
+static void test_mp4_mux_demux_direct_io(void)
+{
+	check_write_buffer(true);
+}
+
+
+static int async_pipe[2];
+static unsigned int async_release_count;
+
+
+/* Stall the writer thread until a byte is written in the pipe */
+static void async_release_blocking(const uint8_t *buffer, void *userdata)
+{
+	char c;
+
+	CU_ASSERT_EQUAL(read(async_pipe[0], &c, 1), 1);
+	async_release_count++;
+}
+
+
+static void async_release(const uint8_t *buffer, void *userdata)
+{
+	async_release_count++;
+}
+
+
+/* Expected samples: sample s has a size of s + 1 bytes and a dts of
+ * s * 3000 */
+static void check_async_file(const unsigned int *expected, size_t count)
+{
+	int res = 0;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_track_sample track_sample;
+	uint8_t buffer[16];
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = mp4_demux_get_track_info(demux, 0, &track_info);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL_FATAL(track_info.sample_count, count);
+
+	for (size_t i = 0; i < count; i++) {
+		res = mp4_demux_get_track_sample(demux,
+						 track_info.id,
+						 1,
+						 buffer,
+						 sizeof(buffer),
+						 NULL,
+						 0,
+						 &track_sample);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(track_sample.size, expected[i] + 1);
+		CU_ASSERT_EQUAL(track_sample.dts, expected[i] * 3000);
+		CU_ASSERT_EQUAL(buffer[0], expected[i]);
+	}
+
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+	remove(test_mux_demux_map[0].config.filename);
+}
+
+
+static struct mp4_mux *mux_async_open(enum mp4_mux_async_policy policy)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	struct mp4_mux_config config = test_mux_demux_map[0].config;
+	struct expected_track video = tracks[0];
+
+	config.recovery.tables_file = NULL;
+	config.async.enabled = true;
+	config.async.queue_size = 2;
+	config.async.policy = policy;
+	video.samples = NULL;
+	video.sample_count = 0;
+
+	res = mp4_mux_open(&config, &mux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	add_expected_track(mux, &video);
+
+	return mux;
+}
+
+
+static int
+mux_async_sample(struct mp4_mux *mux, uint8_t *data, unsigned int s, int sync)
+{
+	struct mp4_mux_sample sample = {
+		.buffer = data,
+		.len = s + 1,
+		.sync = sync,
+		.dts = s * 3000,
+	};
+
+	memset(data, s, sample.len);
+	return mp4_mux_track_add_sample(mux, 1, &sample);
+}
+
+
+static void test_mp4_mux_demux_async(void)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	struct mp4_mux_async_stats stats;
+	uint8_t owned[16] = {0};
+	uint8_t data[16];
+	struct mp4_mux_sample sample = {
+		.buffer = owned,
+		.len = 1,
+		.sync = 1,
+		.dts = 0,
+	};
+	const unsigned int all[] = {0, 1, 2, 3, 4, 5, 6, 7};
+	const unsigned int kept[] = {0, 1, 4, 5};
+
+	res = pipe(async_pipe);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	/* Queue full: error */
+	async_release_count = 0;
+	mux = mux_async_open(MP4_MUX_ASYNC_POLICY_ERROR);
+	res = mp4_mux_track_add_sample_owned(
+		mux, 1, &sample, &async_release_blocking, NULL);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mux_async_sample(mux, data, 1, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mux_async_sample(mux, data, 2, 0);
+	CU_ASSERT_EQUAL(res, -EAGAIN);
+	res = mp4_mux_get_async_stats(mux, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.queue_depth, 2);
+	CU_ASSERT_EQUAL(stats.queued_samples, 2);
+	CU_ASSERT_EQUAL(write(async_pipe[1], "", 1), 1);
+	for (unsigned int s = 2; s < SIZEOF_ARRAY(all); s++) {
+		/* Wait for the queued samples to be written */
+		res = mp4_mux_sync(mux, false);
+		CU_ASSERT_EQUAL(res, 0);
+		res = mux_async_sample(mux, data, s, s % 4 == 0);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	res = mp4_mux_sync(mux, false);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_get_async_stats(mux, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.queue_depth, 0);
+	CU_ASSERT_EQUAL(stats.max_queue_depth, 2);
+	CU_ASSERT_EQUAL(stats.written_samples, SIZEOF_ARRAY(all));
+	CU_ASSERT_EQUAL(stats.dropped_samples, 0);
+	CU_ASSERT(stats.max_latency >= stats.mean_latency);
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(async_release_count, 1);
+	check_async_file(all, SIZEOF_ARRAY(all));
+
+	/* Queue full: the non-sync samples are dropped up to the next sync
+	 * sample */
+	async_release_count = 0;
+	mux = mux_async_open(MP4_MUX_ASYNC_POLICY_DROP_NON_SYNC);
+	res = mp4_mux_track_add_sample_owned(
+		mux, 1, &sample, &async_release_blocking, NULL);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mux_async_sample(mux, data, 1, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mux_async_sample(mux, data, 2, 0);
+	CU_ASSERT_EQUAL(res, -ENOBUFS);
+	CU_ASSERT_EQUAL(write(async_pipe[1], "", 1), 1);
+	res = mux_async_sample(mux, data, 3, 0);
+	CU_ASSERT_EQUAL(res, -ENOBUFS);
+	res = mux_async_sample(mux, data, 4, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_sync(mux, false);
+	CU_ASSERT_EQUAL(res, 0);
+	memset(owned, 5, 6);
+	sample.len = 6;
+	sample.sync = 0;
+	sample.dts = 5 * 3000;
+	res = mp4_mux_track_add_sample_owned(
+		mux, 1, &sample, &async_release, NULL);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_get_async_stats(mux, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.dropped_samples, 2);
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(async_release_count, 2);
+	check_async_file(kept, SIZEOF_ARRAY(kept));
+
+	close(async_pipe[0]);
+	close(async_pipe[1]);
+}
+
+
+static void *async_unblock_thread(void *userdata)
+{
+	usleep(100000);
+	CU_ASSERT_EQUAL(write(async_pipe[1], "", 1), 1);
+	return NULL;
+}
+
+
+static void test_mp4_mux_demux_async_errors(void)
+{
+	int res = 0;
+	struct mp4_mux *mux;
+	struct mp4_demux *demux;
+	struct mp4_track_info track_info;
+	struct mp4_mux_async_stats stats;
+	pthread_t thread;
+	uint8_t owned[16] = {0};
+	uint8_t data[16];
+	struct mp4_mux_sample sample = {
+		.buffer = owned,
+		.len = 1,
+		.sync = 1,
+		.dts = 0,
+	};
+	struct mp4_mux_track_params meta_params = {
+		.type = MP4_TRACK_TYPE_METADATA,
+		.name = "metadata",
+		.timescale = 1000,
+	};
+	const unsigned int all[] = {0, 1, 2, 3, 4, 5, 6, 7};
+	const unsigned int kept[] = {0, 1, 2};
+	unsigned int meta_count = 0;
+
+	res = pipe(async_pipe);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	/* Invalid samples are rejected when queued and do not fail the
+	 * following samples */
+	async_release_count = 0;
+	mux = mux_async_open(MP4_MUX_ASYNC_POLICY_BLOCK);
+	res = mux_async_sample(mux, data, 0, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_track_add_sample_owned(
+		mux, 2, &sample, &async_release, NULL);
+	CU_ASSERT_EQUAL(res, -ENOENT);
+	CU_ASSERT_EQUAL(async_release_count, 1);
+	res = mux_async_sample(mux, data, 1, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mux_async_sample(mux, data, 1, 0);
+	CU_ASSERT_EQUAL(res, -EINVAL);
+	for (unsigned int s = 2; s < SIZEOF_ARRAY(all); s++) {
+		res = mux_async_sample(mux, data, s, s % 4 == 0);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	res = mp4_mux_sync(mux, false);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_get_async_stats(mux, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.written_samples, SIZEOF_ARRAY(all));
+	CU_ASSERT_EQUAL(stats.dropped_samples, 0);
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+	check_async_file(all, SIZEOF_ARRAY(all));
+
+	/* Queue full: the non-sync samples of other track types than video
+	 * wait for the writer thread instead of being dropped */
+	async_release_count = 0;
+	mux = mux_async_open(MP4_MUX_ASYNC_POLICY_DROP_NON_SYNC);
+	res = mp4_mux_add_track(mux, &meta_params);
+	CU_ASSERT_EQUAL(res, 2);
+	res = mp4_mux_track_set_metadata_mime_type(
+		mux, 2, "", "application/octet-stream");
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_track_add_sample_owned(
+		mux, 1, &sample, &async_release_blocking, NULL);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mux_async_sample(mux, data, 1, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = pthread_create(&thread, NULL, &async_unblock_thread, NULL);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	for (unsigned int s = 0; s < 2; s++) {
+		sample.buffer = data;
+		sample.sync = 0;
+		sample.dts = (s + 1) * 33;
+		res = mp4_mux_track_add_sample(mux, 2, &sample);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	pthread_join(thread, NULL);
+	res = mp4_mux_sync(mux, false);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mux_async_sample(mux, data, 2, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_sync(mux, false);
+	CU_ASSERT_EQUAL(res, 0);
+	res = mp4_mux_get_async_stats(mux, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.written_samples, 5);
+	CU_ASSERT_EQUAL(stats.dropped_samples, 0);
+	res = mp4_mux_close(mux);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(async_release_count, 1);
+
+	res = mp4_demux_open(test_mux_demux_map[0].config.filename, &demux);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	for (unsigned int t = 0; t < 2; t++) {
+		res = mp4_demux_get_track_info(demux, t, &track_info);
+		CU_ASSERT_EQUAL(res, 0);
+		if (track_info.type == MP4_TRACK_TYPE_METADATA)
+			meta_count = track_info.sample_count;
+	}
+	CU_ASSERT_EQUAL(meta_count, 2);
+	res = mp4_demux_close(demux);
+	CU_ASSERT_EQUAL(res, 0);
+	check_async_file(kept, SIZEOF_ARRAY(kept));
+
+	close(async_pipe[0]);
+	close(async_pipe[1]);
+}
+
+
 static void test_mp4_mux_demux_big_file(void)
 {
 	int res = 0;
@@ -428,9 +2571,38 @@ static void test_mp4_mux_demux_big_file(void)
 
 CU_TestInfo g_mp4_test_mux_demux[] = {
 	{FN("mp4-mux-test-mux-demux"), &test_mp4_mux_demux_test},
+	{FN("mp4-mux-test-mux-demux-mmap"), &test_mp4_mux_demux_mmap_test},
+	{FN("mp4-mux-test-mux-demux-index"), &test_mp4_mux_demux_index_test},
 	{FN("mp4-mux-test-mux-internal-sync-demux"),
 	 &test_mp4_mux_internal_sync_demux_test},
 	{FN("mp4-mux-test-mux-recovery"), &test_mp4_mux_recovery_test},
+	{FN("mp4-mux-test-mux-demux-metadata-track"),
+	 &test_mp4_mux_demux_metadata_track},
+	{FN("mp4-mux-test-mux-demux-cursor"), &test_mp4_mux_demux_cursor},
+	{FN("mp4-mux-test-mux-demux-track-samples"),
+	 &test_mp4_mux_demux_track_samples},
+	{FN("mp4-mux-test-mux-demux-readahead"), &test_mp4_mux_demux_readahead},
+	{FN("mp4-mux-test-mux-demux-reader"), &test_mp4_mux_demux_reader},
+	{FN("mp4-mux-test-mux-demux-iterator"), &test_mp4_mux_demux_iterator},
+	{FN("mp4-mux-test-mux-demux-many-tracks"),
+	 &test_mp4_mux_demux_many_tracks},
+	{FN("mp4-mux-test-mux-demux-gops"), &test_mp4_mux_demux_gops},
+	{FN("mp4-mux-test-mux-demux-split"), &test_mp4_mux_demux_split},
+	{FN("mp4-mux-test-mux-demux-split-threads"),
+	 &test_mp4_mux_demux_split_threads},
+	{FN("mp4-mux-test-mux-demux-trick-play"),
+	 &test_mp4_mux_demux_trick_play},
+	{FN("mp4-mux-test-mux-demux-samples-range"),
+	 &test_mp4_mux_demux_samples_range},
+	{FN("mp4-mux-test-mux-demux-scattered"), &test_mp4_mux_demux_scattered},
+	{FN("mp4-mux-test-mux-demux-chunks"), &test_mp4_mux_demux_chunks},
+	{FN("mp4-mux-test-mux-demux-tables"), &test_mp4_mux_demux_tables},
+	{FN("mp4-mux-test-mux-demux-write-buffer"),
+	 &test_mp4_mux_demux_write_buffer},
+	{FN("mp4-mux-test-mux-demux-direct-io"), &test_mp4_mux_demux_direct_io},
+	{FN("mp4-mux-test-mux-demux-async"), &test_mp4_mux_demux_async},
+	{FN("mp4-mux-test-mux-demux-async-errors"),
+	 &test_mp4_mux_demux_async_errors},
 	{FN("mp4-mux-test-mux-demux-big-file"), &test_mp4_mux_demux_big_file},
 
 	CU_TEST_INFO_NULL,
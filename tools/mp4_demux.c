@@ -46,6 +46,7 @@ ULOG_DECLARE_TAG(mp4_demux);
 
 
 #define DATE_SIZE 26
+#define FRAMES_BATCH_COUNT 64
 #ifndef PATH_MAX
 #	ifdef _MAX_PATH
 #		define PATH_MAX _MAX_PATH
@@ -319,7 +320,8 @@ static void print_chapters(struct mp4_demux *demux)
 static void print_frames(const struct mp4_demux *demux)
 {
 	struct mp4_track_info tk;
-	struct mp4_track_sample sample;
+	struct mp4_track_sample samples[FRAMES_BATCH_COUNT];
+	unsigned int sample_count;
 	int i;
 	int count;
 	int ret;
@@ -346,28 +348,35 @@ static void print_frames(const struct mp4_demux *demux)
 
 	i = 0;
 	do {
-		ret = mp4_demux_get_track_sample(
-			demux, id, 1, NULL, 0, NULL, 0, &sample);
+		ret = mp4_demux_get_track_samples(demux,
+						  id,
+						  FRAMES_BATCH_COUNT,
+						  0,
+						  NULL,
+						  0,
+						  NULL,
+						  0,
+						  samples,
+						  &sample_count);
 		if (ret < 0) {
-			ULOG_ERRNO("mp4_demux_get_track_sample", -ret);
-			i++;
-			continue;
-		}
-
-		if (sample.size == 0)
+			ULOG_ERRNO("mp4_demux_get_track_samples", -ret);
 			break;
+		}
 
-		printf("Frame #%d size=%06" PRIu32 " offset=0x%08" PRIX64
-		       " metadata_size=%" PRIu32 " dts=%" PRIu64 " sync=%d\n",
-		       i,
-		       sample.size,
-		       sample.offset,
-		       sample.metadata_size,
-		       sample.dts,
-		       sample.sync);
-
-		i++;
-	} while (sample.size);
+		for (unsigned int j = 0; j < sample_count; j++) {
+			const struct mp4_track_sample *sample = &samples[j];
+			printf("Frame #%d size=%06" PRIu32
+			       " offset=0x%08" PRIX64 " metadata_size=%" PRIu32
+			       " dts=%" PRIu64 " sync=%d\n",
+			       i,
+			       sample->size,
+			       sample->offset,
+			       sample->metadata_size,
+			       sample->dts,
+			       sample->sync);
+			i++;
+		}
+	} while (sample_count > 0);
 
 	printf("\n");
 }
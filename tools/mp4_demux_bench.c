@@ -0,0 +1,1150 @@
+/**
+ * Copyright (c) 2026 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FILE_OFFSET_BITS
+#	define _FILE_OFFSET_BITS 64
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#	include <winsock2.h>
+#else /* !_WIN32 */
+#	include <arpa/inet.h>
+#endif /* !_WIN32 */
+
+#include <futils/futils.h>
+#include <libmp4.h>
+
+#include "mp4_decode.h"
+
+#define ULOG_TAG mp4_demux_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(mp4_demux_bench);
+
+
+#define BENCH_TIMESCALE 90000
+#define BENCH_FRAMERATE 30
+#define BENCH_GOP_LENGTH 30
+#define BENCH_SEEK_COUNT 10000
+#define BENCH_SEEK_MIN_SAMPLES 1000
+
+
+struct bench_params {
+	const char *filename;
+	unsigned int sample_count;
+	/* Generated file: the second half of the samples lasts one second
+	 * each instead of one frame */
+	int variable_rate;
+	unsigned int iterations;
+	int cold;
+	unsigned int files;
+	unsigned int batch;
+	unsigned int read_count;
+	unsigned int threads;
+};
+
+
+enum read_mode {
+	READ_MODE_SAMPLE = 0,
+	READ_MODE_READER,
+	READ_MODE_READER_REGISTERED,
+	READ_MODE_COUNT,
+};
+
+
+static const char *const read_mode_names[] = {
+	[READ_MODE_SAMPLE] = "read (get_track_sample)",
+	[READ_MODE_READER] = "read (reader)",
+	[READ_MODE_READER_REGISTERED] = "read (reader, reg. buf.)",
+};
+
+
+enum decode_table {
+	DECODE_TABLE_STSZ = 0,
+	DECODE_TABLE_STCO,
+	DECODE_TABLE_CO64,
+	DECODE_TABLE_COUNT,
+};
+
+
+static const char *const decode_table_names[] = {
+	[DECODE_TABLE_STSZ] = "stsz",
+	[DECODE_TABLE_STCO] = "stco",
+	[DECODE_TABLE_CO64] = "co64",
+};
+
+
+enum decode_kernel {
+	DECODE_KERNEL_NTOHL = 0,
+	DECODE_KERNEL_SCALAR,
+	DECODE_KERNEL_VECTOR,
+	DECODE_KERNEL_COUNT,
+};
+
+
+static const char *const decode_kernel_names[] = {
+	[DECODE_KERNEL_NTOHL] = "ntohl",
+	[DECODE_KERNEL_SCALAR] = "scalar",
+	[DECODE_KERNEL_VECTOR] = MP4_DECODE_VECTOR_ISA,
+};
+
+
+struct bench_test {
+	const char *name;
+	int (*run)(const struct bench_params *params);
+	/* Uses the file (generated first if it does not exist) */
+	int uses_file;
+};
+
+
+static void usage(const char *prog_name)
+{
+	/* clang-format off */
+	printf("Usage: %s [options] <file>\n"
+	       "Run demuxer benchmarks on a file; if the file does not exist, "
+	       "a single video track file is generated first\n"
+	       "Options:\n"
+	       "  -h | --help                          "
+		       "Print this message\n"
+	       "  -t | --test <test>                   "
+		       "Benchmark to run: open, read, split, seek or "
+		       "decode "
+		       "(default: all)\n"
+	       "  -n | --samples <count>               "
+		       "Sample count of the generated file, maximum "
+		       "sample count of the seek test files, and entry count "
+		       "of the decode test tables (default: 10000000)\n"
+	       "  -i | --iterations <count>            "
+		       "Iterations of each measure (default: 5)\n"
+	       "  -c | --cold                          "
+		       "Drop the file pages from the page cache before "
+		       "each iteration\n"
+	       "  -f | --files <count>                 "
+		       "read: demuxers reading the file (default: 8)\n"
+	       "  -b | --batch <count>                 "
+		       "read: sample reader batch size (default: 64)\n"
+	       "  -r | --read-samples <count>          "
+		       "read: samples read per demuxer (default: 1000000)\n"
+	       "  -j | --threads <count>               "
+		       "split: maximum number of threads (default: 8)\n"
+	       "\n",
+	       prog_name);
+	/* clang-format on */
+}
+
+
+static const char short_options[] = "ht:n:i:cf:b:r:j:";
+
+
+static const struct option long_options[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"test", required_argument, NULL, 't'},
+	{"samples", required_argument, NULL, 'n'},
+	{"iterations", required_argument, NULL, 'i'},
+	{"cold", no_argument, NULL, 'c'},
+	{"files", required_argument, NULL, 'f'},
+	{"batch", required_argument, NULL, 'b'},
+	{"read-samples", required_argument, NULL, 'r'},
+	{"threads", required_argument, NULL, 'j'},
+	{0, 0, 0, 0},
+};
+
+
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+	uint64_t us = 0;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *)a;
+	uint64_t vb = *(const uint64_t *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+
+static void print_times(const char *name, uint64_t *times, unsigned int count)
+{
+	qsort(times, count, sizeof(*times), compare_u64);
+	printf("%-24s min %10.3f ms  median %10.3f ms  max %10.3f ms\n",
+	       name,
+	       (double)times[0] / 1000.,
+	       (double)times[count / 2] / 1000.,
+	       (double)times[count - 1] / 1000.);
+}
+
+
+/* Best effort, evict the file pages from the page cache */
+static void drop_cache(const char *filename)
+{
+#ifdef POSIX_FADV_DONTNEED
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return;
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+#endif /* POSIX_FADV_DONTNEED */
+}
+
+
+/* Single video track with small samples of varying sizes, so that the
+ * sample size table is not constant (and the time to sample table is not
+ * either in variable rate) */
+static int generate_file(const struct bench_params *params)
+{
+	int ret, track;
+	struct mp4_mux *mux = NULL;
+	uint8_t frame[4] = {0x5a, 0x5a, 0x5a, 0x5a};
+	uint8_t sps[] = {0x67, 0x64, 0x00, 0x33, 0xac};
+	uint8_t pps[] = {0x68, 0xee, 0x3c, 0x80};
+	uint64_t start = get_time_us();
+	struct mp4_mux_config config = {
+		.filename = params->filename,
+		.filemode = 0644,
+		.timescale = BENCH_TIMESCALE,
+		.tables_size_mbytes = MP4_MUX_DEFAULT_TABLE_SIZE_MB,
+	};
+	struct mp4_mux_track_params track_params = {
+		.type = MP4_TRACK_TYPE_VIDEO,
+		.name = "video",
+		.enabled = 1,
+		.in_movie = 1,
+		.in_preview = 1,
+		.timescale = BENCH_TIMESCALE,
+	};
+	struct mp4_video_decoder_config video_config = {
+		.codec = MP4_VIDEO_CODEC_AVC,
+		.width = 1920,
+		.height = 1080,
+		.avc.c_sps = sps,
+		.avc.sps_size = sizeof(sps),
+		.avc.c_pps = pps,
+		.avc.pps_size = sizeof(pps),
+	};
+
+	printf("generating '%s' (%u samples%s)\n",
+	       params->filename,
+	       params->sample_count,
+	       params->variable_rate ? ", variable rate" : "");
+
+	ret = mp4_mux_open(&config, &mux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_open:'%s'", -ret, params->filename);
+		return ret;
+	}
+	track = mp4_mux_add_track(mux, &track_params);
+	if (track < 0) {
+		ret = track;
+		ULOG_ERRNO("mp4_mux_add_track", -ret);
+		goto out;
+	}
+	ret = mp4_mux_track_set_video_decoder_config(mux, track, &video_config);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_track_set_video_decoder_config", -ret);
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < params->sample_count; i++) {
+		unsigned int half = params->sample_count / 2;
+		struct mp4_mux_sample sample = {
+			.buffer = frame,
+			.len = 1 + i % sizeof(frame),
+			.sync = (i % BENCH_GOP_LENGTH) == 0,
+			.dts = (uint64_t)i * BENCH_TIMESCALE / BENCH_FRAMERATE,
+		};
+		if (params->variable_rate && i > half)
+			sample.dts += (uint64_t)(i - half) *
+				      (BENCH_TIMESCALE -
+				       BENCH_TIMESCALE / BENCH_FRAMERATE);
+		ret = mp4_mux_track_add_sample(mux, track, &sample);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_mux_track_add_sample", -ret);
+			goto out;
+		}
+	}
+
+out:
+	if (ret < 0) {
+		mp4_mux_close(mux);
+		unlink(params->filename);
+		return ret;
+	}
+	ret = mp4_mux_close(mux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_close", -ret);
+		unlink(params->filename);
+		return ret;
+	}
+	printf("generated in %.3f s\n", (double)(get_time_us() - start) / 1e6);
+
+	return 0;
+}
+
+
+/* Opening the file by parsing it, against loading the index file */
+static int bench_open(const struct bench_params *params)
+{
+	int ret = 0;
+	char *index_filename = NULL;
+	uint64_t *parse_times = NULL;
+	uint64_t *index_times = NULL;
+	struct mp4_demux *demux;
+
+	ret = asprintf(&index_filename,
+		       "%s%s",
+		       params->filename,
+		       MP4_DEMUX_INDEX_SUFFIX);
+	if (ret < 0) {
+		index_filename = NULL;
+		ret = -ENOMEM;
+		ULOG_ERRNO("asprintf", -ret);
+		goto out;
+	}
+	parse_times = calloc(params->iterations, sizeof(*parse_times));
+	index_times = calloc(params->iterations, sizeof(*index_times));
+	if (parse_times == NULL || index_times == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		goto out;
+	}
+
+	/* Write the index file */
+	unlink(index_filename);
+	ret = mp4_demux_open_with_index(params->filename, NULL, &demux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_open_with_index", -ret);
+		goto out;
+	}
+	mp4_demux_close(demux);
+
+	for (unsigned int i = 0; i < params->iterations; i++) {
+		uint64_t start;
+
+		if (params->cold)
+			drop_cache(params->filename);
+		start = get_time_us();
+		ret = mp4_demux_open(params->filename, &demux);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_demux_open", -ret);
+			goto out;
+		}
+		mp4_demux_close(demux);
+		parse_times[i] = get_time_us() - start;
+
+		if (params->cold) {
+			drop_cache(params->filename);
+			drop_cache(index_filename);
+		}
+		start = get_time_us();
+		ret = mp4_demux_open_with_index(
+			params->filename, index_filename, &demux);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_demux_open_with_index", -ret);
+			goto out;
+		}
+		mp4_demux_close(demux);
+		index_times[i] = get_time_us() - start;
+	}
+
+	print_times("open (parse)", parse_times, params->iterations);
+	print_times("open (index)", index_times, params->iterations);
+
+out:
+	if (index_filename != NULL)
+		unlink(index_filename);
+	free(index_filename);
+	free(parse_times);
+	free(index_times);
+	return ret;
+}
+
+
+/* Read the samples of the first track of all the demuxers, one
+ * mp4_demux_get_track_sample() call per sample; returns the sample count
+ * or a negative errno value */
+static int64_t read_samples(struct mp4_demux **demuxes,
+			    unsigned int count,
+			    unsigned int track_id,
+			    uint8_t *buffer,
+			    size_t buffer_size,
+			    unsigned int max_samples)
+{
+	int ret;
+	int64_t total = 0;
+	struct mp4_track_sample sample;
+
+	for (unsigned int s = 0; s < max_samples; s++) {
+		for (unsigned int d = 0; d < count; d++) {
+			ret = mp4_demux_get_track_sample(demuxes[d],
+							 track_id,
+							 1,
+							 buffer,
+							 buffer_size,
+							 NULL,
+							 0,
+							 &sample);
+			if (ret < 0) {
+				ULOG_ERRNO("mp4_demux_get_track_sample", -ret);
+				return ret;
+			}
+			if (sample.size == 0)
+				return total;
+			total++;
+		}
+	}
+
+	return total;
+}
+
+
+/* Same as read_samples() with the sample reader, 'batch' samples at a
+ * time spread over the demuxers */
+static int64_t reader_read_samples(struct mp4_demux_reader *reader,
+				   struct mp4_demux **demuxes,
+				   unsigned int count,
+				   unsigned int track_id,
+				   struct mp4_demux_sample_read *reads,
+				   uint8_t *buffers,
+				   size_t buffer_size,
+				   unsigned int batch,
+				   unsigned int max_samples)
+{
+	int ret;
+	int64_t total = 0;
+	int64_t max_total = (int64_t)max_samples * count;
+
+	while (total < max_total) {
+		unsigned int n = batch;
+		if ((int64_t)n > max_total - total)
+			n = (unsigned int)(max_total - total);
+		for (unsigned int i = 0; i < n; i++) {
+			reads[i].demux = demuxes[i % count];
+			reads[i].track_id = track_id;
+			reads[i].buffer = buffers + i * buffer_size;
+			reads[i].buffer_size = buffer_size;
+		}
+		ret = mp4_demux_reader_read_samples(reader, reads, n);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_demux_reader_read_samples", -ret);
+			return ret;
+		}
+		for (unsigned int i = 0; i < n; i++) {
+			if (reads[i].status < 0) {
+				ULOG_ERRNO("read", -reads[i].status);
+				return reads[i].status;
+			}
+			if (reads[i].sample.size == 0)
+				return total;
+			total++;
+		}
+	}
+
+	return total;
+}
+
+
+/* Reading the samples of several demuxers one at a time, against
+ * batches of the sample reader (io_uring if the library supports it) */
+static int bench_read(const struct bench_params *params)
+{
+	int ret = 0;
+	struct mp4_demux **demuxes = NULL;
+	struct mp4_demux_reader *reader = NULL;
+	struct mp4_demux_sample_read *reads = NULL;
+	struct mp4_track_info info;
+	uint8_t *buffers = NULL;
+	size_t buffer_size, pool_size;
+	uint64_t *times = NULL;
+	int64_t total = 0;
+
+	demuxes = calloc(params->files, sizeof(*demuxes));
+	reads = calloc(params->batch, sizeof(*reads));
+	times = calloc(params->iterations, sizeof(*times));
+	if (demuxes == NULL || reads == NULL || times == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		goto out;
+	}
+
+	for (unsigned int d = 0; d < params->files; d++) {
+		ret = mp4_demux_open(params->filename, &demuxes[d]);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_demux_open", -ret);
+			goto out;
+		}
+	}
+	ret = mp4_demux_get_track_info(demuxes[0], 0, &info);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_get_track_info", -ret);
+		goto out;
+	}
+	buffer_size = info.sample_max_size;
+	pool_size = buffer_size * params->batch;
+	buffers = malloc(pool_size);
+	if (buffers == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("malloc", -ret);
+		goto out;
+	}
+	ret = mp4_demux_reader_new(params->batch, &reader);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_reader_new", -ret);
+		goto out;
+	}
+
+	for (int m = 0; m < READ_MODE_COUNT; m++) {
+		if (m == READ_MODE_READER_REGISTERED) {
+			ret = mp4_demux_reader_register_buffers(
+				reader, &buffers, &pool_size, 1);
+			if (ret < 0) {
+				ULOG_ERRNO("mp4_demux_reader_register_buffers",
+					   -ret);
+				goto out;
+			}
+		}
+		for (unsigned int i = 0; i < params->iterations; i++) {
+			uint64_t start;
+
+			for (unsigned int d = 0; d < params->files; d++) {
+				ret = mp4_demux_seek(demuxes[d],
+						     0,
+						     MP4_SEEK_METHOD_PREVIOUS);
+				if (ret < 0) {
+					ULOG_ERRNO("mp4_demux_seek", -ret);
+					goto out;
+				}
+			}
+			if (params->cold)
+				drop_cache(params->filename);
+			start = get_time_us();
+			if (m == READ_MODE_SAMPLE) {
+				total = read_samples(demuxes,
+						     params->files,
+						     info.id,
+						     buffers,
+						     buffer_size,
+						     params->read_count);
+			} else {
+				total = reader_read_samples(
+					reader,
+					demuxes,
+					params->files,
+					info.id,
+					reads,
+					buffers,
+					buffer_size,
+					params->batch,
+					params->read_count);
+			}
+			times[i] = get_time_us() - start;
+			if (total < 0) {
+				ret = (int)total;
+				goto out;
+			}
+		}
+		print_times(read_mode_names[m], times, params->iterations);
+	}
+	printf("%" PRIi64 " samples read from %u demuxers\n",
+	       total,
+	       params->files);
+	ret = 0;
+
+out:
+	mp4_demux_reader_destroy(reader);
+	for (unsigned int d = 0; demuxes != NULL && d < params->files; d++)
+		mp4_demux_close(demuxes[d]);
+	free(demuxes);
+	free(reads);
+	free(buffers);
+	free(times);
+	return ret;
+}
+
+
+struct split_thread {
+	pthread_t thread;
+	struct mp4_demux_cursor *cursor;
+	uint8_t *buffer;
+	size_t buffer_size;
+	int ret;
+	uint64_t count;
+};
+
+
+static void *split_read_thread(void *userdata)
+{
+	struct split_thread *thread = userdata;
+	struct mp4_track_sample sample;
+
+	while (true) {
+		thread->ret = mp4_demux_cursor_get_sample(thread->cursor,
+							  1,
+							  thread->buffer,
+							  thread->buffer_size,
+							  NULL,
+							  0,
+							  &sample);
+		if (thread->ret < 0) {
+			ULOG_ERRNO("mp4_demux_cursor_get_sample", -thread->ret);
+			break;
+		}
+		if (sample.size == 0)
+			break;
+		thread->count++;
+	}
+
+	return NULL;
+}
+
+
+/* Read the whole track with one thread per part of the track; returns the
+ * sample count or a negative errno value */
+static int64_t split_read_samples(struct mp4_demux *demux,
+				  unsigned int track_id,
+				  struct split_thread *threads,
+				  unsigned int thread_count)
+{
+	int ret;
+	int64_t total = 0;
+	unsigned int count = 0;
+	unsigned int started;
+	struct mp4_demux_cursor **cursors;
+
+	cursors = calloc(thread_count, sizeof(*cursors));
+	if (cursors == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		return ret;
+	}
+	ret = mp4_demux_split_track(demux,
+				    track_id,
+				    MP4_DEMUX_SPLIT_BY_SIZE,
+				    thread_count,
+				    cursors,
+				    &count);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_split_track", -ret);
+		free(cursors);
+		return ret;
+	}
+
+	for (started = 0; started < count; started++) {
+		struct split_thread *thread = &threads[started];
+		thread->cursor = cursors[started];
+		thread->ret = 0;
+		thread->count = 0;
+		ret = pthread_create(
+			&thread->thread, NULL, &split_read_thread, thread);
+		if (ret != 0) {
+			ret = -ret;
+			ULOG_ERRNO("pthread_create", -ret);
+			break;
+		}
+	}
+	for (unsigned int t = 0; t < started; t++) {
+		pthread_join(threads[t].thread, NULL);
+		if (threads[t].ret < 0 && ret >= 0)
+			ret = threads[t].ret;
+		total += threads[t].count;
+	}
+	for (unsigned int t = 0; t < count; t++)
+		mp4_demux_cursor_destroy(cursors[t]);
+	free(cursors);
+
+	return ret < 0 ? ret : total;
+}
+
+
+/* Reading the whole track split in parts by 1 to 'threads' threads (by
+ * powers of 2), one cursor per thread on a single demuxer */
+static int bench_split(const struct bench_params *params)
+{
+	int ret = 0;
+	struct mp4_demux *demux = NULL;
+	struct split_thread *threads = NULL;
+	struct mp4_track_info info;
+	uint64_t *times = NULL;
+	uint64_t single_time = 0;
+	int64_t total = 0;
+	char name[32];
+
+	threads = calloc(params->threads, sizeof(*threads));
+	times = calloc(params->iterations, sizeof(*times));
+	if (threads == NULL || times == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		goto out;
+	}
+
+	ret = mp4_demux_open(params->filename, &demux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_open", -ret);
+		goto out;
+	}
+	ret = mp4_demux_get_track_info(demux, 0, &info);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_get_track_info", -ret);
+		goto out;
+	}
+	for (unsigned int t = 0; t < params->threads; t++) {
+		threads[t].buffer_size = info.sample_max_size;
+		threads[t].buffer = malloc(info.sample_max_size);
+		if (threads[t].buffer == NULL) {
+			ret = -ENOMEM;
+			ULOG_ERRNO("malloc", -ret);
+			goto out;
+		}
+	}
+
+	for (unsigned int n = 1; n <= params->threads; n *= 2) {
+		for (unsigned int i = 0; i < params->iterations; i++) {
+			uint64_t start;
+
+			if (params->cold)
+				drop_cache(params->filename);
+			start = get_time_us();
+			total = split_read_samples(demux, info.id, threads, n);
+			times[i] = get_time_us() - start;
+			if (total < 0) {
+				ret = (int)total;
+				goto out;
+			}
+		}
+		snprintf(name,
+			 sizeof(name),
+			 "split (%u thread%s)",
+			 n,
+			 n > 1 ? "s" : "");
+		print_times(name, times, params->iterations);
+		/* The times are sorted by print_times() */
+		if (n == 1)
+			single_time = times[params->iterations / 2];
+		else if (times[params->iterations / 2] > 0)
+			printf("%-24s %.2fx\n",
+			       "  speedup (median)",
+			       (double)single_time /
+				       (double)times[params->iterations / 2]);
+	}
+	printf("%" PRIi64 " samples read\n", total);
+	ret = 0;
+
+out:
+	mp4_demux_close(demux);
+	for (unsigned int t = 0; threads != NULL && t < params->threads; t++)
+		free(threads[t].buffer);
+	free(threads);
+	free(times);
+	return ret;
+}
+
+
+/* Random seeks in a file, alternating the methods that find a sample at
+ * any time */
+static int seek_file(const char *filename,
+		     const struct bench_params *params,
+		     uint64_t *times)
+{
+	int ret;
+	struct mp4_demux *demux;
+	struct mp4_media_info info;
+	const enum mp4_seek_method methods[] = {
+		MP4_SEEK_METHOD_PREVIOUS,
+		MP4_SEEK_METHOD_PREVIOUS_SYNC,
+		MP4_SEEK_METHOD_NEAREST,
+	};
+
+	ret = mp4_demux_open(filename, &demux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_open:'%s'", -ret, filename);
+		return ret;
+	}
+	ret = mp4_demux_get_media_info(demux, &info);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_get_media_info", -ret);
+		goto out;
+	}
+	if (info.duration == 0) {
+		ret = -EINVAL;
+		ULOGE("'%s': empty file", filename);
+		goto out;
+	}
+
+	srand(1);
+	for (unsigned int i = 0; i < params->iterations; i++) {
+		uint64_t start = get_time_us();
+		for (unsigned int s = 0; s < BENCH_SEEK_COUNT; s++) {
+			uint64_t time = (((uint64_t)rand() << 31) | rand()) %
+					info.duration;
+			enum mp4_seek_method method =
+				methods[s % SIZEOF_ARRAY(methods)];
+			ret = mp4_demux_seek(demux, time, method);
+			if (ret < 0) {
+				ULOG_ERRNO("mp4_demux_seek", -ret);
+				goto out;
+			}
+		}
+		times[i] = get_time_us() - start;
+	}
+	ret = 0;
+
+out:
+	mp4_demux_close(demux);
+	return ret;
+}
+
+
+/* Seek latency in variable rate files of increasing durations, from 1000
+ * samples to the sample count by factors of 10; the files are generated
+ * next to the file and removed after the test */
+static int bench_seek(const struct bench_params *params)
+{
+	int ret = 0;
+	struct bench_params file_params = *params;
+	char *filename = NULL;
+	uint64_t *times = NULL;
+	char name[32];
+
+	times = calloc(params->iterations, sizeof(*times));
+	if (times == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("calloc", -ret);
+		return ret;
+	}
+
+	for (unsigned int count = BENCH_SEEK_MIN_SAMPLES;; count *= 10) {
+		count = MIN(count, params->sample_count);
+		ret = asprintf(
+			&filename, "%s.seek-%u", params->filename, count);
+		if (ret < 0) {
+			filename = NULL;
+			ret = -ENOMEM;
+			ULOG_ERRNO("asprintf", -ret);
+			goto out;
+		}
+		file_params.filename = filename;
+		file_params.sample_count = count;
+		file_params.variable_rate = 1;
+		ret = generate_file(&file_params);
+		if (ret < 0)
+			goto out;
+
+		ret = seek_file(filename, params, times);
+		if (ret < 0)
+			goto out;
+		snprintf(name, sizeof(name), "seek (%u samples)", count);
+		print_times(name, times, params->iterations);
+		printf("%-24s %.3f us\n",
+		       "  per seek (median)",
+		       (double)times[params->iterations / 2] /
+			       BENCH_SEEK_COUNT);
+
+		unlink(filename);
+		free(filename);
+		filename = NULL;
+		if (count == params->sample_count)
+			break;
+	}
+
+out:
+	if (filename != NULL)
+		unlink(filename);
+	free(filename);
+	free(times);
+	return ret;
+}
+
+
+/* Sample table decoding as done by the demuxer, but without the track
+ * structure (the decoding loops of the previous versions stored to the
+ * track tables, reloading the count and the table pointer) */
+struct decode_track {
+	uint32_t count;
+	uint32_t *sampleSize;
+	uint32_t sampleMaxSize;
+	uint64_t *chunkOffset;
+};
+
+
+static void decode_ntohl(enum decode_table table,
+			 struct decode_track *tk,
+			 const uint8_t *src)
+{
+	uint32_t val32;
+
+	for (uint32_t i = 0; i < tk->count; i++) {
+		switch (table) {
+		case DECODE_TABLE_STSZ:
+			memcpy(&val32, src + i * 4, sizeof(val32));
+			tk->sampleSize[i] = ntohl(val32);
+			if (tk->sampleSize[i] > tk->sampleMaxSize)
+				tk->sampleMaxSize = tk->sampleSize[i];
+			break;
+		case DECODE_TABLE_STCO:
+			memcpy(&val32, src + i * 4, sizeof(val32));
+			tk->chunkOffset[i] = ntohl(val32);
+			break;
+		case DECODE_TABLE_CO64:
+		default:
+			memcpy(&val32, src + i * 8, sizeof(val32));
+			tk->chunkOffset[i] = (uint64_t)ntohl(val32) << 32;
+			memcpy(&val32, src + i * 8 + 4, sizeof(val32));
+			tk->chunkOffset[i] |= ntohl(val32);
+			break;
+		}
+	}
+}
+
+
+static void decode_table(enum decode_table table,
+			 enum decode_kernel kernel,
+			 struct decode_track *tk,
+			 const uint8_t *src)
+{
+	tk->sampleMaxSize = 0;
+
+	switch (kernel) {
+	case DECODE_KERNEL_NTOHL:
+		decode_ntohl(table, tk, src);
+		break;
+	case DECODE_KERNEL_SCALAR:
+		if (table == DECODE_TABLE_STSZ)
+			tk->sampleMaxSize = mp4_decode_be32_max_scalar(
+				tk->sampleSize, src, tk->count);
+		else if (table == DECODE_TABLE_STCO)
+			mp4_decode_be32_to_64_scalar(
+				tk->chunkOffset, src, tk->count);
+		else
+			mp4_decode_be64_scalar(tk->chunkOffset, src, tk->count);
+		break;
+	case DECODE_KERNEL_VECTOR:
+	default:
+		if (table == DECODE_TABLE_STSZ)
+			tk->sampleMaxSize = mp4_decode_be32_max(
+				tk->sampleSize, src, tk->count);
+		else if (table == DECODE_TABLE_STCO)
+			mp4_decode_be32_to_64(tk->chunkOffset, src, tk->count);
+		else
+			mp4_decode_be64(tk->chunkOffset, src, tk->count);
+		break;
+	}
+}
+
+
+/* Checksum of the decoded table, to compare the kernels */
+static uint64_t decode_checksum(enum decode_table table,
+				const struct decode_track *tk)
+{
+	uint64_t sum = tk->sampleMaxSize;
+
+	for (uint32_t i = 0; i < tk->count; i++) {
+		sum = sum * 31 + ((table == DECODE_TABLE_STSZ)
+					  ? tk->sampleSize[i]
+					  : tk->chunkOffset[i]);
+	}
+
+	return sum;
+}
+
+
+/* Decoding of random stsz, stco and co64 tables of 'sample_count' entries
+ * with the per-entry ntohl loop, the scalar kernels and the vector kernels
+ * (when built for a target with vector instructions) */
+static int bench_decode(const struct bench_params *params)
+{
+	int ret = 0;
+	struct decode_track tk = {.count = params->sample_count};
+	uint8_t *src = NULL;
+	uint64_t *times = NULL;
+	uint64_t checksum, expected = 0;
+	char name[32];
+
+	src = malloc((size_t)tk.count * 8);
+	tk.sampleSize = malloc((size_t)tk.count * sizeof(*tk.sampleSize));
+	tk.chunkOffset = malloc((size_t)tk.count * sizeof(*tk.chunkOffset));
+	times = calloc(params->iterations, sizeof(*times));
+	if (src == NULL || tk.sampleSize == NULL || tk.chunkOffset == NULL ||
+	    times == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("malloc", -ret);
+		goto out;
+	}
+	srand(1);
+	for (size_t i = 0; i < (size_t)tk.count * 8; i++)
+		src[i] = rand();
+
+	for (int t = 0; t < DECODE_TABLE_COUNT; t++) {
+		for (int k = 0; k < DECODE_KERNEL_COUNT; k++) {
+			for (unsigned int i = 0; i < params->iterations; i++) {
+				uint64_t start = get_time_us();
+				decode_table(t, k, &tk, src);
+				times[i] = get_time_us() - start;
+			}
+			checksum = decode_checksum(t, &tk);
+			if (k == DECODE_KERNEL_NTOHL) {
+				expected = checksum;
+			} else if (checksum != expected) {
+				ret = -EPROTO;
+				ULOGE("decode %s (%s): wrong result",
+				      decode_table_names[t],
+				      decode_kernel_names[k]);
+				goto out;
+			}
+			snprintf(name,
+				 sizeof(name),
+				 "decode %s (%s)",
+				 decode_table_names[t],
+				 decode_kernel_names[k]);
+			print_times(name, times, params->iterations);
+		}
+	}
+
+out:
+	free(src);
+	free(tk.sampleSize);
+	free(tk.chunkOffset);
+	free(times);
+	return ret;
+}
+
+
+static const struct bench_test tests[] = {
+	{"open", &bench_open, 1},
+	{"read", &bench_read, 1},
+	{"split", &bench_split, 1},
+	{"seek", &bench_seek, 1},
+	{"decode", &bench_decode, 0},
+};
+
+
+int main(int argc, char **argv)
+{
+	int ret = EXIT_SUCCESS;
+	int idx;
+	int c;
+	const char *test = NULL;
+	int uses_file = 1;
+	struct stat st;
+	struct bench_params params = {
+		.sample_count = 10000000,
+		.iterations = 5,
+		.files = 8,
+		.batch = 64,
+		.read_count = 1000000,
+		.threads = 8,
+	};
+
+	/* Command-line parameters */
+	while ((c = getopt_long(
+			argc, argv, short_options, long_options, &idx)) != -1) {
+		switch (c) {
+		case 0:
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		case 't':
+			test = optarg;
+			break;
+		case 'n':
+			params.sample_count = atoi(optarg);
+			break;
+		case 'i':
+			params.iterations = atoi(optarg);
+			break;
+		case 'c':
+			params.cold = 1;
+			break;
+		case 'f':
+			params.files = atoi(optarg);
+			break;
+		case 'b':
+			params.batch = atoi(optarg);
+			break;
+		case 'r':
+			params.read_count = atoi(optarg);
+			break;
+		case 'j':
+			params.threads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+			break;
+		}
+	}
+
+	if (argc != optind + 1 || params.sample_count == 0 ||
+	    params.iterations == 0 || params.files == 0 || params.batch == 0 ||
+	    params.read_count == 0 || params.threads == 0) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	params.filename = argv[optind];
+
+	if (test != NULL) {
+		size_t i;
+		for (i = 0; i < SIZEOF_ARRAY(tests); i++) {
+			if (strcmp(test, tests[i].name) == 0)
+				break;
+		}
+		if (i == SIZEOF_ARRAY(tests)) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		uses_file = tests[i].uses_file;
+	}
+
+	if (uses_file && stat(params.filename, &st) < 0 &&
+	    generate_file(&params) < 0)
+		exit(EXIT_FAILURE);
+
+	for (size_t i = 0; i < SIZEOF_ARRAY(tests); i++) {
+		if (test != NULL && strcmp(test, tests[i].name) != 0)
+			continue;
+		if (tests[i].run(&params) < 0)
+			ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
@@ -114,19 +114,18 @@ int main(int argc, char *argv[])
 	int audiotrack = -1;
 
 	int current_track = -1;
-	int has_more_audio = 0;
-	int has_more_video = 0;
+	struct mp4_demux_iterator *iterator = NULL;
+	unsigned int iterator_tracks[2];
+	unsigned int iterator_track_count = 0;
 
 	int vs_count = 0;
 	int as_count = 0;
-	uint64_t step_ts = 0;
-	const uint64_t increment_ts = 100000; /* 100ms */
 	unsigned int cover_size;
 	enum mp4_metadata_cover_type cover_type;
 
 	struct mp4_track_info info;
-	struct mp4_track_info video;
-	struct mp4_track_info audio;
+	struct mp4_track_info video = {0};
+	struct mp4_track_info audio = {0};
 	struct mp4_mux_config config = {
 		.filename = out,
 		.filemode = 0,
@@ -205,7 +204,6 @@ int main(int argc, char *argv[])
 			}
 			mp4_mux_track_set_video_decoder_config(
 				mux, videotrack, &vdc);
-			has_more_video = info.sample_count > 0;
 			current_track = videotrack;
 		}
 		if (info.type == MP4_TRACK_TYPE_AUDIO && audiotrack == -1) {
@@ -233,7 +231,6 @@ int main(int argc, char *argv[])
 				info.audio_channel_count,
 				info.audio_sample_size,
 				info.audio_sample_rate);
-			has_more_audio = info.sample_count > 0;
 			current_track = audiotrack;
 		}
 		if (info.type == MP4_TRACK_TYPE_METADATA && metatrack == -1) {
@@ -319,38 +316,48 @@ int main(int argc, char *argv[])
 		mp4_mux_set_file_cover(
 			mux, cover_type, sample_buffer, cover_size);
 
-	/* Iterate over samples, 100ms at a time */
-	while (has_more_audio || has_more_video) {
+	/* Iterate over the video and audio samples in decoding order */
+	if (videotrack != -1)
+		iterator_tracks[iterator_track_count++] = video.id;
+	if (audiotrack != -1)
+		iterator_tracks[iterator_track_count++] = audio.id;
+	ret = mp4_demux_iterator_new(demux,
+				     MP4_DEMUX_ITERATOR_ORDER_DTS,
+				     iterator_tracks,
+				     iterator_track_count,
+				     &iterator);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_demux_iterator_new", -ret);
+		goto out;
+	}
+	while (1) {
 		struct mp4_track_sample sample;
 		struct mp4_mux_sample mux_sample;
-		int lc_video = 0;
-		int lc_audio = 0;
-		step_ts += increment_ts;
-		while (has_more_video) {
-			ret = mp4_demux_get_track_sample(demux,
-							 video.id,
-							 1,
-							 sample_buffer,
-							 sample_buffer_size,
-							 metadata_buffer,
-							 metadata_buffer_size,
-							 &sample);
-
-			if (ret != 0 || sample.size == 0) {
-				has_more_video = 0;
-				break;
-			}
+		unsigned int track_id;
+		ret = mp4_demux_iterator_next(iterator,
+					      sample_buffer,
+					      sample_buffer_size,
+					      metadata_buffer,
+					      metadata_buffer_size,
+					      &track_id,
+					      &sample);
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_demux_iterator_next", -ret);
+			break;
+		}
+		if (track_id == 0)
+			break;
+
+		mux_sample.buffer = sample_buffer;
+		mux_sample.len = sample.size;
+		mux_sample.dts = sample.dts;
+		if (videotrack != -1 && track_id == video.id) {
 			ULOGD("got a video sample [%d] of size %" PRIu32
 			      ", with meta of size %" PRIu32,
 			      vs_count++,
 			      sample.size,
 			      sample.metadata_size);
-			lc_video++;
-
-			mux_sample.buffer = sample_buffer;
-			mux_sample.len = sample.size;
 			mux_sample.sync = sample.sync;
-			mux_sample.dts = sample.dts;
 			mp4_mux_track_add_sample(mux, videotrack, &mux_sample);
 			if (sample.metadata_size > 0 && metatrack != -1) {
 				mux_sample.buffer = metadata_buffer;
@@ -358,41 +365,15 @@ int main(int argc, char *argv[])
 				mp4_mux_track_add_sample(
 					mux, metatrack, &mux_sample);
 			}
-			if (mp4_sample_time_to_usec(sample.next_dts,
-						    info.timescale) > step_ts)
-				break;
-		}
-		while (has_more_audio) {
-			ret = mp4_demux_get_track_sample(demux,
-							 audio.id,
-							 1,
-							 sample_buffer,
-							 sample_buffer_size,
-							 NULL,
-							 0,
-							 &sample);
-			if (ret != 0 || sample.size == 0) {
-				has_more_audio = 0;
-				break;
-			}
+		} else {
 			ULOGD("got an audio sample [%d] of size %" PRIu32,
 			      as_count++,
 			      sample.size);
-			lc_audio++;
-
-			mux_sample.buffer = sample_buffer;
-			mux_sample.len = sample.size;
 			mux_sample.sync = 0;
-			mux_sample.dts = sample.dts;
 			mp4_mux_track_add_sample(mux, audiotrack, &mux_sample);
-			if (mp4_sample_time_to_usec(sample.next_dts,
-						    info.timescale) > step_ts)
-				break;
 		}
-		ULOGD("added %d video samples and %d audio samples",
-		      lc_video,
-		      lc_audio);
 	}
+	mp4_demux_iterator_destroy(iterator);
 
 	if (as_count < 100 && vs_count < 100)
 		mp4_mux_dump(mux);
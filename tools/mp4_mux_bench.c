@@ -0,0 +1,329 @@
+/**
+ * Copyright (c) 2026 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FILE_OFFSET_BITS
+#	define _FILE_OFFSET_BITS 64
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <futils/futils.h>
+#include <libmp4.h>
+
+#define ULOG_TAG mp4_mux_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(mp4_mux_bench);
+
+
+enum write_mode {
+	WRITE_MODE_UNBUFFERED = 0,
+	WRITE_MODE_BUFFERED,
+	WRITE_MODE_DIRECT,
+	WRITE_MODE_COUNT,
+};
+
+
+static const char *const write_mode_names[] = {
+	[WRITE_MODE_UNBUFFERED] = "unbuffered",
+	[WRITE_MODE_BUFFERED] = "buffered",
+	[WRITE_MODE_DIRECT] = "direct",
+};
+
+
+struct bench_params {
+	const char *filename;
+	unsigned int duration;
+	unsigned int bitrate;
+	unsigned int framerate;
+	size_t buffer_size;
+	unsigned int sync_period;
+};
+
+
+static void usage(const char *prog_name)
+{
+	/* clang-format off */
+	printf("Usage: %s [options] <output_file>\n"
+	       "Write a synthetic video track and report the throughput and "
+	       "the add_sample latency of each write mode\n"
+	       "Options:\n"
+	       "  -h | --help                          "
+		       "Print this message\n"
+	       "  -m | --mode <mode>                   "
+		       "Write mode: unbuffered, buffered or direct "
+		       "(default: all)\n"
+	       "  -d | --duration <s>                  "
+		       "Recording duration in seconds (default: 20)\n"
+	       "  -r | --bitrate <Mbit/s>              "
+		       "Video bitrate (default: 100)\n"
+	       "  -f | --framerate <fps>               "
+		       "Video framerate (default: 30)\n"
+	       "  -b | --buffer-size <KiB>             "
+		       "Write buffer size (default: 4096)\n"
+	       "  -s | --sync-period <frames>          "
+		       "Frames between mp4_mux_sync() calls, 0 to disable "
+		       "(default: 0)\n"
+	       "\n",
+	       prog_name);
+	/* clang-format on */
+}
+
+
+static const char short_options[] = "hm:d:r:f:b:s:";
+
+
+static const struct option long_options[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"mode", required_argument, NULL, 'm'},
+	{"duration", required_argument, NULL, 'd'},
+	{"bitrate", required_argument, NULL, 'r'},
+	{"framerate", required_argument, NULL, 'f'},
+	{"buffer-size", required_argument, NULL, 'b'},
+	{"sync-period", required_argument, NULL, 's'},
+	{0, 0, 0, 0},
+};
+
+
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+	uint64_t us = 0;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *)a;
+	uint64_t vb = *(const uint64_t *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+
+static int run_bench(const struct bench_params *params, enum write_mode mode)
+{
+	int ret, track;
+	struct mp4_mux *mux = NULL;
+	uint8_t *frame = NULL;
+	uint64_t *latencies = NULL;
+	uint32_t frame_count = params->duration * params->framerate;
+	size_t mean_size = (uint64_t)params->bitrate * 1000000 / 8 /
+			   params->framerate;
+	uint64_t total_size = 0;
+	uint64_t start, end, t;
+	uint8_t sps[] = {0x67, 0x64, 0x00, 0x33, 0xac};
+	uint8_t pps[] = {0x68, 0xee, 0x3c, 0x80};
+	struct mp4_mux_config config = {
+		.filename = params->filename,
+		.timescale = 90000,
+		.tables_size_mbytes = MP4_MUX_DEFAULT_TABLE_SIZE_MB,
+	};
+	struct mp4_mux_track_params track_params = {
+		.type = MP4_TRACK_TYPE_VIDEO,
+		.name = "video",
+		.enabled = 1,
+		.in_movie = 1,
+		.in_preview = 1,
+		.timescale = 90000,
+	};
+	struct mp4_video_decoder_config video_config = {
+		.codec = MP4_VIDEO_CODEC_AVC,
+		.width = 3840,
+		.height = 2160,
+		.avc.c_sps = sps,
+		.avc.sps_size = sizeof(sps),
+		.avc.c_pps = pps,
+		.avc.pps_size = sizeof(pps),
+	};
+
+	if (mode != WRITE_MODE_UNBUFFERED)
+		config.write_buffer.size = params->buffer_size;
+	config.write_buffer.direct_io = (mode == WRITE_MODE_DIRECT);
+
+	/* Up to 1.25 times the mean frame size */
+	frame = malloc(mean_size + mean_size / 4);
+	latencies = calloc(frame_count, sizeof(*latencies));
+	if (frame == NULL || latencies == NULL) {
+		ret = -ENOMEM;
+		ULOG_ERRNO("malloc", -ret);
+		goto out;
+	}
+	memset(frame, 0x5a, mean_size + mean_size / 4);
+
+	unlink(params->filename);
+	ret = mp4_mux_open(&config, &mux);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_open:'%s'", -ret, params->filename);
+		goto out;
+	}
+	track = mp4_mux_add_track(mux, &track_params);
+	if (track < 0) {
+		ret = track;
+		ULOG_ERRNO("mp4_mux_add_track", -ret);
+		goto out;
+	}
+	ret = mp4_mux_track_set_video_decoder_config(mux, track, &video_config);
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_track_set_video_decoder_config", -ret);
+		goto out;
+	}
+
+	start = get_time_us();
+	for (uint32_t i = 0; i < frame_count; i++) {
+		struct mp4_mux_sample sample = {
+			.buffer = frame,
+			/* 0.75, 1 and 1.25 times the mean size */
+			.len = mean_size * (3 + i % 3) / 4,
+			.sync = (i % params->framerate) == 0,
+			.dts = (uint64_t)i * 90000 / params->framerate,
+		};
+		t = get_time_us();
+		ret = mp4_mux_track_add_sample(mux, track, &sample);
+		latencies[i] = get_time_us() - t;
+		if (ret < 0) {
+			ULOG_ERRNO("mp4_mux_track_add_sample", -ret);
+			goto out;
+		}
+		total_size += sample.len;
+		if (params->sync_period != 0 &&
+		    (i + 1) % params->sync_period == 0) {
+			ret = mp4_mux_sync(mux, true);
+			if (ret < 0) {
+				ULOG_ERRNO("mp4_mux_sync", -ret);
+				goto out;
+			}
+		}
+	}
+	ret = mp4_mux_close(mux);
+	mux = NULL;
+	if (ret < 0) {
+		ULOG_ERRNO("mp4_mux_close", -ret);
+		goto out;
+	}
+	end = get_time_us();
+
+	qsort(latencies, frame_count, sizeof(*latencies), compare_u64);
+	printf("%-10s %8.1f MB/s  add_sample p50 %6" PRIu64
+	       " us  p99 %6" PRIu64 " us  max %6" PRIu64 " us\n",
+	       write_mode_names[mode],
+	       (double)total_size / (end - start),
+	       latencies[frame_count / 2],
+	       latencies[(uint64_t)frame_count * 99 / 100],
+	       latencies[frame_count - 1]);
+
+out:
+	if (mux != NULL)
+		mp4_mux_close(mux);
+	unlink(params->filename);
+	free(latencies);
+	free(frame);
+	return ret;
+}
+
+
+int main(int argc, char **argv)
+{
+	int ret = EXIT_SUCCESS;
+	int idx;
+	int c;
+	int mode = -1;
+	struct bench_params params = {
+		.duration = 20,
+		.bitrate = 100,
+		.framerate = 30,
+		.buffer_size = 4096 * 1024,
+		.sync_period = 0,
+	};
+
+	/* Command-line parameters */
+	while ((c = getopt_long(
+			argc, argv, short_options, long_options, &idx)) != -1) {
+		switch (c) {
+		case 0:
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		case 'm':
+			for (mode = 0; mode < WRITE_MODE_COUNT; mode++) {
+				if (strcmp(optarg, write_mode_names[mode]) == 0)
+					break;
+			}
+			if (mode == WRITE_MODE_COUNT) {
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'd':
+			params.duration = atoi(optarg);
+			break;
+		case 'r':
+			params.bitrate = atoi(optarg);
+			break;
+		case 'f':
+			params.framerate = atoi(optarg);
+			break;
+		case 'b':
+			params.buffer_size = (size_t)atoi(optarg) * 1024;
+			break;
+		case 's':
+			params.sync_period = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+			break;
+		}
+	}
+
+	if (argc != optind + 1 || params.duration == 0 ||
+	    params.bitrate == 0 || params.framerate == 0 ||
+	    params.buffer_size == 0) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	params.filename = argv[optind];
+
+	for (int m = 0; m < WRITE_MODE_COUNT; m++) {
+		if (mode >= 0 && m != mode)
+			continue;
+		if (run_bench(&params, m) < 0)
+			ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}